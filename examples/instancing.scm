@@ -0,0 +1,62 @@
+; drawing lots of copies of the same primitive with draw-instances
+; the transforms come from a pdata array, so they can be updated
+; with pdata-op and friends rather than a scheme loop per copy.
+
+; if the shader reads the InstanceTransform and InstanceColour
+; attributes, the graphics card draws all the cubes in one call,
+; without a shader they are drawn one after the other, but the
+; state is still only set up once for all of them
+
+(clear)
+
+(define instance-vert "
+    attribute mat4 InstanceTransform;
+    attribute vec4 InstanceColour;
+    varying vec3 N;
+    varying vec4 C;
+
+    void main()
+    {
+        vec4 p = InstanceTransform*gl_Vertex;
+        N = normalize(gl_NormalMatrix*(InstanceTransform*vec4(gl_Normal,0)).xyz);
+        C = InstanceColour;
+        gl_Position = gl_ModelViewProjectionMatrix*p;
+    }
+    ")
+
+(define instance-frag "
+    varying vec3 N;
+    varying vec4 C;
+
+    void main()
+    {
+        float d = max(dot(normalize(N),vec3(0,0,1)),0.2);
+        gl_FragColor = vec4(C.rgb*d,C.a);
+    }
+    ")
+
+(define cube (build-cube))
+(with-primitive cube (hide 1))
+
+; a hidden particle primitive just to hold the positions and colours
+(define positions (build-particles 10000))
+
+(with-primitive positions
+    (hide 1)
+    (pdata-add "vel" "v")
+    (pdata-map! (lambda (p) (vmul (crndvec) 30)) "p")
+    (pdata-map! (lambda (c) (rndvec)) "c")
+    (pdata-map! (lambda (v) (vmul (srndvec) 0.01)) "vel"))
+
+(define (render)
+    (with-primitive positions
+        (pdata-op "+" "p" "vel"))
+
+    (with-state
+        (shader-source instance-vert instance-frag)
+        (with-primitive positions
+            (draw-instances cube "p" "c"))))
+
+(every-frame (render))
+
+(show-fps 1)
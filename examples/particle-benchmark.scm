@@ -0,0 +1,61 @@
+; a benchmark for particle rendering, this draws a lot of particles
+; as camera facing sprites and then as points, and prints how many
+; particles per second each way manages.
+
+; the sprites are expanded into one big vertex stream each frame
+; (honouring the size and rotation pdata) and drawn in one go, the
+; points are drawn straight from the pdata
+
+(define particle-count 1000000)
+; how many frames to time each way
+(define frames-per-test 200)
+
+(clear)
+(show-fps 1)
+
+(define particles 
+    (with-state
+        (hint-unlit)
+        (texture (load-texture "splat.png"))
+        (build-particles particle-count)))
+
+(with-primitive particles
+    (pdata-map! (lambda (p) (vmul (srndvec) 50)) "p")
+    (pdata-map! (lambda (c) (rndvec)) "c")
+    (pdata-map! (lambda (s) (vector 0.5 0.5 0.5)) "s")
+    (pdata-index-map! (lambda (i r) (* i 10)) "r"))
+
+(define tests (list 
+    (list "sprites" (lambda () (hint-none) (hint-solid)))
+    (list "sorted sprites" (lambda () (hint-depth-sort)))
+    (list "points" (lambda () (hint-none) (hint-points)))))
+
+(define current tests)
+(define frame 0)
+(define start-time 0)
+
+(define (start-test)
+    (with-primitive particles
+        ((cadr (car current))))
+    (set! frame 0)
+    (set! start-time (current-inexact-milliseconds)))
+
+(define (end-test)
+    (let ((secs (/ (- (current-inexact-milliseconds) start-time) 1000)))
+        (printf "~a: ~a particles/sec (~a fps)~n" 
+            (car (car current))
+            (round (/ (* particle-count frames-per-test) secs))
+            (round (/ frames-per-test secs)))))
+
+(start-test)
+
+(every-frame
+    (when (not (null? current))
+        (with-primitive particles
+            (rotate (vector 0 0.1 0)))
+        (set! frame (+ frame 1))
+        (when (> frame frames-per-test)
+            (end-test)
+            (set! current (cdr current))
+            (when (not (null? current))
+                (start-test)))))
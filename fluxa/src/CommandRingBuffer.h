@@ -14,6 +14,9 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#ifndef COMMAND_RING_BUFFER
+#define COMMAND_RING_BUFFER
+
 #include "RingBuffer.h"
 
 static const unsigned int COMMAND_DATA_SIZE = 128;
@@ -54,3 +57,5 @@ public:
 private:
 	Command m_Current;
 };
+
+#endif
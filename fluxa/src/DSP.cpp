@@ -0,0 +1,739 @@
+// Copyright (C) 2011 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <iostream>
+#include <vector>
+#include "DSP.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace spiralcore
+{
+namespace DSP
+{
+
+// reading a wavetable like Sample::operator[](float) does
+static inline float Lookup(const float *table, unsigned int length, float pos)
+{
+	unsigned int i=(unsigned int)pos;
+	if (i==length-1) return table[i%length];
+	float t=pos-i;
+	return (table[i%length]*(1-t))+(table[(i+1)%length]*t);
+}
+
+// keeps the position in the table. the usual case is a step that 
+// can't have gone round more than once, where taking off the length 
+// once is exact, so it gives the same answer as fmod
+static inline float Wrap(float pos, unsigned int length)
+{
+	float wrap=length-1;
+	if (pos>=0 && pos<wrap*2)
+	{
+		if (pos>=wrap) pos-=wrap;
+		return pos;
+	}
+	if (pos<0) pos=length-pos;
+	return fmod(pos,wrap);
+}
+
+namespace Scalar
+{
+
+void Fill(float *out, float v, unsigned int n)
+{
+	for (unsigned int i=0; i<n; i++) out[i]=v;
+}
+
+void MulMix(float *out, const float *in, float m, unsigned int n)
+{
+	for (unsigned int i=0; i<n; i++) out[i]+=in[i]*m;
+}
+
+void MulClipMix(float *out, const float *in, float m, unsigned int n)
+{
+	for (unsigned int i=0; i<n; i++)
+	{
+		float t=in[i]*m;
+		if (t>m) t=m;
+		else if (t<-m) t=-m;
+		out[i]+=t;
+	}
+}
+
+void Math(Op op, float *out, const float *a, const float *b, unsigned int n)
+{
+	switch (op)
+	{
+		case ADD: for (unsigned int i=0; i<n; i++) out[i]=a[i]+b[i]; break;
+		case SUB: for (unsigned int i=0; i<n; i++) out[i]=a[i]-b[i]; break;
+		case MUL: for (unsigned int i=0; i<n; i++) out[i]=a[i]*b[i]; break;
+		case DIV: for (unsigned int i=0; i<n; i++) if (b[i]!=0) out[i]=a[i]/b[i]; break;
+	}
+}
+
+void Math(Op op, float *out, float a, const float *b, unsigned int n)
+{
+	switch (op)
+	{
+		case ADD: for (unsigned int i=0; i<n; i++) out[i]=a+b[i]; break;
+		case SUB: for (unsigned int i=0; i<n; i++) out[i]=a-b[i]; break;
+		case MUL: for (unsigned int i=0; i<n; i++) out[i]=a*b[i]; break;
+		case DIV: for (unsigned int i=0; i<n; i++) if (b[i]!=0) out[i]=a/b[i]; break;
+	}
+}
+
+void Math(Op op, float *out, const float *a, float b, unsigned int n)
+{
+	switch (op)
+	{
+		case ADD: for (unsigned int i=0; i<n; i++) out[i]=a[i]+b; break;
+		case SUB: for (unsigned int i=0; i<n; i++) out[i]=a[i]-b; break;
+		case MUL: for (unsigned int i=0; i<n; i++) out[i]=a[i]*b; break;
+		case DIV: if (b!=0) for (unsigned int i=0; i<n; i++) out[i]=a[i]/b; break;
+	}
+}
+
+float WaveTable(float *out, const float *table, unsigned int length, 
+                float pos, float incr, float volume, unsigned int n)
+{
+	for (unsigned int i=0; i<n; i++)
+	{
+		pos+=incr;
+		if (pos<0) pos=length-pos;
+		pos=fmod(pos,length-1);
+		out[i]=Lookup(table,length,pos)*volume;
+	}
+	return pos;
+}
+
+float WaveTableFM(float *out, const float *table, unsigned int length, 
+                  float pos, const float *pitch, float scale, float volume, unsigned int n)
+{
+	for (unsigned int i=0; i<n; i++)
+	{
+		if (isfinite(pitch[i]))
+		{
+			pos+=pitch[i]*scale;
+			if (pos<0) pos=length-pos;
+			pos=fmod(pos,length-1);
+			out[i]=Lookup(table,length,pos)*volume;
+		}
+	}
+	return pos;
+}
+
+void ADSR(float *out, const float *t, float attack, float decay, 
+          float sustain, float release, float volume, unsigned int n)
+{
+	for (unsigned int i=0; i<n; i++)
+	{
+		float v;
+		if (t[i]<attack)
+		{
+			v=t[i]/attack;
+		}
+		else if (t[i]<attack+decay)
+		{
+			float nt=(t[i]-attack)/decay;
+			v=(1-nt)+(sustain*nt);
+		}
+		else
+		{
+			float nt=(t[i]-(attack+decay))/release;
+			v=sustain*(1-nt);
+			if (release<0.2f) v=sustain;
+		}
+		out[i]=v*volume;
+	}
+}
+
+float Compress(float *io, float env, float speed, float threshold, unsigned int n)
+{
+	for (unsigned int i=0; i<n; i++)
+	{
+		float t=io[i]*io[i];
+		env=env*(1-speed)+t*speed;
+		if (env>threshold) io[i]*=1.0f/(1.0f+(env-threshold));
+	}
+	return env;
+}
+
+}
+
+#ifdef __SSE2__
+
+// mask ? a : b
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask,a),_mm_andnot_ps(mask,b));
+}
+
+// the interpolation from Lookup for four positions, which 
+// must be inside the table
+static inline __m128 Lookup4(const float *table, const float *pos)
+{
+	__m128 p=_mm_loadu_ps(pos);
+	__m128i whole=_mm_cvttps_epi32(p);
+	__m128 t=_mm_sub_ps(p,_mm_cvtepi32_ps(whole));
+	int i[4];
+	_mm_storeu_si128((__m128i*)i,whole);
+	__m128 a=_mm_set_ps(table[i[3]],table[i[2]],table[i[1]],table[i[0]]);
+	__m128 b=_mm_set_ps(table[i[3]+1],table[i[2]+1],table[i[1]+1],table[i[0]+1]);
+	return _mm_add_ps(_mm_mul_ps(a,_mm_sub_ps(_mm_set1_ps(1),t)),_mm_mul_ps(b,t));
+}
+
+void Fill(float *out, float v, unsigned int n)
+{
+	__m128 v4=_mm_set1_ps(v);
+	unsigned int i=0;
+	for (; i+4<=n; i+=4) _mm_storeu_ps(out+i,v4);
+	Scalar::Fill(out+i,v,n-i);
+}
+
+void MulMix(float *out, const float *in, float m, unsigned int n)
+{
+	__m128 m4=_mm_set1_ps(m);
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		_mm_storeu_ps(out+i,_mm_add_ps(_mm_loadu_ps(out+i),_mm_mul_ps(_mm_loadu_ps(in+i),m4)));
+	}
+	Scalar::MulMix(out+i,in+i,m,n-i);
+}
+
+void MulClipMix(float *out, const float *in, float m, unsigned int n)
+{
+	__m128 m4=_mm_set1_ps(m);
+	__m128 negm4=_mm_set1_ps(-m);
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		__m128 t=_mm_mul_ps(_mm_loadu_ps(in+i),m4);
+		// not min and max, so nans go through as they did
+		t=Select(_mm_cmpgt_ps(t,m4),m4,t);
+		t=Select(_mm_cmplt_ps(t,negm4),negm4,t);
+		_mm_storeu_ps(out+i,_mm_add_ps(_mm_loadu_ps(out+i),t));
+	}
+	Scalar::MulClipMix(out+i,in+i,m,n-i);
+}
+
+// add, sub and mul are left as the plain loops, as the compiler does 
+// just as well with them (-dspbench has them at 0.95-1.3x either way), 
+// the check for zero stops it doing that with div
+
+static inline __m128 Div4(__m128 a, __m128 b, __m128 old)
+{
+	return Select(_mm_cmpneq_ps(b,_mm_setzero_ps()),_mm_div_ps(a,b),old);
+}
+
+void Math(Op op, float *out, const float *a, const float *b, unsigned int n)
+{
+	if (op!=DIV) 
+	{
+		Scalar::Math(op,out,a,b,n);
+		return;
+	}
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		_mm_storeu_ps(out+i,Div4(_mm_loadu_ps(a+i),_mm_loadu_ps(b+i),_mm_loadu_ps(out+i)));
+	}
+	Scalar::Math(op,out+i,a+i,b+i,n-i);
+}
+
+void Math(Op op, float *out, float a, const float *b, unsigned int n)
+{
+	if (op!=DIV) 
+	{
+		Scalar::Math(op,out,a,b,n);
+		return;
+	}
+	__m128 a4=_mm_set1_ps(a);
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		_mm_storeu_ps(out+i,Div4(a4,_mm_loadu_ps(b+i),_mm_loadu_ps(out+i)));
+	}
+	Scalar::Math(op,out+i,a,b+i,n-i);
+}
+
+void Math(Op op, float *out, const float *a, float b, unsigned int n)
+{
+	if (op!=DIV) 
+	{
+		Scalar::Math(op,out,a,b,n);
+		return;
+	}
+	if (b==0) return;
+	// no zeros to skip, so a straight divide
+	__m128 b4=_mm_set1_ps(b);
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		_mm_storeu_ps(out+i,_mm_div_ps(_mm_loadu_ps(a+i),b4));
+	}
+	Scalar::Math(op,out+i,a+i,b,n-i);
+}
+
+float WaveTable(float *out, const float *table, unsigned int length, 
+                float pos, float incr, float volume, unsigned int n)
+{
+	__m128 volume4=_mm_set1_ps(volume);
+	float phase[4];
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		// the position depends on the last one, so it's 
+		// still stepped one at a time
+		for (unsigned int k=0; k<4; k++)
+		{
+			pos=Wrap(pos+incr,length);
+			phase[k]=pos;
+		}
+
+		if (phase[0]>=0 && phase[1]>=0 && phase[2]>=0 && phase[3]>=0)
+		{
+			_mm_storeu_ps(out+i,_mm_mul_ps(Lookup4(table,phase),volume4));
+		}
+		else
+		{
+			// nans
+			for (unsigned int k=0; k<4; k++) out[i+k]=Lookup(table,length,phase[k])*volume;
+		}
+	}
+	return Scalar::WaveTable(out+i,table,length,pos,incr,volume,n-i);
+}
+
+float WaveTableFM(float *out, const float *table, unsigned int length, 
+                  float pos, const float *pitch, float scale, float volume, unsigned int n)
+{
+	__m128 volume4=_mm_set1_ps(volume);
+	float phase[4];
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		bool simple=true;
+		for (unsigned int k=0; k<4; k++)
+		{
+			if (isfinite(pitch[i+k])) pos=Wrap(pos+pitch[i+k]*scale,length);
+			else simple=false;
+			phase[k]=pos;
+		}
+
+		if (simple && phase[0]>=0 && phase[1]>=0 && phase[2]>=0 && phase[3]>=0)
+		{
+			_mm_storeu_ps(out+i,_mm_mul_ps(Lookup4(table,phase),volume4));
+		}
+		else
+		{
+			for (unsigned int k=0; k<4; k++)
+			{
+				if (isfinite(pitch[i+k])) out[i+k]=Lookup(table,length,phase[k])*volume;
+			}
+		}
+	}
+	return Scalar::WaveTableFM(out+i,table,length,pos,pitch+i,scale,volume,n-i);
+}
+
+void ADSR(float *out, const float *t, float attack, float decay, 
+          float sustain, float release, float volume, unsigned int n)
+{
+	__m128 attack4=_mm_set1_ps(attack);
+	__m128 decay4=_mm_set1_ps(decay);
+	__m128 attackdecay4=_mm_set1_ps(attack+decay);
+	__m128 sustain4=_mm_set1_ps(sustain);
+	__m128 release4=_mm_set1_ps(release);
+	__m128 volume4=_mm_set1_ps(volume);
+	__m128 one=_mm_set1_ps(1);
+	bool hold=release<0.2f;
+
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		// work out all three parts, and pick the right one
+		__m128 t4=_mm_loadu_ps(t+i);
+		__m128 a=_mm_div_ps(t4,attack4);
+		__m128 nt=_mm_div_ps(_mm_sub_ps(t4,attack4),decay4);
+		__m128 d=_mm_add_ps(_mm_sub_ps(one,nt),_mm_mul_ps(sustain4,nt));
+		__m128 r=sustain4;
+		if (!hold)
+		{
+			nt=_mm_div_ps(_mm_sub_ps(t4,attackdecay4),release4);
+			r=_mm_mul_ps(sustain4,_mm_sub_ps(one,nt));
+		}
+		__m128 v=Select(_mm_cmplt_ps(t4,attackdecay4),d,r);
+		v=Select(_mm_cmplt_ps(t4,attack4),a,v);
+		_mm_storeu_ps(out+i,_mm_mul_ps(v,volume4));
+	}
+	Scalar::ADSR(out+i,t+i,attack,decay,sustain,release,volume,n-i);
+}
+
+float Compress(float *io, float env, float speed, float threshold, unsigned int n)
+{
+	// the envelope is a one pole filter, so four steps of it can be 
+	// done at once by summing the inputs up with the right powers
+	float a=1-speed;
+	__m128 a1=_mm_set1_ps(a);
+	__m128 a2=_mm_set1_ps(a*a);
+	__m128 powers=_mm_set_ps(a*a*a*a,a*a*a,a*a,a);
+	__m128 speed4=_mm_set1_ps(speed);
+	__m128 threshold4=_mm_set1_ps(threshold);
+	__m128 one=_mm_set1_ps(1);
+	__m128 env4=_mm_set1_ps(env);
+
+	unsigned int i=0;
+	for (; i+4<=n; i+=4)
+	{
+		__m128 x=_mm_loadu_ps(io+i);
+		__m128 u=_mm_mul_ps(_mm_mul_ps(x,x),speed4);
+		u=_mm_add_ps(u,_mm_mul_ps(a1,_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(u),4))));
+		u=_mm_add_ps(u,_mm_mul_ps(a2,_mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(u),8))));
+		__m128 e=_mm_add_ps(u,_mm_mul_ps(powers,env4));
+
+		__m128 gain=_mm_div_ps(one,_mm_add_ps(one,_mm_sub_ps(e,threshold4)));
+		_mm_storeu_ps(io+i,Select(_mm_cmpgt_ps(e,threshold4),_mm_mul_ps(x,gain),x));
+		env4=_mm_shuffle_ps(e,e,_MM_SHUFFLE(3,3,3,3));
+	}
+	_mm_store_ss(&env,env4);
+	return Scalar::Compress(io+i,env,speed,threshold,n-i);
+}
+
+#else
+
+void Fill(float *out, float v, unsigned int n) 
+{ Scalar::Fill(out,v,n); }
+void MulMix(float *out, const float *in, float m, unsigned int n) 
+{ Scalar::MulMix(out,in,m,n); }
+void MulClipMix(float *out, const float *in, float m, unsigned int n) 
+{ Scalar::MulClipMix(out,in,m,n); }
+void Math(Op op, float *out, const float *a, const float *b, unsigned int n) 
+{ Scalar::Math(op,out,a,b,n); }
+void Math(Op op, float *out, float a, const float *b, unsigned int n) 
+{ Scalar::Math(op,out,a,b,n); }
+void Math(Op op, float *out, const float *a, float b, unsigned int n) 
+{ Scalar::Math(op,out,a,b,n); }
+
+float WaveTable(float *out, const float *table, unsigned int length, 
+                float pos, float incr, float volume, unsigned int n)
+{
+	return Scalar::WaveTable(out,table,length,pos,incr,volume,n);
+}
+
+float WaveTableFM(float *out, const float *table, unsigned int length, 
+                  float pos, const float *pitch, float scale, float volume, unsigned int n)
+{
+	return Scalar::WaveTableFM(out,table,length,pos,pitch,scale,volume,n);
+}
+
+void ADSR(float *out, const float *t, float attack, float decay, 
+          float sustain, float release, float volume, unsigned int n)
+{
+	Scalar::ADSR(out,t,attack,decay,sustain,release,volume,n);
+}
+
+float Compress(float *io, float env, float speed, float threshold, unsigned int n)
+{
+	return Scalar::Compress(io,env,speed,threshold,n);
+}
+
+#endif
+
+///////////////////////////////////////////////////////////
+
+static const unsigned int BENCHMARK_BLOCKS=20000;
+static const unsigned int CHECK_BLOCKS=1000;
+static const unsigned int TABLE_LENGTH=1024;
+
+static double Now()
+{
+	timeval t;
+	gettimeofday(&t,NULL);
+	return t.tv_sec+t.tv_usec/1000000.0;
+}
+
+static float Random(float lo, float hi)
+{
+	return lo+(rand()/(float)RAND_MAX)*(hi-lo);
+}
+
+static float Difference(const float *a, const float *b, unsigned int n)
+{
+	float worst=0;
+	for (unsigned int i=0; i<n; i++)
+	{
+		float d=fabs(a[i]-b[i]);
+		// nans should match nans
+		if (a[i]!=a[i] || b[i]!=b[i]) d=(a[i]!=a[i] && b[i]!=b[i])?0:1;
+		if (d>worst) worst=d;
+	}
+	return worst;
+}
+
+// each kernel is run through a Test, with one block at a time 
+// going through the fast or the scalar version
+class Test
+{
+public:
+	Test(unsigned int bufsize) : m_BufSize(bufsize) {}
+	virtual ~Test() {}
+	virtual const char *Name()=0;
+	// how far apart the two versions are allowed to be
+	virtual float Tolerance() { return 0; }
+	virtual void Reset() {}
+	virtual void Run(bool fast, float *out)=0;
+
+protected:
+	unsigned int m_BufSize;
+};
+
+static bool RunTest(Test &test, unsigned int bufsize)
+{
+	vector<float> fast(bufsize),scalar(bufsize);
+
+	// check they agree over a run of blocks, to catch 
+	// anything carried from block to block going astray
+	float worst=0;
+	test.Reset();
+	for (unsigned int b=0; b<CHECK_BLOCKS; b++)
+	{
+		test.Run(true,&fast[0]);
+		test.Run(false,&scalar[0]);
+		float d=Difference(&fast[0],&scalar[0],bufsize);
+		if (d>worst) worst=d;
+	}
+
+	double start=Now();
+	for (unsigned int b=0; b<BENCHMARK_BLOCKS; b++) test.Run(false,&scalar[0]);
+	double scalartime=(Now()-start)/BENCHMARK_BLOCKS;
+	start=Now();
+	for (unsigned int b=0; b<BENCHMARK_BLOCKS; b++) test.Run(true,&fast[0]);
+	double fasttime=(Now()-start)/BENCHMARK_BLOCKS;
+
+	bool ok=worst<=test.Tolerance();
+	cout<<"  "<<test.Name()<<": scalar "<<scalartime*1000000000<<"ns, fast "<<fasttime*1000000000
+		<<"ns ("<<(fasttime>0?scalartime/fasttime:0)<<"x), largest difference "<<worst
+		<<(ok?"":" - too far out!")<<endl;
+	return ok;
+}
+
+class MixTest : public Test
+{
+public:
+	MixTest(unsigned int bufsize, bool clip) : Test(bufsize), m_Clip(clip), m_In(bufsize) 
+	{
+		for (unsigned int i=0; i<bufsize; i++) m_In[i]=Random(-2,2);
+	}
+	const char *Name() { return m_Clip?"mulclipmix":"mulmix"; }
+	void Run(bool fast, float *out)
+	{
+		// the same starting point for both
+		Scalar::Fill(out,0.1,m_BufSize);
+		if (m_Clip)
+		{
+			if (fast) MulClipMix(out,&m_In[0],0.7,m_BufSize);
+			else Scalar::MulClipMix(out,&m_In[0],0.7,m_BufSize);
+		}
+		else
+		{
+			if (fast) MulMix(out,&m_In[0],0.7,m_BufSize);
+			else Scalar::MulMix(out,&m_In[0],0.7,m_BufSize);
+		}
+	}
+
+private:
+	bool m_Clip;
+	vector<float> m_In;
+};
+
+class MathTest : public Test
+{
+public:
+	// which of the arguments are constants
+	enum Form {BLOCKS,CONSTANT_A,CONSTANT_B};
+
+	MathTest(unsigned int bufsize, Op op, Form form) : 
+	Test(bufsize), m_Op(op), m_Form(form), m_A(bufsize), m_B(bufsize)
+	{
+		for (unsigned int i=0; i<bufsize; i++) 
+		{
+			m_A[i]=Random(-1,1);
+			// some zeros to divide by
+			m_B[i]=(i%7==0)?0:Random(-1,1);
+		}
+	}
+
+	const char *Name() 
+	{ 
+		static const char *names[3][4]={{"add","sub","mul","div"},
+		                                {"add constant","sub from constant","mul constant","div constant"},
+		                                {"add to constant","sub constant","mul by constant","div by constant"}};
+		return names[m_Form][m_Op];
+	}
+
+	void Run(bool fast, float *out)
+	{
+		Scalar::Fill(out,0.1,m_BufSize);
+		switch (m_Form)
+		{
+			case BLOCKS:
+				if (fast) Math(m_Op,out,&m_A[0],&m_B[0],m_BufSize);
+				else Scalar::Math(m_Op,out,&m_A[0],&m_B[0],m_BufSize);
+			break;
+			case CONSTANT_A:
+				if (fast) Math(m_Op,out,0.3f,&m_B[0],m_BufSize);
+				else Scalar::Math(m_Op,out,0.3f,&m_B[0],m_BufSize);
+			break;
+			case CONSTANT_B:
+				if (fast) Math(m_Op,out,&m_A[0],0.3f,m_BufSize);
+				else Scalar::Math(m_Op,out,&m_A[0],0.3f,m_BufSize);
+			break;
+		}
+	}
+
+private:
+	Op m_Op;
+	Form m_Form;
+	vector<float> m_A,m_B;
+};
+
+class WaveTableTest : public Test
+{
+public:
+	WaveTableTest(unsigned int bufsize, bool fm) : 
+	Test(bufsize), m_FM(fm), m_Table(TABLE_LENGTH), m_Pitch(bufsize)
+	{
+		for (unsigned int i=0; i<TABLE_LENGTH; i++) m_Table[i]=sin(i/(float)TABLE_LENGTH*2*M_PI);
+		// going backwards and forwards, with the odd broken value
+		for (unsigned int i=0; i<bufsize; i++) m_Pitch[i]=Random(-2000,4000);
+		if (bufsize>10) m_Pitch[10]=INFINITY;
+	}
+
+	const char *Name() { return m_FM?"wavetable fm":"wavetable"; }
+	void Reset() { m_FastPos=m_ScalarPos=0; }
+
+	void Run(bool fast, float *out)
+	{
+		float scale=TABLE_LENGTH/44100.0f;
+		float &pos=fast?m_FastPos:m_ScalarPos;
+		if (m_FM)
+		{
+			Scalar::Fill(out,0,m_BufSize);
+			if (fast) pos=WaveTableFM(out,&m_Table[0],TABLE_LENGTH,pos,&m_Pitch[0],scale,0.8,m_BufSize);
+			else pos=Scalar::WaveTableFM(out,&m_Table[0],TABLE_LENGTH,pos,&m_Pitch[0],scale,0.8,m_BufSize);
+		}
+		else
+		{
+			if (fast) pos=WaveTable(out,&m_Table[0],TABLE_LENGTH,pos,440*scale,0.8,m_BufSize);
+			else pos=Scalar::WaveTable(out,&m_Table[0],TABLE_LENGTH,pos,440*scale,0.8,m_BufSize);
+		}
+	}
+
+private:
+	bool m_FM;
+	vector<float> m_Table;
+	vector<float> m_Pitch;
+	float m_FastPos,m_ScalarPos;
+};
+
+class ADSRTest : public Test
+{
+public:
+	ADSRTest(unsigned int bufsize) : Test(bufsize), m_Times(bufsize)
+	{
+		for (unsigned int i=0; i<bufsize; i++) m_Times[i]=Random(0,1.3);
+	}
+
+	const char *Name() { return "adsr"; }
+	void Run(bool fast, float *out)
+	{
+		if (fast) ADSR(out,&m_Times[0],0.1,0.2,0.5,1,0.9,m_BufSize);
+		else Scalar::ADSR(out,&m_Times[0],0.1,0.2,0.5,1,0.9,m_BufSize);
+	}
+
+private:
+	vector<float> m_Times;
+};
+
+class CompressTest : public Test
+{
+public:
+	CompressTest(unsigned int bufsize) : Test(bufsize), m_In(bufsize)
+	{
+		for (unsigned int i=0; i<bufsize; i++) m_In[i]=Random(-1,1);
+	}
+
+	const char *Name() { return "compress"; }
+	// the envelope is summed in a different order
+	float Tolerance() { return 0.00001; }
+	void Reset() { m_FastEnv=m_ScalarEnv=0; }
+
+	void Run(bool fast, float *out)
+	{
+		for (unsigned int i=0; i<m_BufSize; i++) out[i]=m_In[i];
+		if (fast) m_FastEnv=Compress(out,m_FastEnv,0.0005,0.1,m_BufSize);
+		else m_ScalarEnv=Scalar::Compress(out,m_ScalarEnv,0.0005,0.1,m_BufSize);
+	}
+
+private:
+	vector<float> m_In;
+	float m_FastEnv,m_ScalarEnv;
+};
+
+bool Benchmark(unsigned int bufsize)
+{
+#ifdef __SSE2__
+	cout<<"timing the sse kernels against the scalar ones, on "<<bufsize<<" sample blocks"<<endl;
+#else
+	cout<<"no sse, so the kernels are the scalar ones, on "<<bufsize<<" sample blocks"<<endl;
+#endif
+
+	bool ok=true;
+	MixTest mulmix(bufsize,false);
+	ok&=RunTest(mulmix,bufsize);
+	MixTest mulclipmix(bufsize,true);
+	ok&=RunTest(mulclipmix,bufsize);
+
+	for (unsigned int form=MathTest::BLOCKS; form<=MathTest::CONSTANT_B; form++)
+	{
+		for (unsigned int op=ADD; op<=DIV; op++)
+		{
+			MathTest math(bufsize,(Op)op,(MathTest::Form)form);
+			ok&=RunTest(math,bufsize);
+		}
+	}
+
+	WaveTableTest wavetable(bufsize,false);
+	ok&=RunTest(wavetable,bufsize);
+	WaveTableTest wavetablefm(bufsize,true);
+	ok&=RunTest(wavetablefm,bufsize);
+	ADSRTest adsr(bufsize);
+	ok&=RunTest(adsr,bufsize);
+	CompressTest compress(bufsize);
+	ok&=RunTest(compress,bufsize);
+
+	return ok;
+}
+
+}
+}
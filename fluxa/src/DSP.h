@@ -0,0 +1,85 @@
+// Copyright (C) 2011 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef DSP_KERNELS
+#define DSP_KERNELS
+
+namespace spiralcore
+{
+
+// block versions of the inner loops, working on plain float arrays
+// so there's no wrapping on each access. with sse2 (which 64 bit x86
+// always has) they do four samples at a time, apart from the simple
+// maths that the compiler manages on its own, otherwise they are the
+// plain loops in DSP::Scalar, which are also kept to check and time 
+// the fast ones against. apart from Compress, which works out its 
+// envelope in a different order, they give exactly the same results
+namespace DSP
+{
+	enum Op {ADD,SUB,MUL,DIV};
+
+	// out=v
+	void Fill(float *out, float v, unsigned int n);
+	// out+=in*m
+	void MulMix(float *out, const float *in, float m, unsigned int n);
+	// out+=in*m, with in*m clipped to +/-m
+	void MulClipMix(float *out, const float *in, float m, unsigned int n);
+	// out=a op b, dividing by zero leaves out alone
+	void Math(Op op, float *out, const float *a, const float *b, unsigned int n);
+	void Math(Op op, float *out, float a, const float *b, unsigned int n);
+	void Math(Op op, float *out, const float *a, float b, unsigned int n);
+	// reads from a looping, linearly interpolated wavetable, stepping 
+	// by incr each sample, and returns the position it got to
+	float WaveTable(float *out, const float *table, unsigned int length, 
+	                float pos, float incr, float volume, unsigned int n);
+	// as above, stepping by pitch*scale, skipping samples where 
+	// the pitch isn't a finite number
+	float WaveTableFM(float *out, const float *table, unsigned int length, 
+	                  float pos, const float *pitch, float scale, float volume, unsigned int n);
+	// the attack, decay and release shape at each time t, which 
+	// should all be between 0 and the end of the release
+	void ADSR(float *out, const float *t, float attack, float decay, 
+	          float sustain, float release, float volume, unsigned int n);
+	// turns down the signal when the envelope goes over the 
+	// threshold, returns the envelope to pass in next time
+	float Compress(float *io, float env, float speed, float threshold, unsigned int n);
+
+	namespace Scalar
+	{
+		void Fill(float *out, float v, unsigned int n);
+		void MulMix(float *out, const float *in, float m, unsigned int n);
+		void MulClipMix(float *out, const float *in, float m, unsigned int n);
+		void Math(Op op, float *out, const float *a, const float *b, unsigned int n);
+		void Math(Op op, float *out, float a, const float *b, unsigned int n);
+		void Math(Op op, float *out, const float *a, float b, unsigned int n);
+		float WaveTable(float *out, const float *table, unsigned int length, 
+		                float pos, float incr, float volume, unsigned int n);
+		float WaveTableFM(float *out, const float *table, unsigned int length, 
+		                  float pos, const float *pitch, float scale, float volume, unsigned int n);
+		void ADSR(float *out, const float *t, float attack, float decay, 
+		          float sustain, float release, float volume, unsigned int n);
+		float Compress(float *io, float env, float speed, float threshold, unsigned int n);
+	}
+
+	// times each kernel against its scalar version and prints 
+	// the results, returns false if any don't agree
+	bool Benchmark(unsigned int bufsize);
+}
+
+}
+
+#endif
@@ -15,6 +15,7 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <limits.h>
+#include <string.h>
 #include "SearchPaths.h"
 #include "Fluxa.h"
 #include "SampleStore.h"
@@ -22,24 +23,23 @@
 
 using namespace spiralcore;
 
-Fluxa::Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport) :
-m_SampleRate(jack->GetSamplerate()),
-m_Graph(70,jack->GetSamplerate()),
-m_Sampler(jack->GetSamplerate()),
+Fluxa::Fluxa(CommandRingBuffer *commands, unsigned int samplerate, unsigned int bufsize, unsigned int threads) :
+m_SampleRate(samplerate),
+m_Graph(70,samplerate,bufsize,threads),
+m_Sampler(samplerate),
+m_LeftJack(0),
+m_RightJack(0),
 m_Running(false),
-m_Server(server),
+m_Commands(commands),
 m_GlobalVolume(1.0f),
 m_Pan(0.0f),
 m_Debug(false),
-m_LeftEq(jack->GetSamplerate()),
-m_RightEq(jack->GetSamplerate()),
-m_LeftComp(jack->GetSamplerate()),
-m_RightComp(jack->GetSamplerate())
+m_LeftEq(samplerate),
+m_RightEq(samplerate),
+m_LeftComp(samplerate),
+m_RightComp(samplerate)
 {
 	WaveTable::WriteWaves();
-    CryptoInit();
-
- 	jack->SetCallback(Run,(void*)this);
 
 	//PortAudioClient* Audio=PortAudioClient::Get();
 	//Audio->SetCallback(Run,(void*)this);
@@ -54,6 +54,18 @@ m_RightComp(jack->GetSamplerate())
 	m_LeftBuffer.Zero();
 	m_RightBuffer.Zero();
 
+	//Sample::SetAllocator(new RealtimeAllocator(1024*1024*40));
+
+	Time Now;
+	Now.SetToNow();
+	m_CurrentTime.Seconds=Now.Seconds;
+	m_CurrentTime.Fraction=Now.Fraction;
+}
+
+void Fluxa::Attach(JackClient* jack, const string &leftport, const string &rightport)
+{
+ 	jack->SetCallback(Run,(void*)this);
+
 	if (jack->IsAttached())
 	{
 		//Audio->SetOutputs(m_LeftBuffer.GetNonConstBuffer(),m_RightBuffer.GetNonConstBuffer());
@@ -64,33 +76,35 @@ m_RightComp(jack->GetSamplerate())
   	    m_RightJack = jack->AddOutputPort();
  		jack->SetOutputBuf(m_RightJack, m_RightBuffer.GetNonConstBuffer());
   	    jack->ConnectOutput(m_RightJack,rightport);
+		// the workers help the jack thread, so run them alongside it
+		m_Graph.SetThreadPriority(jack->GetRealTimePriority());
  		m_Running=true;
 	}
-	//Sample::SetAllocator(new RealtimeAllocator(1024*1024*40));
-
-	Time Now;
-	Now.SetToNow();
-	m_CurrentTime.Seconds=Now.Seconds;
-	m_CurrentTime.Fraction=Now.Fraction;
 
 	cerr<<"fluxa server ready... "<<endl;
 }
 
 void Fluxa::Run(void *RunContext, unsigned int BufSize)
 {
-	((Fluxa*)RunContext)->ProcessCommands();
-	((Fluxa*)RunContext)->Process(BufSize);
+	((Fluxa*)RunContext)->Render(BufSize);
+}
+
+void Fluxa::Render(unsigned int BufSize)
+{
+	ProcessCommands();
+	Process(BufSize);
 }
 
 void Fluxa::ProcessCommands()
 {
 	CommandRingBuffer::Command cmd;
-	while (m_Server->Get(cmd))
+	while (m_Commands->Get(cmd))
 	{
-		string name = cmd.Name;
+		// no strings, to keep allocation out of the audio thread
+		const char *name = cmd.Name;
 		//cerr<<name<<endl;
 
-		if (name=="/setclock")
+		if (!strcmp(name,"/setclock"))
 		{
 			// baddddd :P
 			Time Now;
@@ -98,7 +112,7 @@ void Fluxa::ProcessCommands()
 			m_CurrentTime.Seconds=Now.Seconds;
 			m_CurrentTime.Fraction=Now.Fraction;
 		}
-		else if (name=="/create")
+		else if (!strcmp(name,"/create"))
 		{
 			unsigned int pos=0;
 			while (pos<cmd.Size())
@@ -124,7 +138,7 @@ void Fluxa::ProcessCommands()
 				}
 			}
 		}
-		else if (name=="/connect")
+		else if (!strcmp(name,"/connect"))
 		{
 			for (unsigned int n=0; n<cmd.Size(); n+=3)
 			{
@@ -138,7 +152,7 @@ void Fluxa::ProcessCommands()
 				}
 			}
 		}
-		else if (name=="/play")
+		else if (!strcmp(name,"/play"))
 		{
 			Event e;
 			e.TimeStamp.Seconds=(unsigned int)cmd.GetInt(0);
@@ -174,24 +188,23 @@ void Fluxa::ProcessCommands()
 																			 (unsigned int)e.TimeStamp.Fraction);
 			}
 		}
-		else if (name=="/maxsynths")
+		else if (!strcmp(name,"/maxsynths"))
 		{
 			m_Graph.SetMaxPlaying(cmd.GetInt(0));
 		}
-		else if (name=="/reset")
+		else if (!strcmp(name,"/reset"))
 		{
-			m_Graph.Clear();
-			m_Graph.Init();
+			m_Graph.Reset();
 		}
-		else if (name=="/globalvolume")
+		else if (!strcmp(name,"/globalvolume"))
 		{
 			m_GlobalVolume=cmd.GetFloat(0);
 		}
-		else if (name=="/pan")
+		else if (!strcmp(name,"/pan"))
 		{
 			m_Pan=cmd.GetFloat(0);
 		}
-		else if (name=="/eq")
+		else if (!strcmp(name,"/eq"))
 		{
 			m_LeftEq.SetLow(cmd.GetFloat(0));
             m_LeftEq.SetMid(cmd.GetFloat(1));
@@ -200,7 +213,7 @@ void Fluxa::ProcessCommands()
 			m_RightEq.SetMid(cmd.GetFloat(1));
 			m_RightEq.SetHigh(cmd.GetFloat(2));
 		}
-		else if (name=="/comp")
+		else if (!strcmp(name,"/comp"))
 		{
 			m_LeftComp.SetAttack(cmd.GetFloat(0));
 			m_LeftComp.SetRelease(cmd.GetFloat(1));
@@ -212,7 +225,7 @@ void Fluxa::ProcessCommands()
 			m_RightComp.SetThreshold(cmd.GetFloat(2));
 			m_RightComp.SetSlope(cmd.GetFloat(3));
 		}
-		else if (name=="/addtoqueue")
+		else if (!strcmp(name,"/addtoqueue"))
 		{
 			char *filename = cmd.GetString(1);
 			if (filename!=NULL)
@@ -220,19 +233,19 @@ void Fluxa::ProcessCommands()
 				SampleStore::Get()->AddToQueue(cmd.GetInt(0), filename);
 			}
 		}
-		else if (name=="/loadqueue")
+		else if (!strcmp(name,"/loadqueue"))
 		{
 			SampleStore::Get()->LoadQueue();
 		}
-		else if (name=="/unload")
+		else if (!strcmp(name,"/unload"))
 		{
 			SampleStore::Get()->Unload(cmd.GetInt(0));
 		}
-		else if (name=="/debug")
+		else if (!strcmp(name,"/debug"))
 		{
 			m_Debug=cmd.GetInt(0);
 		}
-		else if (name=="/addsearchpath")
+		else if (!strcmp(name,"/addsearchpath"))
 		{
 			SearchPaths::Get()->AddPath(cmd.GetString(0));
 		}
@@ -252,8 +265,11 @@ void Fluxa::Process(unsigned int BufSize)
 		m_LeftBuffer.Allocate(BufSize);
 		m_RightBuffer.Allocate(BufSize);
 		//PortAudioClient::Get()->SetOutputs(m_LeftBuffer.GetNonConstBuffer(),m_RightBuffer.GetNonConstBuffer());
- 		JackClient::Get()->SetOutputBuf(m_LeftJack, m_LeftBuffer.GetNonConstBuffer());
- 		JackClient::Get()->SetOutputBuf(m_RightJack, m_RightBuffer.GetNonConstBuffer());
+		if (m_Running)
+		{
+ 			JackClient::Get()->SetOutputBuf(m_LeftJack, m_LeftBuffer.GetNonConstBuffer());
+ 			JackClient::Get()->SetOutputBuf(m_RightJack, m_RightBuffer.GetNonConstBuffer());
+		}
 	}
 
 	m_LeftBuffer.Zero();
@@ -18,7 +18,7 @@
 #include "Time.h"
 #include "EventQueue.h"
 #include "Trace.h"
-#include "OSCServer.h"
+#include "CommandRingBuffer.h"
 #include "Sampler.h"
 #include "Graph.h"
 #include "JackClient.h"
@@ -31,9 +31,20 @@ static const int EVENT_BUFFER_SIZE=1024;
 class Fluxa
 {
 public:
-	Fluxa(OSCServer *server, JackClient* jack, const string &leftport, const string &rightport);
+	// threads is how many to process the voices with, including the audio thread
+	Fluxa(CommandRingBuffer *commands, unsigned int samplerate, unsigned int bufsize, unsigned int threads);
 	~Fluxa() {}
 
+	// connects the output to jack, which then calls Render
+	void Attach(JackClient* jack, const string &leftport, const string &rightport);
+	// runs the waiting commands and makes the next BufSize 
+	// samples, so it can also be driven without jack
+	void Render(unsigned int BufSize);
+	const Sample &GetLeft() { return m_LeftBuffer; }
+	const Sample &GetRight() { return m_RightBuffer; }
+	const Time &GetTime() { return m_CurrentTime; }
+	void SetTime(const Time &t) { m_CurrentTime=t; }
+
 private:
 	static void Run(void *RunContext, unsigned int BufSize);
 	void Process(unsigned int BufSize);
@@ -49,7 +60,7 @@ private:
 	int    m_RightJack;
 	bool 	m_Running;
 	Time	m_CurrentTime;
-	OSCServer *m_Server;
+	CommandRingBuffer *m_Commands;
 	EventQueue m_EventQueue;
 	float m_GlobalVolume;
 	float m_Pan;
@@ -16,127 +16,261 @@
 
 #include <vector>
 #include <math.h>
+#include <unistd.h>
+#include <limits.h>
 #include "Graph.h"
 #include "ModuleNodes.h"
 #include "Modules.h"
 
-Graph::Graph(unsigned int NumNodes, unsigned int SampleRate) :
-m_MaxPlaying(10),
-m_NumNodes(NumNodes),
-m_SampleRate(SampleRate)
-{
-	Init();
-}
-
-Graph::~Graph()
-{
-	Clear();
-}
+static const unsigned int NUM_TERMINALS=2000;
+// room for the pool pointers passed between the threads
+static const unsigned int POOL_RING_SIZE=1024;
+// how often the build thread checks for work, in microseconds
+static const unsigned int BUILD_SLEEP=10000;
+static const unsigned int NO_SEGMENT=UINT_MAX;
 
-void Graph::Init()
+Graph::NodePool::NodePool(unsigned int NumNodes, unsigned int SampleRate, unsigned int BufSize)
 {
+	unsigned int total=0;
 	for (unsigned int type=0; type<NUMTYPES; type++)
 	{
-		NodeDescVec *descvec = new NodeDescVec;
+		unsigned int count=NumNodes;
 
-		unsigned int count=m_NumNodes;
+		if (type==TERMINAL) count=NUM_TERMINALS;
 
-		if (type==TERMINAL) count=2000;
+		m_Slots[type].resize(count);
+		m_Current[type]=0;
+		total+=count;
 
 		for(unsigned int n=0; n<count; n++)
 		{
-			NodeDesc *nodedesc = new NodeDesc;
+			GraphNode *node=NULL;
 
 			switch(type)
 			{
-				case TERMINAL : nodedesc->m_Node = new TerminalNode(0); break;
-				case SINOSC : nodedesc->m_Node = new OscNode((int)WaveTable::SINE,m_SampleRate); break;
-				case SAWOSC : nodedesc->m_Node = new OscNode((int)WaveTable::SAW,m_SampleRate); break;
-				case TRIOSC : nodedesc->m_Node = new OscNode((int)WaveTable::TRIANGLE,m_SampleRate); break;
-				case SQUOSC : nodedesc->m_Node = new OscNode((int)WaveTable::SQUARE,m_SampleRate); break;
-				case WHITEOSC : nodedesc->m_Node = new OscNode((int)WaveTable::NOISE,m_SampleRate); break;
-				case PINKOSC : nodedesc->m_Node = new OscNode((int)WaveTable::PINKNOISE,m_SampleRate); break;
-				case ADSR : nodedesc->m_Node = new ADSRNode(m_SampleRate); break;
-				case ADD : nodedesc->m_Node = new MathNode(MathNode::ADD); break;
-				case SUB : nodedesc->m_Node = new MathNode(MathNode::SUB); break;
-				case MUL : nodedesc->m_Node = new MathNode(MathNode::MUL); break;
-				case DIV : nodedesc->m_Node = new MathNode(MathNode::DIV); break;
-				case POW : nodedesc->m_Node = new MathNode(MathNode::POW); break;
-				case MOOGLP : nodedesc->m_Node = new FilterNode(FilterNode::MOOGLP,m_SampleRate); break;
-				case MOOGBP : nodedesc->m_Node = new FilterNode(FilterNode::MOOGBP,m_SampleRate); break;
-				case MOOGHP : nodedesc->m_Node = new FilterNode(FilterNode::MOOGHP,m_SampleRate); break;
-				case FORMANT : nodedesc->m_Node = new FilterNode(FilterNode::FORMANT,m_SampleRate); break;
-				case SAMPLER : nodedesc->m_Node = new SampleNode(m_SampleRate); break;
-				case CRUSH : nodedesc->m_Node = new EffectNode(EffectNode::CRUSH,m_SampleRate); break;
-				case DISTORT : nodedesc->m_Node = new EffectNode(EffectNode::DISTORT,m_SampleRate); break;
-				case CRYPTODISTORT : nodedesc->m_Node = new EffectNode(EffectNode::CRYPTODISTORT,m_SampleRate); break;
-				case CLIP : nodedesc->m_Node = new EffectNode(EffectNode::CLIP,m_SampleRate); break;
-				case DELAY : nodedesc->m_Node = new EffectNode(EffectNode::DELAY,m_SampleRate); break;
-				case KS : nodedesc->m_Node = new KSNode(m_SampleRate); break;
-				case XFADE : nodedesc->m_Node = new XFadeNode(); break;
-				case SAMPNHOLD : nodedesc->m_Node = new HoldNode(HoldNode::SAMP); break;
-				case TRACKNHOLD : nodedesc->m_Node = new HoldNode(HoldNode::TRACK); break;
-				case PAD : nodedesc->m_Node = new PadNode(m_SampleRate); break;
+				case TERMINAL : node = new TerminalNode(0); break;
+				case SINOSC : node = new OscNode((int)WaveTable::SINE,SampleRate); break;
+				case SAWOSC : node = new OscNode((int)WaveTable::SAW,SampleRate); break;
+				case TRIOSC : node = new OscNode((int)WaveTable::TRIANGLE,SampleRate); break;
+				case SQUOSC : node = new OscNode((int)WaveTable::SQUARE,SampleRate); break;
+				case WHITEOSC : node = new OscNode((int)WaveTable::NOISE,SampleRate); break;
+				case PINKOSC : node = new OscNode((int)WaveTable::PINKNOISE,SampleRate); break;
+				case ADSR : node = new ADSRNode(SampleRate); break;
+				case ADD : node = new MathNode(MathNode::ADD); break;
+				case SUB : node = new MathNode(MathNode::SUB); break;
+				case MUL : node = new MathNode(MathNode::MUL); break;
+				case DIV : node = new MathNode(MathNode::DIV); break;
+				case POW : node = new MathNode(MathNode::POW); break;
+				case MOOGLP : node = new FilterNode(FilterNode::MOOGLP,SampleRate); break;
+				case MOOGBP : node = new FilterNode(FilterNode::MOOGBP,SampleRate); break;
+				case MOOGHP : node = new FilterNode(FilterNode::MOOGHP,SampleRate); break;
+				case FORMANT : node = new FilterNode(FilterNode::FORMANT,SampleRate); break;
+				case SAMPLER : node = new SampleNode(SampleRate); break;
+				case CRUSH : node = new EffectNode(EffectNode::CRUSH,SampleRate); break;
+				case DISTORT : node = new EffectNode(EffectNode::DISTORT,SampleRate); break;
+				case CRYPTODISTORT : node = new EffectNode(EffectNode::CRYPTODISTORT,SampleRate); break;
+				case CLIP : node = new EffectNode(EffectNode::CLIP,SampleRate); break;
+				case DELAY : node = new EffectNode(EffectNode::DELAY,SampleRate); break;
+				case KS : node = new KSNode(SampleRate); break;
+				case XFADE : node = new XFadeNode(); break;
+				case SAMPNHOLD : node = new HoldNode(HoldNode::SAMP); break;
+				case TRACKNHOLD : node = new HoldNode(HoldNode::TRACK); break;
+				case PAD : node = new PadNode(SampleRate); break;
 				default: assert(0); break;
 			}
 
-			descvec->m_Vec.push_back(nodedesc);
+			// terminals have no output
+			if (type!=TERMINAL) node->Allocate(BufSize);
+			m_Slots[type][n].m_Node=node;
 		}
+	}
+
+	unsigned int size=1;
+	while (size<total*2) size<<=1;
+	m_Table.resize(size);
+	m_TableMask=size-1;
+}
 
-		m_NodeDescMap[(Type)type] = descvec;
+Graph::NodePool::~NodePool()
+{
+	for (unsigned int type=0; type<NUMTYPES; type++)
+	{
+		for (vector<Slot>::iterator i=m_Slots[type].begin(); i!=m_Slots[type].end(); ++i)
+		{
+			delete i->m_Node;
+		}
 	}
 }
 
-void Graph::Clear()
+GraphNode *Graph::NodePool::Create(unsigned int id, Type t)
 {
-	m_RootNodes.clear();
-	m_NodeMap.clear();
+	Slot &slot=m_Slots[t][m_Current[t]];
+	m_Current[t]=(m_Current[t]+1)%m_Slots[t].size();
+
+	Remove(slot.m_ID,slot.m_Node);
+	slot.m_ID=id;
+	slot.m_Node->Clear();
+	Insert(id,slot.m_Node);
+	return slot.m_Node;
+}
+
+GraphNode *Graph::NodePool::Find(unsigned int id) const
+{
+	for (unsigned int i=Hash(id); m_Table[i].m_Node!=NULL; i=(i+1)&m_TableMask)
+	{
+		if (m_Table[i].m_ID==id) return m_Table[i].m_Node;
+	}
+	return NULL;
+}
+
+void Graph::NodePool::Forget()
+{
+	for (vector<Slot>::iterator i=m_Table.begin(); i!=m_Table.end(); ++i)
+	{
+		i->m_Node=NULL;
+	}
 
-	for (map<Type,NodeDescVec*>::iterator i=m_NodeDescMap.begin();
-		i!=m_NodeDescMap.end(); ++i)
+	for (unsigned int type=0; type<NUMTYPES; type++)
 	{
-		for (vector<NodeDesc*>::iterator ni=i->second->m_Vec.begin();
-			ni!=i->second->m_Vec.end(); ++ni)
+		for (vector<Slot>::iterator i=m_Slots[type].begin(); i!=m_Slots[type].end(); ++i)
 		{
-			delete (*ni)->m_Node;
+			i->m_ID=0;
+			i->m_Node->Clear();
 		}
-		i->second->m_Vec.clear();
+		m_Current[type]=0;
 	}
+}
 
-	m_NodeDescMap.clear();
+void Graph::NodePool::Insert(unsigned int id, GraphNode *node)
+{
+	unsigned int i=Hash(id);
+	while (m_Table[i].m_Node!=NULL && m_Table[i].m_ID!=id) i=(i+1)&m_TableMask;
+	m_Table[i].m_ID=id;
+	m_Table[i].m_Node=node;
 }
 
-void Graph::Create(unsigned int id, Type t, float v)
+void Graph::NodePool::Remove(unsigned int id, GraphNode *node)
 {
-	unsigned int index=m_NodeDescMap[t]->NewIndex();
-	unsigned int oldid=m_NodeDescMap[t]->m_Vec[index]->m_ID;
+	unsigned int i=Hash(id);
+	while (m_Table[i].m_Node!=NULL && m_Table[i].m_ID!=id) i=(i+1)&m_TableMask;
+	// the id may have been given to another node since
+	if (m_Table[i].m_Node!=node) return;
+
+	// shuffle back the entries after it that would
+	// otherwise not be found, rather than leaving a gap
+	m_Table[i].m_Node=NULL;
+	for (unsigned int j=(i+1)&m_TableMask; m_Table[j].m_Node!=NULL; j=(j+1)&m_TableMask)
+	{
+		unsigned int home=Hash(m_Table[j].m_ID);
+		if (((j-home)&m_TableMask)>=((j-i)&m_TableMask))
+		{
+			m_Table[i]=m_Table[j];
+			m_Table[j].m_Node=NULL;
+			i=j;
+		}
+	}
+}
 
-//cerr<<"create id:"<<id<<" index:"<<index<<" type:"<<t<<" value:"<<v<<endl;
+///////////////////////////////////////////////////////////
 
-	map<unsigned int,GraphNode*>::iterator i=m_NodeMap.find(oldid);
-	if (i!=m_NodeMap.end()) m_NodeMap.erase(i);
+Graph::Graph(unsigned int NumNodes, unsigned int SampleRate, unsigned int BufSize, unsigned int Threads) :
+m_MaxPlaying(10),
+m_Pool(NULL),
+m_Stamp(0),
+m_Changed(false),
+m_ProcessSize(BufSize),
+m_Workers(Threads),
+m_NumNodes(NumNodes),
+m_SampleRate(SampleRate),
+m_BufSize(BufSize),
+m_Exit(false),
+m_Fresh(POOL_RING_SIZE),
+m_Retired(POOL_RING_SIZE),
+m_Built(0),
+m_Taken(0)
+{
+	m_Roots.reserve(MAX_PLAYING+1);
+	// terminals are never scheduled
+	m_Schedule.reserve(NumNodes*(NUMTYPES-1));
+	m_Stack.reserve(NumNodes*(NUMTYPES-1));
+	m_Segments.reserve(MAX_PLAYING+1);
+	m_Jobs.reserve(MAX_PLAYING+1);
+	m_Pool=new NodePool(m_NumNodes,m_SampleRate,m_BufSize);
+	pthread_create(&m_BuildThread,NULL,BuildLoop,this);
+}
 
-	list<pair<unsigned int,float> >::iterator remove;
-	bool found=false;
-	for (list<pair<unsigned int,float> >::iterator ri=m_RootNodes.begin();
-		ri!=m_RootNodes.end(); ++ri)
+Graph::~Graph()
+{
+	m_Exit=true;
+	pthread_join(m_BuildThread,NULL);
+
+	NodePool *pool;
+	while (m_Fresh.Read((char*)&pool,sizeof(pool))) delete pool;
+	while (m_Retired.Read((char*)&pool,sizeof(pool))) delete pool;
+	delete m_Pool;
+}
+
+void *Graph::BuildLoop(void *context)
+{
+	Graph *graph=(Graph*)context;
+	while (!graph->m_Exit)
 	{
-		if (ri->first==oldid)
+		NodePool *pool;
+		while (graph->m_Retired.Read((char*)&pool,sizeof(pool))) delete pool;
+
+		// keep a spare ready for the next reset
+		if (graph->m_Built==graph->m_Taken)
 		{
-			remove=ri;
-			found=true;
+			pool=new NodePool(graph->m_NumNodes,graph->m_SampleRate,graph->m_BufSize);
+			if (graph->m_Fresh.Write((char*)&pool,sizeof(pool))) graph->m_Built++;
+			else delete pool;
 		}
+
+		usleep(BUILD_SLEEP);
+	}
+	return NULL;
+}
+
+void Graph::Reset()
+{
+	m_Roots.clear();
+	m_Changed=true;
+
+	NodePool *fresh=NULL;
+	if (m_Fresh.Read((char*)&fresh,sizeof(fresh)))
+	{
+		m_Taken++;
+		// the build thread empties this before making the next
+		// spare, so there is always room
+		m_Retired.Write((char*)&m_Pool,sizeof(m_Pool));
+		m_Pool=fresh;
+	}
+	else
+	{
+		// resetting again before the spare is ready
+		m_Pool->Forget();
 	}
-	if (found) m_RootNodes.erase(remove);
+}
+
+void Graph::Create(unsigned int id, Type t, float v)
+{
+	if (t>=NUMTYPES) return;
 
-	m_NodeDescMap[t]->m_Vec[index]->m_ID=id;
-	m_NodeDescMap[t]->m_Vec[index]->m_Node->Clear();
-	m_NodeMap[id]=m_NodeDescMap[t]->m_Vec[index]->m_Node;
+//cerr<<"create id:"<<id<<" type:"<<t<<" value:"<<v<<endl;
+
+	GraphNode *node=m_Pool->Create(id,t);
+	m_Changed=true;
+
+	// stop it playing as whatever it was before
+	for (vector<Root>::iterator i=m_Roots.begin(); i!=m_Roots.end(); )
+	{
+		if (i->m_Node==node) i=m_Roots.erase(i);
+		else ++i;
+	}
 
 	if (t==TERMINAL)
 	{
-		TerminalNode *terminal = dynamic_cast<TerminalNode*>(m_NodeMap[id]);
-		assert(terminal!=NULL);
+		TerminalNode *terminal = static_cast<TerminalNode*>(node);
 		terminal->SetValue(v);
 	}
 }
@@ -144,44 +278,176 @@ void Graph::Create(unsigned int id, Type t, float v)
 void Graph::Connect(unsigned int id, unsigned int arg, unsigned int to)
 {
 //cerr<<"connect id "<<id<<" arg "<<arg<<" to "<<to<<endl;
-	if (m_NodeMap[id]!=NULL && m_NodeMap[to]!=NULL)
+	GraphNode *node=m_Pool->Find(id);
+	GraphNode *child=m_Pool->Find(to);
+	if (node!=NULL && child!=NULL)
 	{
-		m_NodeMap[id]->SetChild(arg,m_NodeMap[to]);
+		node->SetChild(arg,child);
+		m_Changed=true;
 	}
 }
 
 void Graph::Play(float time, unsigned int id, float pan)
 {
 //cerr<<"play id "<<id<<endl;
-	if (m_NodeMap[id]!=NULL)
+	GraphNode *node=m_Pool->Find(id);
+	if (node!=NULL)
 	{
-		m_NodeMap[id]->Trigger(time);
-		m_RootNodes.push_back(pair<unsigned int, float>(id,pan));
+		node->Trigger(time);
 
-		while (m_RootNodes.size()>m_MaxPlaying)
+		// there is room reserved for one more than the most playing
+		Root root;
+		root.m_Node=node;
+		root.m_Pan=pan;
+		m_Roots.push_back(root);
+		m_Changed=true;
+
+		while (m_Roots.size()>m_MaxPlaying)
 		{
-			m_RootNodes.erase(m_RootNodes.begin());
+			m_Roots.erase(m_Roots.begin());
 		}
 	}
 }
 
 void Graph::Process(unsigned int bufsize, Sample &left, Sample &right)
 {
-	for(list<pair<unsigned int, float> >::iterator i=m_RootNodes.begin();
-		i!=m_RootNodes.end(); ++i)
+	// so the next spare is made the right size
+	m_BufSize=bufsize;
+
+	if (m_Changed) Schedule();
+
+	m_ProcessSize=bufsize;
+	m_Workers.Run(RunJob,this,m_Jobs.size());
+
+	for(vector<Root>::iterator i=m_Roots.begin(); i!=m_Roots.end(); ++i)
+	{
+		// do stereo panning
+		float pan = i->m_Pan;
+		float leftpan=1,rightpan=1;
+		if (pan<0) leftpan=1-pan;
+		else rightpan=1+pan;
+
+		left.MulMix(i->m_Node->GetOutput(),0.1*leftpan);
+		right.MulMix(i->m_Node->GetOutput(),0.1*rightpan);
+	}
+}
+
+void Graph::RunJob(void *context, unsigned int job)
+{
+	Graph *graph=(Graph*)context;
+	for (unsigned int seg=graph->m_Jobs[job]; seg<graph->m_Segments.size(); 
+		seg=graph->m_Segments[seg].m_Next)
+	{
+		const Segment &segment=graph->m_Segments[seg];
+		for (unsigned int n=segment.m_Start; n<segment.m_End; n++)
+		{
+			graph->m_Schedule[n]->Process(graph->m_ProcessSize);
+		}
+	}
+}
+
+void Graph::Schedule()
+{
+	m_Schedule.clear();
+	m_Segments.clear();
+	m_Jobs.clear();
+	// a new stamp each time saves clearing the old ones,
+	// and fresh nodes start at 0
+	m_Stamp++;
+	if (m_Stamp==0) m_Stamp=1;
+
+	for (unsigned int voice=0; voice<m_Roots.size(); voice++)
 	{
-		if (m_NodeMap[i->first]!=NULL)
+		Segment segment;
+		segment.m_Start=m_Schedule.size();
+		segment.m_Next=NO_SEGMENT;
+		segment.m_Last=voice;
+		segment.m_Parent=voice;
+		m_Segments.push_back(segment);
+		Visit(m_Roots[voice].m_Node,voice);
+		m_Segments[voice].m_End=m_Schedule.size();
+	}
+
+	// chain the voices that share nodes into jobs, in order, 
+	// as the later ones rely on the earlier ones' nodes
+	for (unsigned int voice=0; voice<m_Segments.size(); voice++)
+	{
+		unsigned int job=FindJob(voice);
+		if (job==voice) m_Jobs.push_back(voice);
+		else
 		{
-			m_NodeMap[i->first]->Process(bufsize);
+			m_Segments[m_Segments[job].m_Last].m_Next=voice;
+			m_Segments[job].m_Last=voice;
+		}
+	}
 
-            // do stereo panning
-            float pan = i->second;
-            float leftpan=1,rightpan=1;
-            if (pan<0) leftpan=1-pan;
-            else rightpan=1+pan;
+	m_Changed=false;
+}
 
-			left.MulMix(m_NodeMap[i->first]->GetOutput(),0.1*leftpan);
-            right.MulMix(m_NodeMap[i->first]->GetOutput(),0.1*rightpan);
+// the voices sharing nodes are kept as sets, each 
+// pointing at the first voice of the set
+unsigned int Graph::FindJob(unsigned int voice)
+{
+	while (m_Segments[voice].m_Parent!=voice)
+	{
+		m_Segments[voice].m_Parent=m_Segments[m_Segments[voice].m_Parent].m_Parent;
+		voice=m_Segments[voice].m_Parent;
+	}
+	return voice;
+}
+
+void Graph::Join(unsigned int a, unsigned int b)
+{
+	a=FindJob(a);
+	b=FindJob(b);
+	if (a<b) m_Segments[b].m_Parent=a;
+	else m_Segments[a].m_Parent=b;
+}
+
+// depth first, using our own stack rather than recursion. nodes
+// are stamped when first reached, so a loop in the patch can't
+// send it round forever - the node closing the loop just reads
+// the last block's output
+void Graph::Visit(GraphNode *node, unsigned int voice)
+{
+	if (node->IsTerminal()) return;
+	if (node->GetStamp()==m_Stamp)
+	{
+		Join(node->GetVoice(),voice);
+		return;
+	}
+
+	node->SetStamp(m_Stamp,voice);
+	Frame frame;
+	frame.m_Node=node;
+	frame.m_Child=0;
+	m_Stack.push_back(frame);
+
+	while (!m_Stack.empty())
+	{
+		Frame &top=m_Stack.back();
+		if (top.m_Child<top.m_Node->GetNumChildren())
+		{
+			GraphNode *child=top.m_Node->GetChild(top.m_Child++);
+			if (child!=NULL && !child->IsTerminal())
+			{
+				if (child->GetStamp()==m_Stamp)
+				{
+					// already in, but maybe from another voice
+					if (child->GetVoice()!=voice) Join(child->GetVoice(),voice);
+					continue;
+				}
+				child->SetStamp(m_Stamp,voice);
+				frame.m_Node=child;
+				frame.m_Child=0;
+				m_Stack.push_back(frame);
+			}
+		}
+		else
+		{
+			// all its children are in, so it can go next
+			m_Schedule.push_back(top.m_Node);
+			m_Stack.pop_back();
 		}
 	}
 }
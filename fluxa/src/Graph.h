@@ -15,68 +15,143 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <vector>
-#include <map>
-#include <set>
-#include <list>
 #include <math.h>
+#include <pthread.h>
 #include "GraphNode.h"
 #include "ModuleNodes.h"
+#include "RingBuffer.h"
+#include "WorkerPool.h"
 
 #ifndef GRAPH
 #define GRAPH
 
+// all the nodes are made up front in a pool, and new pools for
+// resetting are made in another thread, so nothing is allocated
+// or freed by the graph when running in the audio thread.
+// the playing voices are compiled into one flat list of nodes,
+// children before parents, which is rebuilt when the graph
+// changes. a node shared between voices appears once, so it's
+// only processed once a block. voices that don't share any nodes
+// are processed in parallel by the worker threads, and mixed in
+// the order they were played, so the output doesn't depend on
+// the number of threads
+
 class Graph
 {
 public:
-	Graph(unsigned int NumNodes, unsigned int SampleRate);
+	Graph(unsigned int NumNodes, unsigned int SampleRate, unsigned int BufSize, unsigned int Threads);
 	~Graph();
 
 	enum Type{TERMINAL,SINOSC,SAWOSC,TRIOSC,SQUOSC,WHITEOSC,PINKOSC,ADSR,ADD,SUB,MUL,DIV,POW,
 		      MOOGLP,MOOGBP,MOOGHP,FORMANT,SAMPLER,CRUSH,DISTORT,CLIP,DELAY,KS,XFADE,SAMPNHOLD,
 			  TRACKNHOLD,PAD,CRYPTODISTORT,NUMTYPES};
 
-	void Init();
-	void Clear();
+	// swaps in a fresh set of nodes
+	void Reset();
 	void Create(unsigned int id, Type t, float v);
 	void Connect(unsigned int id, unsigned int arg, unsigned int to);
 	void Play(float time, unsigned int id, float pan);
 	void Process(unsigned int bufsize, Sample &left, Sample &right);
-	void SetMaxPlaying(int s) { m_MaxPlaying=s; }
+	void SetMaxPlaying(unsigned int s) { m_MaxPlaying=s<MAX_PLAYING?s:MAX_PLAYING; }
+	void SetThreadPriority(int priority) { m_Workers.SetPriority(priority); }
+
+	static const unsigned int MAX_PLAYING=256;
 
 private:
-	class NodeDesc
+	class NodePool
+	{
+	public:
+		NodePool(unsigned int NumNodes, unsigned int SampleRate, unsigned int BufSize);
+		~NodePool();
+
+		// reuses the oldest node of this type
+		GraphNode *Create(unsigned int id, Type t);
+		GraphNode *Find(unsigned int id) const;
+		// forgets all the ids, for resetting in place
+		void Forget();
+
+	private:
+		void Insert(unsigned int id, GraphNode *node);
+		void Remove(unsigned int id, GraphNode *node);
+		unsigned int Hash(unsigned int id) const { return (id*2654435761u)&m_TableMask; }
+
+		class Slot
+		{
+		public:
+			Slot() : m_Node(NULL), m_ID(0) {}
+			GraphNode *m_Node;
+			unsigned int m_ID;
+		};
+
+		vector<Slot> m_Slots[NUMTYPES];
+		unsigned int m_Current[NUMTYPES];
+
+		// flat id to node table with open addressing, with room
+		// for twice the nodes so it never fills up
+		vector<Slot> m_Table;
+		unsigned int m_TableMask;
+	};
+
+	class Root
 	{
 	public:
-		NodeDesc(): m_Node(NULL), m_ID(0) {}
 		GraphNode *m_Node;
-		unsigned int m_ID;
+		float m_Pan;
 	};
 
-	class NodeDescVec
+	class Frame
 	{
 	public:
-		unsigned int NewIndex()
-		{
-			m_Current++;
-			if (m_Current>=m_Vec.size())
-			{
-				//cerr<<"going round..."<<endl;
-				m_Current=0;
-			}
-			return m_Current;
-		}
-
-		NodeDescVec(): m_Current(0) {}
-		unsigned int m_Current;
-		vector<NodeDesc*> m_Vec;
+		GraphNode *m_Node;
+		unsigned int m_Child;
+	};
+
+	// a run of the schedule for one voice, voices sharing
+	// nodes are chained together into one job
+	class Segment
+	{
+	public:
+		unsigned int m_Start;
+		unsigned int m_End;
+		unsigned int m_Next;
+		unsigned int m_Last;
+		unsigned int m_Parent;
 	};
 
+	void Schedule();
+	void Visit(GraphNode *node, unsigned int voice);
+	unsigned int FindJob(unsigned int voice);
+	void Join(unsigned int a, unsigned int b);
+	static void RunJob(void *context, unsigned int job);
+
+	static void *BuildLoop(void *context);
+
 	unsigned int m_MaxPlaying;
-	list<pair<unsigned int, float> > m_RootNodes;
-	map<unsigned int,GraphNode*> m_NodeMap;
-	map<Type,NodeDescVec*> m_NodeDescMap;
+	vector<Root> m_Roots;
+	NodePool *m_Pool;
+
+	// reserved for every node in a pool, so never reallocated
+	vector<GraphNode*> m_Schedule;
+	vector<Frame> m_Stack;
+	vector<Segment> m_Segments;
+	vector<unsigned int> m_Jobs;
+	unsigned int m_Stamp;
+	bool m_Changed;
+	unsigned int m_ProcessSize;
+	WorkerPool m_Workers;
+
 	unsigned int m_NumNodes;
 	unsigned int m_SampleRate;
+	volatile unsigned int m_BufSize;
+
+	// pools go to the audio thread through m_Fresh, and back
+	// to be deleted through m_Retired
+	pthread_t m_BuildThread;
+	volatile bool m_Exit;
+	RingBuffer m_Fresh;
+	RingBuffer m_Retired;
+	volatile unsigned int m_Built;
+	volatile unsigned int m_Taken;
 };
 
 #endif
@@ -22,7 +22,9 @@ using namespace std;
 
 ///////////////////////////////////////////
 	
-GraphNode::GraphNode(unsigned int numinputs) 
+GraphNode::GraphNode(unsigned int numinputs) :
+m_Stamp(0),
+m_Voice(0)
 { 
 	for(unsigned int n=0; n<numinputs; n++)
 	{
@@ -49,18 +51,6 @@ void GraphNode::TriggerChildren(float time)
 	}
 }
 
-void GraphNode::ProcessChildren(unsigned int bufsize)
-{
-	for(vector<GraphNode*>::iterator i=m_ChildNodes.begin(); 
-		i!=m_ChildNodes.end(); ++i)
-	{
-		if (*i!=NULL)
-		{
-			(*i)->Process(bufsize);
-		}
-	}
-}
-
 void GraphNode::Clear()
 {
 	for(unsigned int n=0; n<m_ChildNodes.size(); n++)
@@ -34,25 +34,38 @@ public:
 	virtual ~GraphNode();
 	
 	virtual void Trigger(float time) {}
+	// the graph processes the children first, so
+	// their outputs are ready to be read here
 	virtual void Process(unsigned int bufsize)=0;
 	virtual float GetValue() { return 0; }
 	virtual bool IsTerminal() { return false; }
 	virtual Sample &GetOutput() { return m_Output; }
 	virtual void Clear();
+	// sizes the buffers, the graph does this for all its nodes
+	// up front, so it only happens in Process if the size grows
+	virtual void Allocate(unsigned int bufsize) { m_Output.Allocate(bufsize); }
 	
 	void TriggerChildren(float time);
-	void ProcessChildren(unsigned int bufsize);
 	void SetChild(unsigned int num, GraphNode *s);
 	bool ChildExists(unsigned int num);
 	GraphNode* GetChild(unsigned int num);
 	Sample &GetInput(unsigned int num);
 	float GetCVValue();
+	unsigned int GetNumChildren() const { return m_ChildNodes.size(); }
+
+	// marks the node as visited when the graph is scheduled,
+	// and which voice got to it first
+	unsigned int GetStamp() const { return m_Stamp; }
+	unsigned int GetVoice() const { return m_Voice; }
+	void SetStamp(unsigned int s, unsigned int voice) { m_Stamp=s; m_Voice=voice; }
 	
 protected:
 	Sample m_Output;
 	
 private:
 	vector<GraphNode*> m_ChildNodes;
+	unsigned int m_Stamp;
+	unsigned int m_Voice;
 };
 
 #endif
@@ -97,6 +97,22 @@ void JackClient::Detach()
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+unsigned int JackClient::GetBufferSize()
+{
+        if (m_Attached) return jack_get_buffer_size(m_Client);
+        return m_BufferSize;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+int JackClient::GetRealTimePriority()
+{
+        if (m_Attached) return jack_client_real_time_priority(m_Client);
+        return -1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
 int JackClient::Process(jack_nframes_t nframes, void *o)
 {
         for (map<int,JackPort*>::iterator i=m_InputPortMap.begin();
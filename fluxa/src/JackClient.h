@@ -54,6 +54,9 @@ public:
     int    AddInputPort();
     int    AddOutputPort();
 	unsigned int GetSamplerate() { return m_SampleRate; }
+	unsigned int GetBufferSize();
+	// the priority of the process thread, -1 if it's not real time
+	int    GetRealTimePriority();
 	
 protected:
 	JackClient();
@@ -15,6 +15,7 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "ModuleNodes.h"
+#include "DSP.h"
 
 TerminalNode::TerminalNode(float Value):
 GraphNode(0),
@@ -46,9 +47,8 @@ void OscNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && !GetChild(0)->IsTerminal())
 	{
@@ -82,10 +82,9 @@ void ADSRNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
 	m_Envelope.Process(bufsize, m_Output);
 }
 
@@ -104,13 +103,22 @@ void MathNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
-
 	if (ChildExists(0) && ChildExists(1))
 	{
+		// the inputs have been processed before us, so they are big 
+		// enough, unless a loop in the patch brings one round after 
+		// the buffer size has grown
+		if ((!GetChild(0)->IsTerminal() && GetChild(0)->GetOutput().GetLength()<bufsize) ||
+		    (!GetChild(1)->IsTerminal() && GetChild(1)->GetOutput().GetLength()<bufsize))
+		{
+			return;
+		}
+
+		AudioType *out=m_Output.GetNonConstBuffer();
+
 		if (GetChild(0)->IsTerminal() && GetChild(1)->IsTerminal())
 		{
 			float value=0;
@@ -126,34 +134,25 @@ void MathNode::Process(unsigned int bufsize)
 				case POW: if (v0!=0 || v1>0) value=powf(v0,v1); break;
 			};
 
-			for (unsigned int n=0; n<bufsize; n++) m_Output[n]=value;
+			DSP::Fill(out,value,bufsize);
 		}
 		else if (GetChild(0)->IsTerminal() && !GetChild(1)->IsTerminal())
 		{
 			float v0 = GetChild(0)->GetValue();
+			const AudioType *in1 = GetChild(1)->GetOutput().GetBuffer();
 
 			switch(m_Type)
 			{
-				case ADD: for (unsigned int n=0; n<bufsize; n++) m_Output[n]=v0+GetChild(1)->GetOutput()[n]; break;
-				case SUB: for (unsigned int n=0; n<bufsize; n++) m_Output[n]=v0-GetChild(1)->GetOutput()[n]; break;
-				case MUL: for (unsigned int n=0; n<bufsize; n++) m_Output[n]=v0*GetChild(1)->GetOutput()[n]; break;
-				case DIV:
-				{
-					for (unsigned int n=0; n<bufsize; n++)
-					{
-						if (GetChild(1)->GetOutput()[n]!=0)
-						{
-							m_Output[n]=v0/GetChild(1)->GetOutput()[n];
-						}
-					}
-				}
-				break;
+				case ADD: DSP::Math(DSP::ADD,out,v0,in1,bufsize); break;
+				case SUB: DSP::Math(DSP::SUB,out,v0,in1,bufsize); break;
+				case MUL: DSP::Math(DSP::MUL,out,v0,in1,bufsize); break;
+				case DIV: DSP::Math(DSP::DIV,out,v0,in1,bufsize); break;
 				case POW:
 					for (unsigned int n=0; n<bufsize; n++)
 					{
-						if (v0!=0 && GetChild(1)->GetOutput()[n]>0)
+						if (v0!=0 && in1[n]>0)
 						{
-							m_Output[n]=powf(v0,GetChild(1)->GetOutput()[n]);
+							out[n]=powf(v0,in1[n]);
 						}
 					}
 				break;
@@ -161,30 +160,21 @@ void MathNode::Process(unsigned int bufsize)
 		}
 		else if (!GetChild(0)->IsTerminal() && GetChild(1)->IsTerminal())
 		{
+			const AudioType *in0 = GetChild(0)->GetOutput().GetBuffer();
 			float v1 = GetChild(1)->GetValue();
 
 			switch(m_Type)
 			{
-				case ADD: for (unsigned int n=0; n<bufsize; n++) m_Output[n]=GetChild(0)->GetOutput()[n]+v1; break;
-				case SUB: for (unsigned int n=0; n<bufsize; n++) m_Output[n]=GetChild(0)->GetOutput()[n]-v1; break;
-				case MUL: for (unsigned int n=0; n<bufsize; n++) m_Output[n]=GetChild(0)->GetOutput()[n]*v1; break;
-				case DIV:
-				{
-					if (v1!=0)
-					{
-						for (unsigned int n=0; n<bufsize; n++)
-						{
-							m_Output[n]=GetChild(0)->GetOutput()[n]/v1;
-						}
-					}
-				}
-				break;
+				case ADD: DSP::Math(DSP::ADD,out,in0,v1,bufsize); break;
+				case SUB: DSP::Math(DSP::SUB,out,in0,v1,bufsize); break;
+				case MUL: DSP::Math(DSP::MUL,out,in0,v1,bufsize); break;
+				case DIV: DSP::Math(DSP::DIV,out,in0,v1,bufsize); break;
 				case POW:
 					for (unsigned int n=0; n<bufsize; n++)
 					{
-						if (GetChild(0)->GetOutput()[n]!=0 && v1>0)
+						if (in0[n]!=0 && v1>0)
 						{
-							m_Output[n]=powf(GetChild(0)->GetOutput()[n],v1);
+							out[n]=powf(in0[n],v1);
 						}
 					}
 				break;
@@ -192,48 +182,22 @@ void MathNode::Process(unsigned int bufsize)
 		}
 		else
 		{
+			const AudioType *in0 = GetChild(0)->GetOutput().GetBuffer();
+			const AudioType *in1 = GetChild(1)->GetOutput().GetBuffer();
+
 			switch(m_Type)
 			{
-				case ADD:
-				{
-					for (unsigned int n=0; n<bufsize; n++)
-					{
-						m_Output[n]=GetChild(0)->GetOutput()[n]+GetChild(1)->GetOutput()[n];
-					}
-
-				} break;
-				case SUB:
-				{
-					for (unsigned int n=0; n<bufsize; n++)
-					{
-						m_Output[n]=GetChild(0)->GetOutput()[n]-GetChild(1)->GetOutput()[n];
-					}
-				} break;
-				case MUL:
-				{
-					for (unsigned int n=0; n<bufsize; n++)
-					{
-						m_Output[n]=GetChild(0)->GetOutput()[n]*GetChild(1)->GetOutput()[n];
-					}
-				} break;
-				case DIV:
-				{
-					for (unsigned int n=0; n<bufsize; n++)
-					{
-						if (GetChild(1)->GetOutput()[n]!=0)
-						{
-							m_Output[n]=GetChild(0)->GetOutput()[n]/GetChild(1)->GetOutput()[n];
-						}
-					}
-				}
-				break;
+				case ADD: DSP::Math(DSP::ADD,out,in0,in1,bufsize); break;
+				case SUB: DSP::Math(DSP::SUB,out,in0,in1,bufsize); break;
+				case MUL: DSP::Math(DSP::MUL,out,in0,in1,bufsize); break;
+				case DIV: DSP::Math(DSP::DIV,out,in0,in1,bufsize); break;
 				case POW:
 				{
 					for (unsigned int n=0; n<bufsize; n++)
 					{
-						if (GetChild(0)->GetOutput()[n]!=0 && GetChild(1)->GetOutput()[n]>0)
+						if (in0[n]!=0 && in1[n]>0)
 						{
-							m_Output[n]=powf(GetChild(0)->GetOutput()[n],GetChild(1)->GetOutput()[n]);
+							out[n]=powf(in0[n],in1[n]);
 						}
 					}
 				} break;
@@ -265,11 +229,9 @@ void FilterNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
-
 	if (ChildExists(0) && !GetChild(0)->IsTerminal() && ChildExists(1) && ChildExists(2))
 	{
 		float r=GetChild(2)->GetValue();
@@ -296,6 +258,12 @@ m_Sampler(samplerate)
 {
 }
 
+void SampleNode::Allocate(unsigned int bufsize)
+{
+	GraphNode::Allocate(bufsize);
+	m_Temp.Allocate(bufsize);
+}
+
 void SampleNode::Trigger(float time)
 {
 	TriggerChildren(time);
@@ -313,11 +281,9 @@ void SampleNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
-		m_Temp.Allocate(bufsize);
+		Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
 	m_Output.Zero();
 	m_Sampler.Process(bufsize, m_Output, m_Temp);
 }
@@ -325,7 +291,8 @@ void SampleNode::Process(unsigned int bufsize)
 EffectNode::EffectNode(Type type, unsigned int samplerate):
 GraphNode(3),
 m_Type(type),
-m_Delay(samplerate)
+m_Delay(samplerate),
+m_Crypto(samplerate)
 {
 }
 
@@ -338,11 +305,9 @@ void EffectNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
 
-	ProcessChildren(bufsize);
-
     if (ChildExists(0) && !GetChild(0)->IsTerminal() && ChildExists(1))
     {
         if (m_Type==CLIP)
@@ -372,7 +337,7 @@ void EffectNode::Process(unsigned int bufsize)
         else if (m_Type==CRYPTODISTORT)
         {
             m_Output=GetInput(0);
-            CryptoDistort(m_Output);
+            m_Crypto.Process(bufsize,m_Output);
         }
         else if (ChildExists(2))
         {
@@ -420,9 +385,8 @@ void KSNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(1) && ChildExists(2))
 	{
@@ -455,9 +419,8 @@ void XFadeNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && ChildExists(1) && ChildExists(2))
 	{
@@ -605,9 +568,8 @@ void HoldNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
 	if (ChildExists(0) && ChildExists(1))
 	{
@@ -725,9 +687,8 @@ void PadNode::Process(unsigned int bufsize)
 {
 	if (bufsize>(unsigned int)m_Output.GetLength())
 	{
-		m_Output.Allocate(bufsize);
+		Allocate(bufsize);
 	}
-	ProcessChildren(bufsize);
 
     bool HaveFreqCV = false;
     bool HaveGapCV = false;
@@ -145,6 +145,7 @@ public:
 	SampleNode(unsigned int samplerate);
 	virtual void Trigger(float time);
 	virtual void Process(unsigned int bufsize);
+	virtual void Allocate(unsigned int bufsize);
 
 private:
 	PlayMode m_PlayMode;
@@ -164,6 +165,7 @@ public:
 private:
 	Type m_Type;
 	Delay m_Delay;
+	CryptoDistort m_Crypto;
 };
 
 #endif
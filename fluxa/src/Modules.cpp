@@ -15,6 +15,7 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include "Modules.h"
+#include "DSP.h"
 #include <stdlib.h>
 #include <math.h>
 #include <openssl/evp.h>
@@ -97,11 +98,12 @@ void MovingHardClip(Sample &buf, const Sample &level)
 	}
 }
 
-EVP_CIPHER_CTX e_ctx;
+///////////////////////////////////////////////////////////////////////////
 
-void CryptoInit()
+CryptoDistort::CryptoDistort(int SampleRate) :
+Module(SampleRate),
+m_Context(EVP_CIPHER_CTX_new())
 {
-    cerr<<"cryptoinit"<<endl;
     string salt_data("salt");
     string key_data("key");
     unsigned char key[32], iv[32];
@@ -111,36 +113,37 @@ void CryptoInit()
                    (unsigned char*)key_data.c_str(), key_data.length(), 1,
                    key,
                    iv);
-    cerr<<1<<endl;
-    EVP_CIPHER_CTX_init(&e_ctx);
-    cerr<<2<<endl;
-    EVP_EncryptInit_ex(&e_ctx, EVP_aes_256_ecb(), NULL, key, iv);
-    cerr<<"cryptoinit done"<<endl;
+    // set up here, as the first init can allocate
+    EVP_EncryptInit_ex(m_Context, EVP_aes_256_ecb(), NULL, key, iv);
 }
 
-char enc_dati[4096];
-char enc_dato[4096];
+CryptoDistort::~CryptoDistort()
+{
+    EVP_CIPHER_CTX_free(m_Context);
+}
 
-void CryptoDistort(Sample &buf)
+void CryptoDistort::Process(unsigned int BufSize, Sample &In)
 {
-    unsigned int byteslen = buf.GetLength();
+    char enc_dati[4096];
+    char enc_dato[4096+AES_BLOCK_SIZE];
+    unsigned int byteslen = In.GetLength();
 
-    for (unsigned int i=0; i<buf.GetLength(); i++)
+    for (unsigned int i=0; i<In.GetLength(); i++)
     {
-        enc_dati[i]=buf[i]*127;
+        enc_dati[i]=In[i]*127;
     }
 
+    // ecb, and final leaves the context ready for the next block
     int c_len=byteslen+AES_BLOCK_SIZE;
-    EVP_EncryptUpdate(&e_ctx,(unsigned char*)enc_dato, &c_len,
-                             (unsigned char*)enc_dati, byteslen);
+    EVP_EncryptUpdate(m_Context,(unsigned char*)enc_dato, &c_len,
+                                (unsigned char*)enc_dati, byteslen);
     int f_len = 0;
-    EVP_EncryptFinal_ex(&e_ctx,(unsigned char*)enc_dato+c_len, &f_len);
+    EVP_EncryptFinal_ex(m_Context,(unsigned char*)enc_dato+c_len, &f_len);
 
-    for (unsigned int i=0; i<buf.GetLength(); i++)
+    for (unsigned int i=0; i<In.GetLength(); i++)
     {
-        buf[i]=enc_dato[i]/127.0f;
+        In[i]=enc_dato[i]/127.0f;
     }
-
 }
 
 
@@ -296,28 +299,20 @@ void WaveTable::Process(unsigned int BufSize, Sample &In)
 		if (m_Octave<0) Freq/=1<<(-m_Octave);
 		Incr = Freq*m_TablePerSample;
 
-		for (unsigned int n=0; n<BufSize; n++)
-		{
-			m_CyclePos+=Incr;
-			if (m_CyclePos<0) m_CyclePos=m_TableLength-m_CyclePos;
-			m_CyclePos=fmod(m_CyclePos,m_TableLength-1);
-			In[n]=m_Table[(int)m_Type][m_CyclePos]*m_Volume;
-		}
+		assert(BufSize<=In.GetLength());
+		m_CyclePos=DSP::WaveTable(In.GetNonConstBuffer(),m_Table[(int)m_Type].GetBuffer(),m_TableLength,
+		                          m_CyclePos,Incr,m_Volume,BufSize);
 	}
 }
 
 void WaveTable::ProcessFM(unsigned int BufSize, Sample &In, const Sample &Pitch)
 {
-	for (unsigned int n=0; n<BufSize; n++)
-	{
-		if (isfinite(Pitch[n]))
-		{
-			m_CyclePos+=Pitch[n]*m_TablePerSample;
-			if (m_CyclePos<0) m_CyclePos=m_TableLength-m_CyclePos;
-			m_CyclePos=fmod(m_CyclePos,m_TableLength-1);
-			In[n]=m_Table[(int)m_Type][m_CyclePos]*m_Volume;
-		}
-	}
+	assert(BufSize<=In.GetLength());
+	// the pitch can come up short if it's come round a loop
+	// in the patch just after the buffer size has grown
+	if (BufSize>Pitch.GetLength()) BufSize=Pitch.GetLength();
+	m_CyclePos=DSP::WaveTableFM(In.GetNonConstBuffer(),m_Table[(int)m_Type].GetBuffer(),m_TableLength,
+	                            m_CyclePos,Pitch.GetBuffer(),m_TablePerSample,m_Volume,BufSize);
 }
 
 void WaveTable::SimpleProcess(unsigned int BufSize, Sample &In)
@@ -389,6 +384,9 @@ void SimpleWave::Process(unsigned int BufSize, Sample &In)
 
 ///////////////////////////////////////////////////////////////////////////
 
+// the largest block worked out in one go
+static const unsigned int MAX_ENVELOPE_BLOCK=1024;
+
 Envelope::Envelope(int SampleRate) :
 Module(SampleRate)
 {
@@ -435,6 +433,41 @@ void Envelope::Process(unsigned int BufSize, Sample &CV, bool Smooth)
 		return;
 	}
 
+	// usually the whole block is inside the envelope, where the shape
+	// can be worked out in one go, leaving only the smoothing to do 
+	// a sample at a time. the times are summed up one by one as below,
+	// so the block ends up exactly where it would have done
+	if (m_t>=0 && BufSize<=MAX_ENVELOPE_BLOCK)
+	{
+		float times[MAX_ENVELOPE_BLOCK];
+		float t=m_t;
+		for (unsigned int n=0; n<BufSize; n++)
+		{
+			times[n]=t;
+			t+=m_SampleTime;
+		}
+
+		if (times[BufSize-1]<m_Attack+m_Decay+m_Release)
+		{
+			AudioType *out=CV.GetNonConstBuffer();
+			DSP::ADSR(out,times,m_Attack,m_Decay,m_Sustain,m_Release,m_Volume,BufSize);
+			if (Smooth)
+			{
+				for (unsigned int n=0; n<BufSize; n++)
+				{
+					if (!feq(out[n],m_Current,0.01))
+					{
+						out[n]=(out[n]*ONEMINUS_SMOOTH+m_Current*SMOOTH);
+					}
+					m_Current=out[n];
+				}
+			}
+			else m_Current=out[BufSize-1];
+			m_t=t;
+			return;
+		}
+	}
+
 
 	for (unsigned int n=0; n<BufSize; n++)
 	{
@@ -632,7 +665,8 @@ b2(0.0f),
 b3(0.0f),
 b4(0.0f),
 t1(0.0f),
-t2(0.0f)
+t2(0.0f),
+m_Dither(0)
 {
 	Reset();
 }
@@ -666,7 +700,7 @@ void MoogFilter::Process(unsigned int BufSize, Sample &In, Sample *CutoffCV, Sam
 		in = In[n];
 
 		// say no to denormalisation!
-		in+=(rand()%1000)*0.000000001;
+		in+=Dither();
 
 		in -= q * b4;
 
@@ -1012,24 +1046,11 @@ float compressdave(float in) {
 
 void Compressor::Process(unsigned int BufSize, Sample &In)
 {
-    // for each sample...
-    for (unsigned int i=0; i<BufSize; ++i)
-    {
-//        In[i]=compressdave(In[i]);
-
-        // square input (to abs and make logarithmic)
-        float t=In[i]*In[i];
-        // blend to create simple envelope follower
-        m_Env=m_Env*(1-m_Speed)+t*m_Speed;
-
-        // if we are over the threshold
-        if (m_Env > m_Threshold) {
-            // calculate the gain related to amount over thresh
-            In[i] *= 1.0f/(1.0f+(m_Env - m_Threshold));
-        }
-
-		//if (i==0) cerr<<m_Env<<" "<<Gain<<endl;
-    }
+    // square input (to abs and make logarithmic), blend to create 
+    // simple envelope follower, and if we are over the threshold
+    // reduce the gain related to amount over thresh
+    assert(BufSize<=In.GetLength());
+    m_Env=DSP::Compress(In.GetNonConstBuffer(),m_Env,m_Speed,m_Threshold,BufSize);
 }
 
 /*
@@ -17,6 +17,7 @@
 #include "Types.h"
 #include "Sample.h"
 #include <stdlib.h>
+#include <openssl/evp.h>
 
 #ifndef MODULES
 #define MODULES
@@ -36,8 +37,6 @@ void Distort(Sample &buf, float amount);
 void MovingDistort(Sample &buf, const Sample &amount);
 void HardClip(Sample &buf, float level);
 void MovingHardClip(Sample &buf, const Sample &level);
-void CryptoDistort(Sample &buf);
-void CryptoInit();
 
 class Module
 {
@@ -203,7 +202,7 @@ public:
         q = Q + (1.0f + 0.5f * q * (1.0f - q + 5.6f * q * q));
 
         // say no to denormalisation!
-        in+=(rand()%1000)*0.000000001;
+        in+=Dither();
 
         in -= q * b4;
 
@@ -222,12 +221,21 @@ public:
     }
 
 protected:
+	// our own noise rather than rand(), which isn't
+	// safe when voices run on different threads
+	inline float Dither()
+	{
+		m_Dither=m_Dither*1664525+1013904223;
+		return (m_Dither>>22)*0.000000001f;
+	}
+
 	float Cutoff, Resonance;
 
 	float fs, fc;
 	float f,p,q;
 	float b0,b1,b2,b3,b4;
 	float t1,t2;
+	unsigned int m_Dither;
 
 	float in1,in2,in3,in4,out1,out2,out3,out4;
 };
@@ -290,6 +298,23 @@ protected:
 	Sample m_Buffer;
 };
 
+// each one has it's own cipher context, so voices on 
+// different threads don't have to share one
+class CryptoDistort : public Module
+{
+public:
+	CryptoDistort(int SampleRate);
+	virtual ~CryptoDistort();
+
+	virtual void Process(unsigned int BufSize, Sample &In);
+
+private:
+	CryptoDistort(const CryptoDistort &);
+	CryptoDistort &operator=(const CryptoDistort &);
+
+	EVP_CIPHER_CTX *m_Context;
+};
+
 class Eq : public Module
 {
 public:
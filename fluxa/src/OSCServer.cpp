@@ -21,6 +21,7 @@
 #include <iostream>
 
 #include "OSCServer.h"
+#include "Time.h"
 
 using namespace std;
 
@@ -33,7 +34,8 @@ extern "C" {
 OSCServer::OSCServer(const string &Port) :
 m_Port(Port),
 m_Exit(false),
-m_CommandRingBuffer(262144)
+m_CommandRingBuffer(262144),
+m_Record(NULL)
 {
         //cerr<<"Using port: ["<<Port<<"]"<<endl;
     m_Server = lo_server_thread_new(Port.c_str(), ErrorHandler);
@@ -43,6 +45,19 @@ m_CommandRingBuffer(262144)
 OSCServer::~OSCServer()
 {
         m_Exit=true;
+        if (m_Record!=NULL) fclose(m_Record);
+}
+
+bool OSCServer::Record(const string &filename)
+{
+        if (m_Record!=NULL) fclose(m_Record);
+        m_Record=fopen(filename.c_str(),"w");
+        if (m_Record==NULL)
+        {
+                cerr<<"couldn't open "<<filename<<" to record to"<<endl;
+                return false;
+        }
+        return true;
 }
 
 void OSCServer::Run()
@@ -135,6 +150,26 @@ int OSCServer::DefaultHandler(const char *path, const char *types, lo_arg **argv
                 {
                         //cerr<<"OSCServer - ringbuffer full!"<<endl;
                 }
+
+                if (server->m_Record!=NULL)
+                {
+                        // one command per line, tab separated: arrival time
+                        // seconds and fraction, path, types then the arguments
+                        spiralcore::Time now;
+                        now.SetToNow();
+                        fprintf(server->m_Record,"%u\t%u\t%s\t%s",now.Seconds,now.Fraction,path,types);
+                        for (int i=0; i<argc; i++)
+                        {
+                                switch (types[i])
+                                {
+                                        case LO_INT32: fprintf(server->m_Record,"\t%d",argv[i]->i); break;
+                                        case LO_FLOAT: fprintf(server->m_Record,"\t%.9g",argv[i]->f); break;
+                                        case LO_STRING: fprintf(server->m_Record,"\t%s",&argv[i]->s); break;
+                                }
+                        }
+                        fprintf(server->m_Record,"\n");
+                        fflush(server->m_Record);
+                }
         }
         else
         {
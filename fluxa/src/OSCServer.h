@@ -16,6 +16,7 @@
 
 #include <string>
 #include <lo/lo.h>
+#include <cstdio>
 #include "CommandRingBuffer.h"
 
 using namespace std;
@@ -28,6 +29,10 @@ public:
 	
 	void Run();
 	bool Get(CommandRingBuffer::Command& command) { return m_CommandRingBuffer.Get(command);}
+	CommandRingBuffer *GetCommands() { return &m_CommandRingBuffer; }
+	// writes all the commands received to a file, with the time 
+	// they arrived, for rendering later with fluxa -render
+	bool Record(const string &filename);
 	
 private:
 	static int DefaultHandler(const char *path, const char *types, lo_arg **argv, int argc, void *data, void *user_data);
@@ -37,4 +42,5 @@ private:
 	string m_Port;
 	bool m_Exit;
 	CommandRingBuffer m_CommandRingBuffer; 
+	FILE *m_Record;
 };
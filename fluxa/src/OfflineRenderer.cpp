@@ -0,0 +1,434 @@
+// Copyright (C) 2011 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sndfile.h>
+#include "OfflineRenderer.h"
+
+using namespace spiralcore;
+
+// allocations are counted while rendering, to check none happen
+// in what would be the audio threads. only the rendering thread and
+// the workers are counted, so the graph can still make its spare nodes
+static volatile bool s_Counting=false;
+static volatile unsigned int s_Allocations=0;
+
+static inline void CountAllocation()
+{
+	if (s_Counting && WorkerPool::IsAudioThread()) __sync_fetch_and_add(&s_Allocations,1);
+}
+
+void *operator new(size_t size)
+{
+	CountAllocation();
+	void *mem=malloc(size?size:1);
+	if (mem==NULL) throw std::bad_alloc();
+	return mem;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *mem) throw()
+{
+	if (mem!=NULL) CountAllocation();
+	free(mem);
+}
+
+void operator delete[](void *mem) throw()
+{
+	operator delete(mem);
+}
+
+static const unsigned int MAX_LINE=4096;
+// how many voices are timed for each patch
+static const unsigned int BENCHMARK_VOICES=32;
+static const float BENCHMARK_SECONDS=5;
+static const char *BENCHMARK_PATCHES[]={"sine","fm","moog"};
+static const unsigned int NUM_BENCHMARK_PATCHES=3;
+// microseconds to wait for the graph to make new nodes
+static const unsigned int RESET_WAIT=3000000;
+
+void OfflineRenderer::Stats::Add(double t, unsigned int allocations)
+{
+	m_Blocks++;
+	m_Allocations+=allocations;
+	m_Total+=t;
+	if (t>m_Worst) m_Worst=t;
+}
+
+OfflineRenderer::OfflineRenderer(unsigned int samplerate, unsigned int bufsize, unsigned int threads) :
+m_SampleRate(samplerate),
+m_BufSize(bufsize),
+m_Threads(threads),
+m_Commands(262144),
+m_Fluxa(&m_Commands,samplerate,bufsize,threads),
+m_NextID(0)
+{
+}
+
+bool OfflineRenderer::Load(const string &filename)
+{
+	FILE *file=fopen(filename.c_str(),"r");
+	if (file==NULL)
+	{
+		cerr<<"couldn't open "<<filename<<endl;
+		return false;
+	}
+
+	char line[MAX_LINE];
+	unsigned int linenum=0;
+	while (fgets(line,MAX_LINE,file)!=NULL)
+	{
+		linenum++;
+		line[strcspn(line,"\r\n")]='\0';
+
+		// tab separated: seconds, fraction, path, types then the arguments
+		vector<char*> fields;
+		char *pos=line;
+		fields.push_back(pos);
+		while ((pos=strchr(pos,'\t'))!=NULL)
+		{
+			*pos++='\0';
+			fields.push_back(pos);
+		}
+
+		if (fields.size()<4 || strlen(fields[2])>=256 || strlen(fields[3])>=64 || 
+		    fields.size()!=4+strlen(fields[3]))
+		{
+			cerr<<filename<<":"<<linenum<<": malformed command, skipping"<<endl;
+			continue;
+		}
+
+		const char *types=fields[3];
+		char data[COMMAND_DATA_SIZE];
+		unsigned int size=0;
+		bool ok=true;
+		for (unsigned int i=0; types[i]!='\0' && ok; i++)
+		{
+			const char *arg=fields[4+i];
+			switch (types[i])
+			{
+				case 'i':
+				case 'f':
+				{
+					if (size+4>COMMAND_DATA_SIZE) { ok=false; break; }
+					if (types[i]=='i')
+					{
+						int v=atoi(arg);
+						memcpy(data+size,&v,4);
+					}
+					else
+					{
+						float v=atof(arg);
+						memcpy(data+size,&v,4);
+					}
+					size+=4;
+				}
+				break;
+				case 's':
+				{
+					unsigned int len=strlen(arg)+1;
+					if (size+len>COMMAND_DATA_SIZE) { ok=false; break; }
+					memcpy(data+size,arg,len);
+					size+=len;
+				}
+				break;
+				default: ok=false; break;
+			}
+		}
+
+		if (!ok)
+		{
+			cerr<<filename<<":"<<linenum<<": can't read arguments, skipping"<<endl;
+			continue;
+		}
+
+		RecordedCommand command;
+		command.m_Time.Seconds=strtoul(fields[0],NULL,10);
+		command.m_Time.Fraction=strtoul(fields[1],NULL,10);
+		command.m_Command=CommandRingBuffer::Command(fields[2],types,data,size);
+		m_Recorded.push_back(command);
+	}
+
+	fclose(file);
+	cerr<<"loaded "<<m_Recorded.size()<<" commands from "<<filename<<endl;
+	return !m_Recorded.empty();
+}
+
+bool OfflineRenderer::Render(const string &filename, float tail)
+{
+	if (m_Recorded.empty())
+	{
+		cerr<<"no commands to render"<<endl;
+		return false;
+	}
+
+	SNDFILE *file=NULL;
+	if (filename!="")
+	{
+		SF_INFO info;
+		memset(&info,0,sizeof(info));
+		info.samplerate=m_SampleRate;
+		info.channels=2;
+		info.format=SF_FORMAT_WAV|SF_FORMAT_FLOAT;
+		file=sf_open(filename.c_str(),SFM_WRITE,&info);
+		if (file==NULL)
+		{
+			cerr<<"couldn't open "<<filename<<" to write to: "<<sf_strerror(NULL)<<endl;
+			return false;
+		}
+	}
+
+	// run on the recorded clock, so the timestamps on the 
+	// events mean the same as when they were recorded
+	m_Fluxa.SetTime(m_Recorded[0].m_Time);
+	Time end=m_Recorded[m_Recorded.size()-1].m_Time;
+	end+=tail;
+
+	vector<float> interleaved(m_BufSize*2);
+	Stats stats;
+	unsigned int next=0;
+	Time now=m_Fluxa.GetTime();
+	while (now<end)
+	{
+		// pass on the commands that would have arrived by now
+		while (next<m_Recorded.size() && m_Recorded[next].m_Time<=now)
+		{
+			CommandRingBuffer::Command &command=m_Recorded[next].m_Command;
+			// we are in charge of the clock
+			if (strcmp(command.Name,"/setclock") && !m_Commands.Send(command))
+			{
+				// full, so try again next block
+				break;
+			}
+			next++;
+		}
+
+		RenderBlock(stats);
+
+		if (file!=NULL)
+		{
+			const AudioType *left=m_Fluxa.GetLeft().GetBuffer();
+			const AudioType *right=m_Fluxa.GetRight().GetBuffer();
+			for (unsigned int n=0; n<m_BufSize; n++)
+			{
+				interleaved[n*2]=left[n];
+				interleaved[n*2+1]=right[n];
+			}
+			sf_writef_float(file,&interleaved[0],m_BufSize);
+		}
+
+		now=m_Fluxa.GetTime();
+	}
+
+	if (file!=NULL) sf_close(file);
+	PrintStats(stats);
+	return true;
+}
+
+void OfflineRenderer::Benchmark()
+{
+	cout<<"benchmarking "<<BENCHMARK_VOICES<<" voices, "<<m_BufSize<<" sample blocks at "
+		<<m_SampleRate<<"Hz on "<<m_Threads<<" thread"<<(m_Threads>1?"s":"")<<endl;
+
+	for (unsigned int patch=0; patch<NUM_BENCHMARK_PATCHES; patch++)
+	{
+		Stats empty,full,warmup;
+		SendInt("/maxsynths",BENCHMARK_VOICES);
+		Send("/reset","",NULL,0);
+		RenderSeconds(0.1,warmup);
+		RenderSeconds(BENCHMARK_SECONDS,empty);
+
+		for (unsigned int voice=0; voice<BENCHMARK_VOICES; voice++)
+		{
+			Play(BuildPatch(patch));
+			// keep the ringbuffer from filling up
+			RenderBlock(warmup);
+		}
+		// wait for them to start
+		RenderSeconds(0.2,warmup);
+		RenderSeconds(BENCHMARK_SECONDS,full);
+
+		double pervoice=(full.Mean()-empty.Mean())/BENCHMARK_VOICES;
+		double worstpervoice=(full.m_Worst-empty.Mean())/BENCHMARK_VOICES;
+		cout<<BENCHMARK_PATCHES[patch]<<":"<<endl;
+		PrintStats(full);
+		if (pervoice>0 && worstpervoice>0)
+		{
+			cout<<"  "<<pervoice*1000000<<"us per voice, "
+				<<(int)((BlockTime()-empty.Mean())/pervoice)<<" voices per block, "
+				<<(int)((BlockTime()-empty.Mean())/worstpervoice)<<" going by the worst block"<<endl;
+		}
+	}
+}
+
+bool OfflineRenderer::AllocationTest()
+{
+	cout<<"counting allocations while playing and resetting"<<endl;
+
+	Stats stats,warmup;
+	SendInt("/maxsynths",BENCHMARK_VOICES);
+	RenderBlock(warmup);
+
+	for (unsigned int patch=0; patch<NUM_BENCHMARK_PATCHES; patch++)
+	{
+		// give the graph time to make a spare, so 
+		// the reset swaps the nodes over
+		usleep(RESET_WAIT);
+		Send("/reset","",NULL,0);
+		for (unsigned int voice=0; voice<BENCHMARK_VOICES; voice++)
+		{
+			Play(BuildPatch(patch));
+			RenderBlock(stats);
+		}
+		RenderSeconds(1,stats);
+
+		// and straight away, before the spare is ready
+		Send("/reset","",NULL,0);
+		Play(BuildPatch(patch));
+		RenderSeconds(1,stats);
+	}
+
+	cout<<"  "<<stats.m_Allocations<<" allocations or frees in "<<stats.m_Blocks<<" blocks"<<endl;
+	return stats.m_Allocations==0;
+}
+
+void OfflineRenderer::RenderBlock(Stats &stats)
+{
+	timeval start,end;
+	WorkerPool::SetAudioThread(true);
+	s_Allocations=0;
+	s_Counting=true;
+	gettimeofday(&start,NULL);
+	m_Fluxa.Render(m_BufSize);
+	gettimeofday(&end,NULL);
+	s_Counting=false;
+	stats.Add((end.tv_sec-start.tv_sec)+(end.tv_usec-start.tv_usec)/1000000.0,s_Allocations);
+}
+
+void OfflineRenderer::RenderSeconds(float seconds, Stats &stats)
+{
+	unsigned int blocks=(unsigned int)(seconds*m_SampleRate/m_BufSize);
+	for (unsigned int n=0; n<blocks; n++) RenderBlock(stats);
+}
+
+void OfflineRenderer::PrintStats(const Stats &stats)
+{
+	double length=stats.m_Blocks*BlockTime();
+	cout<<"  rendered "<<length<<" seconds in "<<stats.m_Total<<" seconds ("
+		<<(stats.m_Total>0?length/stats.m_Total:0)<<"x realtime)"<<endl;
+	cout<<"  block time: mean "<<stats.Mean()*1000000<<"us, worst "<<stats.m_Worst*1000000
+		<<"us, of "<<BlockTime()*1000000<<"us ("<<100*stats.Mean()/BlockTime()<<"% load, worst "
+		<<100*stats.m_Worst/BlockTime()<<"%)"<<endl;
+	if (stats.m_Allocations>0)
+	{
+		cout<<"  "<<stats.m_Allocations<<" allocations or frees while rendering"<<endl;
+	}
+}
+
+//////////////////////////////////////////////////////
+
+void OfflineRenderer::Send(const char *name, const char *types, const char *data, unsigned int size)
+{
+	CommandRingBuffer::Command command(name,types,data,size);
+	if (!m_Commands.Send(command))
+	{
+		cerr<<"OfflineRenderer - ringbuffer full!"<<endl;
+	}
+}
+
+void OfflineRenderer::SendInt(const char *name, int value)
+{
+	Send(name,"i",(const char*)&value,4);
+}
+
+unsigned int OfflineRenderer::Terminal(float value)
+{
+	unsigned int id=++m_NextID;
+	int type=Graph::TERMINAL;
+	char data[12];
+	memcpy(data,&id,4);
+	memcpy(data+4,&type,4);
+	memcpy(data+8,&value,4);
+	Send("/create","iif",data,12);
+	return id;
+}
+
+unsigned int OfflineRenderer::Operator(Graph::Type type, unsigned int numargs, unsigned int a, 
+                                       unsigned int b, unsigned int c, unsigned int d)
+{
+	unsigned int id=++m_NextID;
+	int t=type;
+	char data[48];
+	memcpy(data,&id,4);
+	memcpy(data+4,&t,4);
+	Send("/create","ii",data,8);
+
+	unsigned int args[4]={a,b,c,d};
+	char types[13]="";
+	for (unsigned int n=0; n<numargs; n++)
+	{
+		memcpy(data+n*12,&id,4);
+		memcpy(data+n*12+4,&n,4);
+		memcpy(data+n*12+8,&args[n],4);
+		strcat(types,"iii");
+	}
+	Send("/connect",types,data,numargs*12);
+	return id;
+}
+
+unsigned int OfflineRenderer::BuildPatch(unsigned int patch)
+{
+	unsigned int env=Operator(Graph::ADSR,4,Terminal(0),Terminal(0.1),Terminal(1),Terminal(1));
+	unsigned int osc=0;
+	switch (patch)
+	{
+		case 0: // (sine 440)
+			osc=Operator(Graph::SINOSC,1,Terminal(440));
+		break;
+		case 1: // (sine (add 440 (mul (sine 220) 300)))
+			osc=Operator(Graph::SINOSC,1,
+				Operator(Graph::ADD,2,Terminal(440),
+					Operator(Graph::MUL,2,Operator(Graph::SINOSC,1,Terminal(220)),Terminal(300))));
+		break;
+		default: // (mooglp (saw 110) 0.3 0.4)
+			osc=Operator(Graph::MOOGLP,3,Operator(Graph::SAWOSC,1,Terminal(110)),Terminal(0.3),Terminal(0.4));
+		break;
+	}
+	return Operator(Graph::MUL,2,env,osc);
+}
+
+void OfflineRenderer::Play(unsigned int id)
+{
+	// no timestamp means play now
+	int secs=0, frac=0;
+	float pan=0;
+	char data[16];
+	memcpy(data,&secs,4);
+	memcpy(data+4,&frac,4);
+	memcpy(data+8,&id,4);
+	memcpy(data+12,&pan,4);
+	Send("/play","iiif",data,16);
+}
@@ -0,0 +1,92 @@
+// Copyright (C) 2011 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <string>
+#include <vector>
+#include "CommandRingBuffer.h"
+#include "Fluxa.h"
+
+#ifndef OFFLINE_RENDERER
+#define OFFLINE_RENDERER
+
+// runs fluxa without jack, as fast as it can go. plays back
+// commands recorded with fluxa -record to a wav file, or times
+// some stock patches to see how many voices fit in a block,
+// and checks that no memory is allocated while rendering.
+// the commands go through the same ringbuffer and event queue
+// as they do live, and timings are printed for each run.
+
+class OfflineRenderer
+{
+public:
+	OfflineRenderer(unsigned int samplerate, unsigned int bufsize, unsigned int threads);
+	~OfflineRenderer() {}
+
+	bool Load(const string &filename);
+	// renders the loaded commands, and tail seconds after 
+	// the last one, no wav is written if filename is empty
+	bool Render(const string &filename, float tail);
+	void Benchmark();
+	// plays and resets the benchmark patches, returns 
+	// false if rendering allocated or freed any memory
+	bool AllocationTest();
+
+private:
+	class RecordedCommand
+	{
+	public:
+		Time m_Time;
+		CommandRingBuffer::Command m_Command;
+	};
+
+	class Stats
+	{
+	public:
+		Stats() : m_Blocks(0), m_Total(0), m_Worst(0), m_Allocations(0) {}
+		void Add(double t, unsigned int allocations);
+		double Mean() const { return m_Blocks?m_Total/m_Blocks:0; }
+
+		unsigned int m_Blocks;
+		double m_Total;
+		double m_Worst;
+		unsigned int m_Allocations;
+	};
+
+	void RenderBlock(Stats &stats);
+	void RenderSeconds(float seconds, Stats &stats);
+	void PrintStats(const Stats &stats);
+	double BlockTime() { return m_BufSize/(double)m_SampleRate; }
+
+	// building patches for the benchmark, like fluxa.rkt does
+	void Send(const char *name, const char *types, const char *data, unsigned int size);
+	void SendInt(const char *name, int value);
+	unsigned int Terminal(float value);
+	unsigned int Operator(Graph::Type type, unsigned int numargs, unsigned int a, 
+	                      unsigned int b=0, unsigned int c=0, unsigned int d=0);
+	unsigned int BuildPatch(unsigned int patch);
+	void Play(unsigned int id);
+
+	unsigned int m_SampleRate;
+	unsigned int m_BufSize;
+	unsigned int m_Threads;
+	CommandRingBuffer m_Commands;
+	Fluxa m_Fluxa;
+	vector<RecordedCommand> m_Recorded;
+	unsigned int m_NextID;
+};
+
+#endif
@@ -14,6 +14,9 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#ifndef RING_BUFFER
+#define RING_BUFFER
+
 // ringbuffer for processing commands between asycronous threads, either may be
 // realtime and non blocking, so all code should be realtime capable
 
@@ -39,3 +42,5 @@ private:
 	unsigned int m_SizeMask;	
 	char *m_Buffer;	
 };
+
+#endif
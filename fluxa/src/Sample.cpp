@@ -17,6 +17,7 @@
 #include <string.h>
 #include "Types.h"
 #include "Sample.h"
+#include "DSP.h"
 #include <iostream>
 
 using namespace spiralcore;
@@ -155,34 +156,14 @@ void Sample::Mix(const Sample &S, unsigned int Pos)
 
 void Sample::MulMix(const Sample &S, float m)
 {
-	unsigned int ToPos=0;
-	
-	for (unsigned int FromPos=0; FromPos<S.GetLength(); FromPos++)
-	{
-		float t=S[FromPos]*m;
-	
-		m_Data[ToPos]=m_Data[ToPos]+t;
-		
-		if (ToPos>GetLength()) ToPos=0;
-		ToPos++;
-	}
+	unsigned int Length=S.GetLength()<GetLength()?S.GetLength():GetLength();
+	DSP::MulMix(m_Data,S.GetBuffer(),m,Length);
 }
 
 void Sample::MulClipMix(const Sample &S, float m)
 {
-	unsigned int ToPos=0;
-	
-	for (unsigned int FromPos=0; FromPos<S.GetLength(); FromPos++)
-	{
-		float t=S[FromPos]*m;
-		if (t>m) t=m;
-		else if (t<-m) t=-m;
-	
-		m_Data[ToPos]=m_Data[ToPos]+t;
-		
-		if (ToPos>GetLength()) ToPos=0;
-		ToPos++;
-	}
+	unsigned int Length=S.GetLength()<GetLength()?S.GetLength():GetLength();
+	DSP::MulClipMix(m_Data,S.GetBuffer(),m,Length);
 }
 
 void Sample::Remove(unsigned int Start, unsigned int End)
@@ -65,6 +65,8 @@ public:
 	void Reverse(unsigned int Start, unsigned int End);
 	void Move(unsigned int Dist);
 	void GetRegion(Sample &S, unsigned int Start, unsigned int End) const;
+	// the raw data, for inner loops that know they are in range
+	// and can't afford the wrapping done by operator[]
 	const AudioType *GetBuffer() const {return m_Data;}
 	AudioType *GetNonConstBuffer() {return m_Data;}
 	unsigned int GetLength() const {return m_Length;}
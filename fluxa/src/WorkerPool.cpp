@@ -0,0 +1,197 @@
+// Copyright (C) 2006 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <unistd.h>
+#include <sched.h>
+#include <assert.h>
+#include <iostream>
+#include "WorkerPool.h"
+#ifdef __APPLE__
+#include <mach/mach_init.h>
+#include <mach/task.h>
+#endif
+
+static const unsigned int JOB_BITS=16;
+static const unsigned int JOB_MASK=(1<<JOB_BITS)-1;
+
+__thread bool WorkerPool::s_AudioThread=false;
+
+WorkerPool::WorkerPool(unsigned int threads) :
+m_Exit(false),
+m_Job(NULL),
+m_Context(NULL),
+m_Count(0),
+m_Next(0),
+m_Done(0),
+m_Block(0)
+{
+#ifdef __APPLE__
+	semaphore_create(mach_task_self(),&m_Wake,SYNC_POLICY_FIFO,0);
+#else
+	sem_init(&m_Wake,0,0);
+#endif
+
+	for (unsigned int n=1; n<threads; n++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,WorkerLoop,this)!=0)
+		{
+			cerr<<"WorkerPool - couldn't start a thread, running with "<<n<<endl;
+			break;
+		}
+		m_Threads.push_back(thread);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	m_Exit=true;
+	for (unsigned int n=0; n<m_Threads.size(); n++) Signal();
+	for (vector<pthread_t>::iterator i=m_Threads.begin(); i!=m_Threads.end(); ++i)
+	{
+		pthread_join(*i,NULL);
+	}
+
+#ifdef __APPLE__
+	semaphore_destroy(mach_task_self(),m_Wake);
+#else
+	sem_destroy(&m_Wake);
+#endif
+}
+
+unsigned int WorkerPool::NumCPUs()
+{
+	long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus>0?cpus:1;
+}
+
+void WorkerPool::Run(Job job, void *context, unsigned int count)
+{
+	if (m_Threads.empty() || count<2)
+	{
+		for (unsigned int n=0; n<count; n++) job(context,n);
+		return;
+	}
+
+	assert(count<JOB_MASK);
+
+	// move the counter on to the new block first, with no jobs left 
+	// to take, so a thread still holding the last block's counter 
+	// can't take a job once the new count is in
+	m_Block=(m_Block+1)&((1<<(32-JOB_BITS))-1);
+	m_Next=(m_Block<<JOB_BITS)|JOB_MASK;
+	__sync_synchronize();
+
+	m_Job=job;
+	m_Context=context;
+	m_Count=count;
+	m_Done=0;
+	// make sure the job is seen before the counter opens
+	__sync_synchronize();
+	m_Next=m_Block<<JOB_BITS;
+
+	// no need to wake more threads than there are jobs to go round
+	unsigned int wake=count-1<m_Threads.size()?count-1:m_Threads.size();
+	for (unsigned int n=0; n<wake; n++) Signal();
+
+	Work();
+
+	// the last jobs are still running on the other threads, let 
+	// them have the cpu if there are more threads than cores
+	while (m_Done<count) sched_yield();
+	// and make sure we see what they wrote
+	__sync_synchronize();
+}
+
+void *WorkerPool::WorkerLoop(void *context)
+{
+	WorkerPool *pool=(WorkerPool*)context;
+	SetAudioThread(true);
+	while (true)
+	{
+		pool->Wait();
+		if (pool->m_Exit) break;
+		pool->Work();
+	}
+	return NULL;
+}
+
+void WorkerPool::SetPriority(int priority)
+{
+	sched_param param;
+	int policy=SCHED_OTHER;
+	param.sched_priority=0;
+	if (priority>=0)
+	{
+		policy=SCHED_FIFO;
+		param.sched_priority=priority;
+	}
+
+	for (vector<pthread_t>::iterator i=m_Threads.begin(); i!=m_Threads.end(); ++i)
+	{
+		if (pthread_setschedparam(*i,policy,&param)!=0)
+		{
+			cerr<<"WorkerPool - couldn't set the thread priority to "<<priority<<endl;
+			break;
+		}
+	}
+}
+
+void WorkerPool::Work()
+{
+	unsigned int next=m_Next;
+	unsigned int block=next>>JOB_BITS;
+	while (true)
+	{
+		unsigned int job=next&JOB_MASK;
+		// read the count before taking the job, it's checked 
+		// again by the swap failing if the block has moved on
+		__sync_synchronize();
+		if (job>=m_Count) return;
+
+		unsigned int seen=__sync_val_compare_and_swap(&m_Next,next,next+1);
+		if (seen==next)
+		{
+			m_Job(m_Context,job);
+			__sync_fetch_and_add(&m_Done,1);
+			next++;
+		}
+		else
+		{
+			// another thread got there first
+			if ((seen>>JOB_BITS)!=block) return;
+			next=seen;
+		}
+	}
+}
+
+void WorkerPool::Signal()
+{
+#ifdef __APPLE__
+	semaphore_signal(m_Wake);
+#else
+	sem_post(&m_Wake);
+#endif
+}
+
+void WorkerPool::Wait()
+{
+#ifdef __APPLE__
+	semaphore_wait(m_Wake);
+#else
+	while (sem_wait(&m_Wake)!=0) {}
+#endif
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2006 David Griffiths <dave@pawfal.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+#include <vector>
+#include <pthread.h>
+#ifdef __APPLE__
+#include <mach/semaphore.h>
+#else
+#include <semaphore.h>
+#endif
+
+using namespace std;
+
+#ifndef WORKER_POOL
+#define WORKER_POOL
+
+// a set of threads that sit waiting to help the audio thread out.
+// Run hands out the jobs by bumping a shared counter, without any
+// locks, and the calling thread takes jobs too, then waits for the
+// rest to finish. with one thread it all just runs in the caller
+
+class WorkerPool
+{
+public:
+	// threads includes the one calling Run
+	WorkerPool(unsigned int threads);
+	~WorkerPool();
+
+	typedef void (*Job)(void *context, unsigned int n);
+
+	// calls job for 0 to count-1 spread across the threads,
+	// returns when they are all done. jobs can run in any order
+	void Run(Job job, void *context, unsigned int count);
+	unsigned int GetNumThreads() const { return m_Threads.size()+1; }
+	// runs the workers with SCHED_FIFO at this priority, which should 
+	// be the audio thread's, or back to normal scheduling if it's -1
+	void SetPriority(int priority);
+
+	static unsigned int NumCPUs();
+
+	// marks the threads doing the audio, the workers mark themselves,
+	// the one calling Run has to be marked by whoever started it
+	static void SetAudioThread(bool s) { s_AudioThread=s; }
+	static bool IsAudioThread() { return s_AudioThread; }
+
+private:
+	static void *WorkerLoop(void *context);
+	void Work();
+	void Signal();
+	void Wait();
+
+	vector<pthread_t> m_Threads;
+#ifdef __APPLE__
+	semaphore_t m_Wake;
+#else
+	sem_t m_Wake;
+#endif
+	volatile bool m_Exit;
+
+	Job m_Job;
+	void *m_Context;
+	volatile unsigned int m_Count;
+	// the block number in the top half, the next job in the bottom, 
+	// so a thread waking late can't take a job from the next block
+	volatile unsigned int m_Next;
+	volatile unsigned int m_Done;
+	unsigned int m_Block;
+
+	static __thread bool s_AudioThread;
+};
+
+#endif
@@ -16,11 +16,23 @@
 
 #include <iostream>
 #include "Fluxa.h"
+#include "OSCServer.h"
 #include "JackClient.h"
+#include "OfflineRenderer.h"
+#include "WorkerPool.h"
+#include "DSP.h"
+
+// seconds to keep rendering after the last recorded command
+static const float RENDER_TAIL=2;
 
 void printusage()
 {
-	cerr<<"usage: fluxa [-osc oscportnumber] [-jackports leftport rightport]"<<endl;
+	cerr<<"usage: fluxa [-osc oscportnumber] [-jackports leftport rightport] [-record commandfile] [-threads count]"<<endl;
+	cerr<<"       fluxa -render commandfile wavfile [-samplerate rate] [-bufsize size] [-threads count]"<<endl;
+	cerr<<"       fluxa -bench [-samplerate rate] [-bufsize size] [-threads count]"<<endl;
+	cerr<<"       fluxa -alloctest [-samplerate rate] [-bufsize size] [-threads count]"<<endl;
+	cerr<<"       fluxa -dspbench [-bufsize size]"<<endl;
+	cerr<<"the voices are spread over one thread per cpu by default, -threads 1 turns that off"<<endl;
 	exit(-1);
 }
 
@@ -34,6 +46,15 @@ int main(int argc, char **argv)
 	string rightport("alsa_pcm:playback_2");
 #endif
 	string port("4004");
+	string record;
+	string commandfile;
+	string wavfile;
+	bool bench=false;
+	bool alloctest=false;
+	bool dspbench=false;
+	unsigned int samplerate=44100;
+	unsigned int bufsize=128;
+	unsigned int threads=WorkerPool::NumCPUs();
 
 	int arg=1;
 	while(arg<argc)
@@ -52,13 +73,67 @@ int main(int argc, char **argv)
 			}
 			else printusage();
 		}
+		if (!strcmp(argv[arg],"-record"))
+		{
+			if (arg+1 < argc) record=argv[arg+1];
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-render"))
+		{
+			if (arg+2 < argc)
+			{
+				commandfile=argv[arg+1];
+				wavfile=argv[arg+2];
+			}
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-bench")) bench=true;
+		if (!strcmp(argv[arg],"-alloctest")) alloctest=true;
+		if (!strcmp(argv[arg],"-dspbench")) dspbench=true;
+		if (!strcmp(argv[arg],"-samplerate"))
+		{
+			if (arg+1 < argc) samplerate=atoi(argv[arg+1]);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-bufsize"))
+		{
+			if (arg+1 < argc) bufsize=atoi(argv[arg+1]);
+			else printusage();
+		}
+		if (!strcmp(argv[arg],"-threads"))
+		{
+			if (arg+1 < argc) threads=atoi(argv[arg+1]);
+			else printusage();
+		}
 		arg++;
 	}
 
+	if (threads==0) printusage();
+
+	if (dspbench)
+	{
+		if (bufsize==0) printusage();
+		return DSP::Benchmark(bufsize)?0:-1;
+	}
+
+	if (bench || alloctest || commandfile!="")
+	{
+		if (samplerate==0 || bufsize==0) printusage();
+
+		// no jack or osc, just render as fast as possible
+		OfflineRenderer renderer(samplerate,bufsize,threads);
+		if (bench) renderer.Benchmark();
+		else if (alloctest) return renderer.AllocationTest()?0:-1;
+		else if (!renderer.Load(commandfile) || !renderer.Render(wavfile,RENDER_TAIL)) return -1;
+		return 0;
+	}
+
 	OSCServer server(port);
+	if (record!="") server.Record(record);
 	JackClient* jack=JackClient::Get();
 	jack->Attach("fluxa");
-	Fluxa engine(&server,jack,leftport,rightport);
+	Fluxa engine(server.GetCommands(),jack->GetSamplerate(),jack->GetBufferSize(),threads);
+	engine.Attach(jack,leftport,rightport);
 	server.Run();
 	return 0;
 }
@@ -0,0 +1,199 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+// times the dMatrix kernels against the plain scalar maths they
+// replace, and checks they give the same answers. it's not part of
+// the normal build, from this directory:
+//
+// g++ -O2 -I../src dada-bench.cpp ../src/dada.cpp -o dada-bench
+
+#include <stdio.h>
+#include <math.h>
+#include <sys/time.h>
+#include <vector>
+#include "dada.h"
+
+using namespace Fluxus;
+
+static const unsigned int COUNT=100000;
+static const unsigned int REPEATS=50;
+
+static double Now()
+{
+	timeval t;
+	gettimeofday(&t,NULL);
+	return t.tv_sec+t.tv_usec/1000000.0;
+}
+
+///////////////////////////////////////////////////////////
+// the scalar versions, as the code was before
+
+static void ScalarMul(const dMatrix &a, const dMatrix &b, dMatrix &t)
+{
+	for (int i=0; i<4; i++)
+	{
+		for (int j=0; j<4; j++)
+		{
+			t.m[i][j]=a.m[0][j]*b.m[i][0]+a.m[1][j]*b.m[i][1]+
+			          a.m[2][j]*b.m[i][2]+a.m[3][j]*b.m[i][3];
+		}
+	}
+}
+
+static void ScalarTransform(const dMatrix &a, const dVector *src, dVector *dst, unsigned int count)
+{
+	for (unsigned int i=0; i<count; i++)
+	{
+		const dVector &p=src[i];
+		dVector t;
+		t.x=p.x*a.m[0][0] + p.y*a.m[1][0] + p.z*a.m[2][0] + p.w*a.m[3][0];
+		t.y=p.x*a.m[0][1] + p.y*a.m[1][1] + p.z*a.m[2][1] + p.w*a.m[3][1];
+		t.z=p.x*a.m[0][2] + p.y*a.m[1][2] + p.z*a.m[2][2] + p.w*a.m[3][2];
+		t.w=p.x*a.m[0][3] + p.y*a.m[1][3] + p.z*a.m[2][3] + p.w*a.m[3][3];
+		dst[i]=t;
+	}
+}
+
+static void ScalarTransformNoTrans(const dMatrix &a, const dVector *src, dVector *dst, unsigned int count)
+{
+	for (unsigned int i=0; i<count; i++)
+	{
+		const dVector &p=src[i];
+		dVector t;
+		t.x=p.x*a.m[0][0] + p.y*a.m[1][0] + p.z*a.m[2][0];
+		t.y=p.x*a.m[0][1] + p.y*a.m[1][1] + p.z*a.m[2][1];
+		t.z=p.x*a.m[0][2] + p.y*a.m[1][2] + p.z*a.m[2][2];
+		t.w=p.w;
+		dst[i]=t;
+	}
+}
+
+static void ScalarTransformNormals(const dMatrix &a, const dVector *src, dVector *dst, unsigned int count)
+{
+	ScalarTransformNoTrans(a,src,dst,count);
+	for (unsigned int i=0; i<count; i++)
+	{
+		float mag=sqrt(dst[i].x*dst[i].x+dst[i].y*dst[i].y+dst[i].z*dst[i].z);
+		if (mag>0)
+		{
+			dst[i].x/=mag;
+			dst[i].y/=mag;
+			dst[i].z/=mag;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////
+
+static float Difference(const float *a, const float *b, unsigned int count)
+{
+	float largest=0;
+	for (unsigned int i=0; i<count; i++)
+	{
+		float d=fabs(a[i]-b[i]);
+		if (d>largest) largest=d;
+	}
+	return largest;
+}
+
+static void Report(const char *name, double scalar, double fast, float difference)
+{
+	// time per element
+	scalar=scalar*1000000000.0/(COUNT*REPEATS);
+	fast=fast*1000000000.0/(COUNT*REPEATS);
+	printf("  %s: scalar %gns, fast %gns (%gx), largest difference %g\n",
+	       name,scalar,fast,scalar/fast,difference);
+}
+
+int main()
+{
+	vector<dMatrix> matrices(COUNT);
+	vector<dVector> src(COUNT);
+	vector<dVector> scalar(COUNT);
+	vector<dVector> fast(COUNT);
+	vector<dMatrix> scalarm(COUNT);
+	vector<dMatrix> fastm(COUNT);
+
+	for (unsigned int i=0; i<COUNT; i++)
+	{
+		matrices[i].translate(RandRange(-10,10),RandRange(-10,10),RandRange(-10,10));
+		matrices[i].rotxyz(RandRange(0,360),RandRange(0,360),RandRange(0,360));
+		matrices[i].scale(RandRange(0.1,2),RandRange(0.1,2),RandRange(0.1,2));
+		src[i]=dVector(RandRange(-10,10),RandRange(-10,10),RandRange(-10,10),1);
+	}
+	const dMatrix &m=matrices[0];
+
+#ifdef __SSE__
+	printf("dMatrix kernels, with sse\n");
+#else
+	printf("dMatrix kernels, without sse\n");
+#endif
+
+	double t=Now();
+	for (unsigned int r=0; r<REPEATS; r++)
+		for (unsigned int i=0; i<COUNT; i++) ScalarMul(m,matrices[i],scalarm[i]);
+	double s=Now()-t;
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++)
+		for (unsigned int i=0; i<COUNT; i++) fastm[i]=m*matrices[i];
+	double f=Now()-t;
+	Report("multiply",s,f,Difference(scalarm[0].arr(),fastm[0].arr(),COUNT*16));
+
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++) ScalarTransform(m,&src[0],&scalar[0],COUNT);
+	s=Now()-t;
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++) m.transform(&src[0],&fast[0],COUNT);
+	f=Now()-t;
+	Report("transform array",s,f,Difference(scalar[0].arr(),fast[0].arr(),COUNT*4));
+
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++) ScalarTransformNoTrans(m,&src[0],&scalar[0],COUNT);
+	s=Now()-t;
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++) m.transform_no_trans(&src[0],&fast[0],COUNT);
+	f=Now()-t;
+	Report("transform_no_trans array",s,f,Difference(scalar[0].arr(),fast[0].arr(),COUNT*4));
+
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++) ScalarTransformNormals(m,&src[0],&scalar[0],COUNT);
+	s=Now()-t;
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++) m.transform_normals(&src[0],&fast[0],COUNT);
+	f=Now()-t;
+	Report("transform_normals array",s,f,Difference(scalar[0].arr(),fast[0].arr(),COUNT*4));
+
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++)
+		for (unsigned int i=0; i<COUNT; i++) scalarm[i]=matrices[i].inverse();
+	s=Now()-t;
+	t=Now();
+	for (unsigned int r=0; r<REPEATS; r++)
+		for (unsigned int i=0; i<COUNT; i++) fastm[i]=matrices[i].inverse_affine();
+	f=Now()-t;
+	// the general inverse loses it on some of these, so check 
+	// how far each matrix times its inverse is from the identity
+	float largest=0;
+	dMatrix identity;
+	for (unsigned int i=0; i<COUNT; i++)
+	{
+		dMatrix r=matrices[i]*fastm[i];
+		largest=max(largest,Difference(r.arr(),identity.arr(),16));
+	}
+	Report("inverse_affine",s,f,largest);
+
+	return 0;
+}
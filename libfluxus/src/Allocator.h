@@ -17,12 +17,14 @@
 #include <memory.h>
 #include <limits>
 #include <stdlib.h>
+#include <new>
+#include <memory>
 #include "dada.h"
 
 #ifndef FLUXUS_ALLOCATOR
 #define FLUXUS_ALLOCATOR
 
-#define FLX_ALLOC(T) std::allocator<T>
+#define FLX_ALLOC(T) Fluxus::aligned_allocator<T>
 //#define FLX_ALLOC(T) Fluxus::allocator<T>
 
 void alloc_hook(void *ptr, size_t n);
@@ -102,6 +104,67 @@ namespace Fluxus
         }
     };
 
+    /// Gives 16 byte aligned memory, so the pdata arrays of
+    /// vectors, colours and matrices can be loaded straight into
+    /// SSE registers. Used for all the pdata arrays, see FLX_ALLOC
+    template <class T>
+    class aligned_allocator : public std::allocator<T>
+    {
+    public:
+        typedef size_t size_type;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+
+        template <class U>
+        struct rebind
+        {
+            typedef aligned_allocator<U> other;
+        };
+
+        aligned_allocator() throw()
+        {
+        }
+
+        aligned_allocator(const aligned_allocator& a) throw() : std::allocator<T>(a)
+        {
+        }
+
+        template <class U>
+        aligned_allocator(const aligned_allocator<U>& u) throw()
+        {
+        }
+
+        ~aligned_allocator() throw()
+        {
+        }
+
+        pointer allocate(size_type n, const void *hint = 0)
+        {
+            void *ret=NULL;
+            if (posix_memalign(&ret,16,n*sizeof(T))!=0) throw std::bad_alloc();
+            return reinterpret_cast<pointer>(ret);
+        }
+
+        void deallocate(pointer p, size_type n)
+        {
+            free(p);
+        }
+    };
+
+template <class T1, class T2>
+inline
+bool operator==(const aligned_allocator<T1>& a1, const aligned_allocator<T2>& a2) throw()
+{
+    return true;
+}
+
+template <class T1, class T2>
+inline
+bool operator!=(const aligned_allocator<T1>& a1, const aligned_allocator<T2>& a2) throw()
+{
+    return false;
+}
+
 template <class T1, class T2>
 inline
 bool operator==(const allocator<T1>& a1, const allocator<T2>& a2) throw()
@@ -0,0 +1,356 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <algorithm>
+#include "BVH.h"
+
+using namespace Fluxus;
+
+// for sorting items along an axis by the centre of their boxes
+class CentreLess
+{
+public:
+	CentreLess(const vector<dVector> &centres, int axis) : m_Centres(centres), m_Axis(axis) {}
+	bool operator()(int a, int b) const
+	{
+		return m_Centres[a].arr()[m_Axis]<m_Centres[b].arr()[m_Axis];
+	}
+private:
+	const vector<dVector> &m_Centres;
+	int m_Axis;
+};
+
+static bool LineBox(const dVector &start, const dVector &dir, const dVector &min, const dVector &max, float &t)
+{
+	float tmin=0, tmax=1;
+	const float *s=start.arr(), *d=dir.arr(), *lo=min.arr(), *hi=max.arr();
+	for (int axis=0; axis<3; axis++)
+	{
+		if (fabs(d[axis])<1e-12)
+		{
+			// parallel to this slab, so it needs to start inside it
+			if (s[axis]<lo[axis] || s[axis]>hi[axis]) return false;
+		}
+		else
+		{
+			float t1=(lo[axis]-s[axis])/d[axis];
+			float t2=(hi[axis]-s[axis])/d[axis];
+			if (t1>t2) swap(t1,t2);
+			if (t1>tmin) tmin=t1;
+			if (t2<tmax) tmax=t2;
+			if (tmin>tmax) return false;
+		}
+	}
+	t=tmin;
+	return true;
+}
+
+BVH::BVH() :
+m_NumItems(0),
+m_RefitCount(0),
+m_BuildCost(0),
+m_Cost(0)
+{
+}
+
+BVH::~BVH()
+{
+}
+
+void BVH::Clear()
+{
+	m_Nodes.clear();
+	m_ItemNodes.clear();
+	m_NumItems=0;
+	m_RefitCount=0;
+	m_BuildCost=m_Cost=0;
+}
+
+void BVH::Build(const vector<int> &items, const vector<dBoundingBox> &boxes)
+{
+	Clear();
+	if (items.empty()) return;
+
+	vector<dVector> centres(boxes.size());
+	for (unsigned int i=0; i<boxes.size(); i++)
+	{
+		centres[i]=(boxes[i].min+boxes[i].max)*0.5f;
+	}
+
+	m_ItemNodes.resize(boxes.size(),-1);
+	m_Nodes.reserve(items.size()*2);
+	m_NumItems=items.size();
+
+	vector<int> work(items);
+	BuildNode(&work[0],work.size(),-1,boxes,centres);
+	m_BuildCost=m_Cost=CalculateCost();
+}
+
+int BVH::BuildNode(int *items, int count, int parent, const vector<dBoundingBox> &boxes, 
+                   const vector<dVector> &centres)
+{
+	int index=m_Nodes.size();
+	m_Nodes.push_back(Node());
+
+	Node node;
+	node.Parent=parent;
+
+	if (count==1)
+	{
+		node.Min=boxes[items[0]].min;
+		node.Max=boxes[items[0]].max;
+		node.Left=node.Right=-1;
+		node.Item=items[0];
+		m_ItemNodes[items[0]]=index;
+	}
+	else
+	{
+		// split at the median along the axis the centres are most spread out on
+		dVector cmin=centres[items[0]], cmax=centres[items[0]];
+		for (int i=1; i<count; i++)
+		{
+			const dVector &c=centres[items[i]];
+			cmin.x=min(cmin.x,c.x); cmin.y=min(cmin.y,c.y); cmin.z=min(cmin.z,c.z);
+			cmax.x=max(cmax.x,c.x); cmax.y=max(cmax.y,c.y); cmax.z=max(cmax.z,c.z);
+		}
+		dVector extent=cmax-cmin;
+		int axis=0;
+		if (extent.y>extent.x) axis=1;
+		if (extent.z>extent.arr()[axis]) axis=2;
+
+		int mid=count/2;
+		nth_element(items,items+mid,items+count,CentreLess(centres,axis));
+
+		node.Item=-1;
+		node.Left=BuildNode(items,mid,index,boxes,centres);
+		node.Right=BuildNode(items+mid,count-mid,index,boxes,centres);
+
+		const Node &l=m_Nodes[node.Left], &r=m_Nodes[node.Right];
+		node.Min=dVector(min(l.Min.x,r.Min.x),min(l.Min.y,r.Min.y),min(l.Min.z,r.Min.z));
+		node.Max=dVector(max(l.Max.x,r.Max.x),max(l.Max.y,r.Max.y),max(l.Max.z,r.Max.z));
+	}
+
+	m_Nodes[index]=node;
+	return index;
+}
+
+void BVH::Refit(int item, const dBoundingBox &box)
+{
+	if (item<0 || item>=(int)m_ItemNodes.size() || m_ItemNodes[item]==-1) return;
+
+	int index=m_ItemNodes[item];
+	m_Nodes[index].Min=box.min;
+	m_Nodes[index].Max=box.max;
+	m_RefitCount++;
+
+	// update the parents until one doesn't change
+	index=m_Nodes[index].Parent;
+	while (index!=-1)
+	{
+		Node &node=m_Nodes[index];
+		const Node &l=m_Nodes[node.Left], &r=m_Nodes[node.Right];
+		dVector nmin(min(l.Min.x,r.Min.x),min(l.Min.y,r.Min.y),min(l.Min.z,r.Min.z));
+		dVector nmax(max(l.Max.x,r.Max.x),max(l.Max.y,r.Max.y),max(l.Max.z,r.Max.z));
+		if (nmin.x==node.Min.x && nmin.y==node.Min.y && nmin.z==node.Min.z &&
+			nmax.x==node.Max.x && nmax.y==node.Max.y && nmax.z==node.Max.z)
+		{
+			break;
+		}
+		node.Min=nmin;
+		node.Max=nmax;
+		index=node.Parent;
+	}
+}
+
+void BVH::RefitAll(const vector<dBoundingBox> &boxes)
+{
+	// children are always after their parents, so going 
+	// backwards does the whole tree in one pass
+	for (int index=m_Nodes.size()-1; index>=0; index--)
+	{
+		Node &node=m_Nodes[index];
+		if (node.Item!=-1)
+		{
+			node.Min=boxes[node.Item].min;
+			node.Max=boxes[node.Item].max;
+		}
+		else
+		{
+			const Node &l=m_Nodes[node.Left], &r=m_Nodes[node.Right];
+			node.Min=dVector(min(l.Min.x,r.Min.x),min(l.Min.y,r.Min.y),min(l.Min.z,r.Min.z));
+			node.Max=dVector(max(l.Max.x,r.Max.x),max(l.Max.y,r.Max.y),max(l.Max.z,r.Max.z));
+		}
+	}
+	m_Cost=CalculateCost();
+}
+
+float BVH::CalculateCost() const
+{
+	float cost=0;
+	for (vector<Node>::const_iterator i=m_Nodes.begin(); i!=m_Nodes.end(); ++i)
+	{
+		if (i->Item!=-1) continue;
+		dVector size=i->Max-i->Min;
+		cost+=size.x*size.y+size.y*size.z+size.z*size.x;
+	}
+	return cost;
+}
+
+void BVH::CollectItems(int index, vector<int> &result) const
+{
+	vector<int> stack;
+	stack.push_back(index);
+	while (!stack.empty())
+	{
+		const Node &node=m_Nodes[stack.back()];
+		stack.pop_back();
+		if (node.Item!=-1) result.push_back(node.Item);
+		else
+		{
+			stack.push_back(node.Left);
+			stack.push_back(node.Right);
+		}
+	}
+}
+
+void BVH::FrustumQuery(const dPlane *planes, unsigned int numplanes, vector<int> &result) const
+{
+	if (m_Nodes.empty()) return;
+
+	// each entry carries a bitmask of the planes we still need
+	// to check, once a box is completely in front of a plane 
+	// its children don't need testing against it
+	unsigned int all=(1<<numplanes)-1;
+	vector<pair<int,unsigned int> > stack;
+	stack.push_back(pair<int,unsigned int>(0,all));
+	while (!stack.empty())
+	{
+		int index=stack.back().first;
+		unsigned int mask=stack.back().second;
+		stack.pop_back();
+		const Node &node=m_Nodes[index];
+
+		bool outside=false;
+		for (unsigned int p=0; p<numplanes && !outside; p++)
+		{
+			if (!(mask&(1<<p))) continue;
+			const dPlane &plane=planes[p];
+
+			// the corners furthest along and furthest against the plane normal
+			dVector pos(plane.a>0?node.Max.x:node.Min.x, plane.b>0?node.Max.y:node.Min.y, plane.c>0?node.Max.z:node.Min.z);
+			dVector neg(plane.a>0?node.Min.x:node.Max.x, plane.b>0?node.Min.y:node.Max.y, plane.c>0?node.Min.z:node.Max.z);
+			if (plane.pointdistance(pos)<=0) outside=true;
+			else if (plane.pointdistance(neg)>0) mask&=~(1<<p);
+		}
+
+		if (outside) continue;
+
+		if (mask==0) CollectItems(index,result);
+		else if (node.Item!=-1) result.push_back(node.Item);
+		else
+		{
+			stack.push_back(pair<int,unsigned int>(node.Left,mask));
+			stack.push_back(pair<int,unsigned int>(node.Right,mask));
+		}
+	}
+}
+
+void BVH::BoxQuery(const dBoundingBox &box, vector<int> &result) const
+{
+	if (m_Nodes.empty()) return;
+
+	vector<int> stack;
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		const Node &node=m_Nodes[stack.back()];
+		stack.pop_back();
+		if (node.Max.x<box.min.x || node.Min.x>box.max.x ||
+			node.Max.y<box.min.y || node.Min.y>box.max.y ||
+			node.Max.z<box.min.z || node.Min.z>box.max.z)
+		{
+			continue;
+		}
+
+		if (node.Item!=-1) result.push_back(node.Item);
+		else
+		{
+			stack.push_back(node.Left);
+			stack.push_back(node.Right);
+		}
+	}
+}
+
+void BVH::SphereQuery(const dVector &centre, float radius, vector<int> &result) const
+{
+	if (m_Nodes.empty()) return;
+
+	float radius2=radius*radius;
+	vector<int> stack;
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		const Node &node=m_Nodes[stack.back()];
+		stack.pop_back();
+
+		// squared distance from the centre to the closest point in the box
+		float dist=0;
+		for (int axis=0; axis<3; axis++)
+		{
+			float c=centre.arr()[axis];
+			float lo=node.Min.arr()[axis], hi=node.Max.arr()[axis];
+			if (c<lo) dist+=(lo-c)*(lo-c);
+			else if (c>hi) dist+=(c-hi)*(c-hi);
+		}
+		if (dist>radius2) continue;
+
+		if (node.Item!=-1) result.push_back(node.Item);
+		else
+		{
+			stack.push_back(node.Left);
+			stack.push_back(node.Right);
+		}
+	}
+}
+
+void BVH::LineQuery(const dVector &start, const dVector &end, vector<pair<float,int> > &result) const
+{
+	if (m_Nodes.empty()) return;
+
+	dVector dir=end-start;
+	unsigned int first=result.size();
+	vector<int> stack;
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		const Node &node=m_Nodes[stack.back()];
+		stack.pop_back();
+
+		float t;
+		if (!LineBox(start,dir,node.Min,node.Max,t)) continue;
+
+		if (node.Item!=-1) result.push_back(pair<float,int>(t,node.Item));
+		else
+		{
+			stack.push_back(node.Left);
+			stack.push_back(node.Right);
+		}
+	}
+
+	sort(result.begin()+first,result.end());
+}
+
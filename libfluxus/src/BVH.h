@@ -0,0 +1,192 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_BVH
+#define N_BVH
+
+#include <vector>
+#include <math.h>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// A bounding volume hierarchy, a binary tree of 
+/// boxes for quickly finding which of a set of items
+/// are inside a frustum, overlap a box or sphere, or
+/// are hit by a line. Items are ints (scene node IDs,
+/// triangle numbers...) each with their own box. 
+/// Moving items can be refitted in place, but the tree
+/// gets worse as they move, so it needs rebuilding now 
+/// and again.
+class BVH
+{
+public:
+	BVH();
+	~BVH();
+
+	/// Builds the tree for the items listed, the boxes
+	/// are indexed by item
+	void Build(const vector<int> &items, const vector<dBoundingBox> &boxes);
+	void Clear();
+
+	/// Changes the box of an item, and updates the
+	/// nodes above it. Items not in the tree are ignored
+	void Refit(int item, const dBoundingBox &box);
+
+	/// Changes the boxes of all the items at once, quicker
+	/// than refitting them one by one when most have moved
+	void RefitAll(const vector<dBoundingBox> &boxes);
+
+	/// True if the tree has been refitted enough since
+	/// it was built that it's probably worth rebuilding
+	bool NeedsRebuild() const { return m_RefitCount>m_NumItems*4 || m_Cost>m_BuildCost*2; }
+	bool Empty() const { return m_Nodes.empty(); }
+
+	///////////////////////////////////////////////
+	///@name Queries
+	/// These append the items found to the result
+	///@{
+	/// Items with boxes in front of all the planes (at least partially)
+	void FrustumQuery(const dPlane *planes, unsigned int numplanes, vector<int> &result) const;
+	void BoxQuery(const dBoundingBox &box, vector<int> &result) const;
+	void SphereQuery(const dVector &centre, float radius, vector<int> &result) const;
+	/// Items with boxes crossing the line, with the distance along 
+	/// the line (0 to 1) where it enters them, sorted nearest first
+	void LineQuery(const dVector &start, const dVector &end, vector<pair<float,int> > &result) const;
+	/// Finds the nearest item hit by the line, visiting the boxes 
+	/// nearest first and skipping any further away than the best 
+	/// hit so far. hit(item,t) is called for each item reached, and
+	/// should return true and set t if the item itself is hit closer
+	/// than t (0 to 1 along the line). Returns the nearest item, or 
+	/// -1 if there isn't one. Safe to call from more than one thread.
+	template<class T> int LineNearest(const dVector &start, const dVector &end, T &hit, float &t) const;
+	///@}
+
+private:
+	class Node
+	{
+	public:
+		dVector Min;
+		dVector Max;
+		int Left;
+		int Right;
+		int Parent;
+		int Item; // -1 for branches
+	};
+
+	int BuildNode(int *items, int count, int parent, const vector<dBoundingBox> &boxes, 
+	              const vector<dVector> &centres);
+	void CollectItems(int node, vector<int> &result) const;
+	/// Sum of the surface areas of the branches, which is 
+	/// roughly how much work a query will be
+	float CalculateCost() const;
+	/// Where a line with the inverse direction given enters a 
+	/// node, if it does before tmax
+	static bool LineNode(const dVector &start, const dVector &invdir, const Node &node, float tmax, float &t);
+
+	vector<Node> m_Nodes;
+	vector<int> m_ItemNodes; // node index for each item, -1 if it's not in the tree
+	unsigned int m_NumItems;
+	unsigned int m_RefitCount;
+	float m_BuildCost;
+	float m_Cost;
+};
+
+inline bool BVH::LineNode(const dVector &start, const dVector &invdir, const Node &node, float tmax, float &t)
+{
+	float tmin=0;
+	for (int axis=0; axis<3; axis++)
+	{
+		float t1=(node.Min.arr()[axis]-start.arr()[axis])*invdir.arr()[axis];
+		float t2=(node.Max.arr()[axis]-start.arr()[axis])*invdir.arr()[axis];
+		if (t1>t2) { float tmp=t1; t1=t2; t2=tmp; }
+		if (t1>tmin) tmin=t1;
+		if (t2<tmax) tmax=t2;
+		if (tmin>tmax) return false;
+	}
+	t=tmin;
+	return true;
+}
+
+template<class T> 
+int BVH::LineNearest(const dVector &start, const dVector &end, T &hit, float &t) const
+{
+	t=1;
+	if (m_Nodes.empty()) return -1;
+
+	// lines parallel to an axis get a huge rather than an 
+	// infinite inverse, so the slab tests don't make nans
+	dVector dir=end-start, invdir;
+	for (int axis=0; axis<3; axis++)
+	{
+		float d=dir.arr()[axis];
+		if (fabs(d)<1e-12) invdir.arr()[axis]=d<0?-1e30f:1e30f;
+		else invdir.arr()[axis]=1/d;
+	}
+
+	// the median split keeps the tree shallow, so the stack 
+	// is never more than one deeper than the tree
+	pair<int,float> stack[66];
+	int top=0;
+	float entry;
+	if (!LineNode(start,invdir,m_Nodes[0],t,entry)) return -1;
+	stack[top++]=pair<int,float>(0,entry);
+
+	int nearest=-1;
+	while (top>0)
+	{
+		top--;
+		if (stack[top].second>t) continue;
+		const Node &node=m_Nodes[stack[top].first];
+
+		if (node.Item!=-1)
+		{
+			if (hit(node.Item,t)) nearest=node.Item;
+			continue;
+		}
+
+		float tl,tr;
+		bool l=LineNode(start,invdir,m_Nodes[node.Left],t,tl);
+		bool r=LineNode(start,invdir,m_Nodes[node.Right],t,tr);
+		// push the nearest last, so it's looked at first
+		if (l && r)
+		{
+			if (tl<tr)
+			{
+				stack[top++]=pair<int,float>(node.Right,tr);
+				stack[top++]=pair<int,float>(node.Left,tl);
+			}
+			else
+			{
+				stack[top++]=pair<int,float>(node.Left,tl);
+				stack[top++]=pair<int,float>(node.Right,tr);
+			}
+		}
+		else if (l) stack[top++]=pair<int,float>(node.Left,tl);
+		else if (r) stack[top++]=pair<int,float>(node.Right,tr);
+	}
+
+	return nearest;
+}
+
+}
+
+#endif
@@ -17,12 +17,19 @@
 #include "Renderer.h"
 #include "BlobbyPrimitive.h"
 #include "State.h"
-#include "ImplicitSurface.h"
 
 using namespace Fluxus;
 
+// influences are only summed over the grid points where
+// they add more than this fraction of the isolevel
+static const float INFLUENCE_CUTOFF=0.0001f;
+
 BlobbyPrimitive::BlobbyPrimitive(int dimx, int dimy, int dimz, dVector size) :
-    m_LockVoxels(false)
+m_PointBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_NormalBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_ColourBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_IndexBuffer(GL_ELEMENT_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_LockVoxels(false)
 {
 	AddData("p",new TypedPData<dVector>);
 	AddData("c",new TypedPData<dColour>);
@@ -31,50 +38,17 @@ BlobbyPrimitive::BlobbyPrimitive(int dimx, int dimy, int dimz, dVector size) :
 	// setup the direct access for speed
 	PDataDirty();
 
-	float sx=size.x/(float)dimx;
-	float sy=size.y/(float)dimy;
-	float sz=size.z/(float)dimz;
-
-	m_Width = dimx;
-	m_Height = dimy;
-	m_Depth = dimz;
-
-	for (int x=0; x<dimx; x++)
-	{
-		for (int y=0; y<dimy; y++)
-		{
-			for (int z=0; z<dimz; z++)
-			{
-				Cell cell;
-
-				cell.p[0]=dVector(sx*x,sy*y+sy,sz*z);
-				cell.p[1]=dVector(sx*x,sy*y+sy,sz*z+sz);
-				cell.p[2]=dVector(sx*x,sy*y,sz*z+sz);
-				cell.p[3]=dVector(sx*x,sy*y,sz*z);
-
-				cell.p[4]=dVector(sx*x+sx,sy*y+sy,sz*z);
-				cell.p[5]=dVector(sx*x+sx,sy*y+sy,sz*z+sz);
-				cell.p[6]=dVector(sx*x+sx,sy*y,sz*z+sz);
-				cell.p[7]=dVector(sx*x+sx,sy*y,sz*z);
-
-				cell.val[0]=0;
-				cell.val[1]=0;
-				cell.val[2]=0;
-				cell.val[3]=0;
-				cell.val[4]=0;
-				cell.val[5]=0;
-				cell.val[6]=0;
-				cell.val[7]=0;
-
-				m_Voxels.push_back(cell);
-			}
-		}
-	}
+	m_Field.Init(dimx,dimy,dimz,size);
 }
 
 BlobbyPrimitive::BlobbyPrimitive(const BlobbyPrimitive &other) :
 Primitive(other),
-m_Voxels(other.m_Voxels)
+m_Field(other.m_Field),
+m_PointBuffer(other.m_PointBuffer),
+m_NormalBuffer(other.m_NormalBuffer),
+m_ColourBuffer(other.m_ColourBuffer),
+m_IndexBuffer(other.m_IndexBuffer),
+m_LockVoxels(other.m_LockVoxels)
 {
 	PDataDirty();
 }
@@ -103,65 +77,41 @@ void BlobbyPrimitive::AddInfluence(const dVector &Vert, float Strength)
 	m_ColData->push_back(dColour(1,1,1)); 
 }	
 
-float BlobbyPrimitive::Sample(const dVector &pos)
+void BlobbyPrimitive::UpdateField(float isolevel, bool colour)
 {
-	float val=0;
-	for (unsigned int n=0; n<m_PosData->size(); n++)
+	if (!m_LockVoxels)
 	{
-		float distance=fabs((*m_PosData)[n].distsq(pos));
-		if (distance>0)
-		{
-			val+=(*m_StrengthData)[n]*(1/distance);
-		}
+		m_Field.Evaluate(*m_PosData,*m_StrengthData,colour?m_ColData:NULL,
+		                 fabs(isolevel)*INFLUENCE_CUTOFF);
 	}
-	return val;
 }
 
-float BlobbyPrimitive::SampleCol(const dVector &pos, dColour &col)
+void BlobbyPrimitive::Render()
 {
-	float val=0;
-	col=dColour(0,0,0);
+	bool colour=m_State.Hints & HINT_VERTCOLS;
+	UpdateField(1,colour);
+	m_Field.Polygonise(1,colour);
 	
-	for (unsigned int n=0; n<m_PosData->size(); n++)
+	const vector<dVector> &points=m_Field.GetPoints();
+	const vector<unsigned int> &indices=m_Field.GetIndices();
+	if (indices.empty()) return;
+
+	// the mesh is remade every frame, so the whole thing is streamed 
+	unsigned int size=points.size()*sizeof(dVector);
+	m_PointBuffer.Update(&points[0],size,0,size);
+	m_NormalBuffer.Update(&m_Field.GetNormals()[0],size,0,size);
+	if (colour)
 	{
-		float distance=fabs((*m_PosData)[n].distsq(pos));
-		if (distance>0)
-		{
-			float mul=1/distance;
-			val+=(*m_StrengthData)[n]*mul;
-			
-			//col+=(*m_ColData)[n]*mul;
-
-			col.r+=(*m_ColData)[n].r*mul;
-			col.g+=(*m_ColData)[n].g*mul;
-			col.b+=(*m_ColData)[n].b*mul;
-		}
-	}		
-	return val;	
-}
-
-void BlobbyPrimitive::Render()
-{
+		size=m_Field.GetMeshColours().size()*sizeof(dColour);
+		m_ColourBuffer.Update(&m_Field.GetMeshColours()[0],size,0,size);
+	}
+	size=indices.size()*sizeof(unsigned int);
+	m_IndexBuffer.Update(&indices[0],size,0,size);
 
-    if (!m_LockVoxels)
-    {
-        for (unsigned int i=0; i<m_Voxels.size(); i++)
-        {
-            for (int c=0; c<8; c++)
-            {
-                dVector pos = m_Voxels[i].p[c];
-                
-                if (m_State.Hints & HINT_VERTCOLS)
-                {
-                    m_Voxels[i].val[c]=SampleCol(pos,m_Voxels[i].col[c]);
-                }
-                else
-                {
-                    m_Voxels[i].val[c]=Sample(pos);
-                }
-            }
-        }
-    }
+	glVertexPointer(3,GL_FLOAT,sizeof(dVector),m_PointBuffer.Bind(points[0].arr()));
+	glNormalPointer(GL_FLOAT,sizeof(dVector),m_NormalBuffer.Bind(m_Field.GetNormals()[0].arr()));
+	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	const void *index=m_IndexBuffer.Bind(&indices[0]);
 
 	if (m_State.Hints & HINT_SPHERE_MAP)
 	{
@@ -173,9 +123,13 @@ void BlobbyPrimitive::Render()
 
 	if (m_State.Hints & HINT_SOLID)
 	{
-		glBegin(GL_TRIANGLES);
-		Draw(1, true, m_State.Hints & HINT_VERTCOLS);
-		glEnd();
+		if (colour)
+		{
+			glEnableClientState(GL_COLOR_ARRAY);
+			glColorPointer(4,GL_FLOAT,sizeof(dColour),m_ColourBuffer.Bind(m_Field.GetMeshColours()[0].arr()));
+		}
+		glDrawElements(GL_TRIANGLES,indices.size(),GL_UNSIGNED_INT,index);
+		glDisableClientState(GL_COLOR_ARRAY);
 	}
 
 	if (m_State.Hints & HINT_WIRE)
@@ -189,9 +143,7 @@ void BlobbyPrimitive::Render()
 			glEnable(GL_LINE_STIPPLE);
 			glLineStipple(m_State.StippleFactor, m_State.StipplePattern);
 		}
-		glBegin(GL_TRIANGLES);
-		Draw(1, false, false);
-		glEnd();
+		glDrawElements(GL_TRIANGLES,indices.size(),GL_UNSIGNED_INT,index);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 		glEnable(GL_LIGHTING);
 		if ((m_State.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
@@ -205,6 +157,9 @@ void BlobbyPrimitive::Render()
 		glDisable(GL_TEXTURE_GEN_S);
 		glDisable(GL_TEXTURE_GEN_T);
 	}
+	
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	VertexBuffer::Unbind();
 }
 
 void BlobbyPrimitive::RecalculateNormals(bool smooth)
@@ -224,305 +179,31 @@ dBoundingBox BlobbyPrimitive::GetBoundingBox(const dMatrix &space)
 
 void BlobbyPrimitive::ApplyTransform(bool ScaleRotOnly)
 {
-	if (!ScaleRotOnly)
+	if (!m_PosData->empty())
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_PosData->begin(); i!=m_PosData->end(); ++i)
-		{
-			*i=GetState()->Transform.transform(*i);
-			// why not normals?
-		}
-	}
-	else
-	{
-		for (unsigned int i=0; i<m_PosData->size(); i++)
-		{
-			(*m_PosData)[i]=GetState()->Transform.transform_no_trans((*m_PosData)[i]);
-		}
+		dVector *data=&(*m_PosData)[0];
+		// why not normals?
+		if (!ScaleRotOnly) GetState()->Transform.transform(data,data,m_PosData->size());
+		else GetState()->Transform.transform_no_trans(data,data,m_PosData->size());
 	}
 	
 	GetState()->Transform.init();
 }
 
-// this implicit surface implementation is modified from Paul Bourke's which can be found here:
-// http://astronomy.swin.edu.au/~pbourke/modelling/polygonise/
-
-void BlobbyPrimitive::Draw(float isolevel, bool calcnormals, bool colour)
-{
-   int i;
-   int cubeindex;
-   dVertex vertlist[12];
-
-	for (unsigned int cell=0; cell<m_Voxels.size(); cell++)
-	{ 
-		//  Determine the index into the edge table which
-		//  tells us which vertices are inside of the surface
-		cubeindex = 0;
-		if (m_Voxels[cell].val[0] < isolevel) cubeindex |= 1;
-		if (m_Voxels[cell].val[1] < isolevel) cubeindex |= 2;
-		if (m_Voxels[cell].val[2] < isolevel) cubeindex |= 4;
-		if (m_Voxels[cell].val[3] < isolevel) cubeindex |= 8;
-		if (m_Voxels[cell].val[4] < isolevel) cubeindex |= 16;
-		if (m_Voxels[cell].val[5] < isolevel) cubeindex |= 32;
-		if (m_Voxels[cell].val[6] < isolevel) cubeindex |= 64;
-		if (m_Voxels[cell].val[7] < isolevel) cubeindex |= 128;
-
-		// Cube is entirely in/out of the surface 
-		if (ImplicitSurfaceEdges[cubeindex] != 0)
-		{
-
-			// Find the vertices where the surface intersects the cube
-			if (ImplicitSurfaceEdges[cubeindex] & 1) Interpolate(vertlist[0],isolevel,cell,0,1);
-			if (ImplicitSurfaceEdges[cubeindex] & 2) Interpolate(vertlist[1],isolevel,cell,1,2);
-			if (ImplicitSurfaceEdges[cubeindex] & 4) Interpolate(vertlist[2],isolevel,cell,2,3);
-			if (ImplicitSurfaceEdges[cubeindex] & 8) Interpolate(vertlist[3],isolevel,cell,3,0);
-			if (ImplicitSurfaceEdges[cubeindex] & 16) Interpolate(vertlist[4],isolevel,cell,4,5);
-			if (ImplicitSurfaceEdges[cubeindex] & 32) Interpolate(vertlist[5],isolevel,cell,5,6);
-			if (ImplicitSurfaceEdges[cubeindex] & 64) Interpolate(vertlist[6],isolevel,cell,6,7);
-			if (ImplicitSurfaceEdges[cubeindex] & 128) Interpolate(vertlist[7],isolevel,cell,7,4);
-			if (ImplicitSurfaceEdges[cubeindex] & 256) Interpolate(vertlist[8],isolevel,cell,0,4);
-			if (ImplicitSurfaceEdges[cubeindex] & 512) Interpolate(vertlist[9],isolevel,cell,1,5);
-			if (ImplicitSurfaceEdges[cubeindex] & 1024) Interpolate(vertlist[10],isolevel,cell,2,6);
-			if (ImplicitSurfaceEdges[cubeindex] & 2048) Interpolate(vertlist[11],isolevel,cell,3,7);
-
-			// Create the triangle 
-			for (i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i+=3) 
-			{
-				dVertex a=vertlist[ImplicitSurfaceTriangles[cubeindex][i]];
-				dVertex b=vertlist[ImplicitSurfaceTriangles[cubeindex][i+1]];
-				dVertex c=vertlist[ImplicitSurfaceTriangles[cubeindex][i+2]];
-			
-				dVector normal;
-				float val=0;
-				
-				if (calcnormals)
-   				{
-					val=Sample(a.point);
-					normal.x=val-Sample(a.point+dVector(0.001,0,0));
-					normal.y=val-Sample(a.point+dVector(0,0.001,0));
-					normal.z=val-Sample(a.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
-				if (colour) glColor3fv(a.col.arr());
-   				glVertex3fv(a.point.arr());
-				
-				if (calcnormals)
-   				{
-					val=Sample(b.point);
-					normal.x=val-Sample(b.point+dVector(0.001,0,0));
-					normal.y=val-Sample(b.point+dVector(0,0.001,0));
-					normal.z=val-Sample(b.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
- 				if (colour) glColor3fv(b.col.arr());
-				glVertex3fv(b.point.arr());
-				
-				if (calcnormals)
-   				{
-					val=Sample(c.point);
-					normal.x=val-Sample(c.point+dVector(0.001,0,0));
-					normal.y=val-Sample(c.point+dVector(0,0.001,0));
-					normal.z=val-Sample(c.point+dVector(0,0,0.001));
-					normal.normalise();
-					glNormal3fv(normal.arr());
-				}
-				
-				if (colour) glColor3fv(c.col.arr());
-				glVertex3fv(c.point.arr());
-			}
-		}
-	}
-}
-
 // generate a poly mesh
 void BlobbyPrimitive::ConvertToPoly(PolyPrimitive &poly, float isolevel)
 {
-	if (!m_LockVoxels)
-	{
-		// evaluate the field
-		for (unsigned int i=0; i<m_Voxels.size(); i++)
-		{
-			for (int c=0; c<8; c++)
-			{
-				dVector pos = m_Voxels[i].p[c];
-
-				if (m_State.Hints & HINT_VERTCOLS)
-				{
-					m_Voxels[i].val[c]=SampleCol(pos,m_Voxels[i].col[c]);
-				}
-				else
-				{
-					m_Voxels[i].val[c]=Sample(pos);
-				}
-			}
-		}
-	}
-
-	int i;
-	int cubeindex;
-	dVertex vertlist[12];
-	dVector grads[12]; // gradient calculated from field values
-
-	for (unsigned int cell=0; cell<m_Voxels.size(); cell++)
-	{
-		//  Determine the index into the edge table which
-		//  tells us which vertices are inside of the surface
-		cubeindex = 0;
-		if (m_Voxels[cell].val[0] < isolevel) cubeindex |= 1;
-		if (m_Voxels[cell].val[1] < isolevel) cubeindex |= 2;
-		if (m_Voxels[cell].val[2] < isolevel) cubeindex |= 4;
-		if (m_Voxels[cell].val[3] < isolevel) cubeindex |= 8;
-		if (m_Voxels[cell].val[4] < isolevel) cubeindex |= 16;
-		if (m_Voxels[cell].val[5] < isolevel) cubeindex |= 32;
-		if (m_Voxels[cell].val[6] < isolevel) cubeindex |= 64;
-		if (m_Voxels[cell].val[7] < isolevel) cubeindex |= 128;
-
-		// Cube is entirely in/out of the surface
-		if (ImplicitSurfaceEdges[cubeindex] != 0)
-		{
-			// Find the vertices where the surface intersects the cube
-			if (ImplicitSurfaceEdges[cubeindex] & 1) Interpolate(vertlist[0], grads[0], isolevel, cell, 0, 1);
-			if (ImplicitSurfaceEdges[cubeindex] & 2) Interpolate(vertlist[1], grads[1], isolevel, cell, 1, 2);
-			if (ImplicitSurfaceEdges[cubeindex] & 4) Interpolate(vertlist[2], grads[2], isolevel, cell, 2, 3);
-			if (ImplicitSurfaceEdges[cubeindex] & 8) Interpolate(vertlist[3], grads[3], isolevel, cell, 3, 0);
-			if (ImplicitSurfaceEdges[cubeindex] & 16) Interpolate(vertlist[4], grads[4], isolevel, cell, 4, 5);
-			if (ImplicitSurfaceEdges[cubeindex] & 32) Interpolate(vertlist[5], grads[5], isolevel, cell, 5, 6);
-			if (ImplicitSurfaceEdges[cubeindex] & 64) Interpolate(vertlist[6], grads[6], isolevel, cell, 6, 7);
-			if (ImplicitSurfaceEdges[cubeindex] & 128) Interpolate(vertlist[7], grads[7], isolevel, cell, 7, 4);
-			if (ImplicitSurfaceEdges[cubeindex] & 256) Interpolate(vertlist[8], grads[8], isolevel, cell, 0, 4);
-			if (ImplicitSurfaceEdges[cubeindex] & 512) Interpolate(vertlist[9], grads[9], isolevel, cell, 1, 5);
-			if (ImplicitSurfaceEdges[cubeindex] & 1024) Interpolate(vertlist[10], grads[10], isolevel, cell, 2, 6);
-			if (ImplicitSurfaceEdges[cubeindex] & 2048) Interpolate(vertlist[11], grads[11], isolevel, cell, 3, 7);
-
-			// Create the triangle
-			for (i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i+=3)
-			{
-				int idxa = ImplicitSurfaceTriangles[cubeindex][i];
-				int idxb = ImplicitSurfaceTriangles[cubeindex][i + 1];
-				int idxc = ImplicitSurfaceTriangles[cubeindex][i + 2];
-				dVertex a=vertlist[idxa];
-				dVertex b=vertlist[idxb];
-				dVertex c=vertlist[idxc];
-
-				dVector normal;
-				float val=0;
-
-				if (m_LockVoxels) // when converted from voxels use the cell gradient
-				{
-					normal = grads[idxa];
-				}
-				else
-				{
-					val=Sample(a.point);
-					normal.x=val-Sample(a.point+dVector(0.001,0,0));
-					normal.y=val-Sample(a.point+dVector(0,0.001,0));
-					normal.z=val-Sample(a.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(a.point,normal,a.col));
-
-				if (m_LockVoxels)
-				{
-					normal = grads[idxb];
-				}
-				else
-				{
-					val=Sample(b.point);
-					normal.x=val-Sample(b.point+dVector(0.001,0,0));
-					normal.y=val-Sample(b.point+dVector(0,0.001,0));
-					normal.z=val-Sample(b.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(b.point,normal,b.col));
-
-				if (m_LockVoxels)
-				{
-					normal = grads[idxc];
-				}
-				else
-				{
-					val=Sample(c.point);
-					normal.x=val-Sample(c.point+dVector(0.001,0,0));
-					normal.y=val-Sample(c.point+dVector(0,0.001,0));
-					normal.z=val-Sample(c.point+dVector(0,0,0.001));
-					normal.normalise();
-				}
-
-				poly.AddVertex(dVertex(c.point,normal,c.col));
-			}
-		}
-	}
-}
-
-//   Linearly interpolate the position where an isosurface cuts
-//   an edge between two vertices, each with their own scalar value
-void BlobbyPrimitive::Interpolate(dVertex &vert, float isolevel, int cell, int a, int b)
-{
-	float mu;
-
-	dVector posa = m_Voxels[cell].p[a];
-	dVector posb = m_Voxels[cell].p[b];
-	dColour cola = m_Voxels[cell].col[a];
-	dColour colb = m_Voxels[cell].col[b];
-	float vala = m_Voxels[cell].val[a];
-	float valb = m_Voxels[cell].val[b];
-
-	mu = (isolevel - vala) / (valb - vala);
-	vert.point.x = posa.x + mu * (posb.x - posa.x);
-	vert.point.y = posa.y + mu * (posb.y - posa.y);
-	vert.point.z = posa.z + mu * (posb.z - posa.z);
-
-	vert.col.r = cola.r + mu * (colb.r - cola.r);
-	vert.col.g = cola.g + mu * (colb.g - cola.g);
-	vert.col.b = cola.b + mu * (colb.b - cola.b);
-}
-
-inline float BlobbyPrimitive::SafeVal(int cell, int a)
-{
-	if ((cell >= 0) && ((unsigned)cell < m_Voxels.size()))
+	bool colour=(m_State.Hints & HINT_VERTCOLS) || m_LockVoxels;
+	UpdateField(isolevel,colour);
+	m_Field.Polygonise(isolevel,colour);
+
+	// the poly gets a plain triangle list, as before
+	const vector<dVector> &points=m_Field.GetPoints();
+	const vector<dVector> &normals=m_Field.GetNormals();
+	const vector<dColour> &colours=m_Field.GetMeshColours();
+	const vector<unsigned int> &indices=m_Field.GetIndices();
+	for (vector<unsigned int>::const_iterator i=indices.begin(); i!=indices.end(); ++i)
 	{
-		return m_Voxels[cell].val[a];
+		poly.AddVertex(dVertex(points[*i],normals[*i],colour?colours[*i]:dColour(0,0,0)));
 	}
-	else
-	{
-		return 0;
-	}
-}
-
-// Same as above, but also calculate the gradient
-void BlobbyPrimitive::Interpolate(dVertex &vert, dVector &grad, float isolevel, int cell, int a, int b)
-{
-	float mu;
-
-	dVector posa = m_Voxels[cell].p[a];
-	dVector posb = m_Voxels[cell].p[b];
-	dColour cola = m_Voxels[cell].col[a];
-	dColour colb = m_Voxels[cell].col[b];
-	float vala = m_Voxels[cell].val[a];
-	float valb = m_Voxels[cell].val[b];
-
-	dVector grada(SafeVal(cell - m_Depth * m_Height, a) - SafeVal(cell + m_Depth * m_Height, a),
-				  SafeVal(cell - m_Depth, a) - SafeVal(cell + m_Depth, a),
-				  SafeVal(cell - 1, a) - SafeVal(cell + 1, a));
-	dVector gradb(SafeVal(cell - m_Depth * m_Height, b) - SafeVal(cell + m_Depth * m_Height, b),
-				  SafeVal(cell - m_Depth, b) - SafeVal(cell + m_Depth, b),
-				  SafeVal(cell - 1, b) - SafeVal(cell + 1, b));
-
-	mu = (isolevel - vala) / (valb - vala);
-	vert.point.x = posa.x + mu * (posb.x - posa.x);
-	vert.point.y = posa.y + mu * (posb.y - posa.y);
-	vert.point.z = posa.z + mu * (posb.z - posa.z);
-
-	vert.col.r = cola.r + mu * (colb.r - cola.r);
-	vert.col.g = cola.g + mu * (colb.g - cola.g);
-	vert.col.b = cola.b + mu * (colb.b - cola.b);
-
-	grad = lerp(grada, gradb, mu);
-	grad.normalise();
 }
-
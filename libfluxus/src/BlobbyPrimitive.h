@@ -21,6 +21,8 @@
 
 #include "Primitive.h"
 #include "PolyPrimitive.h"
+#include "IsoSurface.h"
+#include "VertexBuffer.h"
 
 namespace Fluxus
 {
@@ -59,26 +61,17 @@ public:
 	/// (needs to be an empty triangle list)
 	void ConvertToPoly(PolyPrimitive &poly, float isolevel=1.0f);
 
-	class Cell
-	{
-	public:
-		dVector p[8];
-		float val[8];
-		dColour col[8];
-	};
-
-	vector<Cell> &GetVoxels() { return m_Voxels; }
+	/// The field the surface is made from, the values and colours
+	/// can be set directly if LockVoxels() is called to stop them 
+	/// being overwritten by the influences
+	IsoSurface &GetField() { return m_Field; }
 
     void LockVoxels() { m_LockVoxels=true; }
 
 protected:
 
-	void Draw(float isolevel, bool calcnormals, bool colour);
-	void Interpolate(dVertex &vert, float isolevel, int cell, int a, int b);
-	void Interpolate(dVertex &vert, dVector &grad, float isolevel, int cell, int a, int b);
-	float Sample(const dVector &pos);
-	float SampleCol(const dVector &pos, dColour &col);
-	inline float SafeVal(int cell, int a);
+	/// Sums the influences into the field, unless it's locked
+	void UpdateField(float isolevel, bool colour);
 
 	virtual void PDataDirty();
 
@@ -86,10 +79,11 @@ protected:
 	vector<float,FLX_ALLOC(float) > *m_StrengthData;
 	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
 
-	vector<Cell> m_Voxels;
-	unsigned m_Width;
-	unsigned m_Height;
-	unsigned m_Depth;
+	IsoSurface m_Field;
+	VertexBuffer m_PointBuffer;
+	VertexBuffer m_NormalBuffer;
+	VertexBuffer m_ColourBuffer;
+	VertexBuffer m_IndexBuffer;
 
     bool m_LockVoxels;
 };
@@ -28,7 +28,9 @@ DepthSorter::~DepthSorter()
 
 void DepthSorter::Clear()
 {
+	// keeps the memory for next time
 	m_RenderList.clear();
+	m_Depths.clear();
 }
 
 void DepthSorter::Add(const dMatrix &globaltransform, Primitive *prim, int id)
@@ -40,16 +42,17 @@ void DepthSorter::Add(const dMatrix &globaltransform, Primitive *prim, int id)
 
 	dMatrix all=globaltransform*prim->GetState()->Transform;
 	dVector pos=all.transform(dVector(0,0,0));
-	item.Depth=pos.z;
 	m_RenderList.push_back(item);
+	m_Depths.push_back(pos.z);
 }
 
 void DepthSorter::Render()
 {
-	m_RenderList.sort();
+	const vector<unsigned int> &order=m_Sorter.Sort(m_Depths);
 
-	for(list<Item>::iterator i=m_RenderList.begin(); i!=m_RenderList.end(); i++)
+	for (vector<unsigned int>::const_iterator n=order.begin(); n!=order.end(); ++n)
 	{
+		Item *i=&m_RenderList[*n];
 		glPushMatrix();
 		glPushName(i->ID);
 		glLoadIdentity();
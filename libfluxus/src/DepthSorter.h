@@ -25,7 +25,7 @@
 #define N_DEPTHSORTER
 
 #include "Primitive.h"
-#include <list>
+#include "RadixSort.h"
 
 namespace Fluxus
 {
@@ -56,16 +56,12 @@ private:
 	public:
 		Primitive *Prim;
 		dMatrix GlobalTransform;
-		float Depth;
 		int ID;
-		
-		bool operator<(const Item &other) const
-		{
-			return Depth<other.Depth;
-		}
 	};
 
-	list<Item> m_RenderList;
+	vector<Item> m_RenderList;
+	vector<float> m_Depths;
+	RadixSort m_Sorter;
 };
 
 };
@@ -97,6 +97,8 @@ public:
 	void SetFloatAttrib(const string &name, const vector<float,FLX_ALLOC(float) > &s);
 	void SetVectorAttrib(const string &name, const vector<dVector,FLX_ALLOC(dVector) > &s);
 	void SetColourAttrib(const string &name, const vector<dColour,FLX_ALLOC(dColour) > &s);
+	/// Returns -1 if the shader has no attribute of this name
+	int GetAttribLocation(const string &name);
 	///@}
 
 	static bool m_Enabled;
@@ -104,11 +104,61 @@ void GenSkinWeightsPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 	}
 
 
+	// keep the biggest few weights for each vertex as well, 
+	// so skinning doesn't have to blend in every bone
+	TypedPData<dColour> *skinbones = new TypedPData<dColour>(prim.Size());
+	TypedPData<dColour> *skinweights = new TypedPData<dColour>(prim.Size());
+	for (unsigned int n=0; n<prim.Size(); n++)
+	{
+		int top[MAX_INFLUENCES];
+		float topweight[MAX_INFLUENCES];
+		unsigned int count=0;
+		for (unsigned int bone=0; bone<weights.size(); bone++)
+		{
+			float w=weights[bone]->m_Data[n];
+			if (!(w>0)) continue;
+			// insert in order, dropping the smallest
+			unsigned int pos=count<MAX_INFLUENCES?count++:MAX_INFLUENCES;
+			while (pos>0 && topweight[pos-1]<w)
+			{
+				if (pos<MAX_INFLUENCES)
+				{
+					top[pos]=top[pos-1];
+					topweight[pos]=topweight[pos-1];
+				}
+				pos--;
+			}
+			if (pos<MAX_INFLUENCES)
+			{
+				top[pos]=bone;
+				topweight[pos]=w;
+			}
+		}
+
+		float total=0;
+		for (unsigned int i=0; i<count; i++) total+=topweight[i];
+		for (unsigned int i=0; i<MAX_INFLUENCES; i++)
+		{
+			skinbones->m_Data[n].arr()[i]=i<count?top[i]:0;
+			skinweights->m_Data[n].arr()[i]=i<count?topweight[i]/total:0;
+		}
+	}
+
 	// finally, add the weights to the primitive
 	for (unsigned int bone=0; bone<weights.size(); bone++)
 	{
 		char wname[256];
 		snprintf(wname,256,"w%d",bone);
-		prim.AddData(wname, weights[bone]);
+		ReplaceData(prim, wname, weights[bone]);
 	}
+	ReplaceData(prim, "skinbones", skinbones);
+	ReplaceData(prim, "skinweights", skinweights);
+}
+
+void GenSkinWeightsPrimFunc::ReplaceData(Primitive &prim, const string &name, PData *pd)
+{
+	char type;
+	unsigned int size;
+	if (prim.GetDataInfo(name,type,size)) prim.RemoveDataVec(name);
+	prim.AddData(name,pd);
 }
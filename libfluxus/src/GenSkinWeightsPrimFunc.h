@@ -28,6 +28,9 @@ namespace Fluxus
 
 //////////////////////////////////////////////////
 /// A primitive function for generating skin weights
+/// Generates a "w<n>" float pdata array of weights for each bone, 
+/// and also the strongest MAX_INFLUENCES bones for each vertex in
+/// "skinbones", with their weights normalised in "skinweights"
 class GenSkinWeightsPrimFunc : public PrimitiveFunction
 {
 public:
@@ -36,8 +39,12 @@ public:
 
 	virtual void Run(Primitive &prim, const SceneGraph &world);
 
+	/// Bones kept per vertex, the number of channels in a colour
+	static const unsigned int MAX_INFLUENCES=4;
+
 private:
-	
+	/// Adds the pdata, replacing any from a previous run
+	static void ReplaceData(Primitive &prim, const string &name, PData *pd);
 };
 
 
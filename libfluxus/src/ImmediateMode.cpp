@@ -31,6 +31,31 @@ void ImmediateMode::Add(Primitive *p, State *s, bool del /* = false */)
 {
 	assert(p!=NULL);
 	assert(s!=NULL);
+
+	if (!del && !m_IMRecord.empty())
+	{
+		IMItem *last = m_IMRecord.back();
+		// batches from AddInstances without colours can't take on 
+		// one with a new colour, so they are left alone
+		bool batchable = last->m_Transforms.empty() || !last->m_Colours.empty();
+
+		if (batchable && last->m_Primitive==p && !last->m_DelPrim && 
+			!(s->Hints & HINT_CAST_SHADOW) && last->m_State.CanInstance(*s))
+		{
+			if (last->m_Transforms.empty())
+			{
+				// turn the last item into an instance batch
+				last->m_Transforms.push_back(last->m_State.Transform);
+				last->m_Colours.push_back(InstanceColour(last->m_State,last->m_State.Colour));
+				last->m_State.Transform.init();
+			}
+			
+			last->m_Transforms.push_back(s->Transform);
+			last->m_Colours.push_back(InstanceColour(*s,s->Colour));
+			return;
+		}
+	}
+
 	IMItem *newitem = new IMItem;
 	newitem->m_State = *s;
 	newitem->m_Primitive = p;
@@ -38,6 +63,41 @@ void ImmediateMode::Add(Primitive *p, State *s, bool del /* = false */)
 	m_IMRecord.push_back(newitem);
 }
 
+void ImmediateMode::AddInstances(Primitive *p, State *s, const vector<dMatrix> &transforms, 
+                                 const vector<dColour> &colours)
+{
+	assert(p!=NULL);
+	assert(s!=NULL);
+	assert(colours.empty() || colours.size()==transforms.size());
+	if (transforms.empty()) return;
+
+	IMItem *newitem = new IMItem;
+	newitem->m_State = *s;
+	newitem->m_Primitive = p;
+	newitem->m_DelPrim = false;
+	newitem->m_State.Transform.init();
+
+	newitem->m_Transforms.reserve(transforms.size());
+	for (vector<dMatrix>::const_iterator i=transforms.begin(); i!=transforms.end(); ++i)
+	{
+		newitem->m_Transforms.push_back(s->Transform*(*i));
+	}
+
+	newitem->m_Colours.reserve(colours.size());
+	for (vector<dColour>::const_iterator i=colours.begin(); i!=colours.end(); ++i)
+	{
+		newitem->m_Colours.push_back(InstanceColour(*s,*i));
+	}
+
+	m_IMRecord.push_back(newitem);
+}
+
+dColour ImmediateMode::InstanceColour(const State &s, dColour c)
+{
+	if (s.Opacity != 1.0f) c.a=s.Opacity;
+	return c;
+}
+
 void ImmediateMode::Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen)
 {
 	///\todo: not using camera visibility in immediate mode...
@@ -50,11 +110,32 @@ void ImmediateMode::Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen)
 		assert((*i)->m_Primitive!=NULL);
 	    (*i)->m_Primitive->SetState(&(*i)->m_State);
 		(*i)->m_Primitive->Prerender();
-		(*i)->m_Primitive->Render();
+		if ((*i)->m_Transforms.empty())
+		{
+			(*i)->m_Primitive->Render();
+		}
+		else
+		{
+			(*i)->m_Primitive->RenderInstances((*i)->m_Transforms,(*i)->m_Colours);
+		}
 
 		if (shadowgen && (*i)->m_Primitive->GetState()->Hints & HINT_CAST_SHADOW)
 		{
-			shadowgen->Generate((*i)->m_Primitive);
+			if ((*i)->m_Transforms.empty())
+			{
+				shadowgen->Generate((*i)->m_Primitive);
+			}
+			else
+			{
+				// the shadow generator works from the primitive's transform
+				dMatrix &transform = (*i)->m_Primitive->GetState()->Transform;
+				for (vector<dMatrix>::iterator t=(*i)->m_Transforms.begin(); t!=(*i)->m_Transforms.end(); ++t)
+				{
+					transform=*t;
+					shadowgen->Generate((*i)->m_Primitive);
+				}
+				transform.init();
+			}
 		}
 		(*i)->m_State.Unapply();
 		glPopMatrix();
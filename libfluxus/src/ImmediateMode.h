@@ -36,7 +36,14 @@ public:
 	ImmediateMode();
 	~ImmediateMode();
 
+	/// Consecutive adds of the same primitive with states 
+	/// which only differ by transform and colour are grouped
+	/// together and drawn as instances
 	void Add(Primitive *p, State *s, bool del = false);
+	/// Adds a batch of instances of a primitive, the transforms
+	/// are relative to the state's transform, colours are optional
+	void AddInstances(Primitive *p, State *s, const vector<dMatrix> &transforms, 
+	                  const vector<dColour> &colours);
 	void Render(unsigned int CamIndex, ShadowVolumeGen *shadowgen = NULL);
 	void Clear();
 
@@ -46,7 +53,15 @@ private:
 		State m_State;
 		Primitive *m_Primitive;
 		bool m_DelPrim; // delete primitive on clear
+		// if not empty, the primitive is drawn once for each of 
+		// these (in world space) rather than with the state transform
+		vector<dMatrix> m_Transforms;
+		vector<dColour> m_Colours;
 	};
+
+	/// Turns the colour into the one the state would apply
+	dColour InstanceColour(const State &s, dColour c);
+
 	vector<IMItem*> m_IMRecord;
 };
 
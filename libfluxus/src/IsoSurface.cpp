@@ -0,0 +1,350 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <math.h>
+#include <algorithm>
+#include "IsoSurface.h"
+#include "ImplicitSurface.h"
+#include "JobPool.h"
+
+using namespace Fluxus;
+
+// the grid offsets of the cell corners, in the 
+// order the marching cubes tables use them
+static const int CornerOffset[8][3]=
+{
+	{0,1,0}, {0,1,1}, {0,0,1}, {0,0,0},
+	{1,1,0}, {1,1,1}, {1,0,1}, {1,0,0}
+};
+
+// the corners at either end of each cell edge
+static const int EdgeCorners[12][2]=
+{
+	{0,1}, {1,2}, {2,3}, {3,0}, 
+	{4,5}, {5,6}, {6,7}, {7,4},
+	{0,4}, {1,5}, {2,6}, {3,7}
+};
+
+struct IsoJob
+{
+	IsoSurface *Surface;
+	unsigned int Start,End,Slab;
+};
+
+IsoSurface::IsoSurface() :
+m_Width(0),
+m_Height(0),
+m_Depth(0),
+m_InfluencePositions(NULL),
+m_InfluenceStrengths(NULL),
+m_InfluenceColours(NULL),
+m_Cutoff(0),
+m_IsoLevel(1),
+m_UseColour(false)
+{
+}
+
+void IsoSurface::Init(unsigned int w, unsigned int h, unsigned int d, const dVector &size)
+{
+	m_Width=w;
+	m_Height=h;
+	m_Depth=d;
+	m_CellSize=dVector(size.x/(float)w,size.y/(float)h,size.z/(float)d);
+	
+	unsigned int points=(w+1)*(h+1)*(d+1);
+	m_Values.assign(points,0);
+	m_Colours.assign(points,dColour(0,0,0));
+}
+
+unsigned int IsoSurface::RunSlabs(void *(*func)(void *), unsigned int size)
+{
+	unsigned int numthreads=JobPool::Get()->GetNumThreads();
+	if (m_Values.size()<THREADED_SIZE) numthreads=1;
+	if (numthreads>size) numthreads=size;
+	if (numthreads<1) return 0;
+	
+	if (m_Slabs.size()<numthreads) m_Slabs.resize(numthreads);
+	
+	IsoJob jobs[JobPool::MAX_THREADS];
+	unsigned int slice=size/numthreads;
+	for (unsigned int t=0; t<numthreads; t++)
+	{
+		jobs[t].Surface=this;
+		jobs[t].Start=t*slice;
+		jobs[t].End=t==numthreads-1?size:(t+1)*slice;
+		jobs[t].Slab=t;
+	}
+	
+	JobPool::Get()->RunEach(func,jobs,numthreads);
+	return numthreads;
+}
+
+////////////////////////////////////////////////////////////////////////
+
+void IsoSurface::Evaluate(const vector<dVector,FLX_ALLOC(dVector) > &positions, 
+                          const vector<float,FLX_ALLOC(float) > &strengths,
+                          const vector<dColour,FLX_ALLOC(dColour) > *colours, float cutoff)
+{
+	m_InfluencePositions=&positions;
+	m_InfluenceStrengths=&strengths;
+	m_InfluenceColours=colours;
+	m_Cutoff=cutoff;
+	RunSlabs(EvaluateThread,m_Width+1);
+	m_InfluencePositions=NULL;
+	m_InfluenceStrengths=NULL;
+	m_InfluenceColours=NULL;
+}
+
+void *IsoSurface::EvaluateThread(void *data)
+{
+	IsoJob *job=(IsoJob*)data;
+	job->Surface->EvaluateSlab(job->Start,job->End);
+	return NULL;
+}
+
+// finds the grid coordinates within the radius, clamped to the 
+// range given, hi is less than lo if there are none
+static inline void GridRange(float centre, float radius, float cellsize, 
+                             unsigned int start, unsigned int end, int &lo, int &hi)
+{
+	float l=ceilf((centre-radius)/cellsize);
+	float h=floorf((centre+radius)/cellsize);
+	// clamp as floats, as the radius can be huge
+	l=max((float)start,min((float)end,l));
+	h=max((float)start-1,min((float)end-1,h));
+	lo=(int)l;
+	hi=(int)h;
+}
+
+void IsoSurface::EvaluateSlab(unsigned int start, unsigned int end)
+{
+	// clear this slab
+	unsigned int first=Index(start,0,0);
+	unsigned int last=Index(end,0,0);
+	for (unsigned int i=first; i<last; i++) m_Values[i]=0;
+	if (m_InfluenceColours)
+	{
+		for (unsigned int i=first; i<last; i++) m_Colours[i]=dColour(0,0,0);
+	}
+	
+	// add in each influence, over the points close enough to it
+	for (unsigned int n=0; n<m_InfluencePositions->size(); n++)
+	{
+		const dVector &pos=(*m_InfluencePositions)[n];
+		float strength=(*m_InfluenceStrengths)[n];
+		float radius=sqrtf(fabs(strength)/m_Cutoff);
+		
+		int x0,x1,y0,y1,z0,z1;
+		GridRange(pos.x,radius,m_CellSize.x,start,end,x0,x1);
+		GridRange(pos.y,radius,m_CellSize.y,0,m_Height+1,y0,y1);
+		GridRange(pos.z,radius,m_CellSize.z,0,m_Depth+1,z0,z1);
+		
+		for (int x=x0; x<=x1; x++)
+		{
+			float dx=x*m_CellSize.x-pos.x;
+			for (int y=y0; y<=y1; y++)
+			{
+				float dy=y*m_CellSize.y-pos.y;
+				float dxy=dx*dx+dy*dy;
+				unsigned int i=Index(x,y,z0);
+				for (int z=z0; z<=z1; z++, i++)
+				{
+					float dz=z*m_CellSize.z-pos.z;
+					float distance=dxy+dz*dz;
+					if (distance>0)
+					{
+						float mul=1/distance;
+						m_Values[i]+=strength*mul;
+						if (m_InfluenceColours)
+						{
+							const dColour &c=(*m_InfluenceColours)[n];
+							m_Colours[i].r+=c.r*mul;
+							m_Colours[i].g+=c.g*mul;
+							m_Colours[i].b+=c.b*mul;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+
+void IsoSurface::Polygonise(float isolevel, bool colour)
+{
+	m_IsoLevel=isolevel;
+	m_UseColour=colour;
+	
+	m_Points.clear();
+	m_Normals.clear();
+	m_MeshColours.clear();
+	m_Indices.clear();
+	if (m_Width==0 || m_Height==0 || m_Depth==0) return;
+	
+	for (vector<Mesh>::iterator i=m_Slabs.begin(); i!=m_Slabs.end(); ++i)
+	{
+		i->Points.clear();
+		i->Normals.clear();
+		i->Colours.clear();
+		i->Indices.clear();
+	}
+	
+	unsigned int numslabs=RunSlabs(PolygoniseThread,m_Width);
+	
+	// stitch the slabs together, the vertices on the faces between
+	// slabs are made by both, so the later ones are swapped for the 
+	// earlier ones to keep the mesh joined up, and left out, so the
+	// mesh is the same however many slabs there were
+	const unsigned int unmapped=(unsigned int)-1;
+	unsigned int layer=(m_Height+1)*(m_Depth+1);
+	vector<unsigned int> remap;
+	vector<unsigned int> lastremap;
+	for (unsigned int n=0; n<numslabs; n++)
+	{
+		const Mesh &mesh=m_Slabs[n];
+		remap.assign(mesh.Points.size(),unmapped);
+		
+		if (n>0)
+		{
+			const Mesh &last=m_Slabs[n-1];
+			unsigned int face=last.EdgeCache.size()/(layer*3)-1;
+			for (unsigned int i=0; i<layer; i++)
+			{
+				// only the y and z edges lie in the face
+				for (unsigned int axis=1; axis<3; axis++)
+				{
+					int v=mesh.EdgeCache[i*3+axis];
+					int lastv=last.EdgeCache[(face*layer+i)*3+axis];
+					if (v!=-1 && lastv!=-1) remap[v]=lastremap[lastv];
+				}
+			}
+		}
+		
+		for (unsigned int i=0; i<remap.size(); i++)
+		{
+			if (remap[i]==unmapped)
+			{
+				remap[i]=m_Points.size();
+				m_Points.push_back(mesh.Points[i]);
+				m_Normals.push_back(mesh.Normals[i]);
+				if (!mesh.Colours.empty()) m_MeshColours.push_back(mesh.Colours[i]);
+			}
+		}
+		
+		for (vector<unsigned int>::const_iterator i=mesh.Indices.begin(); i!=mesh.Indices.end(); ++i)
+		{
+			m_Indices.push_back(remap[*i]);
+		}
+		remap.swap(lastremap);
+	}
+}
+
+void *IsoSurface::PolygoniseThread(void *data)
+{
+	IsoJob *job=(IsoJob*)data;
+	job->Surface->PolygoniseSlab(job->Start,job->End,job->Surface->m_Slabs[job->Slab]);
+	return NULL;
+}
+
+float IsoSurface::SafeValue(int x, int y, int z) const
+{
+	if (x<0 || y<0 || z<0 || x>(int)m_Width || y>(int)m_Height || z>(int)m_Depth) return 0;
+	return m_Values[Index(x,y,z)];
+}
+
+dVector IsoSurface::Gradient(unsigned int x, unsigned int y, unsigned int z) const
+{
+	// central differences, pointing down the field, 
+	// which is out of the surface
+	return dVector((SafeValue(x-1,y,z)-SafeValue(x+1,y,z))/m_CellSize.x,
+	               (SafeValue(x,y-1,z)-SafeValue(x,y+1,z))/m_CellSize.y,
+	               (SafeValue(x,y,z-1)-SafeValue(x,y,z+1))/m_CellSize.z);
+}
+
+void IsoSurface::PolygoniseSlab(unsigned int start, unsigned int end, Mesh &mesh) const
+{
+	// the vertex made on each edge leading up from a grid point in 
+	// x, y and z, covering the points in the slab and the face after it
+	unsigned int layer=(m_Height+1)*(m_Depth+1);
+	mesh.EdgeCache.assign((end-start+1)*layer*3,-1);
+	
+	int vertlist[12];
+	for (unsigned int x=start; x<end; x++)
+	{
+		for (unsigned int y=0; y<m_Height; y++)
+		{
+			for (unsigned int z=0; z<m_Depth; z++)
+			{
+				int cubeindex=0;
+				for (int c=0; c<8; c++)
+				{
+					if (m_Values[Index(x+CornerOffset[c][0],y+CornerOffset[c][1],z+CornerOffset[c][2])]<m_IsoLevel)
+					{
+						cubeindex|=1<<c;
+					}
+				}
+				
+				// cube is entirely in/out of the surface 
+				int edges=ImplicitSurfaceEdges[cubeindex];
+				if (edges==0) continue;
+				
+				// find or make the vertices where the surface crosses the edges
+				for (int e=0; e<12; e++)
+				{
+					if (!(edges&(1<<e))) continue;
+					
+					const int *ca=CornerOffset[EdgeCorners[e][0]];
+					const int *cb=CornerOffset[EdgeCorners[e][1]];
+					// edges always go up one axis from the lower corner
+					const int *lo=ca, *hi=cb;
+					if (ca[0]+ca[1]+ca[2]>cb[0]+cb[1]+cb[2]) { lo=cb; hi=ca; }
+					int axis=lo[0]!=hi[0]?0:(lo[1]!=hi[1]?1:2);
+					
+					unsigned int ax=x+lo[0], ay=y+lo[1], az=z+lo[2];
+					unsigned int key=(((ax-start)*(m_Height+1)+ay)*(m_Depth+1)+az)*3+axis;
+					if (mesh.EdgeCache[key]==-1)
+					{
+						unsigned int bx=x+hi[0], by=y+hi[1], bz=z+hi[2];
+						unsigned int a=Index(ax,ay,az), b=Index(bx,by,bz);
+						float mu=(m_IsoLevel-m_Values[a])/(m_Values[b]-m_Values[a]);
+						
+						mesh.EdgeCache[key]=mesh.Points.size();
+						mesh.Points.push_back(lerp(Position(ax,ay,az),Position(bx,by,bz),mu));
+						dVector normal=lerp(Gradient(ax,ay,az),Gradient(bx,by,bz),mu);
+						float mag=normal.mag();
+						if (mag>0) normal/=mag;
+						mesh.Normals.push_back(normal);
+						if (m_UseColour)
+						{
+							const dColour &cola=m_Colours[a], &colb=m_Colours[b];
+							mesh.Colours.push_back(dColour(cola.r+mu*(colb.r-cola.r),
+							                               cola.g+mu*(colb.g-cola.g),
+							                               cola.b+mu*(colb.b-cola.b)));
+						}
+					}
+					vertlist[e]=mesh.EdgeCache[key];
+				}
+				
+				for (int i=0; ImplicitSurfaceTriangles[cubeindex][i]!=-1; i++) 
+				{
+					mesh.Indices.push_back(vertlist[ImplicitSurfaceTriangles[cubeindex][i]]);
+				}
+			}
+		}
+	}
+}
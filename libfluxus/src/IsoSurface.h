@@ -0,0 +1,135 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_ISO_SURFACE
+#define N_ISO_SURFACE
+
+#include <vector>
+#include "dada.h"
+#include "Allocator.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// A scalar field sampled on a regular grid of points, which 
+/// can be meshed with marching cubes. The field is stored once
+/// per grid point rather than per cell corner, so each value is
+/// worked out once instead of by all eight cells sharing it, 
+/// and the vertices on the cell edges are shared too, so the 
+/// result is an indexed mesh. Normals come from the gradient of
+/// the grid values. Evaluating and meshing are split into slabs
+/// along x which run on separate threads.
+class IsoSurface
+{
+public:
+	IsoSurface();
+	~IsoSurface() {}
+
+	/// A grid of w*h*d cells, filling size from the origin,
+	/// there are one more points than cells on each axis
+	void Init(unsigned int w, unsigned int h, unsigned int d, const dVector &size);
+
+	unsigned int Index(unsigned int x, unsigned int y, unsigned int z) const 
+		{ return (x*(m_Height+1)+y)*(m_Depth+1)+z; }
+	dVector Position(unsigned int x, unsigned int y, unsigned int z) const
+		{ return dVector(x*m_CellSize.x,y*m_CellSize.y,z*m_CellSize.z); }
+
+	/// The field values and colours for each grid point,
+	/// for setting directly, in the order given by Index()
+	vector<float> &GetValues() { return m_Values; }
+	vector<dColour> &GetColours() { return m_Colours; }
+
+	/// Sets the field to the sum of the influences, which are
+	/// strength/distance squared. An influence is skipped for the
+	/// points where it would add less than the cutoff, so only the 
+	/// part of the grid around it is visited. If colours are given 
+	/// they are summed too, weighted by 1/distance squared
+	void Evaluate(const vector<dVector,FLX_ALLOC(dVector) > &positions, 
+	              const vector<float,FLX_ALLOC(float) > &strengths,
+	              const vector<dColour,FLX_ALLOC(dColour) > *colours, float cutoff);
+
+	/// Builds the mesh of the surface where the field crosses 
+	/// the isolevel, with colours if wanted. Points outside the 
+	/// field are below the isolevel
+	void Polygonise(float isolevel, bool colour);
+
+	///////////////////////////////////////////////
+	///@name The mesh from the last Polygonise
+	/// Three indices per triangle
+	///@{
+	const vector<dVector> &GetPoints() const { return m_Points; }
+	const vector<dVector> &GetNormals() const { return m_Normals; }
+	const vector<dColour> &GetMeshColours() const { return m_MeshColours; }
+	const vector<unsigned int> &GetIndices() const { return m_Indices; }
+	///@}
+
+	/// Grids with fewer points than this aren't threaded
+	static const unsigned int THREADED_SIZE=32768;
+
+private:
+	/// The output of one slab
+	struct Mesh
+	{
+		vector<dVector> Points;
+		vector<dVector> Normals;
+		vector<dColour> Colours;
+		vector<unsigned int> Indices;
+		vector<int> EdgeCache;
+	};
+
+	void EvaluateSlab(unsigned int start, unsigned int end);
+	void PolygoniseSlab(unsigned int start, unsigned int end, Mesh &mesh) const;
+	static void *EvaluateThread(void *data);
+	static void *PolygoniseThread(void *data);
+	/// Splits the grid along x over the threads, 
+	/// returns the number of slabs used
+	unsigned int RunSlabs(void *(*func)(void *), unsigned int size);
+
+	dVector Gradient(unsigned int x, unsigned int y, unsigned int z) const;
+	float SafeValue(int x, int y, int z) const;
+	
+	unsigned int m_Width;
+	unsigned int m_Height;
+	unsigned int m_Depth;
+	dVector m_CellSize;
+	
+	vector<float> m_Values;
+	vector<dColour> m_Colours;
+	
+	// the influences while evaluating
+	const vector<dVector,FLX_ALLOC(dVector) > *m_InfluencePositions;
+	const vector<float,FLX_ALLOC(float) > *m_InfluenceStrengths;
+	const vector<dColour,FLX_ALLOC(dColour) > *m_InfluenceColours;
+	float m_Cutoff;
+	
+	// the settings while polygonising
+	float m_IsoLevel;
+	bool m_UseColour;
+	
+	vector<Mesh> m_Slabs;
+	vector<dVector> m_Points;
+	vector<dVector> m_Normals;
+	vector<dColour> m_MeshColours;
+	vector<unsigned int> m_Indices;
+};
+
+}
+
+#endif
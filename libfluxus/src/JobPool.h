@@ -0,0 +1,110 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_JOB_POOL
+#define N_JOB_POOL
+
+#include <vector>
+#include <pthread.h>
+#ifdef __APPLE__
+#include <mach/semaphore.h>
+#else
+#include <semaphore.h>
+#endif
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// A set of threads started the first time they are needed,
+/// one per processor, that sit waiting to split big loops up.
+/// Run hands out the jobs by bumping a shared counter, and the
+/// calling thread takes jobs too, then waits for the rest to
+/// finish. Only one Run goes over the threads at a time, if the
+/// pool is busy (or Run is called from a job) it all just runs
+/// in the caller.
+class JobPool
+{
+public:
+	/// The most threads used, including the one calling Run
+	static const unsigned int MAX_THREADS=8;
+
+	/// Returns the pool, starting it on the first call
+	static JobPool *Get();
+
+	typedef void (*Job)(void *context, unsigned int n);
+
+	/// Calls job for 0 to count-1 spread across the threads,
+	/// returns when they are all done. Jobs can run in any order
+	void Run(Job job, void *context, unsigned int count);
+
+	/// Calls func on each of an array of job structures,
+	/// for code written to start a thread per job
+	template<class T>
+	void RunEach(void *(*func)(void *), T *jobs, unsigned int count)
+	{
+		Each each;
+		each.Func=func;
+		each.Jobs=(char*)jobs;
+		each.Size=sizeof(T);
+		Run(RunOne,&each,count);
+	}
+
+	/// Includes the one calling Run
+	unsigned int GetNumThreads() const { return m_Threads.size()+1; }
+
+private:
+	JobPool(unsigned int threads);
+
+	struct Each
+	{
+		void *(*Func)(void *);
+		char *Jobs;
+		unsigned int Size;
+	};
+	static void RunOne(void *context, unsigned int n);
+
+	static void *WorkerLoop(void *context);
+	void Work();
+	void Signal();
+	void Wait();
+
+	std::vector<pthread_t> m_Threads;
+#ifdef __APPLE__
+	semaphore_t m_Wake;
+#else
+	sem_t m_Wake;
+#endif
+	pthread_mutex_t m_Busy;
+
+	Job m_Job;
+	void *m_Context;
+	volatile unsigned int m_Count;
+	// the block number in the top half, the next job in the bottom,
+	// so a thread waking late can't take a job from the next block
+	volatile unsigned int m_Next;
+	volatile unsigned int m_Done;
+	unsigned int m_Block;
+
+	static JobPool *m_Pool;
+	static pthread_once_t m_Once;
+	static void Start();
+};
+
+}
+
+#endif
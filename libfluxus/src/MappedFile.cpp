@@ -0,0 +1,80 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "MappedFile.h"
+
+using namespace Fluxus;
+
+MappedFile::MappedFile() :
+m_Data(NULL),
+m_Size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string &filename)
+{
+	Close();
+
+	int fd = open(filename.c_str(),O_RDONLY);
+	if (fd<0) return false;
+
+	struct stat sb;
+	if (fstat(fd,&sb)!=0 || !S_ISREG(sb.st_mode))
+	{
+		close(fd);
+		return false;
+	}
+
+	// empty files can't be mapped, but they are still valid
+	if (sb.st_size==0)
+	{
+		close(fd);
+		return true;
+	}
+
+	void *data = mmap(NULL,sb.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if (data==MAP_FAILED) return false;
+
+	// we read it front to back
+	madvise(data,sb.st_size,MADV_SEQUENTIAL);
+
+	m_Data=(const char*)data;
+	m_Size=sb.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data!=NULL)
+	{
+		munmap((void*)m_Data,m_Size);
+	}
+	m_Data=NULL;
+	m_Size=0;
+}
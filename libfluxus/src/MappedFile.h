@@ -0,0 +1,53 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_MAPPED_FILE
+#define N_MAPPED_FILE
+
+#include <string>
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// A read only file mapped into memory, so parsers can walk 
+/// over the data in place rather than reading it into buffers
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	/// Maps the whole file, returns false if it can't be opened
+	bool Open(const std::string &filename);
+	void Close();
+
+	const char *Data() const { return m_Data; }
+	const char *End() const { return m_Data+m_Size; }
+	unsigned int Size() const { return m_Size; }
+
+private:
+	MappedFile(const MappedFile &other);
+	const MappedFile &operator=(const MappedFile &other);
+
+	const char *m_Data;
+	unsigned int m_Size;
+};
+
+}
+
+#endif
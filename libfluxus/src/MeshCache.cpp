@@ -0,0 +1,149 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "PolyPrimitive.h"
+
+using namespace Fluxus;
+
+static const char *MESH_CACHE_MAGIC = "FLXMESH";
+// the arrays saved, in the order they are in the file
+static const char *MESH_CACHE_ARRAYS[] = { "p", "n", "t", "c" };
+static const unsigned int MESH_CACHE_NUM_ARRAYS = 4;
+// all of them are dVectors or dColours
+static const unsigned int MESH_CACHE_ELEMENT_SIZE = 16;
+
+string MeshCache::CacheName(const string &filename)
+{
+	return filename+".fluxmesh";
+}
+
+bool MeshCache::GetSourceInfo(const string &filename, unsigned long long &size, long long &time)
+{
+	struct stat sb;
+	if (stat(filename.c_str(),&sb)!=0) return false;
+	size=sb.st_size;
+	time=sb.st_mtime;
+	return true;
+}
+
+Primitive *MeshCache::Read(const string &filename)
+{
+	unsigned long long size;
+	long long time;
+	if (!GetSourceInfo(filename,size,time)) return NULL;
+
+	MappedFile file;
+	if (!file.Open(CacheName(filename))) return NULL;
+	if (file.Size()<sizeof(Header)) return NULL;
+
+	const Header *header = (const Header*)file.Data();
+	if (strncmp(header->Magic,MESH_CACHE_MAGIC,8)!=0 ||
+		header->Version!=VERSION ||
+		header->ByteOrder!=ENDIAN_CHECK ||
+		header->SourceSize!=size ||
+		header->SourceTime!=time ||
+		header->Type>PolyPrimitive::POLYGON)
+	{
+		return NULL;
+	}
+
+	unsigned long long arraysize = (unsigned long long)header->Vertices*MESH_CACHE_ELEMENT_SIZE;
+	unsigned long long expected = sizeof(Header)+arraysize*MESH_CACHE_NUM_ARRAYS+
+		(unsigned long long)header->Indices*sizeof(unsigned int);
+	if (file.Size()!=expected) return NULL;
+
+	PolyPrimitive *prim = new PolyPrimitive((PolyPrimitive::Type)header->Type);
+	prim->Resize(header->Vertices);
+
+	const char *data = file.Data()+sizeof(Header);
+	for (unsigned int i=0; i<MESH_CACHE_NUM_ARRAYS; i++)
+	{
+		PData *pd = prim->GetDataRaw(MESH_CACHE_ARRAYS[i]);
+		if (arraysize>0) memcpy(pd->GetRawData(),data,arraysize);
+		data+=arraysize;
+	}
+
+	const unsigned int *indices = (const unsigned int*)data;
+	prim->GetIndex().assign(indices,indices+header->Indices);
+	prim->SetIndexMode(header->IndexMode!=0);
+	return prim;
+}
+
+bool MeshCache::Write(const string &filename, const Primitive *prim)
+{
+	const PolyPrimitive *pp = dynamic_cast<const PolyPrimitive*>(prim);
+	if (pp==NULL) return false;
+
+	Header header;
+	memset(&header,0,sizeof(Header));
+	strncpy(header.Magic,MESH_CACHE_MAGIC,8);
+	header.Version=VERSION;
+	header.ByteOrder=ENDIAN_CHECK;
+	if (!GetSourceInfo(filename,header.SourceSize,header.SourceTime)) return false;
+	header.Type=pp->GetType();
+	header.IndexMode=pp->IsIndexed();
+	header.Vertices=pp->Size();
+	header.Indices=pp->GetIndexConst().size();
+
+	const PData *arrays[MESH_CACHE_NUM_ARRAYS];
+	for (unsigned int i=0; i<MESH_CACHE_NUM_ARRAYS; i++)
+	{
+		arrays[i] = pp->GetDataRawConst(MESH_CACHE_ARRAYS[i]);
+		if (arrays[i]==NULL || 
+			arrays[i]->ElementSize()!=MESH_CACHE_ELEMENT_SIZE ||
+			arrays[i]->Size()!=header.Vertices)
+		{
+			return false;
+		}
+	}
+
+	// write to a temporary file and move it over the cache once 
+	// it's complete, so nothing can read it half written
+	string cachename = CacheName(filename);
+	string tempname = cachename+".tmp";
+	FILE *file = fopen(tempname.c_str(),"wb");
+	if (file==NULL) return false;
+
+	bool ok = fwrite(&header,sizeof(Header),1,file)==1;
+	for (unsigned int i=0; ok && i<MESH_CACHE_NUM_ARRAYS; i++)
+	{
+		if (header.Vertices>0)
+		{
+			ok = fwrite(const_cast<PData*>(arrays[i])->GetRawData(),
+						MESH_CACHE_ELEMENT_SIZE,header.Vertices,file)==header.Vertices;
+		}
+	}
+	if (ok && header.Indices>0)
+	{
+		ok = fwrite(&pp->GetIndexConst()[0],sizeof(unsigned int),header.Indices,file)==header.Indices;
+	}
+	ok = fclose(file)==0 && ok;
+
+	if (!ok || rename(tempname.c_str(),cachename.c_str())!=0)
+	{
+		unlink(tempname.c_str());
+		return false;
+	}
+	return true;
+}
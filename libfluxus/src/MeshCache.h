@@ -0,0 +1,70 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef FLUX_MESH_CACHE
+#define FLUX_MESH_CACHE
+
+#include <string>
+#include "Primitive.h"
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// A binary copy of a mesh, saved next to the file it was 
+/// loaded from (octopus.obj is cached in octopus.obj.fluxmesh)
+/// so it can be loaded again without parsing. The file is 
+/// the pdata arrays and indices as they are in memory, so 
+/// loading it is a handful of memcpys out of a mapped file. 
+/// The cache is ignored if the source file has changed size 
+/// or modification time since it was written.
+class MeshCache
+{
+public:
+	/// Loads the cached copy of the file, or returns NULL 
+	/// if there isn't an up to date one
+	static Primitive *Read(const std::string &filename);
+	/// Saves a cached copy of a primitive loaded from the 
+	/// file, returns false if it can't be written
+	static bool Write(const std::string &filename, const Primitive *prim);
+
+private:
+	static const unsigned int VERSION=2;
+	static const unsigned int ENDIAN_CHECK=0x01020304;
+
+	struct Header
+	{
+		char Magic[8];
+		unsigned int Version;
+		unsigned int ByteOrder;
+		unsigned long long SourceSize;
+		long long SourceTime;
+		unsigned int Type;
+		unsigned int IndexMode;
+		unsigned int Vertices;
+		unsigned int Indices;
+		/// Pad to 64 bytes so the arrays that follow stay aligned
+		char Reserved[16];
+	};
+
+	static std::string CacheName(const std::string &filename);
+	static bool GetSourceInfo(const std::string &filename, unsigned long long &size, long long &time);
+};
+
+}
+
+#endif
@@ -0,0 +1,473 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <math.h>
+#include <algorithm>
+#include "MeshSimplifier.h"
+#include "PolyPrimitive.h"
+
+using namespace Fluxus;
+
+// how strongly open edges are held in place, compared 
+// with the planes of the faces
+static const double BOUNDARY_WEIGHT=100;
+// how close the pdata of coincident verts needs to be 
+// for them to be welded together
+static const float NORMAL_DOT=0.999;
+static const float TEXTURE_ERROR=0.0001;
+static const float COLOUR_ERROR=0.002;
+
+MeshSimplifier::Quadric::Quadric(double a, double b, double c, double d, double w)
+{
+	m[0]=w*a*a; m[1]=w*a*b; m[2]=w*a*c; m[3]=w*a*d;
+	m[4]=w*b*b; m[5]=w*b*c; m[6]=w*b*d;
+	m[7]=w*c*c; m[8]=w*c*d;
+	m[9]=w*d*d;
+}
+
+double MeshSimplifier::Quadric::Error(const dVector &v) const
+{
+	double x=v.x, y=v.y, z=v.z;
+	return m[0]*x*x + 2*m[1]*x*y + 2*m[2]*x*z + 2*m[3]*x +
+	       m[4]*y*y + 2*m[5]*y*z + 2*m[6]*y +
+	       m[7]*z*z + 2*m[8]*z + m[9];
+}
+
+bool MeshSimplifier::Quadric::Optimal(dVector &v) const
+{
+	// solve for the gradient being zero, which has no 
+	// good answer if the faces are flat or in a line
+	double det = m[0]*(m[4]*m[7]-m[5]*m[5]) - 
+	             m[1]*(m[1]*m[7]-m[5]*m[2]) +
+	             m[2]*(m[1]*m[5]-m[4]*m[2]);
+	double trace = m[0]+m[4]+m[7];
+	if (fabs(det)<=1e-6*trace*trace*trace) return false;
+	
+	double bx=-m[3], by=-m[6], bz=-m[8];
+	v.x = (bx*(m[4]*m[7]-m[5]*m[5]) - m[1]*(by*m[7]-m[5]*bz) + m[2]*(by*m[5]-m[4]*bz))/det;
+	v.y = (m[0]*(by*m[7]-bz*m[5]) - bx*(m[1]*m[7]-m[5]*m[2]) + m[2]*(m[1]*bz-by*m[2]))/det;
+	v.z = (m[0]*(m[4]*bz-m[5]*by) - m[1]*(m[1]*bz-by*m[2]) + bx*(m[1]*m[5]-m[4]*m[2]))/det;
+	return true;
+}
+
+MeshSimplifier::MeshSimplifier() :
+m_NumLive(0)
+{
+}
+
+MeshSimplifier::~MeshSimplifier()
+{
+}
+
+void MeshSimplifier::Simplify(PolyPrimitive *src, const vector<unsigned int> &targets,
+                              vector<PolyPrimitive*> &levels)
+{
+	Weld(src);
+	ComputeQuadrics();
+	
+	m_Heap.clear();
+	for (unsigned int v=0; v<m_Points.size(); v++)
+	{
+		PushEdges(v);
+	}
+	
+	vector<unsigned int> sorted(targets);
+	sort(sorted.begin(),sorted.end());
+	reverse(sorted.begin(),sorted.end());
+	
+	unsigned int next=0;
+	while (next<sorted.size() && !m_Heap.empty())
+	{
+		if (m_NumLive<=sorted[next])
+		{
+			levels.push_back(MakeLevel(src));
+			next++;
+			continue;
+		}
+		
+		pop_heap(m_Heap.begin(),m_Heap.end());
+		Collapse c=m_Heap.back();
+		m_Heap.pop_back();
+		
+		// skip edges that have changed since they were queued
+		if (m_Removed[c.Keep] || m_Removed[c.Gone] ||
+			m_Stamps[c.Keep]!=c.KeepStamp || m_Stamps[c.Gone]!=c.GoneStamp)
+		{
+			continue;
+		}
+		
+		dVector pos;
+		CollapseCost(c.Keep,c.Gone,pos);
+		
+		// keep the vert nearest the new position, for its pdata
+		int keep=c.Keep, gone=c.Gone;
+		if ((pos-m_Points[gone]).mag()<(pos-m_Points[keep]).mag()) swap(keep,gone);
+		
+		if (Flips(keep,gone,pos) || Flips(gone,keep,pos)) continue;
+		
+		DoCollapse(keep,gone,pos);
+	}
+	
+	// targets we couldn't get down to get the simplest we managed
+	for (; next<sorted.size(); next++)
+	{
+		levels.push_back(MakeLevel(src));
+	}
+	
+	m_Heap.clear();
+	m_VertFaces.clear();
+}
+
+// whether two coincident verts can be welded
+static bool SameVert(vector<dVector,FLX_ALLOC(dVector) > &n, 
+                     vector<dVector,FLX_ALLOC(dVector) > &t, 
+                     vector<dColour,FLX_ALLOC(dColour) > &c, 
+                     unsigned int a, unsigned int b)
+{
+	if (a<n.size() && b<n.size() && n[a].dot(n[b])<NORMAL_DOT*n[a].mag()*n[b].mag()) return false;
+	if (a<t.size() && b<t.size() && (t[a]-t[b]).mag()>TEXTURE_ERROR) return false;
+	if (a<c.size() && b<c.size())
+	{
+		for (int i=0; i<4; i++)
+		{
+			if (fabs(c[a].arr()[i]-c[b].arr()[i])>COLOUR_ERROR) return false;
+		}
+	}
+	return true;
+}
+
+void MeshSimplifier::Weld(PolyPrimitive *src)
+{
+	m_Points.clear();
+	m_Original.clear();
+	m_Seam.clear();
+	m_Faces.clear();
+	m_VertFaces.clear();
+	
+	vector<dVector,FLX_ALLOC(dVector) > &verts=*src->GetDataVec<dVector>("p");
+	vector<dVector,FLX_ALLOC(dVector) > &normals=*src->GetDataVec<dVector>("n");
+	vector<dVector,FLX_ALLOC(dVector) > &texture=*src->GetDataVec<dVector>("t");
+	vector<dColour,FLX_ALLOC(dColour) > &colours=*src->GetDataVec<dColour>("c");
+	if (verts.empty()) return;
+	
+	// the coincident verts come from the primitive's topology, in
+	// indexed mode these are index positions, so find the first 
+	// one for each vert, and look up the vert for each one found
+	const vector<vector<int> > &connected=src->GetConnectedVerts();
+	const vector<unsigned int> &index=src->GetIndexConst();
+	bool indexed=src->IsIndexed();
+	vector<int> slot;
+	if (indexed)
+	{
+		slot.assign(verts.size(),-1);
+		for (unsigned int i=0; i<index.size(); i++)
+		{
+			if (index[i]<verts.size() && slot[index[i]]==-1) slot[index[i]]=i;
+		}
+	}
+	
+	// weld the coincident verts with the same normals, texture
+	// coordinates and colours, so faces that only touch by position
+	// are joined up. where they differ they're left split, and marked
+	// as a seam so they can be held in place. we also keep the first
+	// welded vert at each position, to find the faces with no area
+	vector<int> welded(verts.size(),-1);
+	vector<int> position(verts.size(),-1);
+	for (unsigned int v=0; v<verts.size(); v++)
+	{
+		if (welded[v]!=-1) continue;
+		int id=m_Points.size();
+		m_Points.push_back(verts[v]);
+		m_Original.push_back(v);
+		m_Seam.push_back(false);
+		welded[v]=id;
+		if (position[v]==-1) position[v]=id;
+		
+		if (indexed && slot[v]==-1) continue;
+		const vector<int> &found=connected[indexed?slot[v]:v];
+		for (vector<int>::const_iterator i=found.begin(); i!=found.end(); ++i)
+		{
+			unsigned int other=indexed?index[*i]:*i;
+			if (other==v) continue;
+			if (position[other]==-1) position[other]=position[v];
+			if (SameVert(normals,texture,colours,v,other))
+			{
+				if (welded[other]==-1) welded[other]=id;
+			}
+			else
+			{
+				m_Seam[id]=true;
+			}
+		}
+	}
+	
+	m_VertFaces.resize(m_Points.size());
+	m_Stamps.assign(m_Points.size(),0);
+	m_Removed.assign(m_Points.size(),false);
+	
+	vector<unsigned int> triangles;
+	src->GetTriangles(triangles);
+	for (unsigned int i=0; i+2<triangles.size(); i+=3)
+	{
+		unsigned int a=triangles[i], b=triangles[i+1], c=triangles[i+2];
+		if (position[a]!=position[b] && position[b]!=position[c] && position[a]!=position[c])
+		{
+			AddFace(welded[a],welded[b],welded[c]);
+		}
+	}
+	m_Dead.assign(m_Faces.size()/3,false);
+	m_NumLive=m_Faces.size()/3;
+}
+
+void MeshSimplifier::AddFace(int a, int b, int c)
+{
+	int face=m_Faces.size()/3;
+	m_Faces.push_back(a);
+	m_Faces.push_back(b);
+	m_Faces.push_back(c);
+	m_VertFaces[a].push_back(face);
+	m_VertFaces[b].push_back(face);
+	m_VertFaces[c].push_back(face);
+}
+
+void MeshSimplifier::ComputeQuadrics()
+{
+	m_Quadrics.assign(m_Points.size(),Quadric());
+	
+	// the plane of each face, weighted by its area
+	vector<dVector> normals(m_Faces.size()/3);
+	for (unsigned int f=0; f<m_Faces.size()/3; f++)
+	{
+		const dVector &a=m_Points[m_Faces[f*3]];
+		const dVector &b=m_Points[m_Faces[f*3+1]];
+		const dVector &c=m_Points[m_Faces[f*3+2]];
+		dVector n=(b-a).cross(c-a);
+		float len=n.mag();
+		if (len==0) continue;
+		n/=len;
+		normals[f]=n;
+		Quadric q(n.x,n.y,n.z,-n.dot(a),len*0.5);
+		for (int k=0; k<3; k++) m_Quadrics[m_Faces[f*3+k]]+=q;
+	}
+	
+	// find the edges with only one face by sorting them all,
+	// and add planes through them at right angles to the face,
+	// this includes the seams as the verts there aren't welded
+	vector<pair<pair<int,int>,int> > edges;
+	edges.reserve(m_Faces.size());
+	for (unsigned int f=0; f<m_Faces.size()/3; f++)
+	{
+		for (int k=0; k<3; k++)
+		{
+			int a=m_Faces[f*3+k], b=m_Faces[f*3+(k+1)%3];
+			edges.push_back(make_pair(make_pair(min(a,b),max(a,b)),f));
+		}
+	}
+	sort(edges.begin(),edges.end());
+	
+	for (unsigned int i=0; i<edges.size(); i++)
+	{
+		bool shared=(i>0 && edges[i-1].first==edges[i].first) ||
+		            (i+1<edges.size() && edges[i+1].first==edges[i].first);
+		if (shared) continue;
+		
+		int a=edges[i].first.first, b=edges[i].first.second;
+		dVector edge=m_Points[b]-m_Points[a];
+		dVector n=edge.cross(normals[edges[i].second]);
+		float len=n.mag();
+		if (len==0) continue;
+		n/=len;
+		Quadric q(n.x,n.y,n.z,-n.dot(m_Points[a]),BOUNDARY_WEIGHT*edge.dot(edge));
+		m_Quadrics[a]+=q;
+		m_Quadrics[b]+=q;
+	}
+}
+
+float MeshSimplifier::CollapseCost(int keep, int gone, dVector &pos) const
+{
+	Quadric q=m_Quadrics[keep];
+	q+=m_Quadrics[gone];
+	
+	// the verts on a seam have a twin on the other side, which 
+	// won't follow them, so they stay put to stop cracks opening.
+	// other verts can still collapse onto them
+	if (m_Seam[keep] || m_Seam[gone])
+	{
+		if (m_Seam[keep] && m_Seam[gone]) return -1;
+		pos=m_Points[m_Seam[keep]?keep:gone];
+		double error=q.Error(pos);
+		return error>0?error:0;
+	}
+	
+	// the optimal position can end up anywhere if the faces are 
+	// nearly flat, so check it against the ends and the middle
+	dVector candidates[4];
+	int count=0;
+	if (q.Optimal(candidates[count])) count++;
+	candidates[count++]=m_Points[keep];
+	candidates[count++]=m_Points[gone];
+	candidates[count++]=(m_Points[keep]+m_Points[gone])*0.5f;
+	
+	double best=q.Error(candidates[0]);
+	pos=candidates[0];
+	for (int i=1; i<count; i++)
+	{
+		double error=q.Error(candidates[i]);
+		if (error<best)
+		{
+			best=error;
+			pos=candidates[i];
+		}
+	}
+	return best>0?best:0;
+}
+
+bool MeshSimplifier::Flips(int vert, int other, const dVector &pos) const
+{
+	// would moving the vert turn any of its faces over, 
+	// apart from the ones which disappear
+	const vector<int> &faces=m_VertFaces[vert];
+	for (vector<int>::const_iterator f=faces.begin(); f!=faces.end(); ++f)
+	{
+		if (m_Dead[*f]) continue;
+		const int *face=&m_Faces[*f*3];
+		if (face[0]==other || face[1]==other || face[2]==other) continue;
+		
+		dVector p[3];
+		for (int k=0; k<3; k++) p[k]=m_Points[face[k]];
+		dVector before=(p[1]-p[0]).cross(p[2]-p[0]);
+		for (int k=0; k<3; k++) if (face[k]==vert) p[k]=pos;
+		dVector after=(p[1]-p[0]).cross(p[2]-p[0]);
+		if (before.dot(after)<=0) return true;
+	}
+	return false;
+}
+
+void MeshSimplifier::PushEdges(int vert)
+{
+	// queue up the edges to all the neighbours, when building the 
+	// first time each edge is only queued from its lowest vert
+	bool first=m_Stamps[vert]==0;
+	const vector<int> &faces=m_VertFaces[vert];
+	for (vector<int>::const_iterator f=faces.begin(); f!=faces.end(); ++f)
+	{
+		if (m_Dead[*f]) continue;
+		const int *face=&m_Faces[*f*3];
+		for (int k=0; k<3; k++)
+		{
+			int other=face[k];
+			if (other==vert || (first && other<vert)) continue;
+			
+			Collapse c;
+			dVector pos;
+			c.Cost=CollapseCost(vert,other,pos);
+			if (c.Cost<0) continue;
+			c.Keep=vert;
+			c.Gone=other;
+			c.KeepStamp=m_Stamps[vert];
+			c.GoneStamp=m_Stamps[other];
+			m_Heap.push_back(c);
+			push_heap(m_Heap.begin(),m_Heap.end());
+		}
+	}
+}
+
+void MeshSimplifier::DoCollapse(int keep, int gone, const dVector &pos)
+{
+	m_Points[keep]=pos;
+	m_Quadrics[keep]+=m_Quadrics[gone];
+	m_Removed[gone]=true;
+	m_Stamps[keep]++;
+	
+	// faces with both verts disappear, the others move over
+	vector<int> &faces=m_VertFaces[gone];
+	for (vector<int>::iterator f=faces.begin(); f!=faces.end(); ++f)
+	{
+		if (m_Dead[*f]) continue;
+		int *face=&m_Faces[*f*3];
+		if (face[0]==keep || face[1]==keep || face[2]==keep)
+		{
+			m_Dead[*f]=true;
+			m_NumLive--;
+		}
+		else
+		{
+			for (int k=0; k<3; k++) if (face[k]==gone) face[k]=keep;
+			m_VertFaces[keep].push_back(*f);
+		}
+	}
+	faces.clear();
+	
+	vector<int> &keepfaces=m_VertFaces[keep];
+	unsigned int out=0;
+	for (unsigned int i=0; i<keepfaces.size(); i++)
+	{
+		if (!m_Dead[keepfaces[i]]) keepfaces[out++]=keepfaces[i];
+	}
+	keepfaces.resize(out);
+	
+	PushEdges(keep);
+}
+
+PolyPrimitive *MeshSimplifier::MakeLevel(PolyPrimitive *src) const
+{
+	vector<int> remap(m_Points.size(),-1);
+	vector<int> used;
+	vector<unsigned int> index;
+	index.reserve(m_NumLive*3);
+	for (unsigned int f=0; f<m_Dead.size(); f++)
+	{
+		if (m_Dead[f]) continue;
+		for (int k=0; k<3; k++)
+		{
+			int v=m_Faces[f*3+k];
+			if (remap[v]==-1)
+			{
+				remap[v]=used.size();
+				used.push_back(v);
+			}
+			index.push_back(remap[v]);
+		}
+	}
+	
+	PolyPrimitive *level = new PolyPrimitive(PolyPrimitive::TRILIST);
+	level->Resize(used.size());
+	
+	vector<dVector,FLX_ALLOC(dVector) > &p=*level->GetDataVec<dVector>("p");
+	vector<dVector,FLX_ALLOC(dVector) > &n=*level->GetDataVec<dVector>("n");
+	vector<dVector,FLX_ALLOC(dVector) > &t=*level->GetDataVec<dVector>("t");
+	vector<dColour,FLX_ALLOC(dColour) > &c=*level->GetDataVec<dColour>("c");
+	vector<dVector,FLX_ALLOC(dVector) > &srcn=*src->GetDataVec<dVector>("n");
+	vector<dVector,FLX_ALLOC(dVector) > &srct=*src->GetDataVec<dVector>("t");
+	vector<dColour,FLX_ALLOC(dColour) > &srcc=*src->GetDataVec<dColour>("c");
+	for (unsigned int i=0; i<used.size(); i++)
+	{
+		p[i]=m_Points[used[i]];
+		unsigned int original=m_Original[used[i]];
+		if (original<srcn.size()) n[i]=srcn[original];
+		if (original<srct.size()) t[i]=srct[original];
+		if (original<srcc.size()) c[i]=srcc[original];
+	}
+	
+	level->GetIndex()=index;
+	level->SetIndexMode(true);
+	// the normals are kept rather than recalculated, as the verts
+	// at hard edges and texture seams are split, and working them
+	// out again would give each side its own
+	if (srcn.size()<src->Size()) level->RecalculateNormals(true,PolyPrimitive::WEIGHT_AREA);
+	return level;
+}
@@ -0,0 +1,103 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_MESH_SIMPLIFIER
+#define N_MESH_SIMPLIFIER
+
+#include <vector>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+class PolyPrimitive;
+
+///////////////////////////////////////////////////////////////
+/// Reduces the triangles in a polygon primitive by collapsing 
+/// edges, cheapest first, with the cost measured by quadric 
+/// error metrics (Garland and Heckbert) - the sum of squared 
+/// distances to the planes of the original faces around the
+/// collapsed verts. Coincident verts with matching normals, 
+/// texture coordinates and colours are welded first so the 
+/// mesh holds together. Open edges are held in place, and so
+/// are seams and hard edges, where the verts are left split.
+class MeshSimplifier
+{
+public:
+	MeshSimplifier();
+	~MeshSimplifier();
+
+	/// Makes simplified copies of the primitive, one for each 
+	/// triangle count in targets (largest first), as indexed 
+	/// triangle lists. Positions are moved to minimise the 
+	/// error, other pdata comes from the nearest original vert.
+	void Simplify(PolyPrimitive *src, const vector<unsigned int> &targets,
+	              vector<PolyPrimitive*> &levels);
+
+private:
+	/// A symmetric 4x4 matrix, storing the upper triangle
+	struct Quadric
+	{
+		Quadric() { for (int i=0; i<10; i++) m[i]=0; }
+		Quadric(double a, double b, double c, double d, double w);
+		void operator+=(const Quadric &o) { for (int i=0; i<10; i++) m[i]+=o.m[i]; }
+		double Error(const dVector &v) const;
+		/// Finds the position with the least error, if there is one
+		bool Optimal(dVector &v) const;
+		double m[10];
+	};
+
+	struct Collapse
+	{
+		bool operator<(const Collapse &other) const { return Cost>other.Cost; }
+		float Cost;
+		int Keep,Gone;
+		unsigned int KeepStamp,GoneStamp;
+	};
+
+	void Weld(PolyPrimitive *src);
+	void AddFace(int a, int b, int c);
+	void ComputeQuadrics();
+	float CollapseCost(int keep, int gone, dVector &pos) const;
+	bool Flips(int vert, int other, const dVector &pos) const;
+	void PushEdges(int vert);
+	void DoCollapse(int keep, int gone, const dVector &pos);
+	PolyPrimitive *MakeLevel(PolyPrimitive *src) const;
+
+	// the welded verts, with the original vert they came from
+	vector<dVector> m_Points;
+	vector<unsigned int> m_Original;
+	// verts with a coincident vert they weren't welded to
+	vector<bool> m_Seam;
+	vector<Quadric> m_Quadrics;
+	vector<unsigned int> m_Stamps;
+	vector<bool> m_Removed;
+	vector<vector<int> > m_VertFaces;
+
+	// three verts per face
+	vector<int> m_Faces;
+	vector<bool> m_Dead;
+	unsigned int m_NumLive;
+
+	vector<Collapse> m_Heap;
+};
+
+}
+
+#endif
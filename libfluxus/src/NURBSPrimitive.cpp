@@ -14,18 +14,29 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <math.h>
+#include <algorithm>
 #include "Renderer.h"
 #include "NURBSPrimitive.h"
 #include "State.h"
 
 using namespace Fluxus;
 
+// glu's sample points per unit of the knot domain we use 
+// normally, which are the most detailed level
+static const float DEFAULT_U_STEP=20;
+static const float DEFAULT_V_STEP=100;
+
 NURBSPrimitive::NURBSPrimitive() :
 m_UOrder(0),
 m_VOrder(0),
 m_UCVCount(0),
 m_VCVCount(0),
-m_Stride(sizeof(dVector)/sizeof(float))
+m_Stride(sizeof(dVector)/sizeof(float)),
+m_LODDetail(0),
+m_UStep(0),
+m_VStep(0),
+m_TrianglesSaved(0)
 {
 	AddData("p",new TypedPData<dVector>);
 	AddData("t",new TypedPData<dVector>);
@@ -46,7 +57,11 @@ m_UOrder(other.m_UOrder),
 m_VOrder(other.m_VOrder),
 m_UCVCount(other.m_UCVCount),
 m_VCVCount(other.m_VCVCount),
-m_Stride(other.m_Stride)
+m_Stride(other.m_Stride),
+m_LODDetail(other.m_LODDetail),
+m_UStep(0),
+m_VStep(0),
+m_TrianglesSaved(0)
 {
 	SetupSurface();
 	PDataDirty();
@@ -77,11 +92,66 @@ void NURBSPrimitive::SetupSurface()
 	//gluNurbsProperty(m_Surface, GLU_SAMPLING_METHOD, GLU_PARAMETRIC_ERROR);
 	//gluNurbsProperty(m_Surface, GLU_PARAMETRIC_TOLERANCE, 5.0);
 	gluNurbsProperty(m_Surface, GLU_SAMPLING_METHOD, GLU_DOMAIN_DISTANCE);
-	gluNurbsProperty(m_Surface, GLU_U_STEP, 20);
+	SetSteps(DEFAULT_U_STEP,DEFAULT_V_STEP);
 	gluNurbsProperty(m_Surface, GLU_DISPLAY_MODE, GLU_FILL);
 	gluNurbsProperty(m_Surface, GLU_CULLING, GLU_TRUE);
 }
 
+void NURBSPrimitive::SetSteps(float usteps, float vsteps)
+{
+	// changing these makes glu do some work, so only when we need to
+	if (usteps!=m_UStep)
+	{
+		gluNurbsProperty(m_Surface, GLU_U_STEP, usteps);
+		m_UStep=usteps;
+	}
+	if (vsteps!=m_VStep)
+	{
+		gluNurbsProperty(m_Surface, GLU_V_STEP, vsteps);
+		m_VStep=vsteps;
+	}
+}
+
+float NURBSPrimitive::GetDomainSize(const vector<float,FLX_ALLOC(float) > &knots, int order, int cvs) const
+{
+	// the surface is defined between these knots
+	if (order<1 || cvs>=(int)knots.size() || order-1>=cvs) return 0;
+	return knots[cvs]-knots[order-1];
+}
+
+void NURBSPrimitive::SetLODDetail(float pixelspertriangle)
+{
+	m_LODDetail=pixelspertriangle;
+	if (m_LODDetail<=0)
+	{
+		SetSteps(DEFAULT_U_STEP,DEFAULT_V_STEP);
+		m_TrianglesSaved=0;
+	}
+}
+
+void NURBSPrimitive::SetScreenSize(float pixels)
+{
+	if (m_LODDetail<=0) return;
+
+	float udomain=GetDomainSize(m_UKnotVec,m_UOrder,m_UCVCount);
+	float vdomain=GetDomainSize(m_VKnotVec,m_VOrder,m_VCVCount);
+	if (udomain<=0 || vdomain<=0) return;
+
+	// the segments across the surface for the detail wanted, 
+	// no more than we'd normally use, and enough to follow 
+	// the control points
+	float segments=pixels/sqrtf(m_LODDetail);
+	float umax=DEFAULT_U_STEP*udomain;
+	float vmax=DEFAULT_V_STEP*vdomain;
+	float usegments=min(max(segments,(float)m_UCVCount),umax);
+	float vsegments=min(max(segments,(float)m_VCVCount),vmax);
+	
+	SetSteps(usegments/udomain,vsegments/vdomain);
+	
+	float saved=(umax*vmax-usegments*vsegments)*2;
+	m_TrianglesSaved=saved>0?(unsigned int)saved:0;
+}
+
 void NURBSPrimitive::Render()
 {
 	if (m_State.Hints & HINT_UNLIT) glDisable(GL_LIGHTING);
@@ -236,19 +306,11 @@ dBoundingBox NURBSPrimitive::GetBoundingBox(const dMatrix &space)
 
 void NURBSPrimitive::ApplyTransform(bool ScaleRotOnly)
 {
-	if (!ScaleRotOnly)
+	if (!m_CVVec->empty())
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_CVVec->begin(); i!=m_CVVec->end(); ++i)
-		{
-			*i=GetState()->Transform.transform(*i);
-		}
-	}
-	else
-	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_CVVec->begin(); i!=m_CVVec->end(); ++i)
-		{
-			*i=GetState()->Transform.transform_no_trans(*i);
-		}
+		dVector *data=&(*m_CVVec)[0];
+		if (!ScaleRotOnly) GetState()->Transform.transform(data,data,m_CVVec->size());
+		else GetState()->Transform.transform_no_trans(data,data,m_CVVec->size());
 	}
 
 	GetState()->Transform.init();
@@ -43,6 +43,16 @@ public:
 	virtual Evaluator *MakeEvaluator() { return NULL; }
 	///@}
 
+	///////////////////////////////////////////////////
+	///@name Level of detail
+	/// The surface is tessellated with fewer steps as it gets 
+	/// smaller on screen, only once a detail has been set
+	///@{
+	virtual void SetScreenSize(float pixels);
+	virtual void SetLODDetail(float pixelspertriangle);
+	virtual unsigned int GetTrianglesSaved() const { return m_TrianglesSaved; }
+	///@}
+
 	///////////////////////////////////////////////////
 	///@name Piecewise construction
 	///@{
@@ -60,6 +70,8 @@ protected:
 
 	virtual void PDataDirty();
 	void SetupSurface();
+	void SetSteps(float usteps, float vsteps);
+	float GetDomainSize(const vector<float,FLX_ALLOC(float) > &knots, int order, int cvs) const;
 
 	vector<dVector,FLX_ALLOC(dVector) > *m_CVVec;
 	vector<dVector,FLX_ALLOC(dVector) > *m_STVec;
@@ -75,6 +87,11 @@ protected:
 	int m_Stride;
 
 	GLUnurbsObj *m_Surface;
+	
+	float m_LODDetail;
+	float m_UStep;
+	float m_VStep;
+	unsigned int m_TrianglesSaved;
 };
 
 };
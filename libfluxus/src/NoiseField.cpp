@@ -0,0 +1,708 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <math.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "NoiseField.h"
+#include "JobPool.h"
+
+using namespace Fluxus;
+using namespace std;
+
+// points are worked on this many at a time
+static const unsigned int BLOCK_SIZE=64;
+// moves each octave away from the last, so they don't all 
+// line up at the origin
+static const float OCTAVE_SHIFT=17.31f;
+// for the finite differences of the curl
+static const float CURL_EPSILON=0.01f;
+// where the three noise fields making the curl's vector field are
+static const float CURL_OFFSETS[3][3]={{0,0,0},{31.41f,-17.23f,59.27f},{-43.71f,71.29f,13.97f}};
+
+// the perlin lattice, as in Noise
+static const int PERLIN_YWRAPB=4;
+static const int PERLIN_YWRAP=1<<PERLIN_YWRAPB;
+static const int PERLIN_ZWRAPB=8;
+static const int PERLIN_ZWRAP=1<<PERLIN_ZWRAPB;
+
+// simplex skewing factors, (sqrt(n+1)-1)/n and (1-1/sqrt(n+1))/n
+static const float F2=0.366025403f;
+static const float G2=0.211324865f;
+static const float F3=1.0f/3.0f;
+static const float G3=1.0f/6.0f;
+static const float F4=0.309016994f;
+static const float G4=0.138196601f;
+
+// simplex gradients, from Stefan Gustavson's "Simplex noise demystified"
+static const float GRAD3[12][3]={
+	{1,1,0},{-1,1,0},{1,-1,0},{-1,-1,0},
+	{1,0,1},{-1,0,1},{1,0,-1},{-1,0,-1},
+	{0,1,1},{0,-1,1},{0,1,-1},{0,-1,-1}};
+
+static const float GRAD4[32][4]={
+	{0,1,1,1},{0,1,1,-1},{0,1,-1,1},{0,1,-1,-1},
+	{0,-1,1,1},{0,-1,1,-1},{0,-1,-1,1},{0,-1,-1,-1},
+	{1,0,1,1},{1,0,1,-1},{1,0,-1,1},{1,0,-1,-1},
+	{-1,0,1,1},{-1,0,1,-1},{-1,0,-1,1},{-1,0,-1,-1},
+	{1,1,0,1},{1,1,0,-1},{1,-1,0,1},{1,-1,0,-1},
+	{-1,1,0,1},{-1,1,0,-1},{-1,-1,0,1},{-1,-1,0,-1},
+	{1,1,1,0},{1,1,-1,0},{1,-1,1,0},{1,-1,-1,0},
+	{-1,1,1,0},{-1,1,-1,0},{-1,-1,1,0},{-1,-1,-1,0}};
+
+// points stored a component at a time, padded with 
+// zeros to a multiple of four
+class NoiseField::Block
+{
+public:
+	float x[BLOCK_SIZE];
+	float y[BLOCK_SIZE];
+	float z[BLOCK_SIZE];
+	float w[BLOCK_SIZE];
+};
+
+struct NoiseJob
+{
+	const NoiseField *Field;
+	int Job;
+	const dVector *Points;
+	void *Result;
+	unsigned int Start;
+	unsigned int End;
+	unsigned int Width;
+	unsigned int Height;
+};
+
+static inline int FastFloor(float x)
+{
+	int i=(int)x;
+	return x<i?i-1:i;
+}
+
+// xorshift, so seeding a field doesn't touch rand()
+static inline unsigned int NextRandom(unsigned int &state)
+{
+	state^=state<<13;
+	state^=state>>17;
+	state^=state<<5;
+	return state;
+}
+
+#ifdef __SSE2__
+static inline __m128 Floor(__m128 v)
+{
+	__m128 t=_mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+	return _mm_sub_ps(t,_mm_and_ps(_mm_cmpgt_ps(t,v),_mm_set1_ps(1)));
+}
+
+// the contribution of one corner of the simplex
+static inline __m128 Corner(__m128 falloff, __m128 x, __m128 y, __m128 z, 
+                            const float *gx, const float *gy, const float *gz)
+{
+	__m128 t=_mm_sub_ps(falloff,_mm_add_ps(_mm_add_ps(_mm_mul_ps(x,x),_mm_mul_ps(y,y)),_mm_mul_ps(z,z)));
+	t=_mm_max_ps(t,_mm_setzero_ps());
+	t=_mm_mul_ps(t,t);
+	t=_mm_mul_ps(t,t);
+	__m128 dot=_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(gx),x),_mm_mul_ps(_mm_loadu_ps(gy),y)),
+	                      _mm_mul_ps(_mm_loadu_ps(gz),z));
+	return _mm_mul_ps(t,dot);
+}
+#endif
+
+NoiseField::NoiseField() :
+m_Basis(SIMPLEX),
+m_Dimensions(3),
+m_Fractal(FBM),
+m_Octaves(1),
+m_Lacunarity(2),
+m_Gain(0.5),
+m_Frequency(1,1,1,1),
+m_Offset(0,0,0,0)
+{
+	SetSeed(1);
+}
+
+void NoiseField::SetSeed(unsigned int seed)
+{
+	unsigned int state=seed*2654435761u+0x9e3779b9u;
+	if (state==0) state=1;
+
+	for (unsigned int i=0; i<256; i++) m_Perm[i]=i;
+	for (unsigned int i=255; i>0; i--)
+	{
+		swap(m_Perm[i],m_Perm[NextRandom(state)%(i+1)]);
+	}
+	for (unsigned int i=0; i<512; i++)
+	{
+		m_Perm[i]=m_Perm[i&255];
+		m_PermMod12[i]=m_Perm[i]%12;
+	}
+
+	for (unsigned int i=0; i<PERLIN_SIZE; i++)
+	{
+		m_Perlin[i]=(NextRandom(state)>>8)/(float)(1<<24);
+	}
+}
+
+void NoiseField::SetDimensions(unsigned int dimensions)
+{
+	m_Dimensions=max(2u,min(4u,dimensions));
+}
+
+//////////////////////////////////////////////
+
+float NoiseField::Sample(const dVector &p) const
+{
+	float result;
+	RunRange(JOB_POINTS,&p,&result,0,1,0,0);
+	return result;
+}
+
+dVector NoiseField::SampleCurl(const dVector &p) const
+{
+	dVector result;
+	RunRange(JOB_CURL,&p,&result,0,1,0,0);
+	return result;
+}
+
+void NoiseField::Fill(const dVector *points, float *result, unsigned int count) const
+{
+	Run(JOB_POINTS,points,result,count,0,0);
+}
+
+void NoiseField::FillCurl(const dVector *points, dVector *result, unsigned int count) const
+{
+	Run(JOB_CURL,points,result,count,0,0);
+}
+
+void NoiseField::FillGrid(unsigned int width, unsigned int height, float *result) const
+{
+	if (width==0) return;
+	Run(JOB_GRID,NULL,result,width*height,width,height);
+}
+
+void NoiseField::Run(Job job, const dVector *points, void *result, unsigned int count, 
+                     unsigned int width, unsigned int height) const
+{
+	unsigned int threads=1;
+	if (count>THREADED_SIZE)
+	{
+		threads=min(JobPool::Get()->GetNumThreads(),count/THREADED_SIZE);
+	}
+
+	if (threads<=1)
+	{
+		RunRange(job,points,result,0,count,width,height);
+		return;
+	}
+
+	// split on whole blocks
+	unsigned int slice=(count/threads+BLOCK_SIZE-1)/BLOCK_SIZE*BLOCK_SIZE;
+	NoiseJob jobs[JobPool::MAX_THREADS];
+	unsigned int numjobs=0;
+	for (unsigned int start=0; start<count; start+=slice)
+	{
+		NoiseJob &j=jobs[numjobs++];
+		j.Field=this;
+		j.Job=job;
+		j.Points=points;
+		j.Result=result;
+		j.Start=start;
+		j.End=min(start+slice,count);
+		j.Width=width;
+		j.Height=height;
+	}
+
+	JobPool::Get()->RunEach(RunThread,jobs,numjobs);
+}
+
+void *NoiseField::RunThread(void *data)
+{
+	NoiseJob *job=(NoiseJob*)data;
+	job->Field->RunRange((Job)job->Job,job->Points,job->Result,job->Start,job->End,job->Width,job->Height);
+	return NULL;
+}
+
+void NoiseField::RunRange(Job job, const dVector *points, void *result, unsigned int start, 
+                          unsigned int end, unsigned int width, unsigned int height) const
+{
+	Block block;
+	for (unsigned int first=start; first<end; first+=BLOCK_SIZE)
+	{
+		unsigned int count=min(BLOCK_SIZE,end-first);
+		unsigned int padded=(count+3)&~3;
+
+		if (job==JOB_GRID)
+		{
+			for (unsigned int i=0; i<count; i++)
+			{
+				unsigned int index=first+i;
+				block.x[i]=(index%width)/(float)width;
+				block.y[i]=(index/width)/(float)height;
+				block.z[i]=0;
+				block.w[i]=0;
+			}
+		}
+		else
+		{
+			for (unsigned int i=0; i<count; i++)
+			{
+				const dVector &p=points[first+i];
+				block.x[i]=p.x;
+				block.y[i]=p.y;
+				block.z[i]=p.z;
+				block.w[i]=p.w;
+			}
+		}
+
+		for (unsigned int i=count; i<padded; i++)
+		{
+			block.x[i]=block.y[i]=block.z[i]=block.w[i]=0;
+		}
+
+		if (job==JOB_CURL)
+		{
+			Transform(block,count,3);
+			Curl(block,count,(dVector*)result+first);
+		}
+		else
+		{
+			unsigned int dimensions=m_Basis==PERLIN?min(m_Dimensions,3u):m_Dimensions;
+			Transform(block,count,dimensions);
+			Octaves(block,count,dimensions,(float*)result+first);
+		}
+	}
+}
+
+void NoiseField::Transform(Block &block, unsigned int count, unsigned int dimensions) const
+{
+	for (unsigned int i=0; i<count; i++)
+	{
+		block.x[i]=block.x[i]*m_Frequency.x+m_Offset.x;
+		block.y[i]=block.y[i]*m_Frequency.y+m_Offset.y;
+		block.z[i]=dimensions>2?block.z[i]*m_Frequency.z+m_Offset.z:0;
+		block.w[i]=dimensions>3?block.w[i]*m_Frequency.w+m_Offset.w:0;
+	}
+}
+
+void NoiseField::Octaves(const Block &block, unsigned int count, unsigned int dimensions, float *result) const
+{
+	unsigned int padded=(count+3)&~3;
+	Block work=block;
+	float value[BLOCK_SIZE];
+	float sum[BLOCK_SIZE];
+	for (unsigned int i=0; i<padded; i++) sum[i]=0;
+
+	float amp=1, total=0;
+	for (unsigned int octave=0; octave<m_Octaves; octave++)
+	{
+		Kernel(work,padded,dimensions,value);
+
+		if (m_Fractal==RIDGED)
+		{
+			// fold the signed noise around zero into creases
+			float scale=m_Basis==PERLIN?2:1;
+			float bias=m_Basis==PERLIN?-1:0;
+			for (unsigned int i=0; i<padded; i++)
+			{
+				float v=1-fabsf(value[i]*scale+bias);
+				sum[i]+=v*v*amp;
+			}
+		}
+		else
+		{
+			for (unsigned int i=0; i<padded; i++) sum[i]+=value[i]*amp;
+		}
+
+		total+=amp;
+		amp*=m_Gain;
+
+		if (octave+1<m_Octaves)
+		{
+			for (unsigned int i=0; i<padded; i++)
+			{
+				work.x[i]=work.x[i]*m_Lacunarity+OCTAVE_SHIFT;
+				work.y[i]=work.y[i]*m_Lacunarity+OCTAVE_SHIFT;
+				if (dimensions>2) work.z[i]=work.z[i]*m_Lacunarity+OCTAVE_SHIFT;
+				if (dimensions>3) work.w[i]=work.w[i]*m_Lacunarity+OCTAVE_SHIFT;
+			}
+		}
+	}
+
+	// keep the range the same whatever the octaves
+	float norm=total>0?1/total:1;
+	for (unsigned int i=0; i<count; i++) result[i]=sum[i]*norm;
+}
+
+void NoiseField::Curl(const Block &block, unsigned int count, dVector *result) const
+{
+	// the derivative of each field along each axis, 
+	// by central differences
+	float derivative[3][3][BLOCK_SIZE];
+	float plus[BLOCK_SIZE], minus[BLOCK_SIZE];
+	Block shifted;
+	unsigned int padded=(count+3)&~3;
+
+	for (unsigned int field=0; field<3; field++)
+	{
+		for (unsigned int axis=0; axis<3; axis++)
+		{
+			for (int sign=-1; sign<=1; sign+=2)
+			{
+				for (unsigned int i=0; i<padded; i++)
+				{
+					shifted.x[i]=block.x[i]+CURL_OFFSETS[field][0]+(axis==0?sign*CURL_EPSILON:0);
+					shifted.y[i]=block.y[i]+CURL_OFFSETS[field][1]+(axis==1?sign*CURL_EPSILON:0);
+					shifted.z[i]=block.z[i]+CURL_OFFSETS[field][2]+(axis==2?sign*CURL_EPSILON:0);
+					shifted.w[i]=0;
+				}
+				Octaves(shifted,count,3,sign>0?plus:minus);
+			}
+
+			for (unsigned int i=0; i<count; i++)
+			{
+				derivative[field][axis][i]=(plus[i]-minus[i])/(2*CURL_EPSILON);
+			}
+		}
+	}
+
+	for (unsigned int i=0; i<count; i++)
+	{
+		result[i]=dVector(derivative[2][1][i]-derivative[1][2][i],
+		                  derivative[0][2][i]-derivative[2][0][i],
+		                  derivative[1][0][i]-derivative[0][1][i]);
+	}
+}
+
+void NoiseField::Kernel(const Block &block, unsigned int count, unsigned int dimensions, float *result) const
+{
+	if (m_Basis==PERLIN)
+	{
+		Perlin(block,count,result);
+		return;
+	}
+
+	switch (dimensions)
+	{
+		case 2: Simplex2(block,count,result); break;
+		case 3: Simplex3(block,count,result); break;
+		default: Simplex4(block,count,result); break;
+	}
+}
+
+//////////////////////////////////////////////
+
+void NoiseField::Perlin(const Block &block, unsigned int count, float *result) const
+{
+	// one octave of Noise::noise
+	for (unsigned int n=0; n<count; n++)
+	{
+		float x=fabsf(block.x[n]);
+		float y=fabsf(block.y[n]);
+		float z=fabsf(block.z[n]);
+		int xi=(int)x;
+		int yi=(int)y;
+		int zi=(int)z;
+		float xf=x-xi;
+		float yf=y-yi;
+		float zf=z-zi;
+
+		int of=xi+(yi<<PERLIN_YWRAPB)+(zi<<PERLIN_ZWRAPB);
+		const int mask=PERLIN_SIZE-1;
+
+		float rxf=0.5f*(1-cosf(xf*(float)M_PI));
+		float ryf=0.5f*(1-cosf(yf*(float)M_PI));
+
+		float n1=m_Perlin[of&mask];
+		n1+=rxf*(m_Perlin[(of+1)&mask]-n1);
+		float n2=m_Perlin[(of+PERLIN_YWRAP)&mask];
+		n2+=rxf*(m_Perlin[(of+PERLIN_YWRAP+1)&mask]-n2);
+		n1+=ryf*(n2-n1);
+
+		of+=PERLIN_ZWRAP;
+		n2=m_Perlin[of&mask];
+		n2+=rxf*(m_Perlin[(of+1)&mask]-n2);
+		float n3=m_Perlin[(of+PERLIN_YWRAP)&mask];
+		n3+=rxf*(m_Perlin[(of+PERLIN_YWRAP+1)&mask]-n3);
+		n2+=ryf*(n3-n2);
+
+		result[n]=n1+0.5f*(1-cosf(zf*(float)M_PI))*(n2-n1);
+	}
+}
+
+void NoiseField::Simplex2(const Block &block, unsigned int count, float *result) const
+{
+#ifdef __SSE2__
+	const __m128 one=_mm_set1_ps(1);
+	for (unsigned int n=0; n<count; n+=4)
+	{
+		__m128 x=_mm_loadu_ps(block.x+n);
+		__m128 y=_mm_loadu_ps(block.y+n);
+
+		// skew to find the cell, and unskew back
+		__m128 s=_mm_mul_ps(_mm_add_ps(x,y),_mm_set1_ps(F2));
+		__m128 fi=Floor(_mm_add_ps(x,s));
+		__m128 fj=Floor(_mm_add_ps(y,s));
+		__m128 t=_mm_mul_ps(_mm_add_ps(fi,fj),_mm_set1_ps(G2));
+		__m128 x0=_mm_sub_ps(x,_mm_sub_ps(fi,t));
+		__m128 y0=_mm_sub_ps(y,_mm_sub_ps(fj,t));
+
+		// which of the two triangles
+		__m128 i1=_mm_and_ps(_mm_cmpgt_ps(x0,y0),one);
+		__m128 j1=_mm_sub_ps(one,i1);
+
+		__m128 x1=_mm_add_ps(_mm_sub_ps(x0,i1),_mm_set1_ps(G2));
+		__m128 y1=_mm_add_ps(_mm_sub_ps(y0,j1),_mm_set1_ps(G2));
+		__m128 x2=_mm_add_ps(x0,_mm_set1_ps(2*G2-1));
+		__m128 y2=_mm_add_ps(y0,_mm_set1_ps(2*G2-1));
+
+		// the hashing is done a point at a time
+		int ii[4],jj[4];
+		float a1[4];
+		_mm_storeu_si128((__m128i*)ii,_mm_cvttps_epi32(fi));
+		_mm_storeu_si128((__m128i*)jj,_mm_cvttps_epi32(fj));
+		_mm_storeu_ps(a1,i1);
+		float gx[3][4],gy[3][4],gz[3][4];
+		for (int lane=0; lane<4; lane++)
+		{
+			int i=ii[lane]&255, j=jj[lane]&255;
+			int o=(int)a1[lane];
+			const float *g0=GRAD3[m_PermMod12[i+m_Perm[j]]];
+			const float *g1=GRAD3[m_PermMod12[i+o+m_Perm[j+1-o]]];
+			const float *g2=GRAD3[m_PermMod12[i+1+m_Perm[j+1]]];
+			gx[0][lane]=g0[0]; gy[0][lane]=g0[1]; gz[0][lane]=0;
+			gx[1][lane]=g1[0]; gy[1][lane]=g1[1]; gz[1][lane]=0;
+			gx[2][lane]=g2[0]; gy[2][lane]=g2[1]; gz[2][lane]=0;
+		}
+
+		__m128 falloff=_mm_set1_ps(0.5f), zero=_mm_setzero_ps();
+		__m128 sum=Corner(falloff,x0,y0,zero,gx[0],gy[0],gz[0]);
+		sum=_mm_add_ps(sum,Corner(falloff,x1,y1,zero,gx[1],gy[1],gz[1]));
+		sum=_mm_add_ps(sum,Corner(falloff,x2,y2,zero,gx[2],gy[2],gz[2]));
+		_mm_storeu_ps(result+n,_mm_mul_ps(sum,_mm_set1_ps(70)));
+	}
+#else
+	for (unsigned int n=0; n<count; n++)
+	{
+		float x=block.x[n], y=block.y[n];
+		float s=(x+y)*F2;
+		int i=FastFloor(x+s);
+		int j=FastFloor(y+s);
+		float t=(i+j)*G2;
+		float x0=x-(i-t);
+		float y0=y-(j-t);
+
+		int i1=x0>y0?1:0;
+		int j1=1-i1;
+
+		float xs[3]={x0, x0-i1+G2, x0-1+2*G2};
+		float ys[3]={y0, y0-j1+G2, y0-1+2*G2};
+		i&=255;
+		j&=255;
+		int gi[3]={m_PermMod12[i+m_Perm[j]], m_PermMod12[i+i1+m_Perm[j+j1]], m_PermMod12[i+1+m_Perm[j+1]]};
+
+		float sum=0;
+		for (int c=0; c<3; c++)
+		{
+			float f=0.5f-xs[c]*xs[c]-ys[c]*ys[c];
+			if (f>0)
+			{
+				f*=f;
+				sum+=f*f*(GRAD3[gi[c]][0]*xs[c]+GRAD3[gi[c]][1]*ys[c]);
+			}
+		}
+		result[n]=70*sum;
+	}
+#endif
+}
+
+void NoiseField::Simplex3(const Block &block, unsigned int count, float *result) const
+{
+#ifdef __SSE2__
+	const __m128 one=_mm_set1_ps(1);
+	for (unsigned int n=0; n<count; n+=4)
+	{
+		__m128 x=_mm_loadu_ps(block.x+n);
+		__m128 y=_mm_loadu_ps(block.y+n);
+		__m128 z=_mm_loadu_ps(block.z+n);
+
+		__m128 s=_mm_mul_ps(_mm_add_ps(_mm_add_ps(x,y),z),_mm_set1_ps(F3));
+		__m128 fi=Floor(_mm_add_ps(x,s));
+		__m128 fj=Floor(_mm_add_ps(y,s));
+		__m128 fk=Floor(_mm_add_ps(z,s));
+		__m128 t=_mm_mul_ps(_mm_add_ps(_mm_add_ps(fi,fj),fk),_mm_set1_ps(G3));
+		__m128 x0=_mm_sub_ps(x,_mm_sub_ps(fi,t));
+		__m128 y0=_mm_sub_ps(y,_mm_sub_ps(fj,t));
+		__m128 z0=_mm_sub_ps(z,_mm_sub_ps(fk,t));
+
+		// which of the six tetrahedra, worked out from 
+		// the order of the offsets without branching
+		__m128 xy=_mm_and_ps(_mm_cmpge_ps(x0,y0),one);
+		__m128 yz=_mm_and_ps(_mm_cmpge_ps(y0,z0),one);
+		__m128 xz=_mm_and_ps(_mm_cmpge_ps(x0,z0),one);
+		__m128 nxy=_mm_sub_ps(one,xy);
+		__m128 i1=_mm_mul_ps(xy,xz);
+		__m128 j1=_mm_mul_ps(nxy,yz);
+		__m128 k1=_mm_mul_ps(_mm_sub_ps(one,yz),_mm_sub_ps(one,xz));
+		__m128 i2=_mm_sub_ps(_mm_add_ps(xy,xz),i1);
+		__m128 j2=_mm_sub_ps(_mm_add_ps(nxy,yz),j1);
+		__m128 k2=_mm_sub_ps(one,_mm_mul_ps(xz,yz));
+
+		__m128 g3=_mm_set1_ps(G3), g32=_mm_set1_ps(2*G3), g33=_mm_set1_ps(3*G3-1);
+		__m128 x1=_mm_add_ps(_mm_sub_ps(x0,i1),g3);
+		__m128 y1=_mm_add_ps(_mm_sub_ps(y0,j1),g3);
+		__m128 z1=_mm_add_ps(_mm_sub_ps(z0,k1),g3);
+		__m128 x2=_mm_add_ps(_mm_sub_ps(x0,i2),g32);
+		__m128 y2=_mm_add_ps(_mm_sub_ps(y0,j2),g32);
+		__m128 z2=_mm_add_ps(_mm_sub_ps(z0,k2),g32);
+		__m128 x3=_mm_add_ps(x0,g33);
+		__m128 y3=_mm_add_ps(y0,g33);
+		__m128 z3=_mm_add_ps(z0,g33);
+
+		int ii[4],jj[4],kk[4];
+		float o[6][4];
+		_mm_storeu_si128((__m128i*)ii,_mm_cvttps_epi32(fi));
+		_mm_storeu_si128((__m128i*)jj,_mm_cvttps_epi32(fj));
+		_mm_storeu_si128((__m128i*)kk,_mm_cvttps_epi32(fk));
+		_mm_storeu_ps(o[0],i1); _mm_storeu_ps(o[1],j1); _mm_storeu_ps(o[2],k1);
+		_mm_storeu_ps(o[3],i2); _mm_storeu_ps(o[4],j2); _mm_storeu_ps(o[5],k2);
+		float gx[4][4],gy[4][4],gz[4][4];
+		for (int lane=0; lane<4; lane++)
+		{
+			int i=ii[lane]&255, j=jj[lane]&255, k=kk[lane]&255;
+			int a1=(int)o[0][lane], b1=(int)o[1][lane], c1=(int)o[2][lane];
+			int a2=(int)o[3][lane], b2=(int)o[4][lane], c2=(int)o[5][lane];
+			const float *g[4]={
+				GRAD3[m_PermMod12[i+m_Perm[j+m_Perm[k]]]],
+				GRAD3[m_PermMod12[i+a1+m_Perm[j+b1+m_Perm[k+c1]]]],
+				GRAD3[m_PermMod12[i+a2+m_Perm[j+b2+m_Perm[k+c2]]]],
+				GRAD3[m_PermMod12[i+1+m_Perm[j+1+m_Perm[k+1]]]]};
+			for (int c=0; c<4; c++)
+			{
+				gx[c][lane]=g[c][0];
+				gy[c][lane]=g[c][1];
+				gz[c][lane]=g[c][2];
+			}
+		}
+
+		__m128 falloff=_mm_set1_ps(0.6f);
+		__m128 sum=Corner(falloff,x0,y0,z0,gx[0],gy[0],gz[0]);
+		sum=_mm_add_ps(sum,Corner(falloff,x1,y1,z1,gx[1],gy[1],gz[1]));
+		sum=_mm_add_ps(sum,Corner(falloff,x2,y2,z2,gx[2],gy[2],gz[2]));
+		sum=_mm_add_ps(sum,Corner(falloff,x3,y3,z3,gx[3],gy[3],gz[3]));
+		_mm_storeu_ps(result+n,_mm_mul_ps(sum,_mm_set1_ps(32)));
+	}
+#else
+	for (unsigned int n=0; n<count; n++)
+	{
+		float x=block.x[n], y=block.y[n], z=block.z[n];
+		float s=(x+y+z)*F3;
+		int i=FastFloor(x+s);
+		int j=FastFloor(y+s);
+		int k=FastFloor(z+s);
+		float t=(i+j+k)*G3;
+		float x0=x-(i-t);
+		float y0=y-(j-t);
+		float z0=z-(k-t);
+
+		int xy=x0>=y0, yz=y0>=z0, xz=x0>=z0;
+		int i1=xy&xz, j1=!xy&yz, k1=!yz&!xz;
+		int i2=xy|xz, j2=!xy|yz, k2=!(xz&yz);
+
+		float xs[4]={x0, x0-i1+G3, x0-i2+2*G3, x0-1+3*G3};
+		float ys[4]={y0, y0-j1+G3, y0-j2+2*G3, y0-1+3*G3};
+		float zs[4]={z0, z0-k1+G3, z0-k2+2*G3, z0-1+3*G3};
+		i&=255;
+		j&=255;
+		k&=255;
+		int gi[4]={
+			m_PermMod12[i+m_Perm[j+m_Perm[k]]],
+			m_PermMod12[i+i1+m_Perm[j+j1+m_Perm[k+k1]]],
+			m_PermMod12[i+i2+m_Perm[j+j2+m_Perm[k+k2]]],
+			m_PermMod12[i+1+m_Perm[j+1+m_Perm[k+1]]]};
+
+		float sum=0;
+		for (int c=0; c<4; c++)
+		{
+			float f=0.6f-xs[c]*xs[c]-ys[c]*ys[c]-zs[c]*zs[c];
+			if (f>0)
+			{
+				f*=f;
+				sum+=f*f*(GRAD3[gi[c]][0]*xs[c]+GRAD3[gi[c]][1]*ys[c]+GRAD3[gi[c]][2]*zs[c]);
+			}
+		}
+		result[n]=32*sum;
+	}
+#endif
+}
+
+void NoiseField::Simplex4(const Block &block, unsigned int count, float *result) const
+{
+	for (unsigned int n=0; n<count; n++)
+	{
+		float x=block.x[n], y=block.y[n], z=block.z[n], w=block.w[n];
+		float s=(x+y+z+w)*F4;
+		int i=FastFloor(x+s);
+		int j=FastFloor(y+s);
+		int k=FastFloor(z+s);
+		int l=FastFloor(w+s);
+		float t=(i+j+k+l)*G4;
+		float x0=x-(i-t);
+		float y0=y-(j-t);
+		float z0=z-(k-t);
+		float w0=w-(l-t);
+
+		// rank the offsets to find which of the 24 simplices
+		int rankx=0, ranky=0, rankz=0, rankw=0;
+		if (x0>y0) rankx++; else ranky++;
+		if (x0>z0) rankx++; else rankz++;
+		if (x0>w0) rankx++; else rankw++;
+		if (y0>z0) ranky++; else rankz++;
+		if (y0>w0) ranky++; else rankw++;
+		if (z0>w0) rankz++; else rankw++;
+
+		int o[5][4]={
+			{0,0,0,0},
+			{rankx>=3, ranky>=3, rankz>=3, rankw>=3},
+			{rankx>=2, ranky>=2, rankz>=2, rankw>=2},
+			{rankx>=1, ranky>=1, rankz>=1, rankw>=1},
+			{1,1,1,1}};
+
+		i&=255;
+		j&=255;
+		k&=255;
+		l&=255;
+		float sum=0;
+		for (int c=0; c<5; c++)
+		{
+			float xc=x0-o[c][0]+c*G4;
+			float yc=y0-o[c][1]+c*G4;
+			float zc=z0-o[c][2]+c*G4;
+			float wc=w0-o[c][3]+c*G4;
+			float f=0.6f-xc*xc-yc*yc-zc*zc-wc*wc;
+			if (f>0)
+			{
+				const float *g=GRAD4[m_Perm[i+o[c][0]+m_Perm[j+o[c][1]+m_Perm[k+o[c][2]+m_Perm[l+o[c][3]]]]]%32];
+				f*=f;
+				sum+=f*f*(g[0]*xc+g[1]*yc+g[2]*zc+g[3]*wc);
+			}
+		}
+		result[n]=27*sum;
+	}
+}
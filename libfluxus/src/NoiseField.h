@@ -0,0 +1,129 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_NOISE_FIELD
+#define N_NOISE_FIELD
+
+#include "dada.h"
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// Fills whole arrays with fractal noise in one go. Unlike the
+/// Noise and SimplexNoise functions each field has its own 
+/// seed and settings, so different fields can be used at the 
+/// same time, from different threads. Points are worked on in 
+/// blocks, with the simplex noise done four at a time using 
+/// SSE where it's available, and big arrays are spread over
+/// the processors.
+///
+/// Perlin noise is the same kind as Noise::noise, ranging from 
+/// 0 to 1, simplex noise ranges from -1 to 1.
+class NoiseField
+{
+public:
+	NoiseField();
+
+	enum Basis{PERLIN,SIMPLEX};
+	/// Fbm adds the octaves together, ridged folds each 
+	/// one into sharp creases first, and ranges from 0 to 1
+	enum Fractal{FBM,RIDGED};
+
+	///////////////////////////////////////////////
+	///@name Settings
+	///@{
+	void SetSeed(unsigned int seed);
+	void SetBasis(Basis basis) { m_Basis=basis; }
+	/// How many components of the points are used, 2 to 4. 
+	/// Perlin noise only goes up to 3
+	void SetDimensions(unsigned int dimensions);
+	void SetFractal(Fractal fractal) { m_Fractal=fractal; }
+	void SetOctaves(unsigned int octaves) { m_Octaves=octaves>0?octaves:1; }
+	/// Frequency multiplier for each octave
+	void SetLacunarity(float lacunarity) { m_Lacunarity=lacunarity; }
+	/// Amplitude multiplier for each octave
+	void SetGain(float gain) { m_Gain=gain; }
+	/// The points are multiplied by the frequency then 
+	/// have the offset added before sampling
+	void SetFrequency(const dVector &frequency) { m_Frequency=frequency; }
+	void SetOffset(const dVector &offset) { m_Offset=offset; }
+	///@}
+
+	///////////////////////////////////////////////
+	///@name Sampling
+	///@{
+	float Sample(const dVector &p) const;
+	/// The curl of a vector field made from three copies of 
+	/// the noise, which makes flow without sources or sinks, 
+	/// handy for moving particles about. Always 3D.
+	dVector SampleCurl(const dVector &p) const;
+
+	void Fill(const dVector *points, float *result, unsigned int count) const;
+	void FillCurl(const dVector *points, dVector *result, unsigned int count) const;
+	/// Samples a grid of width by height points, with x and y 
+	/// going from 0 to 1 across it, for filling images
+	void FillGrid(unsigned int width, unsigned int height, float *result) const;
+	///@}
+
+	/// Arrays are only spread over threads if bigger than this
+	static const unsigned int THREADED_SIZE=4096;
+
+private:
+	class Block;
+	enum Job{JOB_POINTS,JOB_CURL,JOB_GRID};
+
+	void Run(Job job, const dVector *points, void *result, unsigned int count, 
+	         unsigned int width, unsigned int height) const;
+	/// width and height are the size of the whole grid for 
+	/// JOB_GRID, not of the range being filled
+	void RunRange(Job job, const dVector *points, void *result, unsigned int start, 
+	              unsigned int end, unsigned int width, unsigned int height) const;
+	static void *RunThread(void *data);
+
+	/// Applies the frequency and offset, and clears the 
+	/// components beyond the dimensions used
+	void Transform(Block &block, unsigned int count, unsigned int dimensions) const;
+	void Octaves(const Block &block, unsigned int count, unsigned int dimensions, float *result) const;
+	void Curl(const Block &block, unsigned int count, dVector *result) const;
+	/// One octave of the chosen basis
+	void Kernel(const Block &block, unsigned int count, unsigned int dimensions, float *result) const;
+
+	void Perlin(const Block &block, unsigned int count, float *result) const;
+	void Simplex2(const Block &block, unsigned int count, float *result) const;
+	void Simplex3(const Block &block, unsigned int count, float *result) const;
+	void Simplex4(const Block &block, unsigned int count, float *result) const;
+
+	Basis m_Basis;
+	unsigned int m_Dimensions;
+	Fractal m_Fractal;
+	unsigned int m_Octaves;
+	float m_Lacunarity;
+	float m_Gain;
+	dVector m_Frequency;
+	dVector m_Offset;
+
+	/// Permutations repeated twice, to save wrapping
+	unsigned char m_Perm[512];
+	unsigned char m_PermMod12[512];
+	static const unsigned int PERLIN_SIZE=4096;
+	float m_Perlin[PERLIN_SIZE];
+};
+
+}
+
+#endif
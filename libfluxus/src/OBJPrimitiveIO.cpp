@@ -16,7 +16,7 @@
 
 #include <cstdlib>
 #include <cstdio>
-#include <algorithm>
+#include <cstring>
 
 #include "assert.h"
 #include "PolyPrimitive.h"
@@ -24,326 +24,350 @@
 #include "OBJPrimitiveIO.h"
 #include "SceneGraph.h"
 #include "Trace.h"
+#include "MappedFile.h"
+#include "TextParse.h"
 
 using namespace Fluxus;
 
-OBJPrimitiveIO::OBJPrimitiveIO()
+OBJPrimitiveIO::OBJPrimitiveIO() :
+m_UnifiedIndices(true),
+m_Quads(true)
 {
 }
 
 OBJPrimitiveIO::~OBJPrimitiveIO()
 {
-	// clear some mem
-	m_Position.clear();
-	m_Texture.clear();
-	m_Normal.clear();
-	m_Faces.clear();
 }
 
 Primitive *OBJPrimitiveIO::FormatRead(const string &filename)
 {
-	FILE *file = fopen(filename.c_str(),"r");
-	if (file==NULL)
+	MappedFile file;
+	if (!file.Open(filename))
 	{
 		Trace::Stream<<"Cannot open .obj file: "<<filename<<endl;
 		return NULL;
 	}
 
-	fseek(file,0,SEEK_END);
-	m_DataSize = ftell(file);
-	rewind(file);
-
-	m_Data = new char[m_DataSize+1];
-	if (m_DataSize!=fread(m_Data,1,m_DataSize,file))
-	{
-		Trace::Stream<<"Error reading .obj file: "<<filename<<endl;
-		fclose(file);
-		return NULL;
-	}
-	fclose(file);
-	m_Data[m_DataSize]='\0';
-
 	m_UnifiedIndices = true;
-	ReadOBJ(m_Position, m_Texture, m_Normal, m_Faces);
+	ReadOBJ(file.Data(), file.End());
+	file.Close();
 
-	// now get rid of the text
-	delete[] m_Data;
+	CheckIndices();
+	if (m_Corners.empty()) return NULL;
 
 	// skip processing if all the indices are the same per vertex
 	if (m_UnifiedIndices)
 	{
-		m_Indices.clear();
-		for (vector<Face>::const_iterator fi=m_Faces.begin();
-				fi!=m_Faces.end(); ++fi)
+		m_Indices.resize(m_Corners.size());
+		for (unsigned int i=0; i<m_Corners.size(); i++)
 		{
-			for (vector<Indices>::const_iterator ii=fi->Index.begin();
-					ii!=fi->Index.end(); ++ii)
-			{
-				m_Indices.push_back(ii->Position);
-			}
+			m_Indices[i]=m_Corners[i].Position;
 		}
 	}
 	else
 	{
 		// shuffle stuff around so we only have one set of indices
-		vector<Indices> unique=RemoveDuplicateIndices();
-		ReorderData(unique);
-		UnifyIndices(unique);
+		UnifyIndices();
 	}
 
-	if (m_Faces.empty()) return NULL;
-
 	return MakePrimitive();
 }
 
 Primitive *OBJPrimitiveIO::MakePrimitive()
 {
-	// stick all the data in a primitive
-
-	// what type?
-	PolyPrimitive::Type type;
-	switch (m_Faces[0].Index.size())
-	{
-		case 3: type=PolyPrimitive::TRILIST; break;
-		case 4: type=PolyPrimitive::QUADS; break;
-		default:
-		{
-			Trace::Stream<<"obj file needs to contain triangles or quads"<<endl;
-			return NULL;
-		}
-	}
-
-	PolyPrimitive *prim = new PolyPrimitive(type);
+	// stick all the data in a primitive, files made of quads stay
+	// quads, anything else is triangulated as it's read
+	PolyPrimitive *prim = new PolyPrimitive(m_Quads?PolyPrimitive::QUADS:PolyPrimitive::TRILIST);
 	prim->Resize(m_Position.size());
 
-	TypedPData<dVector> *pos = new TypedPData<dVector>(m_Position);
-	prim->SetDataRaw("p", pos);
+	// swap the arrays in rather than copying them
+	static_cast<TypedPData<dVector>*>(prim->GetDataRaw("p"))->m_Data.swap(m_Position);
 
 	if (!m_Texture.empty())
 	{
 		assert(m_Texture.size()==m_Position.size());
-		TypedPData<dVector> *tex = new TypedPData<dVector>(m_Texture);
-		prim->SetDataRaw("t", tex);
+		static_cast<TypedPData<dVector>*>(prim->GetDataRaw("t"))->m_Data.swap(m_Texture);
 	}
 
 	if (!m_Normal.empty())
 	{
 		assert(m_Normal.size()==m_Position.size());
-		TypedPData<dVector> *nrm = new TypedPData<dVector>(m_Normal);
-		prim->SetDataRaw("n", nrm);
+		static_cast<TypedPData<dVector>*>(prim->GetDataRaw("n"))->m_Data.swap(m_Normal);
+	}
+
+	if (!m_Colour.empty())
+	{
+		assert(m_Colour.size()==m_Position.size());
+		static_cast<TypedPData<dColour>*>(prim->GetDataRaw("c"))->m_Data.swap(m_Colour);
 	}
 
-	prim->GetIndex()=m_Indices;
+	prim->GetIndex().swap(m_Indices);
 	prim->SetIndexMode(true);
 	return prim;
 }
 
-unsigned int OBJPrimitiveIO::TokeniseLine(unsigned int pos, vector<string> &output)
+void OBJPrimitiveIO::ReadVector(const char *&pos, const char *end, unsigned int count,
+		std::vector<dVector, FLX_ALLOC(dVector) > &output)
 {
-	char c=m_Data[pos];
-	vector<string> temp;
-	temp.push_back("");
-	while(c!='\n' && pos<m_DataSize)
+	dVector v(0,0,0);
+	for (unsigned int i=0; i<count; i++)
 	{
-		if (c==' ' && *temp.rbegin()!="") temp.push_back("");
-		else temp.rbegin()->push_back(c);
-		c=m_Data[++pos];
+		SkipSpace(pos,end);
+		if (!ParseFloat(pos,end,v.arr()[i]))
+		{
+			// texture coordinates can have two or three
+			if (i<2) return;
+			break;
+		}
 	}
+	output.push_back(v);
+}
+
+bool OBJPrimitiveIO::ReadCorner(const char *&pos, const char *end, Corner &corner)
+{
+	// one of p, p/t, p//n or p/t/n, indices count from 1, 
+	// or backwards from the last vertex read if negative
+	corner.Position=-1;
+	corner.Texture=-1;
+	corner.Normal=-1;
 
-	// get rid of whitespace
-	output.clear();
-	for(vector<string>::iterator i=temp.begin(); i!=temp.end(); ++i)
+	int index;
+	if (!ParseInt(pos,end,index)) return false;
+	corner.Position=index<0?(int)m_Position.size()+index:index-1;
+
+	if (pos<end && *pos=='/')
 	{
-		if (*i!="")	output.push_back(*i);
-	}
+		pos++;
+		if (ParseInt(pos,end,index))
+		{
+			corner.Texture=index<0?(int)m_Texture.size()+index:index-1;
+		}
 
-	return pos+1;
-}
+		if (pos<end && *pos=='/')
+		{
+			pos++;
+			if (ParseInt(pos,end,index))
+			{
+				corner.Normal=index<0?(int)m_Normal.size()+index:index-1;
+			}
+		}
+	}
 
-void OBJPrimitiveIO::TokeniseIndices(const string &str, vector<string> &output)
-{
-	unsigned int pos=0;
-	output.clear();
-	output.push_back("");
-	while(pos<str.size())
+	if ((corner.Texture!=-1 && corner.Texture!=corner.Position) ||
+		(corner.Normal!=-1 && corner.Normal!=corner.Position))
 	{
-		char c=str[pos++];
-		if (c==' ' || c=='/') output.push_back("");
-		else output.rbegin()->push_back(c);
+		m_UnifiedIndices = false;
 	}
+
+	return true;
 }
 
-void OBJPrimitiveIO::ReadOBJ(std::vector<dVector, FLX_ALLOC(dVector) > &positions,
-		std::vector<dVector, FLX_ALLOC(dVector) > &textures,
-		std::vector<dVector, FLX_ALLOC(dVector) > &normals,
-		std::vector<Face> &faces)
+void OBJPrimitiveIO::ReadOBJ(const char *pos, const char *end)
 {
-	unsigned int pos=0;
-	positions.clear();
-	textures.clear();
-	normals.clear();
-	faces.clear();
+	m_Position.clear();
+	m_Texture.clear();
+	m_Normal.clear();
+	m_Colour.clear();
+	m_Corners.clear();
+	m_Quads=true;
 
-	while (pos<m_DataSize)
+	while (pos<end)
 	{
-		vector<string> tokens;
-		pos = TokeniseLine(pos, tokens);
-		if (tokens.empty())
-			continue;
-
-		if ((tokens[0] == "v") && (tokens.size() == 4))
+		SkipSpace(pos,end);
+		if (pos+1>=end)
 		{
-			positions.push_back(dVector(atof(tokens[1].c_str()),
-									 atof(tokens[2].c_str()),
-									 atof(tokens[3].c_str())));
+			break;
 		}
-		else if (tokens[0] == "vt")
+
+		if (pos[0]=='v' && (pos[1]==' ' || pos[1]=='\t'))
 		{
-			if (tokens.size() == 4)
+			pos++;
+			ReadVector(pos,end,3,m_Position);
+
+			// some programs write a vertex colour after the position
+			dColour c;
+			unsigned int i=0;
+			for (; i<3; i++)
 			{
-				textures.push_back(dVector(atof(tokens[1].c_str()),
-										 atof(tokens[2].c_str()),
-										 atof(tokens[3].c_str())));
+				SkipSpace(pos,end);
+				if (!ParseFloat(pos,end,c.arr()[i])) break;
 			}
-			else if (tokens.size() == 3)
+			if (i==3)
 			{
-				textures.push_back(dVector(atof(tokens[1].c_str()),
-										 atof(tokens[2].c_str()),
-										 0));
+				// the vertices without colours are white
+				m_Colour.resize(m_Position.size()-1,dColour(1,1,1));
+				m_Colour.push_back(c);
 			}
 		}
-		else if ((tokens[0] == "vn") && (tokens.size() == 4))
+		else if (pos[0]=='v' && pos[1]=='t')
+		{
+			pos+=2;
+			ReadVector(pos,end,3,m_Texture);
+		}
+		else if (pos[0]=='v' && pos[1]=='n')
 		{
-			normals.push_back(dVector(atof(tokens[1].c_str()),
-									 atof(tokens[2].c_str()),
-									 atof(tokens[3].c_str())));
+			pos+=2;
+			ReadVector(pos,end,3,m_Normal);
 		}
-		else if (tokens[0] == "f")
+		else if (pos[0]=='f' && (pos[1]==' ' || pos[1]=='\t'))
 		{
-			Face f;
-			for(unsigned int i=1; i<tokens.size(); i++)
+			pos++;
+			m_Polygon.clear();
+			SkipSpace(pos,end);
+			while (!IsEndOfLine(pos,end))
 			{
-				vector<string> itokens;
-				TokeniseIndices(tokens[i],itokens);
-				if (itokens.size()==3)
+				Corner corner;
+				if (!ReadCorner(pos,end,corner))
 				{
-					Indices ind;
-					if (itokens[0]!="") ind.Position=(unsigned int)atof(itokens[0].c_str())-1;
-					if (itokens[1]!="") ind.Texture=(unsigned int)atof(itokens[1].c_str())-1;
-					if (itokens[2]!="") ind.Normal=(unsigned int)atof(itokens[2].c_str())-1;
-					f.Index.push_back(ind);
-
-					if ((ind.Position != ind.Texture) ||
-						(ind.Position != ind.Normal) ||
-						(ind.Texture != ind.Normal))
-					{
-						m_UnifiedIndices = false;
-					}
-				}
-				else if (itokens.size()==2)
-				{
-					Indices ind;
-					if (itokens[0]!="") ind.Position=(unsigned int)atof(itokens[0].c_str())-1;
-					if (itokens[1]!="") ind.Texture=(unsigned int)atof(itokens[1].c_str())-1;
-					f.Index.push_back(ind);
-
-					if (ind.Position != ind.Texture)
-					{
-						m_UnifiedIndices = false;
-					}
-				}
-				else if (itokens.size()==1)
-				{
-					Indices ind;
-					if (itokens[0]!="") ind.Position=(unsigned int)atof(itokens[0].c_str())-1;
-					f.Index.push_back(ind);
-				}
-				else
-				{
-					Trace::Stream<<"Wrong number of indices in .obj file ("<<itokens.size()<<")"<<endl;
+					Trace::Stream<<"Bad face index in .obj file"<<endl;
+					break;
 				}
+				m_Polygon.push_back(corner);
+				SkipSpace(pos,end);
 			}
 
-			// subdivide polygons to triangles
-			if (f.Index.size() > 3)
+			if (m_Quads && m_Polygon.size()==4)
 			{
-				Face tri;
-				for (unsigned i = 0; i < 3; i++)
-				{
-					tri.Index.push_back(f.Index[i]);
-				}
-				faces.push_back(tri);
+				m_Corners.insert(m_Corners.end(),m_Polygon.begin(),m_Polygon.end());
+			}
+			else if (m_Polygon.size()>=3)
+			{
+				// the first face that isn't a quad means
+				// we have to triangulate everything
+				if (m_Quads) TriangulateQuads();
 
-				for (unsigned i = 3; i < f.Index.size(); i++)
+				// subdivide polygons to triangles
+				for (unsigned int i=2; i<m_Polygon.size(); i++)
 				{
-					tri.Index.erase(tri.Index.begin() + 1);
-					tri.Index.push_back(f.Index[i]);
-					faces.push_back(tri);
+					m_Corners.push_back(m_Polygon[0]);
+					m_Corners.push_back(m_Polygon[i-1]);
+					m_Corners.push_back(m_Polygon[i]);
 				}
 			}
-			else
-			{
-				faces.push_back(f);
-			}
 		}
+
+		SkipLine(pos,end);
+	}
+
+	if (!m_Colour.empty())
+	{
+		m_Colour.resize(m_Position.size(),dColour(1,1,1));
+	}
+
+	// if the texture coordinates or normals don't 
+	// line up with the positions we need to unify
+	if ((!m_Texture.empty() && m_Texture.size()!=m_Position.size()) ||
+		(!m_Normal.empty() && m_Normal.size()!=m_Position.size()))
+	{
+		m_UnifiedIndices = false;
 	}
 }
 
-vector<OBJPrimitiveIO::Indices> OBJPrimitiveIO::RemoveDuplicateIndices()
+void OBJPrimitiveIO::TriangulateQuads()
 {
-	vector<Indices> ret;
-	for (vector<Face>::iterator fi=m_Faces.begin();
-		fi!=m_Faces.end(); ++fi)
+	vector<Corner> quads;
+	quads.swap(m_Corners);
+	m_Corners.reserve(quads.size()/2*3);
+	for (unsigned int i=0; i<quads.size(); i+=4)
 	{
-		for (vector<Indices>::iterator ii=fi->Index.begin();
-			ii!=fi->Index.end(); ++ii)
-		{
-			vector<Indices>::iterator result = find(ret.begin(), ret.end(), *ii);
-			if (result == ret.end())
-			{
-				ii->UnifiedIndex = ret.size();
-				ret.push_back(*ii);
-			}
-			else
-			{
-				ii->UnifiedIndex = result - ret.begin();
-			}
-		}
+		m_Corners.push_back(quads[i]);
+		m_Corners.push_back(quads[i+1]);
+		m_Corners.push_back(quads[i+2]);
+		m_Corners.push_back(quads[i]);
+		m_Corners.push_back(quads[i+2]);
+		m_Corners.push_back(quads[i+3]);
 	}
-	return ret;
+	m_Quads=false;
 }
 
-void OBJPrimitiveIO::ReorderData(const vector<OBJPrimitiveIO::Indices> &unique)
+void OBJPrimitiveIO::CheckIndices()
 {
-	vector<dVector, FLX_ALLOC(dVector) > NewPosition;
-	vector<dVector, FLX_ALLOC(dVector) > NewTexture;
-	vector<dVector, FLX_ALLOC(dVector) > NewNormal;
-
-	for (vector<Indices>::const_iterator i=unique.begin();
-		i!=unique.end(); ++i)
+	// remove faces pointing outside the positions, and 
+	// ignore texture or normal indices that are out of range
+	unsigned int bad=0;
+	unsigned int out=0;
+	unsigned int size=m_Quads?4:3;
+	for (unsigned int i=0; i<m_Corners.size(); i+=size)
 	{
-		if (!m_Position.empty()) NewPosition.push_back(m_Position[i->Position]);
-		if (!m_Texture.empty()) NewTexture.push_back(m_Texture[i->Texture]);
-		if (!m_Normal.empty()) NewNormal.push_back(m_Normal[i->Normal]);
+		bool ok=true;
+		for (unsigned int c=i; c<i+size; c++)
+		{
+			Corner &corner=m_Corners[c];
+			if (corner.Position<0 || corner.Position>=(int)m_Position.size()) ok=false;
+			if (corner.Texture>=(int)m_Texture.size()) corner.Texture=-1;
+			if (corner.Normal>=(int)m_Normal.size()) corner.Normal=-1;
+		}
+
+		if (ok)
+		{
+			for (unsigned int c=i; c<i+size; c++) m_Corners[out++]=m_Corners[c];
+		}
+		else
+		{
+			bad++;
+		}
 	}
+	m_Corners.resize(out);
 
-	m_Position=NewPosition;
-	m_Texture=NewTexture;
-	m_Normal=NewNormal;
+	if (bad>0)
+	{
+		Trace::Stream<<"Ignoring "<<bad<<" faces with bad indices in .obj file"<<endl;
+	}
 }
 
-void OBJPrimitiveIO::UnifyIndices(const vector<Indices> &unique)
+void OBJPrimitiveIO::UnifyIndices()
 {
-	m_Indices.clear();
-	for (vector<Face>::const_iterator fi=m_Faces.begin();
-		fi!=m_Faces.end(); ++fi)
+	// make a vertex for each distinct combination of indices, 
+	// found with an open addressing hash table
+	static const unsigned int EMPTY=0xffffffff;
+	unsigned int size=1;
+	while (size<m_Corners.size()*2) size<<=1;
+	vector<unsigned int> table(size,EMPTY);
+	vector<Corner> unique;
+
+	m_Indices.resize(m_Corners.size());
+	for (unsigned int i=0; i<m_Corners.size(); i++)
 	{
-		for (vector<Indices>::const_iterator ii=fi->Index.begin();
-			ii!=fi->Index.end(); ++ii)
+		const Corner &corner=m_Corners[i];
+		unsigned int h=((unsigned int)corner.Position*73856093)^
+					   ((unsigned int)corner.Texture*19349663)^
+					   ((unsigned int)corner.Normal*83492791);
+		h&=size-1;
+		while (table[h]!=EMPTY && !(unique[table[h]]==corner))
+		{
+			h=(h+1)&(size-1);
+		}
+
+		if (table[h]==EMPTY)
 		{
-			m_Indices.push_back(ii->UnifiedIndex);
+			table[h]=unique.size();
+			unique.push_back(corner);
 		}
+		m_Indices[i]=table[h];
 	}
+
+	// now reorder the data to match
+	vector<dVector, FLX_ALLOC(dVector) > NewPosition(unique.size());
+	vector<dVector, FLX_ALLOC(dVector) > NewTexture;
+	vector<dVector, FLX_ALLOC(dVector) > NewNormal;
+	vector<dColour, FLX_ALLOC(dColour) > NewColour;
+	if (!m_Texture.empty()) NewTexture.resize(unique.size());
+	if (!m_Normal.empty()) NewNormal.resize(unique.size());
+	if (!m_Colour.empty()) NewColour.resize(unique.size());
+
+	for (unsigned int i=0; i<unique.size(); i++)
+	{
+		const Corner &corner=unique[i];
+		NewPosition[i]=m_Position[corner.Position];
+		if (!m_Colour.empty()) NewColour[i]=m_Colour[corner.Position];
+		if (!m_Texture.empty() && corner.Texture!=-1) NewTexture[i]=m_Texture[corner.Texture];
+		if (!m_Normal.empty() && corner.Normal!=-1) NewNormal[i]=m_Normal[corner.Normal];
+	}
+
+	m_Position.swap(NewPosition);
+	m_Texture.swap(NewTexture);
+	m_Normal.swap(NewNormal);
+	m_Colour.swap(NewColour);
 }
 
 //////////////////////////////////
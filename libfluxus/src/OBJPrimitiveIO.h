@@ -35,39 +35,30 @@ public:
 			const SceneGraph &world);
 
 private:
-	class Indices
+	/// The position, texture and normal index of a face corner,
+	/// -1 where the file doesn't give one
+	struct Corner
 	{
-	public:
-		Indices() : Position(0), Texture(0), Normal(0), UnifiedIndex(0) {}
-
-		bool operator==(const Indices &other) const
+		bool operator==(const Corner &other) const
 		{
 			return Position==other.Position &&
 				   Texture==other.Texture &&
 				   Normal==other.Normal;
 		}
 
-		unsigned int Position;
-		unsigned int Texture;
-		unsigned int Normal;
-
-		unsigned int UnifiedIndex;
-	};
-
-	struct Face
-	{
-		vector<Indices> Index;
+		int Position;
+		int Texture;
+		int Normal;
 	};
 
-	unsigned int TokeniseLine(unsigned int pos, vector<string> &output);
-	void TokeniseIndices(const string &str, vector<string> &output);
-	void ReadOBJ(std::vector<dVector, FLX_ALLOC(dVector) > &positions,
-				std::vector<dVector, FLX_ALLOC(dVector) > &textures,
-				std::vector<dVector, FLX_ALLOC(dVector) > &normals,
-				std::vector<Face> &faces);
-	vector<Indices> RemoveDuplicateIndices();
-	void ReorderData(const vector<Indices> &unique);
-	void UnifyIndices(const vector<Indices> &unique);
+	void ReadOBJ(const char *pos, const char *end);
+	void ReadVector(const char *&pos, const char *end, unsigned int count,
+				std::vector<dVector, FLX_ALLOC(dVector) > &output);
+	bool ReadCorner(const char *&pos, const char *end, Corner &corner);
+	/// Splits the quads read so far into triangles
+	void TriangulateQuads();
+	void CheckIndices();
+	void UnifyIndices();
 	Primitive *MakePrimitive();
 
 	void FormatWriteOBJ(const Primitive *ob, unsigned id, const SceneGraph &world, FILE *file, FILE *mfile);
@@ -78,16 +69,19 @@ private:
 
 	void FormatWriteMTL(const Primitive *ob, unsigned id, FILE *file);
 
-	unsigned int m_DataSize;
-	char *m_Data;
-
-	vector<Face> m_Faces;
+	// the corners of the face being read
+	vector<Corner> m_Polygon;
+	// every corner of the faces, quads if they all are, 
+	// triangles otherwise
+	vector<Corner> m_Corners;
 	vector<dVector, FLX_ALLOC(dVector) > m_Position;
 	vector<dVector, FLX_ALLOC(dVector) > m_Texture;
 	vector<dVector, FLX_ALLOC(dVector) > m_Normal;
+	vector<dColour, FLX_ALLOC(dColour) > m_Colour;
 	vector<unsigned int> m_Indices;
 
 	bool m_UnifiedIndices;
+	bool m_Quads;
 };
 
 }
@@ -18,3 +18,5 @@
 
 using namespace Fluxus;
 
+unsigned int PData::m_NextVersion=0;
+
@@ -19,6 +19,8 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <climits>
 #include "dada.h"
 #include "Allocator.h"
 
@@ -32,31 +34,82 @@ namespace Fluxus
 class PData
 {
 public:
-	PData() {}
+	PData() { SetDirty(); }
 	virtual ~PData() {}
 	virtual PData *Copy() const=0;
 	virtual unsigned int Size() const=0;
 	virtual void Resize(unsigned int size)=0;
 	
+	/// Returns the size of one element in bytes
+	virtual unsigned int ElementSize() const=0;
+	
+	/// Returns a pointer to the start of the array, 
+	/// or NULL if it's empty
+	virtual void *GetRawData()=0;
+	
 	char GetType() const { return m_Type; }
 	
+	///////////////////////////////////////////////////
+	///@name Dirty tracking
+	/// Anything which writes to the array needs to mark
+	/// the elements it changed, so copies kept elsewhere
+	/// (vertex buffers on the graphics card) can be 
+	/// updated with only the range that's changed. New 
+	/// arrays start off completely dirty.
+	///@{
+	void SetDirty() { m_DirtyStart=0; m_DirtyEnd=UINT_MAX; m_Version=++m_NextVersion; }
+	void SetDirty(unsigned int index) 
+	{ 
+		if (m_DirtyStart>=m_DirtyEnd) { m_DirtyStart=index; m_DirtyEnd=index+1; }
+		else if (index<m_DirtyStart) m_DirtyStart=index;
+		else if (index>=m_DirtyEnd) m_DirtyEnd=index+1;
+		m_Version=++m_NextVersion;
+	}
+	void ClearDirty() { m_DirtyStart=m_DirtyEnd=0; }
+	bool IsDirty() const { return m_DirtyStart<m_DirtyEnd; }
+	/// Gets the range of elements written to since the last 
+	/// ClearDirty(), end is one past the last changed element
+	void GetDirtyRange(unsigned int &start, unsigned int &end) const
+	{
+		end=min(m_DirtyEnd,Size());
+		start=min(m_DirtyStart,end);
+	}
+	/// Changes whenever the array is marked dirty, and isn't 
+	/// reset by ClearDirty(), so anything caching results from
+	/// the array can tell if it's changed since it last looked.
+	/// No two arrays share a version.
+	unsigned int GetVersion() const { return m_Version; }
+	///@}
+	
 protected:
 	void SetType(const char s) { m_Type=s; }
 	
 private:
 	char m_Type;
+	unsigned int m_DirtyStart;
+	unsigned int m_DirtyEnd;
+	unsigned int m_Version;
+	static unsigned int m_NextVersion;
 };
 
+/////////////////////////////////////////////////
+/// The type letters for the supported pdata types
+template<class T> inline char PDataType() { return '?'; }
+template<> inline char PDataType<float>() { return 'f'; }
+template<> inline char PDataType<dVector>() { return 'v'; }
+template<> inline char PDataType<dColour>() { return 'c'; }
+template<> inline char PDataType<dMatrix>() { return 'm'; }
+
 /////////////////////////////////////////////////
 /// The templated pdata array class
 template<class T>
 class TypedPData : public PData
 {
 public:
-	TypedPData() {}	
-	TypedPData(T first) { m_Data.push_back(first); }	
-	TypedPData(unsigned int size) { Resize(size); }	
-	TypedPData(vector<T, FLX_ALLOC(T) > s) : m_Data(s) {}
+	TypedPData() { SetType(PDataType<T>()); }	
+	TypedPData(T first) { SetType(PDataType<T>()); m_Data.push_back(first); }	
+	TypedPData(unsigned int size) { SetType(PDataType<T>()); Resize(size); }	
+	TypedPData(vector<T, FLX_ALLOC(T) > s) : m_Data(s) { SetType(PDataType<T>()); }
 	virtual ~TypedPData() {}
 	
 	virtual PData *Copy() const
@@ -74,6 +127,18 @@ public:
 	virtual void Resize(unsigned int size)
 	{
 		m_Data.resize(size);
+		SetDirty();
+	}
+	
+	virtual unsigned int ElementSize() const
+	{
+		return sizeof(T);
+	}
+	
+	virtual void *GetRawData()
+	{
+		if (m_Data.empty()) return NULL;
+		return &m_Data[0];
 	}
 	
 	///\todo add operator[] and make m_Data private
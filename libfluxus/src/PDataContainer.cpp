@@ -18,17 +18,59 @@
 
 using namespace Fluxus;
 
-PDataContainer::PDataContainer() 
+const unsigned int PDataContainer::NO_HANDLE;
+
+// the names interned so far, kept in functions so 
+// they exist before any static primitives are made
+static map<string,unsigned int> &HandleMap()
 {
+	static map<string,unsigned int> handles;
+	return handles;
 }
 
-PDataContainer::PDataContainer(const PDataContainer &other) 
+static vector<string> &HandleNames()
 {
-	Clear();
-	for (map<string,PData*>::const_iterator i=other.m_PData.begin(); 
-		i!=other.m_PData.end(); i++)
+	static vector<string> names;
+	return names;
+}
+
+unsigned int PDataContainer::GetHandle(const string &name)
+{
+	map<string,unsigned int>::iterator i=HandleMap().find(name);
+	if (i!=HandleMap().end()) return i->second;
+	
+	unsigned int handle=HandleNames().size();
+	HandleNames().push_back(name);
+	HandleMap()[name]=handle;
+	return handle;
+}
+
+unsigned int PDataContainer::FindHandle(const string &name)
+{
+	map<string,unsigned int>::iterator i=HandleMap().find(name);
+	if (i!=HandleMap().end()) return i->second;
+	return NO_HANDLE;
+}
+
+const string &PDataContainer::GetHandleName(unsigned int handle)
+{
+	static const string unknown("unknown");
+	if (handle>=HandleNames().size()) return unknown;
+	return HandleNames()[handle];
+}
+
+PDataContainer::PDataContainer() :
+m_NumPData(0)
+{
+}
+
+PDataContainer::PDataContainer(const PDataContainer &other) :
+m_PData(other.m_PData),
+m_NumPData(other.m_NumPData)
+{
+	for (vector<PDataSlot>::iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
 	{
-		m_PData[i->first] = i->second->Copy();
+		if (i->Data!=NULL) i->Data=i->Data->Copy();
 	}
 }
 
@@ -39,26 +81,83 @@ PDataContainer::~PDataContainer()
 
 void PDataContainer::Clear()
 {
-	for (map<string,PData*>::iterator i=m_PData.begin(); i!=m_PData.end(); i++)
+	for (vector<PDataSlot>::iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
 	{
-		delete i->second;
+		delete i->Data;
 	}
+	m_PData.clear();
+	m_NumPData=0;
 }	
 
-void PDataContainer::Resize(unsigned int size)
+void PDataContainer::InsertData(unsigned int handle, PData *pd)
 {
-	for (map<string,PData*>::iterator i=m_PData.begin(); i!=m_PData.end(); i++)
+	// keep the table at most half full
+	if ((m_NumPData+1)*2>m_PData.size())
 	{
-		i->second->Resize(size);
+		vector<PDataSlot> old;
+		old.swap(m_PData);
+		m_PData.resize(old.empty()?8:old.size()*2);
+		m_NumPData=0;
+		for (vector<PDataSlot>::iterator i=old.begin(); i!=old.end(); ++i)
+		{
+			if (i->Handle!=NO_HANDLE) InsertData(i->Handle,i->Data);
+		}
 	}
+	
+	unsigned int mask=m_PData.size()-1;
+	unsigned int i=HashHandle(handle)&mask;
+	while (m_PData[i].Handle!=NO_HANDLE && m_PData[i].Handle!=handle)
+	{
+		i=(i+1)&mask;
+	}
+	
+	if (m_PData[i].Handle==NO_HANDLE) m_NumPData++;
+	m_PData[i].Handle=handle;
+	m_PData[i].Data=pd;
 }
 
+void PDataContainer::EraseData(unsigned int handle)
+{
+	if (m_PData.empty()) return;
+	unsigned int mask=m_PData.size()-1;
+	unsigned int i=HashHandle(handle)&mask;
+	while (m_PData[i].Handle!=handle)
+	{
+		if (m_PData[i].Handle==NO_HANDLE) return;
+		i=(i+1)&mask;
+	}
+	
+	m_PData[i]=PDataSlot();
+	m_NumPData--;
+	
+	// shuffle back any entries which probed past 
+	// this slot, so lookups don't stop short
+	for (unsigned int j=(i+1)&mask; m_PData[j].Handle!=NO_HANDLE; j=(j+1)&mask)
+	{
+		unsigned int home=HashHandle(m_PData[j].Handle)&mask;
+		// move it if the gap is between its home slot and here
+		if (((j-home)&mask)>=((j-i)&mask))
+		{
+			m_PData[i]=m_PData[j];
+			m_PData[j]=PDataSlot();
+			i=j;
+		}
+	}
+}
+
+void PDataContainer::Resize(unsigned int size)
+{
+	for (vector<PDataSlot>::iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
+	{
+		if (i->Data!=NULL) i->Data->Resize(size);
+	}
+}
 	
 unsigned int PDataContainer::Size() const
 {
-	if (!m_PData.empty())
+	for (vector<PDataSlot>::const_iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
 	{
-		return m_PData.begin()->second->Size();
+		if (i->Data!=NULL) return i->Data->Size();
 	}
 	
 	return 0;
@@ -66,121 +165,113 @@ unsigned int PDataContainer::Size() const
 
 bool PDataContainer::GetDataInfo(const string &name, char &type, unsigned int &size) const
 {
-	map<string,PData*>::const_iterator i=m_PData.find(name);
-	if (i==m_PData.end())
+	return GetDataInfo(FindHandle(name),type,size);
+}
+
+bool PDataContainer::GetDataInfo(unsigned int handle, char &type, unsigned int &size) const
+{
+	const PData *pd=FindData(handle);
+	if (pd==NULL)
 	{
 		return false;
 	}
 	
-	size=i->second->Size();
-	
-	//\todo: remove all this dynamic casting and store the char type inside pdata...
-	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);	
-	if (data) type='v';
-	else
-	{
-		TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(i->second);
-		if (data) type='c';
-		else 
-		{
-			TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(i->second);
-			if (data) type='f';
-			else 
-			{
-				TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(i->second);
-				if (data) type='m';
-			}
-		}
-	}
-		
+	size=pd->Size();
+	type=pd->GetType();
 	return true;
 }
 	
 void PDataContainer::AddData(const string &name, PData* pd)
 {
-	map<string,PData*>::iterator i=m_PData.find(name);
-	if (i!=m_PData.end())
+	unsigned int handle=GetHandle(name);
+	if (FindData(handle)!=NULL)
 	{
 		Trace::Stream<<"Primitive::AddData: pdata: "<<name<<" already exists"<<endl;
 		return;
 	}
 	
-	m_PData[name]=pd;
+	InsertData(handle,pd);
 }
 
 void PDataContainer::CopyData(const string &name, string newname)
 {
-	map<string,PData*>::iterator i=m_PData.find(name);
-	if (i==m_PData.end())
+	PData *pd=FindData(FindHandle(name));
+	if (pd==NULL)
 	{
 		Trace::Stream<<"Primitive::CopyData: pdata source: "<<name<<" doesn't exist"<<endl;
 		return;
 	}
 	
 	// delete the old one if it exists
-	map<string,PData*>::iterator oldi=m_PData.find(newname);
-	if (oldi!=m_PData.end())
-	{
-		delete oldi->second;
-	}
-	
-	m_PData[newname]=i->second->Copy();
+	unsigned int newhandle=GetHandle(newname);
+	delete FindData(newhandle);
+	InsertData(newhandle,pd->Copy());
 	
 	PDataDirty();
 }
 
 void PDataContainer::RemoveDataVec(const string &name)
 {
-	map<string,PData*>::iterator i=m_PData.find(name);
-	if (i==m_PData.end())
+	unsigned int handle=FindHandle(name);
+	PData *pd=FindData(handle);
+	if (pd==NULL)
 	{
 		Trace::Stream<<"Primitive::RemovePDataVec: pdata: "<<name<<" doesn't exist"<<endl;
 		return;
 	}
 	
-	delete i->second;
-	m_PData.erase(i);
+	delete pd;
+	EraseData(handle);
 }
 
 PData* PDataContainer::GetDataRaw(const string &name)
 {
-	map<string,PData*>::iterator i=m_PData.find(name);
-	if (i==m_PData.end())
-	{
-		return NULL;
-	}
-	
-	return i->second;
+	return FindData(FindHandle(name));
 }
 
 const PData* PDataContainer::GetDataRawConst(const string &name) const
 {
-	map<string,PData*>::const_iterator i=m_PData.find(name);
-	if (i==m_PData.end())
-	{
-		return NULL;
-	}
-	
-	return i->second;
+	return FindData(FindHandle(name));
 }
 
 void PDataContainer::SetDataRaw(const string &name, PData* pd)
 {
-	map<string,PData*>::iterator i=m_PData.find(name);
-	if (i==m_PData.end())
+	unsigned int handle=FindHandle(name);
+	PData *old=FindData(handle);
+	if (old==NULL)
 	{
 		Trace::Stream<<"Primitive::SetDataRaw: pdata: "<<name<<" doesn't exist"<<endl;
 		return;
 	}
-	delete i->second;
-	i->second = pd;
+	delete old;
+	InsertData(handle,pd);
 	PDataDirty();
 }
 
+void PDataContainer::SetDataDirty(const string &name)
+{
+	PData *pd=FindData(FindHandle(name));
+	if (pd!=NULL)
+	{
+		pd->SetDirty();
+	}
+}
+
+void PDataContainer::SetAllDataDirty()
+{
+	for (vector<PDataSlot>::iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
+	{
+		if (i->Data!=NULL) i->Data->SetDirty();
+	}
+}
+
 void PDataContainer::GetDataNames(vector<string> &names) const
 {
-	for (map<string,PData*>::const_iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
+	// sorted, so the order doesn't depend on the hashing
+	unsigned int start=names.size();
+	for (vector<PDataSlot>::const_iterator i=m_PData.begin(); i!=m_PData.end(); ++i)
 	{
-		names.push_back(i->first);
+		if (i->Handle!=NO_HANDLE) names.push_back(GetHandleName(i->Handle));
 	}
+	sort(names.begin()+start,names.end());
 }
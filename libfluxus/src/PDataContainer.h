@@ -18,6 +18,7 @@
 #define PDATA_CONTAINER
 
 #include <map>
+#include <string>
 #include "PData.h"
 #include "PDataOperator.h"
 #include "PDataArithmetic.h"
@@ -40,9 +41,26 @@ namespace Fluxus
 /// by this interface, the primitive need not expose it 
 /// itself at all - and we can use one common interface
 /// for all access.
+///
+/// Names are interned into handles, small numbers which 
+/// are the same for a name in every primitive. Arrays are 
+/// stored in a hash table keyed by handle, so code which 
+/// looks up the same arrays over and over can get the 
+/// handles once and skip the string lookups.
 class PDataContainer
 {
 public:
+	/// Returned when a name has never been used for any pdata
+	static const unsigned int NO_HANDLE=0xffffffff;
+	
+	/// Gets the handle for a name, making a new one if needed
+	static unsigned int GetHandle(const string &name);
+	/// Gets the handle for a name, or NO_HANDLE if no pdata 
+	/// has ever been called this
+	static unsigned int FindHandle(const string &name);
+	/// The name a handle was made from
+	static const string &GetHandleName(unsigned int handle);
+
 	PDataContainer();
 	PDataContainer(const PDataContainer &other);
 	virtual ~PDataContainer();
@@ -61,8 +79,10 @@ public:
 	
 	/// Retrieves a pointer to the internal vector by name
 	/// Returns NULL if it doesn't exist, or is not the 
-	/// type given in the template call.
+	/// type given in the template call. If you write 
+	/// to the vector, mark it with SetDataDirty() 
 	template<class T> vector<T,FLX_ALLOC(T) >* GetDataVec(const string &name);      
+	template<class T> vector<T,FLX_ALLOC(T) >* GetDataVec(unsigned int handle);      
 	
 	/// Destroys a pdata array
 	void RemoveDataVec(const string &name);
@@ -70,27 +90,39 @@ public:
 	/// From the supplied name, fills in information about this pdata,
 	/// returns false if it doesn't actually exist
 	bool GetDataInfo(const string &name, char &type, unsigned int &size) const;
+	bool GetDataInfo(unsigned int handle, char &type, unsigned int &size) const;
 	
 	/// Sets an element of the array. Not checked, for 
 	/// speed - use GetDataInfo() to check
 	template<class T> void SetData(const string &name, unsigned int index, T s);
+	template<class T> void SetData(unsigned int handle, unsigned int index, T s);
 	
 	/// Gets an element of the array. Not checked, for 
 	/// speed - use GetDataInfo() to check
 	template<class T> T GetData(const string &name, unsigned int index) const;
+	template<class T> T GetData(unsigned int handle, unsigned int index) const;
 		
 	/// Runs a pdata operation on the given pdata array
 	template<class T> PData *DataOp(const string &op, const string &name, T operand);
 	
 	/// Gets the whole pdata array, returns NULL if it doesn't exist
 	PData* GetDataRaw(const string &name);
+	PData* GetDataRaw(unsigned int handle) { return FindData(handle); }
 
 	/// Gets the whole const pdata array, returns NULL if it doesn't exist
 	const PData* GetDataRawConst(const string &name) const;
+	const PData* GetDataRawConst(unsigned int handle) const { return FindData(handle); }
 	
 	/// Sets the whole pdata array
 	void SetDataRaw(const string &name, PData* pd);
 	
+	/// Marks a pdata array as changed, for when it's been 
+	/// written to directly rather than with SetData()
+	void SetDataDirty(const string &name);
+	
+	/// Marks all the pdata arrays as changed
+	void SetAllDataDirty();
+	
 	/// Maps the name of a pdata operator to the actual object, all pdata ops
 	/// need to be registered inside this function (see below)
 	template <class S, class T> PData *FindOperate(const string &name, TypedPData<S> *a, T b);
@@ -109,39 +141,93 @@ protected:
 	/// Called when a named pdata mapping changes 
 	virtual void PDataDirty()=0;
 	
-	///Todo: no const [] for m_PData[name] so m_PData has to be mutable??? (see below)
-	///\todo replace with a hashmap?
-	mutable map<string,PData*> m_PData;
-
+	/// A slot in the hash table, empty slots 
+	/// have a handle of NO_HANDLE
+	struct PDataSlot
+	{
+		PDataSlot() : Handle(NO_HANDLE), Data(NULL) {}
+		unsigned int Handle;
+		PData *Data;
+	};
+	
+	/// Open addressed with linear probing, the size is
+	/// always a power of two
+	vector<PDataSlot> m_PData;
+	
+	PData *FindData(unsigned int handle) const
+	{
+		if (m_PData.empty() || handle==NO_HANDLE) return NULL;
+		unsigned int mask=m_PData.size()-1;
+		for (unsigned int i=HashHandle(handle)&mask; ; i=(i+1)&mask)
+		{
+			if (m_PData[i].Handle==handle) return m_PData[i].Data;
+			if (m_PData[i].Handle==NO_HANDLE) return NULL;
+		}
+	}
+	
+private:
+	static unsigned int HashHandle(unsigned int handle) { return handle*2654435761u; }
+	/// Adds or replaces the array for a handle, the 
+	/// old array isn't deleted
+	void InsertData(unsigned int handle, PData *pd);
+	void EraseData(unsigned int handle);
+	
+	unsigned int m_NumPData;
 };
 
 template<class T> 
 void PDataContainer::SetData(const string &name, unsigned int index, T s)	
 {
-	static_cast<TypedPData<T>*>(m_PData[name])->m_Data[index]=s;
+	SetData<T>(FindHandle(name),index,s);
+}
+
+template<class T> 
+void PDataContainer::SetData(unsigned int handle, unsigned int index, T s)	
+{
+	PData *pd=FindData(handle);
+	static_cast<TypedPData<T>*>(pd)->m_Data[index]=s;
+	pd->SetDirty(index);
 }
 
-///Todo: no const [] for m_PData[name] so m_PData has to be mutable???
 template<class T> 
 T PDataContainer::GetData(const string &name, unsigned int index) const
 {
-	return static_cast<TypedPData<T>*>(m_PData[name])->m_Data[index];
+	return GetData<T>(FindHandle(name),index);
+}
+
+template<class T> 
+T PDataContainer::GetData(unsigned int handle, unsigned int index) const
+{
+	return static_cast<TypedPData<T>*>(FindData(handle))->m_Data[index];
 }
 
 template<class T>
 vector<T,FLX_ALLOC(T) >* PDataContainer::GetDataVec(const string &name)
 {
-	map<string,PData*>::iterator i=m_PData.find(name);
-	if (i==m_PData.end())
+	// a lookup shouldn't make a handle for a name that isn't used
+	unsigned int handle=FindHandle(name);
+	if (handle==NO_HANDLE)
 	{
 		Trace::Stream<<"Primitive::GetPDataVec: pdata: "<<name<<" doesn't exists"<<endl;
 		return NULL;
 	}
+	return GetDataVec<T>(handle);
+}
+
+template<class T>
+vector<T,FLX_ALLOC(T) >* PDataContainer::GetDataVec(unsigned int handle)
+{
+	PData *pd=FindData(handle);
+	if (pd==NULL)
+	{
+		Trace::Stream<<"Primitive::GetPDataVec: pdata: "<<GetHandleName(handle)<<" doesn't exists"<<endl;
+		return NULL;
+	}
 	
-	TypedPData<T> *ptr=dynamic_cast<TypedPData<T> *>(i->second);
+	TypedPData<T> *ptr=dynamic_cast<TypedPData<T> *>(pd);
 	if (!ptr) 
 	{
-		Trace::Stream<<"Primitive::GetPDataVec: pdata: "<<name<<" is not of type: "<<typeid(TypedPData<T>).name()<<endl;
+		Trace::Stream<<"Primitive::GetPDataVec: pdata: "<<GetHandleName(handle)<<" is not of type: "<<typeid(TypedPData<T>).name()<<endl;
 		return NULL;
 	}
 	
@@ -151,32 +237,36 @@ vector<T,FLX_ALLOC(T) >* PDataContainer::GetDataVec(const string &name)
 template<class T>
 PData *PDataContainer::DataOp(const string &op, const string &name, T operand)
 {
-	map<string,PData*>::iterator i=m_PData.find(name);
-	if (i==m_PData.end())
+	PData *pd=FindData(FindHandle(name));
+	if (pd==NULL)
 	{
 		Trace::Stream<<"Primitive::DataOp: pdata: "<<name<<" doesn't exists"<<endl;
 		return NULL;
 	}
 	
-	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);	
-	if (data) return FindOperate<dVector,T>(op, data, operand);
+	PData *ret=NULL;
+	TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(pd);	
+	if (data) ret=FindOperate<dVector,T>(op, data, operand);
 	else
 	{
-		TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(i->second);
-		if (data) return FindOperate<dColour, T>(op, data, operand);
+		TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(pd);
+		if (data) ret=FindOperate<dColour, T>(op, data, operand);
 		else 
 		{
-			TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(i->second);
-			if (data) return FindOperate<float, T>(op, data, operand);
+			TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(pd);
+			if (data) ret=FindOperate<float, T>(op, data, operand);
 			else 
 			{
-				TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(i->second);
-				if (data) return FindOperate<dMatrix, T>(op, data, operand);
+				TypedPData<dMatrix> *data = dynamic_cast<TypedPData<dMatrix>*>(pd);
+				if (data) ret=FindOperate<dMatrix, T>(op, data, operand);
 			}
 		}
 	}
 	
-	return NULL;
+	// operators which work in place don't return anything
+	if (ret==NULL) pd->SetDirty();
+	
+	return ret;
 }
 
 template <class S, class T>
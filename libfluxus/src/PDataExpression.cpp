@@ -0,0 +1,490 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <string.h>
+#include <math.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "PDataExpression.h"
+#include "Noise.h"
+#include "Trace.h"
+#include "JobPool.h"
+
+using namespace Fluxus;
+
+// elements worked on at a time, small enough that the 
+// registers for a whole expression stay in the cache
+static const unsigned int BLOCK_SIZE=128;
+
+const unsigned int PDataExpression::NO_VALUE;
+
+//////////////////////////////////////////////////////////
+// the kernels, these work on n elements of 4 floats
+
+#ifdef __SSE__
+
+#define LANEWISE(NAME, EXPR) \
+static inline void NAME(float *d, const float *a, const float *b, unsigned int n) \
+{ \
+	for (unsigned int i=0; i<n*4; i+=4) \
+	{ \
+		__m128 x=_mm_loadu_ps(a+i); \
+		__m128 y=_mm_loadu_ps(b+i); \
+		_mm_storeu_ps(d+i,EXPR); \
+	} \
+}
+
+LANEWISE(Add,_mm_add_ps(x,y))
+LANEWISE(Sub,_mm_sub_ps(x,y))
+LANEWISE(Mul,_mm_mul_ps(x,y))
+LANEWISE(Div,_mm_div_ps(x,y))
+LANEWISE(Min,_mm_min_ps(x,y))
+LANEWISE(Max,_mm_max_ps(x,y))
+
+static inline void MulAdd(float *d, const float *a, const float *b, const float *c, unsigned int n)
+{
+	for (unsigned int i=0; i<n*4; i+=4)
+	{
+		_mm_storeu_ps(d+i,_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a+i),_mm_loadu_ps(b+i)),_mm_loadu_ps(c+i)));
+	}
+}
+
+static inline void Lerp(float *d, const float *a, const float *b, const float *t, unsigned int n)
+{
+	for (unsigned int i=0; i<n*4; i+=4)
+	{
+		__m128 x=_mm_loadu_ps(a+i);
+		_mm_storeu_ps(d+i,_mm_add_ps(x,_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b+i),x),_mm_loadu_ps(t+i))));
+	}
+}
+
+static inline void Clamp(float *d, const float *a, const float *lo, const float *hi, unsigned int n)
+{
+	for (unsigned int i=0; i<n*4; i+=4)
+	{
+		_mm_storeu_ps(d+i,_mm_min_ps(_mm_max_ps(_mm_loadu_ps(a+i),_mm_loadu_ps(lo+i)),_mm_loadu_ps(hi+i)));
+	}
+}
+
+static inline void Transform(float *d, const dMatrix &m, const float *a)
+{
+	__m128 r=_mm_mul_ps(_mm_load1_ps(a),_mm_loadu_ps(m.m[0]));
+	r=_mm_add_ps(r,_mm_mul_ps(_mm_load1_ps(a+1),_mm_loadu_ps(m.m[1])));
+	r=_mm_add_ps(r,_mm_mul_ps(_mm_load1_ps(a+2),_mm_loadu_ps(m.m[2])));
+	r=_mm_add_ps(r,_mm_mul_ps(_mm_load1_ps(a+3),_mm_loadu_ps(m.m[3])));
+	_mm_storeu_ps(d,r);
+}
+
+#else
+
+#define LANEWISE(NAME, EXPR) \
+static inline void NAME(float *d, const float *a, const float *b, unsigned int n) \
+{ \
+	for (unsigned int i=0; i<n*4; i++) \
+	{ \
+		float x=a[i], y=b[i]; \
+		d[i]=EXPR; \
+	} \
+}
+
+LANEWISE(Add,x+y)
+LANEWISE(Sub,x-y)
+LANEWISE(Mul,x*y)
+LANEWISE(Div,x/y)
+LANEWISE(Min,x<y?x:y)
+LANEWISE(Max,x>y?x:y)
+
+static inline void MulAdd(float *d, const float *a, const float *b, const float *c, unsigned int n)
+{
+	for (unsigned int i=0; i<n*4; i++) d[i]=a[i]*b[i]+c[i];
+}
+
+static inline void Lerp(float *d, const float *a, const float *b, const float *t, unsigned int n)
+{
+	for (unsigned int i=0; i<n*4; i++) d[i]=a[i]+(b[i]-a[i])*t[i];
+}
+
+static inline void Clamp(float *d, const float *a, const float *lo, const float *hi, unsigned int n)
+{
+	for (unsigned int i=0; i<n*4; i++) 
+	{
+		float x=a[i]>lo[i]?a[i]:lo[i];
+		d[i]=x<hi[i]?x:hi[i];
+	}
+}
+
+static inline void Transform(float *d, const dMatrix &m, const float *a)
+{
+	for (unsigned int i=0; i<4; i++)
+	{
+		d[i]=a[0]*m.m[0][i]+a[1]*m.m[1][i]+a[2]*m.m[2][i]+a[3]*m.m[3][i];
+	}
+}
+
+#endif
+
+static inline void Broadcast(float *d, float v)
+{
+	d[0]=d[1]=d[2]=d[3]=v;
+}
+
+//////////////////////////////////////////////////////////
+
+PDataExpression::PDataExpression() :
+m_UsesNoise(false)
+{
+}
+
+PDataExpression::~PDataExpression()
+{
+}
+
+void PDataExpression::Clear()
+{
+	m_Values.clear();
+	m_Constants.clear();
+	m_Matrices.clear();
+	m_UsesNoise=false;
+}
+
+bool PDataExpression::FindOp(const string &name, Op &op)
+{
+	if (name=="add" || name=="+") op=ADD;
+	else if (name=="sub" || name=="-") op=SUB;
+	else if (name=="mul" || name=="*") op=MUL;
+	else if (name=="div" || name=="/") op=DIV;
+	else if (name=="min") op=MIN;
+	else if (name=="max") op=MAX;
+	else if (name=="madd") op=MADD;
+	else if (name=="lerp") op=LERP;
+	else if (name=="clamp") op=CLAMP;
+	else if (name=="dot") op=DOT;
+	else if (name=="cross") op=CROSS;
+	else if (name=="mag") op=MAG;
+	else if (name=="normalise" || name=="normalize") op=NORMALISE;
+	else if (name=="noise") op=NOISE;
+	else if (name=="sin") op=SIN;
+	else if (name=="cos") op=COS;
+	else if (name=="transform") op=TRANSFORM;
+	else return false;
+	return true;
+}
+
+unsigned int PDataExpression::NumArgs(Op op)
+{
+	switch (op)
+	{
+		case MAG: case NORMALISE: case NOISE: case SIN: case COS: return 1;
+		case MADD: case LERP: case CLAMP: return 3;
+		default: return 2;
+	}
+}
+
+unsigned int PDataExpression::AddInput(PData *pd)
+{
+	if (pd==NULL || (pd->GetType()!='f' && pd->GetType()!='v' && 
+	                 pd->GetType()!='c' && pd->GetType()!='m'))
+	{
+		Trace::Stream<<"PDataExpression::AddInput: unsupported pdata"<<endl;
+		return NO_VALUE;
+	}
+	
+	Value v;
+	v.ValueKind=INPUT;
+	v.Input=pd;
+	m_Values.push_back(v);
+	return m_Values.size()-1;
+}
+
+unsigned int PDataExpression::AddConstant(const dColour &c)
+{
+	Value v;
+	v.ValueKind=CONSTANT;
+	v.Index=m_Constants.size();
+	m_Constants.push_back(c);
+	m_Values.push_back(v);
+	return m_Values.size()-1;
+}
+
+unsigned int PDataExpression::AddMatrix(const dMatrix &m)
+{
+	Value v;
+	v.ValueKind=MATRIX;
+	v.Index=m_Matrices.size();
+	m_Matrices.push_back(m);
+	m_Values.push_back(v);
+	return m_Values.size()-1;
+}
+
+bool PDataExpression::IsMatrix(unsigned int value) const
+{
+	const Value &v=m_Values[value];
+	return v.ValueKind==MATRIX || (v.ValueKind==INPUT && v.Input->GetType()=='m');
+}
+
+unsigned int PDataExpression::AddOp(Op op, const vector<unsigned int> &args)
+{
+	if (args.size()!=NumArgs(op))
+	{
+		Trace::Stream<<"PDataExpression::AddOp: operator takes "<<NumArgs(op)<<" arguments"<<endl;
+		return NO_VALUE;
+	}
+
+	Value v;
+	v.ValueKind=OPERATOR;
+	v.Operator=op;
+	for (unsigned int n=0; n<args.size(); n++)
+	{
+		if (args[n]>=m_Values.size())
+		{
+			Trace::Stream<<"PDataExpression::AddOp: bad argument"<<endl;
+			return NO_VALUE;
+		}
+		
+		// matrices can only be used to transform things
+		if (IsMatrix(args[n])!=(op==TRANSFORM && n==0))
+		{
+			Trace::Stream<<"PDataExpression::AddOp: matrices can only be the first argument to transform"<<endl;
+			return NO_VALUE;
+		}
+		v.Args[n]=args[n];
+	}
+	
+	if (op==NOISE) m_UsesNoise=true;
+	m_Values.push_back(v);
+	return m_Values.size()-1;
+}
+
+void PDataExpression::RunBlock(unsigned int start, unsigned int count, float *registers) const
+{
+	const unsigned int regsize=BLOCK_SIZE*4;
+	for (unsigned int i=0; i<m_Values.size(); i++)
+	{
+		const Value &v=m_Values[i];
+		float *d=registers+i*regsize;
+		
+		if (v.ValueKind==INPUT)
+		{
+			switch (v.Input->GetType())
+			{
+				case 'f':
+				{
+					const float *src=(const float*)v.Input->GetRawData()+start;
+					for (unsigned int n=0; n<count; n++) Broadcast(d+n*4,src[n]);
+				}
+				break;
+				case 'v': 
+				case 'c':
+					memcpy(d,(const float*)v.Input->GetRawData()+start*4,count*4*sizeof(float));
+				break;
+				// matrices are read straight from the pdata by transform
+			}
+			continue;
+		}
+		
+		if (v.ValueKind!=OPERATOR) continue;
+		
+		const float *a=registers+v.Args[0]*regsize;
+		const float *b=registers+v.Args[1]*regsize;
+		const float *c=registers+v.Args[2]*regsize;
+		
+		switch (v.Operator)
+		{
+			case ADD: Add(d,a,b,count); break;
+			case SUB: Sub(d,a,b,count); break;
+			case MUL: Mul(d,a,b,count); break;
+			case DIV: Div(d,a,b,count); break;
+			case MIN: Min(d,a,b,count); break;
+			case MAX: Max(d,a,b,count); break;
+			case MADD: MulAdd(d,a,b,c,count); break;
+			case LERP: Lerp(d,a,b,c,count); break;
+			case CLAMP: Clamp(d,a,b,c,count); break;
+			case DOT:
+				for (unsigned int n=0; n<count*4; n+=4)
+				{
+					Broadcast(d+n,a[n]*b[n]+a[n+1]*b[n+1]+a[n+2]*b[n+2]);
+				}
+			break;
+			case CROSS:
+				for (unsigned int n=0; n<count*4; n+=4)
+				{
+					float x=a[n+1]*b[n+2]-a[n+2]*b[n+1];
+					float y=a[n+2]*b[n]-a[n]*b[n+2];
+					float z=a[n]*b[n+1]-a[n+1]*b[n];
+					d[n]=x; d[n+1]=y; d[n+2]=z; d[n+3]=a[n+3];
+				}
+			break;
+			case MAG:
+				for (unsigned int n=0; n<count*4; n+=4)
+				{
+					Broadcast(d+n,sqrtf(a[n]*a[n]+a[n+1]*a[n+1]+a[n+2]*a[n+2]));
+				}
+			break;
+			case NORMALISE:
+				for (unsigned int n=0; n<count*4; n+=4)
+				{
+					float mag=sqrtf(a[n]*a[n]+a[n+1]*a[n+1]+a[n+2]*a[n+2]);
+					float s=mag>0?1/mag:0;
+					d[n]=a[n]*s; d[n+1]=a[n+1]*s; d[n+2]=a[n+2]*s; d[n+3]=a[n+3];
+				}
+			break;
+			case NOISE:
+				for (unsigned int n=0; n<count*4; n+=4)
+				{
+					Broadcast(d+n,Noise::noise(a[n],a[n+1],a[n+2]));
+				}
+			break;
+			case SIN: for (unsigned int n=0; n<count*4; n++) d[n]=sinf(a[n]); break;
+			case COS: for (unsigned int n=0; n<count*4; n++) d[n]=cosf(a[n]); break;
+			case TRANSFORM:
+			{
+				const Value &m=m_Values[v.Args[0]];
+				if (m.ValueKind==MATRIX)
+				{
+					const dMatrix &mat=m_Matrices[m.Index];
+					for (unsigned int n=0; n<count; n++) Transform(d+n*4,mat,b+n*4);
+				}
+				else
+				{
+					const dMatrix *mats=(const dMatrix*)m.Input->GetRawData()+start;
+					for (unsigned int n=0; n<count; n++) Transform(d+n*4,mats[n],b+n*4);
+				}
+			}
+			break;
+		}
+	}
+}
+
+void PDataExpression::RunRange(PData *dst, unsigned int result, unsigned int start, 
+                               unsigned int end, float *registers) const
+{
+	const unsigned int regsize=BLOCK_SIZE*4;
+
+	// constants are filled in once
+	for (unsigned int i=0; i<m_Values.size(); i++)
+	{
+		if (m_Values[i].ValueKind==CONSTANT)
+		{
+			const dColour &c=m_Constants[m_Values[i].Index];
+			float *d=registers+i*regsize;
+			for (unsigned int n=0; n<BLOCK_SIZE; n++) memcpy(d+n*4,c.arr(),4*sizeof(float));
+		}
+	}
+
+	char type=dst->GetType();
+	float *out=(float*)dst->GetRawData();
+	const float *r=registers+result*regsize;
+	for (unsigned int s=start; s<end; s+=BLOCK_SIZE)
+	{
+		unsigned int count=min(BLOCK_SIZE,end-s);
+		RunBlock(s,count,registers);
+		
+		switch (type)
+		{
+			case 'f': 
+				for (unsigned int n=0; n<count; n++) out[s+n]=r[n*4]; 
+			break;
+			case 'v': 
+				// leave w alone
+				for (unsigned int n=0; n<count; n++) 
+				{
+					float *d=out+(s+n)*4;
+					d[0]=r[n*4]; d[1]=r[n*4+1]; d[2]=r[n*4+2];
+				}
+			break;
+			case 'c': 
+				memcpy(out+s*4,r,count*4*sizeof(float)); 
+			break;
+		}
+	}
+}
+
+struct ExpressionJob
+{
+	const PDataExpression *Expression;
+	PData *Dst;
+	unsigned int Result,Start,End;
+	vector<float> Registers;
+};
+
+void *PDataExpression::RunThread(void *data)
+{
+	ExpressionJob *job=(ExpressionJob*)data;
+	job->Expression->RunRange(job->Dst,job->Result,job->Start,job->End,&job->Registers[0]);
+	return NULL;
+}
+
+bool PDataExpression::Run(PData *dst, unsigned int result)
+{
+	if (dst==NULL || (dst->GetType()!='f' && dst->GetType()!='v' && dst->GetType()!='c'))
+	{
+		Trace::Stream<<"PDataExpression::Run: can only write to float, vector or colour pdata"<<endl;
+		return false;
+	}
+	
+	if (result>=m_Values.size() || IsMatrix(result))
+	{
+		Trace::Stream<<"PDataExpression::Run: bad result"<<endl;
+		return false;
+	}
+	
+	unsigned int size=dst->Size();
+	for (vector<Value>::iterator i=m_Values.begin(); i!=m_Values.end(); ++i)
+	{
+		if (i->ValueKind==INPUT && i->Input->Size()!=size)
+		{
+			Trace::Stream<<"PDataExpression::Run: pdata sizes don't match"<<endl;
+			return false;
+		}
+	}
+	
+	if (size==0) return true;
+	
+	// the noise tables are made on first use
+	if (m_UsesNoise) Noise::noise(0,0,0);
+
+	unsigned int regsize=m_Values.size()*BLOCK_SIZE*4;
+	unsigned int numthreads=JobPool::Get()->GetNumThreads();
+	
+	if (size<=THREADED_SIZE || numthreads==1)
+	{
+		if (m_Registers.size()<regsize) m_Registers.resize(regsize);
+		RunRange(dst,result,0,size,&m_Registers[0]);
+	}
+	else
+	{
+		ExpressionJob jobs[JobPool::MAX_THREADS];
+		// keep the slices whole blocks
+		unsigned int slice=((size/numthreads)/BLOCK_SIZE+1)*BLOCK_SIZE;
+		unsigned int started=0;
+		for (unsigned int t=0; t<numthreads && t*slice<size; t++)
+		{
+			jobs[t].Expression=this;
+			jobs[t].Dst=dst;
+			jobs[t].Result=result;
+			jobs[t].Start=t*slice;
+			jobs[t].End=min(size,(t+1)*slice);
+			jobs[t].Registers.resize(regsize);
+			started++;
+		}
+		JobPool::Get()->RunEach(RunThread,jobs,started);
+	}
+	
+	dst->SetDirty();
+	return true;
+}
@@ -0,0 +1,124 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_PDATA_EXPRESSION
+#define N_PDATA_EXPRESSION
+
+#include <vector>
+#include <string>
+#include "PData.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// An expression over whole pdata arrays and constants, which
+/// is run over all the elements in one go and written into a
+/// pdata array. Unlike the pdata operators, no temporary arrays
+/// are made - the expression is worked through for a block of 
+/// elements at a time, so chaining lots of operations together 
+/// costs one pass over the arrays. Every value is held as 4 
+/// floats (scalars are copied into all four), so the simple 
+/// operators work on a whole element with one SSE instruction.
+/// Big arrays are split over threads.
+///
+/// Values are added in order, and the arguments of an operator
+/// need to be added before it.
+class PDataExpression
+{
+public:
+	PDataExpression();
+	~PDataExpression();
+
+	enum Op 
+	{
+		ADD, SUB, MUL, DIV, MIN, MAX, 
+		MADD,      ///< a*b+c
+		LERP,      ///< a+(b-a)*t
+		CLAMP,     ///< a clamped between b and c
+		DOT, CROSS, MAG, NORMALISE, 
+		NOISE,     ///< perlin noise at a position
+		SIN, COS, 
+		TRANSFORM  ///< transform a vector by a matrix
+	};
+	
+	/// Returned when a value can't be added
+	static const unsigned int NO_VALUE=0xffffffff;
+
+	/// Removes all the values, but keeps the memory
+	void Clear();
+	
+	/// Finds an operator from its name, returns false if there is none
+	static bool FindOp(const string &name, Op &op);
+	/// The number of arguments an operator takes
+	static unsigned int NumArgs(Op op);
+
+	///////////////////////////////////////////////
+	///@name Values
+	/// These return the number of the value added,
+	/// to be used as an argument to operators 
+	///@{
+	/// A pdata array, of any type
+	unsigned int AddInput(PData *pd);
+	/// A constant, numbers should be given in all four
+	unsigned int AddConstant(const dColour &c);
+	/// A constant matrix, only for TRANSFORM
+	unsigned int AddMatrix(const dMatrix &m);
+	/// Reports errors and returns NO_VALUE if the 
+	/// arguments don't suit the operator
+	unsigned int AddOp(Op op, const vector<unsigned int> &args);
+	///@}
+
+	/// Runs the expression for every element, and writes
+	/// the value given into the destination array, which
+	/// may also be one of the inputs. The inputs need to 
+	/// be the same size as the destination
+	bool Run(PData *dst, unsigned int result);
+	
+	/// Arrays bigger than this are split over threads
+	static const unsigned int THREADED_SIZE=65536;
+
+private:
+	enum Kind { INPUT, CONSTANT, MATRIX, OPERATOR };
+
+	struct Value
+	{
+		Kind ValueKind;
+		Op Operator;
+		PData *Input;
+		unsigned int Index;      ///< for constants and matrices
+		unsigned int Args[3];
+	};
+	
+	bool IsMatrix(unsigned int value) const;
+	void RunRange(PData *dst, unsigned int result, unsigned int start, 
+	              unsigned int end, float *registers) const;
+	void RunBlock(unsigned int start, unsigned int count, float *registers) const;
+	static void *RunThread(void *data);
+	
+	vector<Value> m_Values;
+	vector<dColour> m_Constants;
+	vector<dMatrix> m_Matrices;
+	vector<float> m_Registers;
+	bool m_UsesNoise;
+};
+
+}
+
+#endif
@@ -0,0 +1,360 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <cstring>
+#include "PolyPrimitive.h"
+#include "PLYPrimitiveIO.h"
+#include "MappedFile.h"
+#include "TextParse.h"
+#include "Trace.h"
+
+using namespace Fluxus;
+
+PLYPrimitiveIO::PLYPrimitiveIO() :
+m_Format(ASCII),
+m_Swap(false)
+{
+	for (unsigned int i=0; i<NUM_TARGETS; i++) m_HasTarget[i]=false;
+}
+
+PLYPrimitiveIO::~PLYPrimitiveIO()
+{
+}
+
+Primitive *PLYPrimitiveIO::FormatRead(const string &filename)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		Trace::Stream<<"Cannot open .ply file: "<<filename<<endl;
+		return NULL;
+	}
+
+	const char *pos=file.Data();
+	const char *end=file.End();
+	if (!ReadHeader(pos,end))
+	{
+		Trace::Stream<<"Bad header in .ply file: "<<filename<<endl;
+		return NULL;
+	}
+
+	for (vector<Element>::iterator i=m_Elements.begin(); i!=m_Elements.end(); ++i)
+	{
+		if (!ReadElement(pos,end,*i))
+		{
+			Trace::Stream<<"Unexpected end of .ply file: "<<filename<<endl;
+			return NULL;
+		}
+	}
+	file.Close();
+
+	// remove triangles pointing outside the vertices
+	unsigned int out=0;
+	for (unsigned int i=0; i+2<m_Indices.size(); i+=3)
+	{
+		if (m_Indices[i]<m_Position.size() &&
+			m_Indices[i+1]<m_Position.size() &&
+			m_Indices[i+2]<m_Position.size())
+		{
+			m_Indices[out++]=m_Indices[i];
+			m_Indices[out++]=m_Indices[i+1];
+			m_Indices[out++]=m_Indices[i+2];
+		}
+	}
+	if (out<m_Indices.size())
+	{
+		Trace::Stream<<"Ignoring "<<(m_Indices.size()-out)/3<<" triangles with bad indices in .ply file"<<endl;
+		m_Indices.resize(out);
+	}
+
+	if (m_Indices.empty())
+	{
+		Trace::Stream<<"ply file needs to contain faces: "<<filename<<endl;
+		return NULL;
+	}
+
+	return MakePrimitive();
+}
+
+bool PLYPrimitiveIO::FormatWrite(const std::string &filename, const Primitive *ob, unsigned id,
+		const SceneGraph &world)
+{
+	Trace::Stream<<"Saving .ply files is not supported"<<endl;
+	return false;
+}
+
+Primitive *PLYPrimitiveIO::MakePrimitive()
+{
+	PolyPrimitive *prim = new PolyPrimitive(PolyPrimitive::TRILIST);
+	prim->Resize(m_Position.size());
+
+	static_cast<TypedPData<dVector>*>(prim->GetDataRaw("p"))->m_Data.swap(m_Position);
+
+	if (m_HasTarget[NX] || m_HasTarget[NY] || m_HasTarget[NZ])
+	{
+		static_cast<TypedPData<dVector>*>(prim->GetDataRaw("n"))->m_Data.swap(m_Normal);
+	}
+
+	if (m_HasTarget[TU] || m_HasTarget[TV])
+	{
+		static_cast<TypedPData<dVector>*>(prim->GetDataRaw("t"))->m_Data.swap(m_Texture);
+	}
+
+	if (m_HasTarget[CR] || m_HasTarget[CG] || m_HasTarget[CB] || m_HasTarget[CA])
+	{
+		static_cast<TypedPData<dColour>*>(prim->GetDataRaw("c"))->m_Data.swap(m_Colour);
+	}
+
+	prim->GetIndex().swap(m_Indices);
+	prim->SetIndexMode(true);
+	return prim;
+}
+
+bool PLYPrimitiveIO::ReadHeader(const char *&pos, const char *end)
+{
+	const char *word;
+	unsigned int len=ReadWord(pos,end,word);
+	if (!WordIs(word,len,"ply")) return false;
+	SkipLine(pos,end);
+
+	unsigned short one=1;
+	bool littleendian=*(unsigned char*)&one==1;
+
+	m_Elements.clear();
+	while (pos<end)
+	{
+		len=ReadWord(pos,end,word);
+		if (WordIs(word,len,"end_header"))
+		{
+			SkipLine(pos,end);
+			return true;
+		}
+		else if (WordIs(word,len,"format"))
+		{
+			len=ReadWord(pos,end,word);
+			if (WordIs(word,len,"ascii")) m_Format=ASCII;
+			else if (WordIs(word,len,"binary_little_endian")) m_Format=BINARY_LITTLE_ENDIAN;
+			else if (WordIs(word,len,"binary_big_endian")) m_Format=BINARY_BIG_ENDIAN;
+			else return false;
+			m_Swap=(m_Format==BINARY_LITTLE_ENDIAN && !littleendian) ||
+				   (m_Format==BINARY_BIG_ENDIAN && littleendian);
+		}
+		else if (WordIs(word,len,"element"))
+		{
+			Element element;
+			len=ReadWord(pos,end,word);
+			element.Name=string(word,len);
+			SkipSpace(pos,end);
+			int count=0;
+			if (!ParseInt(pos,end,count) || count<0) return false;
+			element.Count=count;
+			m_Elements.push_back(element);
+		}
+		else if (WordIs(word,len,"property"))
+		{
+			if (m_Elements.empty()) return false;
+			Element &element=*m_Elements.rbegin();
+			Property property;
+			property.CountType=NONE;
+			len=ReadWord(pos,end,word);
+			if (WordIs(word,len,"list"))
+			{
+				len=ReadWord(pos,end,word);
+				property.CountType=ParseType(word,len);
+				if (property.CountType==NONE) return false;
+				len=ReadWord(pos,end,word);
+			}
+			property.Type=ParseType(word,len);
+			if (property.Type==NONE) return false;
+			len=ReadWord(pos,end,word);
+			property.Dest=ParseTarget(element.Name,word,len);
+			// only the face indices can be lists
+			if ((property.CountType!=NONE)!=(property.Dest==INDICES)) property.Dest=UNUSED;
+			if (property.Dest!=UNUSED) m_HasTarget[property.Dest]=true;
+			element.Properties.push_back(property);
+		}
+		// comments and anything else we don't know about are skipped
+		SkipLine(pos,end);
+	}
+	return false;
+}
+
+PLYPrimitiveIO::ValueType PLYPrimitiveIO::ParseType(const char *word, unsigned int len)
+{
+	if (WordIs(word,len,"char") || WordIs(word,len,"int8")) return INT8;
+	if (WordIs(word,len,"uchar") || WordIs(word,len,"uint8")) return UINT8;
+	if (WordIs(word,len,"short") || WordIs(word,len,"int16")) return INT16;
+	if (WordIs(word,len,"ushort") || WordIs(word,len,"uint16")) return UINT16;
+	if (WordIs(word,len,"int") || WordIs(word,len,"int32")) return INT32;
+	if (WordIs(word,len,"uint") || WordIs(word,len,"uint32")) return UINT32;
+	if (WordIs(word,len,"float") || WordIs(word,len,"float32")) return FLOAT32;
+	if (WordIs(word,len,"double") || WordIs(word,len,"float64")) return FLOAT64;
+	return NONE;
+}
+
+PLYPrimitiveIO::Target PLYPrimitiveIO::ParseTarget(const string &element, const char *word, unsigned int len)
+{
+	if (element=="vertex")
+	{
+		if (WordIs(word,len,"x")) return PX;
+		if (WordIs(word,len,"y")) return PY;
+		if (WordIs(word,len,"z")) return PZ;
+		if (WordIs(word,len,"nx")) return NX;
+		if (WordIs(word,len,"ny")) return NY;
+		if (WordIs(word,len,"nz")) return NZ;
+		if (WordIs(word,len,"u") || WordIs(word,len,"s") ||
+			WordIs(word,len,"texture_u") || WordIs(word,len,"texture_s")) return TU;
+		if (WordIs(word,len,"v") || WordIs(word,len,"t") ||
+			WordIs(word,len,"texture_v") || WordIs(word,len,"texture_t")) return TV;
+		if (WordIs(word,len,"red") || WordIs(word,len,"diffuse_red")) return CR;
+		if (WordIs(word,len,"green") || WordIs(word,len,"diffuse_green")) return CG;
+		if (WordIs(word,len,"blue") || WordIs(word,len,"diffuse_blue")) return CB;
+		if (WordIs(word,len,"alpha")) return CA;
+	}
+	else if (element=="face")
+	{
+		if (WordIs(word,len,"vertex_indices") || WordIs(word,len,"vertex_index")) return INDICES;
+	}
+	return UNUSED;
+}
+
+bool PLYPrimitiveIO::ReadValue(const char *&pos, const char *end, ValueType type, double &out)
+{
+	if (m_Format==ASCII)
+	{
+		// values can be split over lines however the file likes
+		while (pos<end && (*pos==' ' || *pos=='\t' || *pos=='\r' || *pos=='\n')) pos++;
+		if (type==FLOAT32 || type==FLOAT64)
+		{
+			float f;
+			if (!ParseFloat(pos,end,f)) return false;
+			out=f;
+		}
+		else
+		{
+			int i;
+			if (!ParseInt(pos,end,i)) return false;
+			out=i;
+		}
+		return true;
+	}
+
+	static const unsigned int sizes[] = {0,1,1,2,2,4,4,4,8};
+	unsigned int size=sizes[type];
+	if (pos+size>end) return false;
+
+	unsigned char buf[8];
+	if (m_Swap)
+	{
+		for (unsigned int i=0; i<size; i++) buf[i]=pos[size-1-i];
+	}
+	else
+	{
+		memcpy(buf,pos,size);
+	}
+	pos+=size;
+
+	switch (type)
+	{
+		case INT8: out=*(signed char*)buf; break;
+		case UINT8: out=*(unsigned char*)buf; break;
+		case INT16: out=*(short*)buf; break;
+		case UINT16: out=*(unsigned short*)buf; break;
+		case INT32: out=*(int*)buf; break;
+		case UINT32: out=*(unsigned int*)buf; break;
+		case FLOAT32: out=*(float*)buf; break;
+		case FLOAT64: out=*(double*)buf; break;
+		default: return false;
+	}
+	return true;
+}
+
+bool PLYPrimitiveIO::ReadElement(const char *&pos, const char *end, const Element &element)
+{
+	bool vertex=element.Name=="vertex";
+	if (vertex)
+	{
+		m_Position.resize(element.Count,dVector(0,0,0));
+		m_Normal.resize(element.Count,dVector(0,0,0));
+		m_Texture.resize(element.Count,dVector(0,0,0));
+		m_Colour.resize(element.Count,dColour(1,1,1));
+	}
+
+	for (unsigned int n=0; n<element.Count; n++)
+	{
+		for (vector<Property>::const_iterator p=element.Properties.begin();
+			p!=element.Properties.end(); ++p)
+		{
+			double value;
+			if (p->CountType!=NONE)
+			{
+				if (!ReadValue(pos,end,p->CountType,value)) return false;
+				unsigned int count=value>0?(unsigned int)value:0;
+				m_Polygon.clear();
+				for (unsigned int i=0; i<count; i++)
+				{
+					if (!ReadValue(pos,end,p->Type,value)) return false;
+					m_Polygon.push_back(value<0?0xffffffff:(unsigned int)value);
+				}
+
+				if (p->Dest==INDICES)
+				{
+					// subdivide polygons to triangles
+					for (unsigned int i=2; i<m_Polygon.size(); i++)
+					{
+						m_Indices.push_back(m_Polygon[0]);
+						m_Indices.push_back(m_Polygon[i-1]);
+						m_Indices.push_back(m_Polygon[i]);
+					}
+				}
+				continue;
+			}
+
+			if (!ReadValue(pos,end,p->Type,value)) return false;
+			if (!vertex) continue;
+
+			// integer colours go from 0 to the type's maximum
+			float f=value;
+			if (p->Dest>=CR && p->Dest<=CA)
+			{
+				if (p->Type==UINT8) f/=255.0f;
+				else if (p->Type==UINT16) f/=65535.0f;
+			}
+
+			switch (p->Dest)
+			{
+				case PX: m_Position[n].x=f; break;
+				case PY: m_Position[n].y=f; break;
+				case PZ: m_Position[n].z=f; break;
+				case NX: m_Normal[n].x=f; break;
+				case NY: m_Normal[n].y=f; break;
+				case NZ: m_Normal[n].z=f; break;
+				case TU: m_Texture[n].x=f; break;
+				case TV: m_Texture[n].y=f; break;
+				case CR: m_Colour[n].r=f; break;
+				case CG: m_Colour[n].g=f; break;
+				case CB: m_Colour[n].b=f; break;
+				case CA: m_Colour[n].a=f; break;
+				default: break;
+			}
+		}
+
+		// ascii files have an element per line
+		if (m_Format==ASCII) SkipLine(pos,end);
+	}
+	return true;
+}
@@ -0,0 +1,90 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef FLUX_PLY_PRIMITIVE_IO
+#define FLUX_PLY_PRIMITIVE_IO
+
+#include "PrimitiveIO.h"
+#include "SceneGraph.h"
+#include "dada.h"
+#include "Allocator.h"
+#include <vector>
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// Reads Stanford .ply files, ascii or binary, as indexed 
+/// triangle lists. Positions, normals, texture coordinates 
+/// and colours are read from the vertices, faces with more 
+/// than three vertices are triangulated and everything else 
+/// in the file is skipped
+class PLYPrimitiveIO : public PrimitiveIO
+{
+public:
+	PLYPrimitiveIO();
+	virtual ~PLYPrimitiveIO();
+	virtual Primitive *FormatRead(const std::string &filename);
+	virtual bool FormatWrite(const std::string &filename, const Primitive *ob, unsigned id,
+			const SceneGraph &world);
+
+private:
+	enum Format {ASCII, BINARY_LITTLE_ENDIAN, BINARY_BIG_ENDIAN};
+	enum ValueType {NONE, INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64};
+
+	/// Where a property ends up
+	enum Target {UNUSED=-1, PX, PY, PZ, NX, NY, NZ, TU, TV, CR, CG, CB, CA, INDICES, NUM_TARGETS};
+
+	struct Property
+	{
+		ValueType Type;
+		/// The type of the length for lists, NONE otherwise
+		ValueType CountType;
+		Target Dest;
+	};
+
+	struct Element
+	{
+		std::string Name;
+		unsigned int Count;
+		vector<Property> Properties;
+	};
+
+	bool ReadHeader(const char *&pos, const char *end);
+	bool ReadElement(const char *&pos, const char *end, const Element &element);
+	bool ReadValue(const char *&pos, const char *end, ValueType type, double &out);
+	static ValueType ParseType(const char *word, unsigned int len);
+	static Target ParseTarget(const std::string &element, const char *word, unsigned int len);
+	Primitive *MakePrimitive();
+
+	Format m_Format;
+	bool m_Swap;
+	vector<Element> m_Elements;
+
+	// the corners of the face being read
+	vector<unsigned int> m_Polygon;
+	vector<dVector, FLX_ALLOC(dVector) > m_Position;
+	vector<dVector, FLX_ALLOC(dVector) > m_Texture;
+	vector<dVector, FLX_ALLOC(dVector) > m_Normal;
+	vector<dColour, FLX_ALLOC(dColour) > m_Colour;
+	vector<unsigned int> m_Indices;
+	bool m_HasTarget[NUM_TARGETS];
+};
+
+}
+
+#endif
@@ -20,8 +20,13 @@
 
 using namespace Fluxus;
 
-ParticlePrimitive::ParticlePrimitive()
+ParticlePrimitive::ParticlePrimitive() :
+m_FrontBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_BackBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_IndexBuffer(GL_ELEMENT_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_StreamFrame(false)
 {
+
 	AddData("p",new TypedPData<dVector>);
 	AddData("c",new TypedPData<dColour>);
 	AddData("s",new TypedPData<dVector>);
@@ -32,8 +37,13 @@ ParticlePrimitive::ParticlePrimitive()
 }
 
 ParticlePrimitive::ParticlePrimitive(const ParticlePrimitive &other) :
-Primitive(other)
+Primitive(other),
+m_FrontBuffer(other.m_FrontBuffer),
+m_BackBuffer(other.m_BackBuffer),
+m_IndexBuffer(other.m_IndexBuffer),
+m_StreamFrame(false)
 {
+
 	PDataDirty();
 }
 
@@ -64,8 +74,14 @@ void ParticlePrimitive::Render()
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 		glEnableClientState(GL_COLOR_ARRAY);
 
-		glVertexPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_VertData->begin()->arr());
-		glColorPointer(4,GL_FLOAT,sizeof(dColour),(void*)m_ColData->begin()->arr());
+		if (VertexBuffer::IsEnabled())
+		{
+			m_VertBuffer.Update(GetDataRaw("p"));
+			m_ColBuffer.Update(GetDataRaw("c"));
+		}
+
+		glVertexPointer(3,GL_FLOAT,sizeof(dVector),m_VertBuffer.Bind(m_VertData->begin()->arr()));
+		glColorPointer(4,GL_FLOAT,sizeof(dColour),m_ColBuffer.Bind(m_ColData->begin()->arr()));
 
 		//glEnable(GL_BLEND);
 	    //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -75,6 +91,7 @@ void ParticlePrimitive::Render()
 		else glDisable(GL_POINT_SMOOTH);
 
 		glDrawArrays(GL_POINTS,0,m_VertData->size());
+		VertexBuffer::Unbind();
 
 		glDisableClientState(GL_COLOR_ARRAY);
 		glEnableClientState(GL_NORMAL_ARRAY);
@@ -89,55 +106,89 @@ void ParticlePrimitive::Render()
 		dVector down=across.cross(cameradir);
 		down.normalise();
 		
-		if (m_State.Hints & HINT_DEPTH_SORT)
+		// expand the particles into a stream of quads, so they all 
+		// go to the card in one upload and one draw call
+		unsigned int count=m_VertData->size();
+		m_Billboards.resize(count*4);
+		for (unsigned int n=0; n<count; n++)
 		{
-			dMatrix ModelView2;
-			glGetFloatv(GL_MODELVIEW_MATRIX,ModelView2.arr());
+			const dVector &pos=(*m_VertData)[n];
+			dVector scaledacross(across*(*m_SizeData)[n].x*0.5);
+			dVector scaledown(down*(*m_SizeData)[n].y*0.5);
 			
-			list<SortItem> sorted;
-			for (unsigned int n=0; n<m_VertData->size(); n++)
+			float angle=(*m_RotateData)[n];
+			if (angle!=0)
 			{
-				dVector t=ModelView2.transform((*m_VertData)[n]);
-				sorted.push_back(SortItem(n, t.z));
+				// spin around the view direction
+				float c=cos(angle*DEG_CONV);
+				float s=sin(angle*DEG_CONV);
+				dVector a=scaledacross*c+scaledown*s;
+				scaledown=scaledown*c-scaledacross*s;
+				scaledacross=a;
 			}
-			sorted.sort();
 			
-			glBegin(GL_QUADS);
-			for (list<SortItem>::iterator i=sorted.begin(); i!=sorted.end(); ++i)
-			{
-				dVector scaledacross(across*(*m_SizeData)[i->Index].x*0.5);
-				dVector scaledown(down*(*m_SizeData)[i->Index].y*0.5);
-				glColor4fv((*m_ColData)[i->Index].arr());
-				glTexCoord2f(0,0);
-				glVertex3fv(((*m_VertData)[i->Index]-scaledacross-scaledown).arr());
-				glTexCoord2f(0,1);
-				glVertex3fv(((*m_VertData)[i->Index]-scaledacross+scaledown).arr());
-				glTexCoord2f(1,1);
-				glVertex3fv(((*m_VertData)[i->Index]+scaledacross+scaledown).arr());
-				glTexCoord2f(1,0);
-				glVertex3fv(((*m_VertData)[i->Index]+scaledacross-scaledown).arr());
-			}
-			glEnd();
+			const dColour &col=(*m_ColData)[n];
+			BillboardVertex *v=&m_Billboards[n*4];
+			v[0].Set(pos-scaledacross-scaledown,0,0,col);
+			v[1].Set(pos-scaledacross+scaledown,0,1,col);
+			v[2].Set(pos+scaledacross+scaledown,1,1,col);
+			v[3].Set(pos+scaledacross-scaledown,1,0,col);
 		}
-		else
+		
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		
+		if (count>0)
 		{
-			glBegin(GL_QUADS);
-			for (unsigned int n=0; n<m_VertData->size(); n++)
+			// alternate between two buffers, so we aren't writing 
+			// into the one the card may still be drawing from
+			m_StreamFrame=!m_StreamFrame;
+			VertexBuffer &stream=m_StreamFrame?m_BackBuffer:m_FrontBuffer;
+			unsigned int size=m_Billboards.size()*sizeof(BillboardVertex);
+			stream.Update(&m_Billboards[0],size,0,size);
+			
+			const char *base=(const char*)stream.Bind(&m_Billboards[0]);
+			glVertexPointer(3,GL_FLOAT,sizeof(BillboardVertex),base);
+			glTexCoordPointer(2,GL_FLOAT,sizeof(BillboardVertex),base+3*sizeof(float));
+			glColorPointer(4,GL_FLOAT,sizeof(BillboardVertex),base+5*sizeof(float));
+		
+			if (m_State.Hints & HINT_DEPTH_SORT)
 			{
-				dVector scaledacross(across*(*m_SizeData)[n].x*0.5);
-				dVector scaledown(down*(*m_SizeData)[n].y*0.5);
-				glColor4fv((*m_ColData)[n].arr());
-				glTexCoord2f(0,0);
-				glVertex3fv(((*m_VertData)[n]-scaledacross-scaledown).arr());
-				glTexCoord2f(0,1);
-				glVertex3fv(((*m_VertData)[n]-scaledacross+scaledown).arr());
-				glTexCoord2f(1,1);
-				glVertex3fv(((*m_VertData)[n]+scaledacross+scaledown).arr());
-				glTexCoord2f(1,0);
-				glVertex3fv(((*m_VertData)[n]+scaledacross-scaledown).arr());
+				dMatrix ModelView2;
+				glGetFloatv(GL_MODELVIEW_MATRIX,ModelView2.arr());
+				
+				// only the eye space z is needed
+				m_Depths.resize(count);
+				for (unsigned int n=0; n<count; n++)
+				{
+					const dVector &p=(*m_VertData)[n];
+					m_Depths[n]=p.x*ModelView2.m[0][2]+p.y*ModelView2.m[1][2]+
+						p.z*ModelView2.m[2][2]+ModelView2.m[3][2];
+				}
+				
+				const vector<unsigned int> &order=m_Sorter.Sort(m_Depths);
+				m_QuadIndices.resize(count*4);
+				for (unsigned int n=0; n<count; n++)
+				{
+					unsigned int first=order[n]*4;
+					unsigned int *i=&m_QuadIndices[n*4];
+					i[0]=first; i[1]=first+1; i[2]=first+2; i[3]=first+3;
+				}
+				
+				size=m_QuadIndices.size()*sizeof(unsigned int);
+				m_IndexBuffer.Update(&m_QuadIndices[0],size,0,size);
+				glDrawElements(GL_QUADS,count*4,GL_UNSIGNED_INT,m_IndexBuffer.Bind(&m_QuadIndices[0]));
 			}
-			glEnd();
+			else
+			{
+				glDrawArrays(GL_QUADS,0,count*4);
+			}
+			
+			VertexBuffer::Unbind();
 		}
+		
+		glDisableClientState(GL_COLOR_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
 	}
 	glEnable(GL_LIGHTING);
 }
@@ -154,20 +205,14 @@ dBoundingBox ParticlePrimitive::GetBoundingBox(const dMatrix &space)
 
 void ParticlePrimitive::ApplyTransform(bool ScaleRotOnly)
 {
-	if (!ScaleRotOnly)
+	if (!m_VertData->empty())
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
-		{
-			*i=GetState()->Transform.transform(*i);
-		}
-	}
-	else
-	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
-		{
-			*i=GetState()->Transform.transform_no_trans(*i);
-		}
+		dVector *data=&(*m_VertData)[0];
+		if (!ScaleRotOnly) GetState()->Transform.transform(data,data,m_VertData->size());
+		else GetState()->Transform.transform_no_trans(data,data,m_VertData->size());
 	}
+	
+	SetDataDirty("p");
 
 	GetState()->Transform.init();
 }
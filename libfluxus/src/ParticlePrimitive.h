@@ -18,6 +18,8 @@
 #define N_PARTICLEPRIM
 
 #include "Primitive.h"
+#include "VertexBuffer.h"
+#include "RadixSort.h"
 
 namespace Fluxus
 {
@@ -61,19 +63,36 @@ private:
 	vector<dVector,FLX_ALLOC(dVector) > *m_SizeData;
 	vector<float,FLX_ALLOC(float) > *m_RotateData;
 	
-	class SortItem
+	VertexBuffer m_VertBuffer;
+	VertexBuffer m_ColBuffer;
+	
+	// the solid particles are expanded into quads with
+	// everything needed to draw them in one vertex
+	struct BillboardVertex
 	{
-	public:
-		SortItem(int i, float d) : Index(i), Depth(d) {}
-
-		int Index;
-		float Depth;
-		
-		bool operator<(const SortItem &other) const
+		void Set(const dVector &p, float u, float v, const dColour &c)
 		{
-			return Depth<other.Depth;
+			x=p.x; y=p.y; z=p.z; 
+			s=u; t=v;
+			r=c.r; g=c.g; b=c.b; a=c.a;
 		}
+		
+		float x,y,z;
+		float s,t;
+		float r,g,b,a;
 	};
+
+	// rebuilt each frame, but kept to save allocating them
+	vector<BillboardVertex> m_Billboards;
+	vector<unsigned int> m_QuadIndices;
+	vector<float> m_Depths;
+	RadixSort m_Sorter;
+	
+	// the quad stream is double buffered
+	VertexBuffer m_FrontBuffer;
+	VertexBuffer m_BackBuffer;
+	VertexBuffer m_IndexBuffer;
+	bool m_StreamFrame;
 };
 
 }
@@ -14,14 +14,68 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <algorithm>
 #include "PolyEvaluator.h"
 #include "PolyPrimitive.h"
 #include "Geometry.h"
+#include "JobPool.h"
 
 using namespace Fluxus;
 
-PolyEvaluator::PolyEvaluator(const PolyPrimitive *prim) :
-m_Prim(prim)
+// Moller and Trumbore's line triangle test, returns the distance
+// along the line (0 to 1), or -1 if it misses. The bary weights
+// are for a, b and c in that order
+static inline float LineTriangle(const dVector &start, const dVector &dir, 
+	const dVector &a, const dVector &b, const dVector &c, dVector &bary)
+{
+	dVector e1=b-a;
+	dVector e2=c-a;
+	dVector p=dir.cross(e2);
+	float det=e1.dot(p);
+	if (det==0) return -1; // parallel, or a degenerate triangle
+	float inv=1/det;
+	dVector s=start-a;
+	float u=s.dot(p)*inv;
+	if (u<0 || u>1) return -1;
+	dVector q=s.cross(e1);
+	float v=dir.dot(q)*inv;
+	if (v<0 || u+v>1) return -1;
+	float t=e2.dot(q)*inv;
+	if (t<=0 || t>1) return -1;
+	bary=dVector(1-u-v,u,v);
+	return t;
+}
+
+// for the bvh to test triangles as it reaches them
+class TriangleHit
+{
+public:
+	TriangleHit(const dVector &start, const dVector &end, const dVector *verts, const unsigned int *triangles) : 
+	m_Start(start), m_Dir(end-start), m_Verts(verts), m_Triangles(triangles) {}
+	
+	bool operator()(int triangle, float &t)
+	{
+		const unsigned int *tri=m_Triangles+triangle*3;
+		dVector bary;
+		float d=LineTriangle(m_Start,m_Dir,m_Verts[tri[0]],m_Verts[tri[1]],m_Verts[tri[2]],bary);
+		if (d<0 || d>=t) return false;
+		t=d;
+		m_Bary=bary;
+		return true;
+	}
+	
+	dVector m_Start;
+	dVector m_Dir;
+	const dVector *m_Verts;
+	const unsigned int *m_Triangles;
+	dVector m_Bary;
+};
+
+PolyEvaluator::PolyEvaluator(PolyPrimitive *prim) :
+m_Prim(prim),
+m_BVH(NULL),
+m_Triangles(NULL),
+m_Verts(NULL)
 {
 	assert(m_Prim!=NULL);
 }
@@ -41,112 +95,131 @@ Evaluator::Point PolyEvaluator::ClosestPoint(const dVector &position)
 
 bool PolyEvaluator::IntersectLine(const dVector &start, const dVector &end, vector<Point> &points)
 {
-	switch (m_Prim->GetType())
-	{
-		case PolyPrimitive::TRISTRIP: return IntersectTriStrip(start,end,points); break;
-		case PolyPrimitive::QUADS: return IntersectQuads(start,end,points); break;
-		case PolyPrimitive::TRILIST: return IntersectTriList(start,end,points); break;
-		case PolyPrimitive::TRIFAN: return IntersectTriFan(start,end,points); break;
-		case PolyPrimitive::POLYGON: return IntersectPolygon(start,end,points); break;
-	};
+	const BVH &bvh=m_Prim->GetTriangleBVH();
+	const vector<unsigned int> &triangles=m_Prim->GetBVHTriangles();
+	if (triangles.empty()) return false;
+	const dVector *verts=&(*m_Prim->GetDataVec<dVector>("p"))[0];
 	
-	return false;
-}
-
-bool PolyEvaluator::IntersectTriStrip(const dVector &start, const dVector &end, vector<Point> &points)
-{
-	dVector bary;
-	bool found=false;
-	unsigned int i=2;
-	while(i<m_Prim->Size())
+	vector<pair<float,int> > candidates;
+	bvh.LineQuery(start,end,candidates);
+	
+	dVector dir=end-start;
+	vector<RayHit> hits;
+	for (vector<pair<float,int> >::iterator i=candidates.begin(); i!=candidates.end(); ++i)
 	{
-		unsigned int i1=i-2;
-		unsigned int i2=i-1;
-		unsigned int i3=i++;
-		
-        float t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i1),
-                                        m_Prim->GetData<dVector>("p",i2),
-                                        m_Prim->GetData<dVector>("p",i3),bary);
-
-		if (t>0)
+		const unsigned int *tri=&triangles[i->second*3];
+		RayHit hit;
+		hit.m_T=LineTriangle(start,dir,verts[tri[0]],verts[tri[1]],verts[tri[2]],hit.m_Bary);
+		if (hit.m_T>0)
 		{
-          points.push_back(InterpolatePData(t,bary,i1,i2,i3));
-          found=true;
+			hit.m_Verts[0]=tri[0];
+			hit.m_Verts[1]=tri[1];
+			hit.m_Verts[2]=tri[2];
+			hits.push_back(hit);
 		}
 	}
+	
+	// the boxes were in order, but the triangles in them might not be
+	for (unsigned int i=1; i<hits.size(); i++)
+	{
+		RayHit hit=hits[i];
+		unsigned int j=i;
+		for (; j>0 && hits[j-1].m_T>hit.m_T; j--) hits[j]=hits[j-1];
+		hits[j]=hit;
+	}
+	
+	for (vector<RayHit>::iterator i=hits.begin(); i!=hits.end(); ++i)
+	{
+		points.push_back(InterpolatePData(*i));
+	}
 
-	return found;
+	return !hits.empty();
 }
 
-bool PolyEvaluator::IntersectQuads(const dVector &start, const dVector &end, vector<Point> &points)
+void PolyEvaluator::IntersectLineRange(const dVector *starts, const dVector *ends, 
+                                       unsigned int start, unsigned int end, RayHit *hits) const
 {
-	dVector bary;
-	bool found=false;
-	unsigned int i=0;
-	while(i<m_Prim->Size())
+	for (unsigned int i=start; i<end; i++)
 	{
-		unsigned int i1=i++;
-		unsigned int i2=i++;
-		unsigned int i4=i++;
-   		unsigned int i3=i++;
-		
-		float t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i1),
-										m_Prim->GetData<dVector>("p",i2),
-										m_Prim->GetData<dVector>("p",i3),bary);
-        if (t>0)
+		TriangleHit test(starts[i],ends[i],m_Verts,m_Triangles);
+		float t;
+		int triangle=m_BVH->LineNearest(starts[i],ends[i],test,t);
+		RayHit &hit=hits[i];
+		if (triangle==-1)
 		{
-          points.push_back(InterpolatePData(t,bary,i1,i2,i3));
-          found=true;
+			hit.m_T=-1;
+			continue;
 		}
-		else 
-        { 
-          t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i2),
-                                    m_Prim->GetData<dVector>("p",i3),
-                                    m_Prim->GetData<dVector>("p",i4),bary);
-          if (t>0)
-          {
-            points.push_back(InterpolatePData(t,bary,i2,i3,i4));
-            found=true;
-          }
-        }
-   
+		
+		const unsigned int *tri=m_Triangles+triangle*3;
+		hit.m_T=t;
+		hit.m_Bary=test.m_Bary;
+		hit.m_Verts[0]=tri[0];
+		hit.m_Verts[1]=tri[1];
+		hit.m_Verts[2]=tri[2];
 	}
-
-	return found;
 }
 
-bool PolyEvaluator::IntersectTriList(const dVector &start, const dVector &end, vector<Point> &points)
-{	
-	dVector bary;
-	bool found=false;
-	unsigned int i=0;
-	while(i<m_Prim->Size())
-	{
-		unsigned int i1=i++;
-		unsigned int i2=i++;
-		unsigned int i3=i++;
-		
-		float t = IntersectLineTriangle(start,end,m_Prim->GetData<dVector>("p",i1),
-                                        m_Prim->GetData<dVector>("p",i2),
-                                        m_Prim->GetData<dVector>("p",i3),bary);
-        if (t>0)
-		{
-          points.push_back(InterpolatePData(t,bary,i1,i2,i3));
-          found=true;
-		}
-	}
+struct IntersectJob
+{
+	const PolyEvaluator *Evaluator;
+	const dVector *Starts;
+	const dVector *Ends;
+	unsigned int Start;
+	unsigned int End;
+	PolyEvaluator::RayHit *Hits;
+};
 
-	return found;
+void *PolyEvaluator::IntersectThread(void *data)
+{
+	IntersectJob *job=(IntersectJob*)data;
+	job->Evaluator->IntersectLineRange(job->Starts,job->Ends,job->Start,job->End,job->Hits);
+	return NULL;
 }
 
-bool PolyEvaluator::IntersectTriFan(const dVector &start, const dVector &end, vector<Point> &points)
+void PolyEvaluator::IntersectLines(const dVector *starts, const dVector *ends, unsigned int count, RayHit *hits)
 {
-	return false;
+	// make sure the bvh is up to date before the threads look at it
+	m_BVH=&m_Prim->GetTriangleBVH();
+	const vector<unsigned int> &triangles=m_Prim->GetBVHTriangles();
+	if (triangles.empty())
+	{
+		for (unsigned int i=0; i<count; i++) hits[i].m_T=-1;
+		return;
+	}
+	m_Triangles=&triangles[0];
+	m_Verts=&(*m_Prim->GetDataVec<dVector>("p"))[0];
+	
+	unsigned int threads=1;
+	if (count>THREADED_SIZE)
+	{
+		threads=min(JobPool::Get()->GetNumThreads(),count/THREADED_SIZE);
+	}
+	
+	if (threads<=1)
+	{
+		IntersectLineRange(starts,ends,0,count,hits);
+		return;
+	}
+
+	IntersectJob jobs[JobPool::MAX_THREADS];
+	unsigned int slice=count/threads;
+	for (unsigned int n=0; n<threads; n++)
+	{
+		jobs[n].Evaluator=this;
+		jobs[n].Starts=starts;
+		jobs[n].Ends=ends;
+		jobs[n].Start=n*slice;
+		jobs[n].End=n==threads-1?count:(n+1)*slice;
+		jobs[n].Hits=hits;
+	}
+	
+	JobPool::Get()->RunEach(IntersectThread,jobs,threads);
 }
 
-bool PolyEvaluator::IntersectPolygon(const dVector &start, const dVector &end, vector<Point> &points)
+Evaluator::Point PolyEvaluator::InterpolatePData(const RayHit &hit)
 {
-	return false;
+	return InterpolatePData(hit.m_T,hit.m_Bary,hit.m_Verts[0],hit.m_Verts[1],hit.m_Verts[2]);
 }
 
 ////////////////////////////////////////////////
@@ -163,24 +236,25 @@ Evaluator::Point PolyEvaluator::InterpolatePData(float t, dVector bary, unsigned
 	{
 		char type=0;
 		unsigned int size=0;
-		m_Prim->GetDataInfo(*i, type, size);
+		unsigned int handle=PDataContainer::FindHandle(*i);
+		m_Prim->GetDataInfo(handle, type, size);
 		
 		Blend *blend;
 		
 		switch(type)
 		{
-			case 'f': blend = new TypedBlend<float>('f',m_Prim->GetData<float>(*i,i1)*bary.x +
-												    m_Prim->GetData<float>(*i,i2)*bary.y +
-											   	    m_Prim->GetData<float>(*i,i3)*bary.z); break;
-			case 'v': blend = new TypedBlend<dVector>('v',m_Prim->GetData<dVector>(*i,i1)*bary.x +
-												  m_Prim->GetData<dVector>(*i,i2)*bary.y +
-												  m_Prim->GetData<dVector>(*i,i3)*bary.z); break;
-			case 'c': blend = new TypedBlend<dColour>('c',m_Prim->GetData<dColour>(*i,i1)*bary.x +
-												  m_Prim->GetData<dColour>(*i,i2)*bary.y +
-												  m_Prim->GetData<dColour>(*i,i3)*bary.z); break;
-			case 'm': blend = new TypedBlend<dMatrix>('m',m_Prim->GetData<dMatrix>(*i,i1)*bary.x +
-												  m_Prim->GetData<dMatrix>(*i,i2)*bary.y +
-												  m_Prim->GetData<dMatrix>(*i,i3)*bary.z); break;
+			case 'f': blend = new TypedBlend<float>('f',m_Prim->GetData<float>(handle,i1)*bary.x +
+												    m_Prim->GetData<float>(handle,i2)*bary.y +
+											   	    m_Prim->GetData<float>(handle,i3)*bary.z); break;
+			case 'v': blend = new TypedBlend<dVector>('v',m_Prim->GetData<dVector>(handle,i1)*bary.x +
+												  m_Prim->GetData<dVector>(handle,i2)*bary.y +
+												  m_Prim->GetData<dVector>(handle,i3)*bary.z); break;
+			case 'c': blend = new TypedBlend<dColour>('c',m_Prim->GetData<dColour>(handle,i1)*bary.x +
+												  m_Prim->GetData<dColour>(handle,i2)*bary.y +
+												  m_Prim->GetData<dColour>(handle,i3)*bary.z); break;
+			case 'm': blend = new TypedBlend<dMatrix>('m',m_Prim->GetData<dMatrix>(handle,i1)*bary.x +
+												  m_Prim->GetData<dMatrix>(handle,i2)*bary.y +
+												  m_Prim->GetData<dMatrix>(handle,i3)*bary.z); break;
 			default: 
 				cerr<<"unknown pdata type in PolyEvaluator::InterpolatePData: "<<type<<endl; 
 				assert(0); 
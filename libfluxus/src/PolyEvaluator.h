@@ -21,6 +21,7 @@
 #include <map>
 #include <assert.h>
 #include "Evaluator.h"
+#include "BVH.h"
 
 namespace Fluxus
 {
@@ -33,23 +34,45 @@ class PolyPrimitive;
 class PolyEvaluator : public Evaluator
 {
 public:
-	PolyEvaluator(const PolyPrimitive *prim);
+	PolyEvaluator(PolyPrimitive *prim);
 	virtual ~PolyEvaluator();
 	
+	/// Finds all the triangles crossed by the line, nearest first
 	virtual bool IntersectLine(const dVector &start, const dVector &end, vector<Point> &points);
 	virtual Point ClosestPoint(const dVector &position);
 	
+	/// The nearest triangle hit by a line
+	class RayHit
+	{
+	public:
+		float m_T; // along the line from 0 to 1, or -1 for a miss
+		unsigned int m_Verts[3];
+		dVector m_Bary; // the weight of each vert at the hit
+	};
+	
+	/// Finds the nearest hit for lots of lines at once, 
+	/// spread over the processors for large batches
+	void IntersectLines(const dVector *starts, const dVector *ends, unsigned int count, RayHit *hits);
+	
+	/// Blends pdata of the hit triangle's verts
+	Point InterpolatePData(const RayHit &hit);
+	
+	/// Lines are only spread over threads in batches bigger than this
+	static const unsigned int THREADED_SIZE=256;
+	
 private:
-	const PolyPrimitive *m_Prim;
+	PolyPrimitive *m_Prim;
 
-	bool IntersectTriStrip(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectQuads(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectTriList(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectTriFan(const dVector &start, const dVector &end, vector<Point> &points);
-	bool IntersectPolygon(const dVector &start, const dVector &end, vector<Point> &points);
+	void IntersectLineRange(const dVector *starts, const dVector *ends, 
+	                        unsigned int start, unsigned int end, RayHit *hits) const;
+	static void *IntersectThread(void *data);
 
-  Point InterpolatePData(float t, dVector bary, unsigned int i1, unsigned int i2, unsigned int i3);
+	Point InterpolatePData(float t, dVector bary, unsigned int i1, unsigned int i2, unsigned int i3);
 
+	// the primitive's, fetched once per call
+	const BVH *m_BVH;
+	const unsigned int *m_Triangles;
+	const dVector *m_Verts;
 };
 
 }
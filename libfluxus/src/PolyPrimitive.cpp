@@ -15,6 +15,11 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include "OpenGL.h"
 
@@ -22,15 +27,37 @@
 #include "PolyPrimitive.h"
 #include "State.h"
 #include "TexturePainter.h"
+#include "SpatialHash.h"
+#include "MeshSimplifier.h"
+#include "JobPool.h"
 
 //#define RENDER_NORMALS
 //#define RENDER_BBOX
 
 using namespace Fluxus;
 
+unsigned int PolyPrimitive::m_NextTopologyVersion=0;
+
+// thread work is split on multiples of this many items
+static const unsigned int THREAD_ALIGN=64;
+// pixels covered by each triangle before dropping a level
+static const float DEFAULT_LOD_DETAIL=16.0f;
+
 PolyPrimitive::PolyPrimitive(Type t) :
+m_TopologyVersion(0),
+m_NormalGroupsVersion(0),
 m_IndexMode(false),
-m_Type(t)
+m_Type(t),
+m_VertData(NULL),
+m_IndexBuffer(GL_ELEMENT_ARRAY_BUFFER),
+m_IndexDirty(true),
+m_InstanceBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_InstanceColourBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_TriangleBVHTopology(0),
+m_TriangleBVHPositions(0),
+m_TriangleBVHVerts(0),
+m_LOD(0),
+m_LODDetail(DEFAULT_LOD_DETAIL)
 {
 	AddData("p",new TypedPData<dVector>);
 	AddData("n",new TypedPData<dVector>);
@@ -43,15 +70,34 @@ m_Type(t)
 
 PolyPrimitive::PolyPrimitive(const PolyPrimitive &other) :
 Primitive(other),
+m_TopologyVersion(0),
+m_NormalGroupsVersion(0),
 m_IndexMode(other.m_IndexMode),
 m_IndexData(other.m_IndexData),
-m_Type(other.m_Type)
+m_Type(other.m_Type),
+m_VertData(NULL),
+m_IndexBuffer(GL_ELEMENT_ARRAY_BUFFER),
+m_IndexDirty(true),
+m_InstanceBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_InstanceColourBuffer(GL_ARRAY_BUFFER,GL_STREAM_DRAW),
+m_TriangleBVHTopology(0),
+m_TriangleBVHPositions(0),
+m_TriangleBVHVerts(0),
+m_LODTriangles(other.m_LODTriangles),
+m_LOD(other.m_LOD),
+m_LODDetail(other.m_LODDetail)
 {
+	for (vector<PolyPrimitive*>::const_iterator i=other.m_LODLevels.begin();
+		i!=other.m_LODLevels.end(); ++i)
+	{
+		m_LODLevels.push_back((*i)->Clone());
+	}
 	PDataDirty();
 }
 
 PolyPrimitive::~PolyPrimitive()
 {
+	ClearLOD();
 }
 
 PolyPrimitive *PolyPrimitive::Clone() const
@@ -62,15 +108,18 @@ PolyPrimitive *PolyPrimitive::Clone() const
 void PolyPrimitive::Clear()
 {
 	Resize(0);
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	ClearTopology();
+	ClearLOD();
 }
 
 void PolyPrimitive::PDataDirty()
 {
+	// new positions mean the topology needs working out again
+	vector<dVector,FLX_ALLOC(dVector) > *verts=GetDataVec<dVector>("p");
+	if (verts!=m_VertData) ClearTopology();
+
 	// reset pointers
-	m_VertData=GetDataVec<dVector>("p");
+	m_VertData=verts;
 	m_NormData=GetDataVec<dVector>("n");
 	m_ColData=GetDataVec<dColour>("c");
 	m_TexData=GetDataVec<dVector>("t");
@@ -83,12 +132,28 @@ void PolyPrimitive::AddVertex(const dVertex &Vert)
 	m_ColData->push_back(Vert.col); 	
 	m_TexData->push_back(dVector(Vert.s, Vert.t, 0));
 	
-	m_ConnectedVerts.clear();
-	m_GeometricNormals.clear();
-	m_UniqueEdges.clear();
+	ClearTopology();
 }
 
 void PolyPrimitive::Render()
+{
+	if (m_LOD>0 && m_LOD<=m_LODLevels.size())
+	{
+		// draw the simplified copy as if it were us, with our 
+		// state, so it doesn't need copying over every frame
+		m_LODLevels[m_LOD-1]->RenderGeometry(m_State,NULL,NULL);
+		return;
+	}
+	RenderGeometry(m_State,NULL,NULL);
+}
+
+void PolyPrimitive::RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours)
+{
+	if (transforms.empty()) return;
+	RenderGeometry(m_State,&transforms,colours.empty()?NULL:&colours);
+}
+
+void PolyPrimitive::RenderGeometry(const State &state, const vector<dMatrix> *transforms, const vector<dColour> *colours)
 {
 	// some drivers crash if they don't get enough data for a primitive...
 	if (m_VertData->size()<3) return;
@@ -115,30 +180,37 @@ void PolyPrimitive::Render()
 		case POLYGON : type=GL_POLYGON; break;
 	}
 
-	if (m_State.Hints & HINT_AALIAS) glEnable(GL_LINE_SMOOTH);
+	if (state.Hints & HINT_AALIAS) glEnable(GL_LINE_SMOOTH);
 	else glDisable(GL_LINE_SMOOTH);
 
-	if (m_State.Hints & HINT_NORMAL)
+	if (state.Hints & HINT_NORMAL)
 	{
-		glColor4fv(m_State.NormalColour.arr());
-		glDisable(GL_LIGHTING);
-		glBegin(GL_LINES);
-		for (unsigned int i=0; i<m_VertData->size(); i++)
+		if (transforms==NULL) RenderNormals(state);
+		else
 		{
-			glVertex3fv((*m_VertData)[i].arr());
-			glVertex3fv(((*m_VertData)[i]+(*m_NormData)[i]).arr());
+			for (unsigned int i=0; i<transforms->size(); i++)
+			{
+				glPushMatrix();
+				glMultMatrixf((*transforms)[i].arr());
+				RenderNormals(state);
+				glPopMatrix();
+			}
 		}
-		glEnd();
-		glEnable(GL_LIGHTING);
-		glColor4fv(m_State.Colour.arr());
 	}
-	if (m_State.Hints & HINT_UNLIT) glDisable(GL_LIGHTING);
+	if (state.Hints & HINT_UNLIT) glDisable(GL_LIGHTING);
+
+	UpdateBuffers(state);
+
+	glVertexPointer(3,GL_FLOAT,sizeof(dVector),m_VertBuffer.Bind(m_VertData->begin()->arr()));
+	glNormalPointer(GL_FLOAT,sizeof(dVector),m_NormBuffer.Bind(m_NormData->begin()->arr()));
+	glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),m_TexBuffer.Bind(m_TexData->begin()->arr()));
 
-	glVertexPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_VertData->begin()->arr());
-	glNormalPointer(GL_FLOAT,sizeof(dVector),(void*)m_NormData->begin()->arr());
-	glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_TexData->begin()->arr());
+	int attrib=-1, colattrib=-1;
+	bool hardware=false;
+	if (transforms!=NULL) hardware=EnableInstanceStreams(state,*transforms,colours,attrib,colattrib);
+	if (!hardware) SetInstanceConstants(state,colattrib);
 
-	if (m_State.Hints & HINT_SPHERE_MAP)
+	if (state.Hints & HINT_SPHERE_MAP)
 	{
 		glEnable(GL_TEXTURE_GEN_S);
 		glEnable(GL_TEXTURE_GEN_T);
@@ -152,7 +224,7 @@ void PolyPrimitive::Render()
 		// possibly a candidate to put in Primitive:PreRender()
 		for (int n=1; n<MAX_TEXTURES; n++)
 		{
-			if (m_State.Textures[n]!=0)
+			if (state.Textures[n]!=0)
 			{
 				char name[3];
 				snprintf(name,3,"t%d",n);
@@ -162,11 +234,13 @@ void PolyPrimitive::Render()
 
 				if (tex!=NULL)
 				{
+					// extra texture coordinates are kept client side
+					VertexBuffer::Unbind();
 					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)tex->m_Data.begin()->arr());
 				}
 				else // default to using the normal vertex coordinates
 				{
-					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),(void*)m_TexData->begin()->arr());
+					glTexCoordPointer(3,GL_FLOAT,sizeof(dVector),m_TexBuffer.Bind(m_TexData->begin()->arr()));
 				}
 			}
 		}
@@ -174,136 +248,677 @@ void PolyPrimitive::Render()
 	}
 	#endif
 
-	if (m_State.Hints & HINT_VERTCOLS)
+	if (state.Hints & HINT_VERTCOLS)
 	{
 		glEnableClientState(GL_COLOR_ARRAY);
-		glColorPointer(4,GL_FLOAT,sizeof(dVector),(void*)m_ColData->begin()->arr());
+		glColorPointer(4,GL_FLOAT,sizeof(dVector),m_ColBuffer.Bind(m_ColData->begin()->arr()));
 	}
 	else
 	{
 		glDisableClientState(GL_COLOR_ARRAY);
 	}
 
-	if (m_State.Hints & HINT_SOLID)
+	const void *index=NULL;
+	if (m_IndexMode) index=m_IndexBuffer.Bind(&(m_IndexData[0]));
+
+	if (state.Hints & HINT_SOLID)
 	{
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,index,transforms,colours,hardware,colattrib);
 	}
 
-	if (m_State.Hints & HINT_WIRE)
+	if (state.Hints & HINT_WIRE)
 	{
 		glDisable(GL_TEXTURE_2D);
 		glPolygonOffset(1,1);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_LINE);
-		glColor4fv(m_State.WireColour.arr());
-		if ((m_State.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
+		glColor4fv(state.WireColour.arr());
+		if ((state.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
 		{
 			glEnable(GL_LINE_STIPPLE);
-			glLineStipple(m_State.StippleFactor, m_State.StipplePattern);
+			glLineStipple(state.StippleFactor, state.StipplePattern);
 		}
 
 		glDisable(GL_LIGHTING);
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,index,transforms,NULL,hardware,-1);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 		glEnable(GL_LIGHTING);
 		glEnable(GL_TEXTURE_2D);
-		if ((m_State.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
+		if ((state.Hints & HINT_WIRE_STIPPLED) > HINT_WIRE)
 		{
 			glDisable(GL_LINE_STIPPLE);
 		}
-		glColor4fv(m_State.Colour.arr());
+		glColor4fv(state.Colour.arr());
 	}
 
-	if (m_State.Hints & HINT_POINTS)
+	if (state.Hints & HINT_POINTS)
 	{
 		glDisable(GL_TEXTURE_2D);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_POINT);
-		glColor4fv(m_State.WireColour.arr());
+		glColor4fv(state.WireColour.arr());
 		glDisable(GL_LIGHTING);
-		if (m_IndexMode) glDrawElements(type,m_IndexData.size(),GL_UNSIGNED_INT,&(m_IndexData[0]));
-		else glDrawArrays(type,0,m_VertData->size());
+		Draw(type,index,transforms,NULL,hardware,-1);
 		glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
 		glEnable(GL_LIGHTING);
 		glEnable(GL_TEXTURE_2D);
-		glColor4fv(m_State.Colour.arr());
+		glColor4fv(state.Colour.arr());
 	}
 
+	if (hardware) DisableInstanceStreams(attrib,colattrib);
+	VertexBuffer::Unbind();
 
-	if (m_State.Hints & HINT_UNLIT) glEnable(GL_LIGHTING);
-	if (m_State.Hints & HINT_AALIAS) glDisable(GL_LINE_SMOOTH);
-	if (m_State.Hints & HINT_SPHERE_MAP)
+	if (state.Hints & HINT_UNLIT) glEnable(GL_LIGHTING);
+	if (state.Hints & HINT_AALIAS) glDisable(GL_LINE_SMOOTH);
+	if (state.Hints & HINT_SPHERE_MAP)
 	{
 		glDisable(GL_TEXTURE_GEN_S);
 		glDisable(GL_TEXTURE_GEN_T);
 	}
 }
 
-void PolyPrimitive::RecalculateNormals(bool smooth)
+void PolyPrimitive::RenderNormals(const State &state)
+{
+	glColor4fv(state.NormalColour.arr());
+	glDisable(GL_LIGHTING);
+	glBegin(GL_LINES);
+	for (unsigned int i=0; i<m_VertData->size(); i++)
+	{
+		glVertex3fv((*m_VertData)[i].arr());
+		glVertex3fv(((*m_VertData)[i]+(*m_NormData)[i]).arr());
+	}
+	glEnd();
+	glEnable(GL_LIGHTING);
+	glColor4fv(state.Colour.arr());
+}
+
+void PolyPrimitive::Draw(int type, const void *index, const vector<dMatrix> *transforms, 
+                         const vector<dColour> *colours, bool hardware, int colattrib)
 {
-	GenerateTopology();
-	CalculateGeometricNormals();
+	unsigned int count = m_IndexMode?m_IndexData.size():m_VertData->size();
+
+	if (transforms==NULL)
+	{
+		if (m_IndexMode) glDrawElements(type,count,GL_UNSIGNED_INT,index);
+		else glDrawArrays(type,0,count);
+		return;
+	}
+
+	#ifdef GLSL
+	if (hardware)
+	{
+		// the shader picks up the transforms and colours 
+		if (m_IndexMode) glDrawElementsInstancedARB(type,count,GL_UNSIGNED_INT,index,transforms->size());
+		else glDrawArraysInstancedARB(type,0,count,transforms->size());
+		return;
+	}
+	#endif
 
-	if (!m_GeometricNormals.empty()) 
+	// no hardware support, but we still only set the 
+	// arrays and state up once for all the instances
+	for (unsigned int i=0; i<transforms->size(); i++)
 	{
-		if (m_IndexMode) // accumulate
+		glPushMatrix();
+		glMultMatrixf((*transforms)[i].arr());
+		if (colours!=NULL)
 		{
-			vector<int> count(m_VertData->size());
-						
-			// clear the normals
-			for (unsigned int i=0; i<m_NormData->size(); i++)
+			glColor4fv((*colours)[i].arr());
+			glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE,(*colours)[i].arr());
+			#ifdef GLSL
+			if (colattrib!=-1) glVertexAttrib4fv(colattrib,(*colours)[i].arr());
+			#endif
+		}
+		if (m_IndexMode) glDrawElements(type,count,GL_UNSIGNED_INT,index);
+		else glDrawArrays(type,0,count);
+		glPopMatrix();
+	}
+}
+
+bool PolyPrimitive::EnableInstanceStreams(const State &state, const vector<dMatrix> &transforms, const vector<dColour> *colours,
+                                          int &attrib, int &colattrib)
+{
+	#ifdef GLSL
+	if (state.Shader==NULL || !VertexBuffer::IsInstancingEnabled()) return false;
+
+	attrib=state.Shader->GetAttribLocation("InstanceTransform");
+	if (attrib==-1) return false;
+
+	// a mat4 attribute takes up 4 consecutive locations, one per column
+	unsigned int size=transforms.size()*sizeof(dMatrix);
+	m_InstanceBuffer.Update(&transforms[0],size,0,size);
+	const char *base=(const char*)m_InstanceBuffer.Bind(&transforms[0]);
+	for (int c=0; c<4; c++)
+	{
+		glEnableVertexAttribArray(attrib+c);
+		glVertexAttribPointer(attrib+c,4,GL_FLOAT,false,sizeof(dMatrix),base+c*4*sizeof(float));
+		glVertexAttribDivisorARB(attrib+c,1);
+	}
+
+	colattrib=state.Shader->GetAttribLocation("InstanceColour");
+	if (colattrib!=-1 && colours==NULL)
+	{
+		// no colours given, so leave them white
+		glVertexAttrib4f(colattrib,1,1,1,1);
+		colattrib=-1;
+	}
+	if (colours!=NULL)
+	{
+		if (colattrib!=-1)
+		{
+			size=colours->size()*sizeof(dColour);
+			m_InstanceColourBuffer.Update(&(*colours)[0],size,0,size);
+			glEnableVertexAttribArray(colattrib);
+			glVertexAttribPointer(colattrib,4,GL_FLOAT,false,sizeof(dColour),
+				m_InstanceColourBuffer.Bind(&(*colours)[0]));
+			glVertexAttribDivisorARB(colattrib,1);
+		}
+	}
+
+	return true;
+	#else
+	return false;
+	#endif
+}
+
+void PolyPrimitive::SetInstanceConstants(const State &state, int &colattrib)
+{
+	colattrib=-1;
+	#ifdef GLSL
+	if (state.Shader==NULL) return;
+
+	// so a shader made for instancing also works on a single copy,
+	// or when the copies are drawn one at a time
+	int attrib=state.Shader->GetAttribLocation("InstanceTransform");
+	if (attrib!=-1)
+	{
+		glVertexAttrib4f(attrib,1,0,0,0);
+		glVertexAttrib4f(attrib+1,0,1,0,0);
+		glVertexAttrib4f(attrib+2,0,0,1,0);
+		glVertexAttrib4f(attrib+3,0,0,0,1);
+	}
+
+	colattrib=state.Shader->GetAttribLocation("InstanceColour");
+	if (colattrib!=-1) glVertexAttrib4f(colattrib,1,1,1,1);
+	#endif
+}
+
+void PolyPrimitive::DisableInstanceStreams(int attrib, int colattrib)
+{
+	#ifdef GLSL
+	for (int c=0; c<4; c++)
+	{
+		glVertexAttribDivisorARB(attrib+c,0);
+		glDisableVertexAttribArray(attrib+c);
+	}
+	if (colattrib!=-1)
+	{
+		glVertexAttribDivisorARB(colattrib,0);
+		glDisableVertexAttribArray(colattrib);
+	}
+	#endif
+}
+
+void PolyPrimitive::GetTriangles(vector<unsigned int> &triangles) const
+{
+	unsigned int size=m_IndexMode?m_IndexData.size():m_VertData->size();
+	unsigned int first=triangles.size();
+
+	switch (m_Type)
+	{
+		case TRISTRIP:
+			for (unsigned int i=2; i<size; i++)
 			{
-				(*m_NormData)[i]=dVector(0,0,0);
-				count[i]=0;
+				// keep the winding consistent
+				if (i%2==0) { triangles.push_back(i-2); triangles.push_back(i-1); }
+				else { triangles.push_back(i-1); triangles.push_back(i-2); }
+				triangles.push_back(i);
 			}
-			
-			// add all the contributing normals
-			for (unsigned int i=0; i<m_IndexData.size(); i++)
+		break;
+		case QUADS:
+			for (unsigned int i=0; i+3<size; i+=4)
+			{
+				triangles.push_back(i); triangles.push_back(i+1); triangles.push_back(i+2);
+				triangles.push_back(i); triangles.push_back(i+2); triangles.push_back(i+3);
+			}
+		break;
+		case TRILIST:
+			for (unsigned int i=0; i+2<size; i+=3)
+			{
+				triangles.push_back(i); triangles.push_back(i+1); triangles.push_back(i+2);
+			}
+		break;
+		case TRIFAN:
+		case POLYGON:
+			for (unsigned int i=2; i<size; i++)
 			{
-				(*m_NormData)[m_IndexData[i]]+=m_GeometricNormals[i];
-				count[m_IndexData[i]]++;
+				triangles.push_back(0); triangles.push_back(i-1); triangles.push_back(i);
 			}
+		break;
+	}
 
-			// scale back
-			for (unsigned int i=0; i<m_NormData->size(); i++)
+	if (m_IndexMode)
+	{
+		for (unsigned int i=first; i<triangles.size(); i++)
+		{
+			triangles[i]=m_IndexData[triangles[i]];
+		}
+	}
+}
+
+void PolyPrimitive::UpdateBuffers(const State &state)
+{
+	if (!VertexBuffer::IsEnabled()) return;
+
+	m_VertBuffer.Update(GetDataRaw("p"));
+	m_NormBuffer.Update(GetDataRaw("n"));
+	m_TexBuffer.Update(GetDataRaw("t"));
+	if (state.Hints & HINT_VERTCOLS)
+	{
+		m_ColBuffer.Update(GetDataRaw("c"));
+	}
+
+	if (m_IndexMode && m_IndexDirty)
+	{
+		unsigned int size=m_IndexData.size()*sizeof(unsigned int);
+		m_IndexBuffer.Update(&(m_IndexData[0]),size,0,size);
+		m_IndexDirty=false;
+	}
+}
+
+void PolyPrimitive::RecalculateNormals(bool smooth)
+{
+	RecalculateNormals(smooth,WEIGHT_EQUAL);
+}
+
+void PolyPrimitive::RecalculateNormals(bool smooth, NormalWeighting weighting)
+{
+	if (m_VertData->empty() || m_NormData->size()!=m_VertData->size()) return;
+	
+	///\todo - need different approach for TRIFAN
+	if (m_Type==TRIFAN) return;
+	
+	// indexed normals are always shared by the index
+	bool flat=!smooth && !m_IndexMode;
+	if (flat || m_Type==POLYGON) 
+	{
+		UpdateFaceNormals(weighting,false,true);
+		SetDataDirty("n");
+		return;
+	}
+	
+	if (!m_IndexMode && m_ConnectedVerts.size()!=m_VertData->size())
+	{
+		ClearTopology();
+		CalculateConnected();
+	}
+	
+	unsigned int slots=m_IndexMode?m_IndexData.size():m_VertData->size();
+	if (m_NormalGroupStart.empty() ||
+		m_NormalGroupsVersion!=m_TopologyVersion ||
+		m_NormalGroupSlots.size()!=slots ||
+		(m_IndexMode && m_NormalGroupStart.size()!=m_VertData->size()+1))
+	{
+		BuildNormalGroups();
+	}
+	
+	UpdateFaceNormals(weighting,true,false);
+	
+	// each thread works out whole groups, gathering from the faces,
+	// so they never write to the same normals
+	unsigned int groups=m_NormalGroupStart.size()-1;
+	if (!m_IndexMode) m_GroupNormals.resize(groups);
+	RunNormalJobs(1,groups,weighting,true,false);
+	if (!m_IndexMode) RunNormalJobs(2,m_VertData->size(),weighting,true,false);
+	
+	SetDataDirty("n");
+}
+
+unsigned int PolyPrimitive::GetNumFaces() const
+{
+	unsigned int slots=m_IndexMode?m_IndexData.size():m_VertData->size();
+	switch (m_Type)
+	{
+		case TRILIST: return slots/3;
+		case QUADS: return slots/4;
+		// each face covers two verts, as the strip is assumed 
+		// to go back and forth
+		case TRISTRIP: return slots<3?0:(slots-1)/2;
+		default: return 0;
+	}
+}
+
+void PolyPrimitive::GetFaceSlots(unsigned int face, unsigned int &first, unsigned int &last) const
+{
+	switch (m_Type)
+	{
+		case TRILIST: first=face*3; last=first+3; break;
+		case QUADS: first=face*4; last=first+4; break;
+		default:
+		{
+			// the last face in a strip gets the left over verts too
+			first=face*2; last=first+2;
+			if (face==GetNumFaces()-1) last=m_IndexMode?m_IndexData.size():m_VertData->size();
+		}
+	}
+}
+
+float PolyPrimitive::GetCornerAngle(unsigned int face, unsigned int slot) const
+{
+	unsigned int prev,next;
+	switch (m_Type)
+	{
+		case TRILIST: 
+		{
+			unsigned int base=face*3, k=slot-base;
+			prev=base+(k+2)%3; next=base+(k+1)%3; 
+		} break;
+		case QUADS: 
+		{
+			unsigned int base=face*4, k=slot-base;
+			prev=base+(k+3)%4; next=base+(k+1)%4; 
+		} break;
+		default:
+		{
+			unsigned int base=face*2, k=slot-base;
+			if (k>2) k=2;
+			slot=base+k; prev=base+(k+2)%3; next=base+(k+1)%3;
+		}
+	}
+	
+	if (m_IndexMode)
+	{
+		slot=m_IndexData[slot];
+		prev=m_IndexData[prev];
+		next=m_IndexData[next];
+	}
+	
+	dVector a((*m_VertData)[prev]-(*m_VertData)[slot]);
+	dVector b((*m_VertData)[next]-(*m_VertData)[slot]);
+	return atan2(a.cross(b).mag(),a.dot(b));
+}
+
+void PolyPrimitive::BuildNormalGroups()
+{
+	unsigned int slots=m_IndexMode?m_IndexData.size():m_VertData->size();
+	unsigned int groups=0;
+	
+	if (m_IndexMode)
+	{
+		groups=m_VertData->size();
+	}
+	else
+	{
+		// weld coincident verts together, each one joins the group 
+		// of the first vert it's connected to, which has already 
+		// been seen as they are sorted
+		m_NormalGroup.resize(slots);
+		for (unsigned int v=0; v<slots; v++)
+		{
+			const vector<int> &connected=m_ConnectedVerts[v];
+			if (!connected.empty() && connected[0]<(int)v) 
+			{
+				m_NormalGroup[v]=m_NormalGroup[connected[0]];
+			}
+			else
 			{
-				(*m_NormData)[i]/=(float)count[i];
+				m_NormalGroup[v]=groups++;
 			}
 		}
-		else
+	}
+	
+	// count the slots in each group, and lay them out in order
+	m_NormalGroupStart.assign(groups+1,0);
+	for (unsigned int s=0; s<slots; s++)
+	{
+		unsigned int g=m_IndexMode?m_IndexData[s]:m_NormalGroup[s];
+		if (g<groups) m_NormalGroupStart[g+1]++;
+	}
+	
+	for (unsigned int g=0; g<groups; g++)
+	{
+		m_NormalGroupStart[g+1]+=m_NormalGroupStart[g];
+	}
+	
+	vector<unsigned int> pos(m_NormalGroupStart.begin(),m_NormalGroupStart.end()-1);
+	m_NormalGroupSlots.resize(slots);
+	for (unsigned int s=0; s<slots; s++)
+	{
+		unsigned int g=m_IndexMode?m_IndexData[s]:m_NormalGroup[s];
+		if (g<groups) m_NormalGroupSlots[pos[g]++]=s;
+	}
+	
+	m_NormalGroupsVersion=m_TopologyVersion;
+}
+
+struct NormalJob
+{
+	PolyPrimitive *Prim;
+	int Phase;
+	unsigned int Start,End;
+	PolyPrimitive::NormalWeighting Weighting;
+	bool Weights,Flat;
+};
+
+void PolyPrimitive::UpdateFaceNormals(NormalWeighting weighting, bool weights, bool flat)
+{
+	unsigned int slots=m_IndexMode?m_IndexData.size():m_VertData->size();
+	m_GeometricNormals.resize(slots);
+	if (weights) m_WeightedNormals.resize(slots);
+	if (slots==0) return;
+	
+	// one face 
+	if (m_Type==POLYGON) 
+	{
+		dVector normal(0,0,0);
+		if (m_VertData->size()>2)
+		{
+			dVector a((*m_VertData)[0]-(*m_VertData)[1]);
+			dVector b((*m_VertData)[1]-(*m_VertData)[2]);
+			normal=a.cross(b);
+			normal.normalise();
+		}
+		
+		for (unsigned int i=0; i<slots; i++)
+		{
+			m_GeometricNormals[i]=normal;
+			if (weights) m_WeightedNormals[i]=normal;
+		}
+		
+		if (flat)
 		{
-			for (unsigned int i=0; i<m_VertData->size(); i++)
+			for (unsigned int i=0; i<m_NormData->size(); i++)
 			{
-				(*m_NormData)[i]=m_GeometricNormals[i];
+				(*m_NormData)[i]=normal;
 			}
 		}
+		return;
+	}
+	
+	unsigned int faces=GetNumFaces();
+	m_FaceNormals.resize(faces);
+	
+	// verts left over after the last whole face
+	unsigned int covered=0;
+	if (faces>0) 
+	{
+		unsigned int first;
+		GetFaceSlots(faces-1,first,covered);
+	}
+	for (unsigned int i=covered; i<slots; i++)
+	{
+		m_GeometricNormals[i]=dVector(0,0,0);
+		if (weights) m_WeightedNormals[i]=dVector(0,0,0);
+	}
+	
+	RunNormalJobs(0,faces,weighting,weights,flat);
+}
+
+void PolyPrimitive::RunNormalJobs(int phase, unsigned int count, NormalWeighting weighting, bool weights, bool flat)
+{
+	NormalJob jobs[JobPool::MAX_THREADS];
+	unsigned int numthreads=JobPool::Get()->GetNumThreads();
+	if (count<THREADED_SIZE) numthreads=1;
+	
+	// split on multiples of the alignment, so neighbouring threads
+	// don't write to the same cache lines
+	unsigned int slice=(count/numthreads)&~(THREAD_ALIGN-1);
+	for (unsigned int t=0; t<numthreads; t++)
+	{
+		jobs[t].Prim=this;
+		jobs[t].Phase=phase;
+		jobs[t].Start=t*slice;
+		jobs[t].End=t==numthreads-1?count:(t+1)*slice;
+		jobs[t].Weighting=weighting;
+		jobs[t].Weights=weights;
+		jobs[t].Flat=flat;
+	}
+	
+	JobPool::Get()->RunEach(NormalThread,jobs,numthreads);
+}
+
+void *PolyPrimitive::NormalThread(void *data)
+{
+	NormalJob *job=(NormalJob*)data;
+	switch (job->Phase)
+	{
+		case 0: job->Prim->CalculateFaceNormals(job->Start,job->End,job->Weighting,job->Weights,job->Flat); break;
+		case 1: job->Prim->AccumulateNormals(job->Start,job->End); break;
+		case 2: job->Prim->CopyGroupNormals(job->Start,job->End); break;
+	}
+	return NULL;
+}
+
+void PolyPrimitive::CalculateFaceNormals(unsigned int start, unsigned int end, NormalWeighting weighting,
+                                         bool weights, bool flat)
+{
+	const dVector *verts=&(*m_VertData)[0];
+	const unsigned int *index=m_IndexMode?&m_IndexData[0]:NULL;
+	
+	// the normal of each face is (p1-p0)x(p3-p2), which is the 
+	// same as the usual cross product for triangles, and crosses 
+	// the diagonals of quads - for both its length is twice the area
+	unsigned int p[4];
+	unsigned int f=start;
+	
+#ifdef __SSE__
+	// four faces at a time, transposed so each register 
+	// holds one coordinate from all four of them
+	for (; f+4<=end; f+=4)
+	{
+		__m128 x[4],y[4],z[4];
+		unsigned int slots[4][4];
+		for (unsigned int j=0; j<4; j++)
+		{
+			unsigned int first,last;
+			GetFaceSlots(f+j,first,last);
+			if (m_Type==QUADS) { p[0]=first; p[1]=first+2; p[2]=first+1; p[3]=first+3; }
+			else { p[0]=first; p[1]=first+1; p[2]=first+1; p[3]=first+2; }
+			for (unsigned int k=0; k<4; k++) slots[k][j]=index?index[p[k]]:p[k];
+		}
+		
+		for (unsigned int k=0; k<4; k++)
+		{
+			__m128 a=_mm_loadu_ps(verts[slots[k][0]].arr());
+			__m128 b=_mm_loadu_ps(verts[slots[k][1]].arr());
+			__m128 c=_mm_loadu_ps(verts[slots[k][2]].arr());
+			__m128 d=_mm_loadu_ps(verts[slots[k][3]].arr());
+			_MM_TRANSPOSE4_PS(a,b,c,d);
+			x[k]=a; y[k]=b; z[k]=c;
+		}
+		
+		__m128 ax=_mm_sub_ps(x[1],x[0]), ay=_mm_sub_ps(y[1],y[0]), az=_mm_sub_ps(z[1],z[0]);
+		__m128 bx=_mm_sub_ps(x[3],x[2]), by=_mm_sub_ps(y[3],y[2]), bz=_mm_sub_ps(z[3],z[2]);
+		__m128 nx=_mm_sub_ps(_mm_mul_ps(ay,bz),_mm_mul_ps(az,by));
+		__m128 ny=_mm_sub_ps(_mm_mul_ps(az,bx),_mm_mul_ps(ax,bz));
+		__m128 nz=_mm_sub_ps(_mm_mul_ps(ax,by),_mm_mul_ps(ay,bx));
+		__m128 len=_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx,nx),_mm_mul_ps(ny,ny)),_mm_mul_ps(nz,nz)));
+		// degenerate faces get a zero normal
+		__m128 scale=_mm_and_ps(_mm_cmpgt_ps(len,_mm_setzero_ps()),_mm_div_ps(_mm_set1_ps(1),len));
+		nx=_mm_mul_ps(nx,scale);
+		ny=_mm_mul_ps(ny,scale);
+		nz=_mm_mul_ps(nz,scale);
+		__m128 area=_mm_mul_ps(len,_mm_set1_ps(0.5f));
+		_MM_TRANSPOSE4_PS(nx,ny,nz,area);
+		_mm_storeu_ps(m_FaceNormals[f].arr(),nx);
+		_mm_storeu_ps(m_FaceNormals[f+1].arr(),ny);
+		_mm_storeu_ps(m_FaceNormals[f+2].arr(),nz);
+		_mm_storeu_ps(m_FaceNormals[f+3].arr(),area);
+	}
+#endif
+	
+	for (; f<end; f++)
+	{
+		unsigned int first,last;
+		GetFaceSlots(f,first,last);
+		if (m_Type==QUADS) { p[0]=first; p[1]=first+2; p[2]=first+1; p[3]=first+3; }
+		else { p[0]=first; p[1]=first+1; p[2]=first+1; p[3]=first+2; }
+		if (index) for (unsigned int k=0; k<4; k++) p[k]=index[p[k]];
 		
-		if (smooth && !m_IndexMode)
+		dVector normal=(verts[p[1]]-verts[p[0]]).cross(verts[p[3]]-verts[p[2]]);
+		float len=normal.mag();
+		if (len>0) normal/=len;
+		else normal=dVector(0,0,0);
+		m_FaceNormals[f]=dVector(normal.x,normal.y,normal.z,len*0.5f);
+	}
+	
+	// now give each slot its face's normal
+	for (f=start; f<end; f++)
+	{
+		const dVector &face=m_FaceNormals[f];
+		dVector normal(face.x,face.y,face.z);
+		unsigned int first,last;
+		GetFaceSlots(f,first,last);
+		for (unsigned int s=first; s<last; s++)
 		{
-			// smooth the normals
-			TypedPData<dVector> *newnorms = new TypedPData<dVector>;
-			for (unsigned int i=0; i<m_VertData->size(); i++)
+			m_GeometricNormals[s]=normal;
+			if (flat) (*m_NormData)[s]=normal;
+			if (weights)
 			{
-				float count=1;
-				dVector n = (*m_NormData)[i];
-				for (vector<int>::iterator b=m_ConnectedVerts[i].begin(); 
-						b!=m_ConnectedVerts[i].end(); b++)
+				switch (weighting)
 				{
-					n+=(*m_NormData)[*b];
-					count+=1;
+					case WEIGHT_AREA: m_WeightedNormals[s]=normal*face.w; break;
+					case WEIGHT_ANGLE: m_WeightedNormals[s]=normal*GetCornerAngle(f,s); break;
+					default: m_WeightedNormals[s]=normal;
 				}
-				newnorms->m_Data.push_back((n/count).normalise());
 			}
-			SetDataRaw("n", newnorms);
 		}
 	}
 }
 
+void PolyPrimitive::AccumulateNormals(unsigned int start, unsigned int end)
+{
+	for (unsigned int g=start; g<end; g++)
+	{
+		unsigned int first=m_NormalGroupStart[g];
+		unsigned int last=m_NormalGroupStart[g+1];
+		// verts not used by any face are left alone
+		if (first==last) continue;
+		
+		dVector n(0,0,0);
+		for (unsigned int i=first; i<last; i++)
+		{
+			n+=m_WeightedNormals[m_NormalGroupSlots[i]];
+		}
+		
+		float len=n.mag();
+		if (len>0) n/=len;
+		
+		if (m_IndexMode) (*m_NormData)[g]=n;
+		else m_GroupNormals[g]=n;
+	}
+}
+
+void PolyPrimitive::CopyGroupNormals(unsigned int start, unsigned int end)
+{
+	for (unsigned int v=start; v<end; v++)
+	{
+		(*m_NormData)[v]=m_GroupNormals[m_NormalGroup[v]];
+	}
+}
+
 void PolyPrimitive::ConvertToIndexed()
 {
 	if (m_IndexMode) return;
 
-	if (m_ConnectedVerts.empty())
+	if (m_ConnectedVerts.size()!=m_VertData->size())
 	{
 		CalculateConnected();
 	}
@@ -352,12 +967,16 @@ void PolyPrimitive::ConvertToIndexed()
 	SetDataRaw("t", NewTex);
 		
 	m_IndexMode=true;
+	m_IndexDirty=true;
 }
 
 void PolyPrimitive::GenerateTopology()
 {
-	if (m_ConnectedVerts.empty())
+	// the cache is also thrown away if the size has changed
+	unsigned int vertcount=m_IndexMode?m_IndexData.size():m_VertData->size();
+	if (m_ConnectedVerts.size()!=vertcount)
 	{
+		ClearTopology();
 		CalculateConnected();
 	}
 	
@@ -367,44 +986,72 @@ void PolyPrimitive::GenerateTopology()
 	}
 }
 
+void PolyPrimitive::ClearTopology()
+{
+	m_ConnectedVerts.clear();
+	m_GeometricNormals.clear();
+	m_UniqueEdges.clear();
+	m_TopologyVersion=++m_NextTopologyVersion;
+}
+
 void PolyPrimitive::CalculateConnected()
 { 
+	m_ConnectedVerts.clear();
+	if (m_VertData->empty()) return;
+	
+	// use a spatial hash to find the coincident verts, 
+	// rather than comparing every vert with every other
+	SpatialHash hash;
+	hash.Build(&(*m_VertData)[0],m_VertData->size());
 	
 	if (m_IndexMode)
 	{		
+		// the index positions which use each vert
+		vector<vector<int> > users(m_VertData->size());
 		for (unsigned int i=0; i<m_IndexData.size(); i++)
 		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_IndexData.size(); b++)
+			users[m_IndexData[i]].push_back(i);
+		}
+		
+		m_ConnectedVerts.resize(m_IndexData.size());
+		vector<int> coincident;
+		vector<int> connected;
+		for (unsigned int v=0; v<users.size(); v++)
+		{
+			if (users[v].empty()) continue;
+			
+			// index positions are connected if they share the 
+			// index value, or their positions are close
+			coincident.clear();
+			hash.Find((*m_VertData)[v],coincident);
+			connected.clear();
+			for (vector<int>::iterator c=coincident.begin(); c!=coincident.end(); ++c)
+			{
+				connected.insert(connected.end(),users[*c].begin(),users[*c].end());
+			}
+			sort(connected.begin(),connected.end());
+			
+			for (vector<int>::iterator i=users[v].begin(); i!=users[v].end(); ++i)
 			{
-				// compare index value
-				if (i!=b && (m_IndexData[i]==m_IndexData[b] || 
-				   // compare positions
-				   ((*m_VertData)[m_IndexData[i]].feq((*m_VertData)[m_IndexData[b]]))))
+				vector<int> &dst=m_ConnectedVerts[*i];
+				dst.reserve(connected.size()-1);
+				for (vector<int>::iterator c=connected.begin(); c!=connected.end(); ++c)
 				{
-					connected.push_back(b);
+					if (*c!=*i) dst.push_back(*c);
 				}
 			}
-			
-			m_ConnectedVerts.push_back(connected);
 		}
 	}
 	else
 	{
-		// cache the connected verts 
+		m_ConnectedVerts.resize(m_VertData->size());
 		for (unsigned int i=0; i<m_VertData->size(); i++)
 		{
-			vector<int> connected;
-			for (unsigned int b=0; b<m_VertData->size(); b++)
-			{
-				// find all close verts
-				if (i!=b && (*m_VertData)[i].feq((*m_VertData)[b]))
-				{
-					connected.push_back(b);
-				}
-			}	
-
-			m_ConnectedVerts.push_back(connected);
+			// find all close verts
+			vector<int> &connected=m_ConnectedVerts[i];
+			hash.Find((*m_VertData)[i],connected);
+			connected.erase(remove(connected.begin(),connected.end(),(int)i),connected.end());
+			sort(connected.begin(),connected.end());
 		}
 	}
 }
@@ -413,72 +1060,26 @@ void PolyPrimitive::CalculateConnected()
 void PolyPrimitive::CalculateGeometricNormals()
 {
 	///\todo - need different approach for TRIFAN
-	// one face 
-	if (m_Type==POLYGON && m_VertData->size()>2) 
-	{
-		m_GeometricNormals.clear();
-		dVector a((*m_VertData)[0]-(*m_VertData)[1]);
-		dVector b((*m_VertData)[1]-(*m_VertData)[2]);
-		dVector normal(a.cross(b));
-		normal.normalise();
-		
-		for (unsigned int i=0; i<m_VertData->size(); i++)
-		{
-			m_GeometricNormals.push_back(normal);
-		}
-		
-		return;
-	}
-	
-	int stride=0;
-	if (m_Type==TRISTRIP) stride=2;
-	if (m_Type==QUADS) stride=4;
-	if (m_Type==TRILIST) stride=3;
-	if (stride>0)
-	{
-		m_GeometricNormals.clear();
-		
-		if (m_IndexMode)
-		{
-			for (unsigned int i=0; i<m_IndexData.size(); i+=stride)
-			{
-				if (i+2<m_IndexData.size())
-				{
-					dVector a((*m_VertData)[m_IndexData[i]]-(*m_VertData)[m_IndexData[i+1]]);
-					dVector b((*m_VertData)[m_IndexData[i+1]]-(*m_VertData)[m_IndexData[i+2]]);
-					dVector normal(a.cross(b));
-					normal.normalise();
-					for (int n=0; n<stride; n++)
-					{
-						m_GeometricNormals.push_back(normal);
-					}
-				}
-			}
-		}
-		else
-		{
-			for (unsigned int i=0; i<m_VertData->size(); i+=stride)
-			{
-				if (i+2<m_VertData->size())
-				{
-					dVector a((*m_VertData)[i]-(*m_VertData)[i+1]);
-					dVector b((*m_VertData)[i+1]-(*m_VertData)[i+2]);
-					dVector normal(a.cross(b));
-					normal.normalise();
-					for (int n=0; n<stride; n++)
-					{
-						m_GeometricNormals.push_back(normal);
-					}
-				}
-			}
-		}
-	}
+	if (m_Type==TRIFAN) return;
+	UpdateFaceNormals(WEIGHT_EQUAL,false,false);
+}
+
+// each vert in a face has one edge leading from it, to the next 
+// vert around the face, so an edge can be checked and looked up 
+// from its first vert without needing to store them all
+static inline bool IsFaceEdge(int a, int b, int stride, int vertcount)
+{
+	if (a>=vertcount || b>=vertcount || a/stride!=b/stride) return false;
+	int pa=a%stride, pb=b%stride;
+	return pb==pa+1 || (pa==stride-1 && pb==0);
 }
 
 void PolyPrimitive::CalculateUniqueEdges()
 {
 	if (m_UniqueEdges.empty())
 	{
+		GenerateTopology();
+		
 		// todo - need different approach for TRIFAN
 		int stride=0;
 		if (m_Type==TRISTRIP) stride=2;
@@ -486,82 +1087,59 @@ void PolyPrimitive::CalculateUniqueEdges()
 		if (m_Type==TRILIST) stride=3;
 		if (stride>0)
 		{		
-			set<pair<int,int> > firstpass;
-			
 			unsigned int vertcount=m_VertData->size();
 			if (m_IndexMode) vertcount=m_IndexData.size();
-			
-			// first, record all valid edges from the topology type
-			for (unsigned int i=0; i<vertcount; i+=stride)
-			{
-				for (int n=0; n<stride-1; n++)
-				{
-					firstpass.insert(pair<int,int>(n+i,n+i+1));
-				}
-				firstpass.insert(pair<int,int>(i+stride-1,i));
-			}
+			// only whole faces
+			vertcount-=vertcount%stride;
 
-			set<pair<int,int> > stored;
-			pair<int,int> key;
+			// whether the edge leading from each vert has been stored
+			vector<bool> stored(vertcount,false);
 
-			// now find all edges which share points and group them together
+			// find all edges which share points and group them together
 			for (unsigned int i=0; i<vertcount; i+=stride)
 			{
 				for (int n=0; n<stride-1; n++)
 				{	
-					UniqueEdgesFindShared(pair<int,int>(n+i,n+i+1), firstpass, stored);
+					UniqueEdgesFindShared(n+i, n+i+1, stride, vertcount, stored);
 				}	
-				UniqueEdgesFindShared(pair<int,int>(i+stride-1,i), firstpass, stored);	
+				UniqueEdgesFindShared(i+stride-1, i, stride, vertcount, stored);	
 			}
 		}
 	}
 }
 
-void PolyPrimitive::UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored)
+void PolyPrimitive::UniqueEdgesFindShared(int a, int b, int stride, int vertcount, vector<bool> &stored)
 {
+	if (stored[a] || (IsFaceEdge(b,a,stride,vertcount) && stored[b])) return;
+	
+	// first, store the test edge
 	vector<pair<int,int> > edges;
+	edges.push_back(pair<int,int>(a,b));
+	stored[a]=true;
 	
-	if (stored.find(edge)==stored.end() && stored.find(pair<int,int>(edge.second,edge.first))==stored.end())
+	// make all combinations of verts connected to the edge verts
+	for (vector<int>::iterator ca=m_ConnectedVerts[a].begin();
+		ca!=m_ConnectedVerts[a].end(); ca++)
 	{
-		// first, store the test edge
-		edges.push_back(edge);
-		stored.insert(edge);
-		
-		//Trace::Stream<<"edge:"<<edge.first<<" "<<edge.second<<endl;
-		
-		// make all combinations of verts connected to the edge verts
-		for (vector<int>::iterator a=m_ConnectedVerts[edge.first].begin();
-			a!=m_ConnectedVerts[edge.first].end(); a++)
+		for (vector<int>::iterator cb=m_ConnectedVerts[b].begin();
+				cb!=m_ConnectedVerts[b].end(); cb++)
 		{
-			for (vector<int>::iterator b=m_ConnectedVerts[edge.second].begin();
-					b!=m_ConnectedVerts[edge.second].end(); b++)
+			// if this is a real edge and we've not stored it already
+			if (IsFaceEdge(*ca,*cb,stride,vertcount) && !stored[*ca])
 			{
-				//Trace::Stream<<*a<<" "<<*b<<endl;
-				pair<int, int> candidate(*a,*b);
-				if (firstpass.find(candidate)!=firstpass.end() && // if this is a real edge
-					stored.find(candidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(candidate);
-					stored.insert(candidate);
-					//Trace::Stream<<"^ "<<candidate.first<<" "<<candidate.second<<endl;
-				}						
-
-				pair<int, int> rcandidate(*b,*a);
-				if (firstpass.find(rcandidate)!=firstpass.end() && // if this is a real edge
-					stored.find(rcandidate)==stored.end() )        // and we've not stored it already
-				{
-					edges.push_back(rcandidate);
-					stored.insert(rcandidate);
-					//Trace::Stream<<"^ "<<rcandidate.first<<" "<<rcandidate.second<<endl;
-				}						
-			}
-		}
+				edges.push_back(pair<int,int>(*ca,*cb));
+				stored[*ca]=true;
+			}						
 
-		if (!edges.empty())
-		{
-			m_UniqueEdges.push_back(edges);
+			if (IsFaceEdge(*cb,*ca,stride,vertcount) && !stored[*cb])
+			{
+				edges.push_back(pair<int,int>(*cb,*ca));
+				stored[*cb]=true;
+			}						
 		}
 	}
+
+	m_UniqueEdges.push_back(edges);
 }
 
 dBoundingBox PolyPrimitive::GetBoundingBox(const dMatrix &space)
@@ -576,24 +1154,165 @@ dBoundingBox PolyPrimitive::GetBoundingBox(const dMatrix &space)
 
 void PolyPrimitive::ApplyTransform(bool ScaleRotOnly)
 {
+	if (m_VertData->empty()) 
+	{
+		GetState()->Transform.init();
+		return;
+	}
+	
 	if (!ScaleRotOnly)
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
-		{
- 			*i=GetState()->Transform.transform(*i);
-			// why not normals?
-		}
+		// why not normals?
+		GetState()->Transform.transform(&(*m_VertData)[0],&(*m_VertData)[0],m_VertData->size());
 	}
 	else
 	{
-		for (unsigned int i=0; i<m_VertData->size(); i++)
+		GetState()->Transform.transform_no_trans(&(*m_VertData)[0],&(*m_VertData)[0],m_VertData->size());
+		GetState()->Transform.transform_normals(&(*m_NormData)[0],&(*m_NormData)[0],m_NormData->size());
+		SetDataDirty("n");
+	}
+	
+	SetDataDirty("p");
+	
+	GetState()->Transform.init();
+}
+
+void PolyPrimitive::CalculateTriangleBoxes()
+{
+	if (m_BVHTriangles.empty())
+	{
+		m_TriangleBoxes.clear();
+		return;
+	}
+
+	const dVector *verts=&(*m_VertData)[0];
+	unsigned int count=m_BVHTriangles.size()/3;
+	m_TriangleBoxes.resize(count);
+	for (unsigned int i=0; i<count; i++)
+	{
+		const dVector &a=verts[m_BVHTriangles[i*3]];
+		const dVector &b=verts[m_BVHTriangles[i*3+1]];
+		const dVector &c=verts[m_BVHTriangles[i*3+2]];
+		dBoundingBox &box=m_TriangleBoxes[i];
+		box.min=dVector(min(a.x,min(b.x,c.x)),min(a.y,min(b.y,c.y)),min(a.z,min(b.z,c.z)));
+		box.max=dVector(max(a.x,max(b.x,c.x)),max(a.y,max(b.y,c.y)),max(a.z,max(b.z,c.z)));
+	}
+}
+
+void PolyPrimitive::UpdateTriangleBVH()
+{
+	static const unsigned int POSITION_HANDLE=PDataContainer::GetHandle("p");
+	unsigned int positions=GetDataRawConst(POSITION_HANDLE)->GetVersion();
+	
+	if (m_TriangleBVHTopology==m_TopologyVersion &&
+		m_TriangleBVHVerts==m_VertData->size())
+	{
+		if (m_TriangleBVHPositions==positions) return;
+		
+		// same triangles in new places, refitting is much 
+		// quicker than building it again, until the tree 
+		// has got too baggy
+		m_TriangleBVHPositions=positions;
+		if (m_BVHTriangles.empty()) return;
+		CalculateTriangleBoxes();
+		m_TriangleBVH.RefitAll(m_TriangleBoxes);
+		if (!m_TriangleBVH.NeedsRebuild()) return;
+	}
+	else
+	{
+		m_TriangleBVHTopology=m_TopologyVersion;
+		m_TriangleBVHPositions=positions;
+		m_TriangleBVHVerts=m_VertData->size();
+		
+		// leave out any triangles with bad indices
+		vector<unsigned int> triangles;
+		GetTriangles(triangles);
+		m_BVHTriangles.clear();
+		m_BVHTriangles.reserve(triangles.size());
+		for (unsigned int i=0; i+2<triangles.size(); i+=3)
 		{
-			(*m_VertData)[i]=GetState()->Transform.transform_no_trans((*m_VertData)[i]);
-			(*m_NormData)[i]=GetState()->Transform.transform_no_trans((*m_NormData)[i]).normalise();
+			if (triangles[i]<m_TriangleBVHVerts && 
+				triangles[i+1]<m_TriangleBVHVerts &&
+				triangles[i+2]<m_TriangleBVHVerts)
+			{
+				m_BVHTriangles.push_back(triangles[i]);
+				m_BVHTriangles.push_back(triangles[i+1]);
+				m_BVHTriangles.push_back(triangles[i+2]);
+			}
 		}
+		CalculateTriangleBoxes();
+	}
+
+	vector<int> items(m_TriangleBoxes.size());
+	for (unsigned int i=0; i<items.size(); i++) items[i]=i;
+	m_TriangleBVH.Build(items,m_TriangleBoxes);
+}
+
+void PolyPrimitive::ClearLOD()
+{
+	for (vector<PolyPrimitive*>::iterator i=m_LODLevels.begin(); i!=m_LODLevels.end(); ++i)
+	{
+		delete *i;
 	}
+	m_LODLevels.clear();
+	m_LODTriangles.clear();
+	m_LOD=0;
+}
+
+void PolyPrimitive::BuildLOD(unsigned int levels, float ratio)
+{
+	ClearLOD();
+	if (levels==0) return;
 	
-	GetState()->Transform.init();
+	if (ratio<=0 || ratio>=1)
+	{
+		Trace::Stream<<"PolyPrimitive::BuildLOD: ratio should be between 0 and 1"<<endl;
+		return;
+	}
+
+	vector<unsigned int> triangles;
+	GetTriangles(triangles);
+	unsigned int count=triangles.size()/3;
+	
+	m_LODTriangles.push_back(count);
+	vector<unsigned int> targets;
+	float target=count;
+	for (unsigned int n=0; n<levels; n++)
+	{
+		target*=ratio;
+		// no point going much further than this
+		if (target<4) break;
+		targets.push_back((unsigned int)target);
+	}
+	
+	if (targets.empty()) return;
+	
+	MeshSimplifier simplifier;
+	simplifier.Simplify(this,targets,m_LODLevels);
+	
+	for (vector<PolyPrimitive*>::iterator i=m_LODLevels.begin(); i!=m_LODLevels.end(); ++i)
+	{
+		m_LODTriangles.push_back((*i)->GetIndexConst().size()/3);
+	}
 }
 
+void PolyPrimitive::SetScreenSize(float pixels)
+{
+	m_LOD=0;
+	if (m_LODLevels.empty() || m_LODDetail<=0) return;
+
+	// the triangles we need to cover the area on screen, 
+	// use the coarsest level with at least that many
+	float needed=pixels*pixels/m_LODDetail;
+	for (unsigned int n=1; n<m_LODTriangles.size(); n++)
+	{
+		if (m_LODTriangles[n]<needed) break;
+		m_LOD=n;
+	}
+}
 
+unsigned int PolyPrimitive::GetTrianglesSaved() const
+{
+	if (m_LOD==0) return 0;
+	return m_LODTriangles[0]-m_LODTriangles[m_LOD];
+}
@@ -21,6 +21,8 @@
 
 #include "Primitive.h"
 #include "PolyEvaluator.h"
+#include "VertexBuffer.h"
+#include "BVH.h"
 
 namespace Fluxus
 {
@@ -42,6 +44,7 @@ public:
 	///@{
 	virtual PolyPrimitive *Clone() const;
 	virtual void Render();
+	virtual void RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours);
 	virtual dBoundingBox GetBoundingBox(const dMatrix &space);
 	virtual void RecalculateNormals(bool smooth);
 	virtual void ApplyTransform(bool ScaleRotOnly=false);
@@ -51,6 +54,16 @@ public:
 	
 	Type GetType() const { return m_Type; }
 	
+	/// How face normals are weighted when they are 
+	/// averaged into smooth vertex normals
+	enum NormalWeighting{WEIGHT_EQUAL,WEIGHT_AREA,WEIGHT_ANGLE};
+	
+	/// Recalculates the normals from the vertex positions, smooth 
+	/// normals average the faces sharing coincident verts (or the 
+	/// same index in indexed mode). Also updates the geometric 
+	/// normals, and is quick enough to call every frame.
+	void RecalculateNormals(bool smooth, NormalWeighting weighting);
+	
 	/// Add a new vertex to the primitive
 	virtual void AddVertex(const dVertex &Vert);
 		
@@ -81,20 +94,61 @@ public:
 	/// In indexed mode there is a geometric normal 
 	/// for every index
 	const vector<dVector> &GetGeometricNormals() { GenerateTopology(); return m_GeometricNormals; }
+	
+	/// Changes whenever the topology is thrown away, so things
+	/// built from it can tell when they need rebuilding. No two
+	/// primitives share a version.
+	unsigned int GetTopologyVersion() const { return m_TopologyVersion; }
 	///@}
 
 	//////////////////////////////////////////////////
 	///@name Indexed mode access
 	///@{
-	void SetIndexMode(bool s) { m_IndexMode=s; }
+	void SetIndexMode(bool s) { m_IndexMode=s; m_IndexDirty=true; }
 	bool IsIndexed() const { return m_IndexMode; }
-	vector<unsigned int> &GetIndex() { return m_IndexData; }
+	/// Assumes the index will be written to, use 
+	/// GetIndexConst() for reading
+	vector<unsigned int> &GetIndex() { m_IndexDirty=true; ClearTopology(); return m_IndexData; }
 	const vector<unsigned int> &GetIndexConst() const { return m_IndexData; }
 	/// Look at coincident verts and compress the poly
 	/// primitive into an indexed form
 	void ConvertToIndexed();
 	///@}
+
+	///////////////////////////////////////////////////
+	///@name Level of detail
+	/// Simplified copies of the primitive, drawn in its place 
+	/// when it's small on screen. They are copies, so they need 
+	/// building again if the primitive changes shape.
+	///@{
+	/// Builds the levels, each with ratio times the triangles 
+	/// of the one before, none clears them
+	void BuildLOD(unsigned int levels, float ratio);
+	unsigned int GetNumLODLevels() const { return m_LODLevels.size(); }
+	/// The level drawn next, 0 is the primitive itself
+	unsigned int GetLOD() const { return m_LOD; }
+	virtual void SetScreenSize(float pixels);
+	virtual void SetLODDetail(float pixelspertriangle) { m_LODDetail=pixelspertriangle; }
+	virtual unsigned int GetTrianglesSaved() const;
+	///@}
+	
+	/// Appends the vertex numbers of the triangles making
+	/// up the primitive, three per triangle, whatever its 
+	/// type, and going through the index if there is one
+	void GetTriangles(vector<unsigned int> &triangles) const;
 	
+	///////////////////////////////////////////////////
+	///@name Triangle bounding volume hierarchy
+	/// For quickly finding the triangles hit by lines. It's 
+	/// built when first asked for, after which it's refitted 
+	/// when "p" is marked as changed and rebuilt when the 
+	/// topology changes.
+	///@{
+	/// The items are triangle numbers
+	const BVH &GetTriangleBVH() { UpdateTriangleBVH(); return m_TriangleBVH; }
+	/// The vertex numbers of the triangles in the BVH, three per triangle
+	const vector<unsigned int> &GetBVHTriangles() { UpdateTriangleBVH(); return m_BVHTriangles; }
+	///@}
 	
 protected:
 
@@ -102,15 +156,68 @@ protected:
 	
 	// Topology generation commands
 	void GenerateTopology();
+	void ClearTopology();
 	void CalculateConnected();
 	void CalculateGeometricNormals();
 	void CalculateUniqueEdges();
-	void UniqueEdgesFindShared(pair<int,int> edge, set<pair<int,int> > firstpass, set<pair<int,int> > &stored);
-	void RecalculateNormalsIndexed();
+	void UniqueEdgesFindShared(int a, int b, int stride, int vertcount, vector<bool> &stored);
+	
+	/// Threads are only used for more faces than this
+	static const unsigned int THREADED_SIZE=4096;
+	
+	// Normal generation, the face normals are worked out for 
+	// each slot (vert, or index position in indexed mode) and 
+	// then averaged over the groups of slots sharing a normal
+	unsigned int GetNumFaces() const;
+	void GetFaceSlots(unsigned int face, unsigned int &first, unsigned int &last) const;
+	float GetCornerAngle(unsigned int face, unsigned int slot) const;
+	void BuildNormalGroups();
+	void UpdateFaceNormals(NormalWeighting weighting, bool weights, bool flat);
+	void CalculateFaceNormals(unsigned int start, unsigned int end, NormalWeighting weighting, 
+	                          bool weights, bool flat);
+	void AccumulateNormals(unsigned int start, unsigned int end);
+	void CopyGroupNormals(unsigned int start, unsigned int end);
+	void RunNormalJobs(int phase, unsigned int count, NormalWeighting weighting, bool weights, bool flat);
+	static void *NormalThread(void *data);
+	
+	/// Sends any changed pdata to the vertex buffers
+	void UpdateBuffers(const State &state);
+
+	/// Renders once, or once per transform if they are given. The 
+	/// state is passed in so level of detail copies can use ours
+	void RenderGeometry(const State &state, const vector<dMatrix> *transforms, const vector<dColour> *colours);
+	void RenderNormals(const State &state);
+	void Draw(int type, const void *index, const vector<dMatrix> *transforms, 
+	          const vector<dColour> *colours, bool hardware, int colattrib);
+
+	/// Sets up the per-instance shader attributes "InstanceTransform" 
+	/// and "InstanceColour" for hardware instancing, returns false if
+	/// it's not supported, or not used by the current shader
+	bool EnableInstanceStreams(const State &state, const vector<dMatrix> &transforms, const vector<dColour> *colours,
+	                           int &attrib, int &colattrib);
+	/// Otherwise sets them to an identity matrix and white, and 
+	/// returns the colour attribute to set for each copy, or -1
+	void SetInstanceConstants(const State &state, int &colattrib);
+	void DisableInstanceStreams(int attrib, int colattrib);
 	
 	vector<vector<int> > m_ConnectedVerts;
 	vector<dVector> m_GeometricNormals;
 	vector<vector<pair<int,int> > > m_UniqueEdges;
+	unsigned int m_TopologyVersion;
+	static unsigned int m_NextTopologyVersion;
+	
+	/// The slots averaged into each smooth normal, a group 
+	/// per vert in indexed mode, or per welded vert otherwise
+	vector<unsigned int> m_NormalGroupStart;
+	vector<unsigned int> m_NormalGroupSlots;
+	/// The group of each vert when not indexed
+	vector<unsigned int> m_NormalGroup;
+	unsigned int m_NormalGroupsVersion;
+	/// Unit normal and area (in w) for each face
+	vector<dVector> m_FaceNormals;
+	/// The face normals scaled by their weight, for each slot
+	vector<dVector> m_WeightedNormals;
+	vector<dVector> m_GroupNormals;
 	
 	bool m_IndexMode;
 	vector<unsigned int> m_IndexData;
@@ -120,6 +227,32 @@ protected:
 	vector<dVector,FLX_ALLOC(dVector) > *m_NormData;
 	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
 	vector<dVector,FLX_ALLOC(dVector) > *m_TexData;
+	
+	VertexBuffer m_VertBuffer;
+	VertexBuffer m_NormBuffer;
+	VertexBuffer m_ColBuffer;
+	VertexBuffer m_TexBuffer;
+	VertexBuffer m_IndexBuffer;
+	bool m_IndexDirty;
+	VertexBuffer m_InstanceBuffer;
+	VertexBuffer m_InstanceColourBuffer;
+	
+	void UpdateTriangleBVH();
+	void CalculateTriangleBoxes();
+	BVH m_TriangleBVH;
+	vector<unsigned int> m_BVHTriangles;
+	vector<dBoundingBox> m_TriangleBoxes;
+	/// What the BVH was made from, to tell when it's out of date
+	unsigned int m_TriangleBVHTopology;
+	unsigned int m_TriangleBVHPositions;
+	unsigned int m_TriangleBVHVerts;
+	
+	void ClearLOD();
+	vector<PolyPrimitive*> m_LODLevels;
+	/// Triangles in each level, starting with this one
+	vector<unsigned int> m_LODTriangles;
+	unsigned int m_LOD;
+	float m_LODDetail;
 };
 
 };
@@ -51,25 +51,38 @@ void Primitive::Prerender()
 
 	if (m_State.Shader!=NULL)
 	{
-		for (map<string,PData*>::iterator i=m_PData.begin(); i!=m_PData.end(); i++)
+		for (vector<PDataSlot>::iterator i=m_PData.begin(); i!=m_PData.end(); i++)
 		{
-			TypedPData<dVector> *data = dynamic_cast<TypedPData<dVector>*>(i->second);
-			if (data) m_State.Shader->SetVectorAttrib(i->first,data->m_Data);
-			else
+			if (i->Data==NULL) continue;
+			const string &name=GetHandleName(i->Handle);
+			switch (i->Data->GetType())
 			{
-				TypedPData<dColour> *data = dynamic_cast<TypedPData<dColour>*>(i->second);
-				if (data) m_State.Shader->SetColourAttrib(i->first,data->m_Data);
-				else
-				{
-					TypedPData<float> *data = dynamic_cast<TypedPData<float>*>(i->second);
-					if (data) m_State.Shader->SetFloatAttrib(i->first,data->m_Data);
-				}
+				case 'v': m_State.Shader->SetVectorAttrib(name,static_cast<TypedPData<dVector>*>(i->Data)->m_Data); break;
+				case 'c': m_State.Shader->SetColourAttrib(name,static_cast<TypedPData<dColour>*>(i->Data)->m_Data); break;
+				case 'f': m_State.Shader->SetFloatAttrib(name,static_cast<TypedPData<float>*>(i->Data)->m_Data); break;
 			}
 		}
 	}
 
 }
 
+void Primitive::RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours)
+{
+	for (unsigned int i=0; i<transforms.size(); i++)
+	{
+		glPushMatrix();
+		glMultMatrixf(transforms[i].arr());
+		if (!colours.empty())
+		{
+			m_State.Colour=colours[i];
+			glColor4fv(m_State.Colour.arr());
+			glMaterialfv(GL_FRONT_AND_BACK,GL_DIFFUSE,m_State.Colour.arr());
+		}
+		Render();
+		glPopMatrix();
+	}
+}
+
 void Primitive::RenderAxes()
 {
 	glDisable(GL_LIGHTING);
@@ -52,6 +52,26 @@ public:
 	/// Only makes sense for certain primitive types
 	virtual void RecalculateNormals(bool smooth) {}
 
+	/// Renders the primitive once for each transform, with the
+	/// state applied once for them all. If colours is not empty
+	/// it needs one colour per transform. The default just calls
+	/// Render() for each, derived types can do it in one go.
+	virtual void RenderInstances(const vector<dMatrix> &transforms, const vector<dColour> &colours);
+
+	///////////////////////////////////////////////////
+	///@name Level of detail
+	/// The scenegraph tells each primitive roughly how many 
+	/// pixels across it will be drawn before rendering it, the 
+	/// types that support it use this to draw fewer triangles
+	///@{
+	virtual void SetScreenSize(float pixels) {}
+	/// How many pixels each triangle should cover on screen, 
+	/// zero turns the level of detail off where that's possible
+	virtual void SetLODDetail(float pixelspertriangle) {}
+	/// The triangles saved for the last screen size set
+	virtual unsigned int GetTrianglesSaved() const { return 0; }
+	///@}
+
 	///////////////////////////////////////////////////
 	///@name Primitive Interface
 	///@{
@@ -16,7 +16,9 @@
  
 #include "PrimitiveIO.h"
 #include "OBJPrimitiveIO.h"
+#include "PLYPrimitiveIO.h"
 #include "PixelPrimitiveIO.h"
+#include "MeshCache.h"
 #include "SceneGraph.h"
 
 using namespace Fluxus;
@@ -40,13 +42,25 @@ Primitive *PrimitiveIO::Read(const string &filename, bool cache)
 	
 	// otherwise, we need to load it...
 	string extension = filename.substr(filename.find_last_of('.')+1,filename.size());
-	PrimitiveIO *pio = GetFromExtension(extension);
+	bool mesh = extension=="obj" || extension=="ply";
+
+	// meshes are much quicker to load from their binary cache 
 	Primitive *prim = NULL;
-	if (pio!=NULL)
+	if (mesh) prim = MeshCache::Read(filename);
+	
+	if (prim==NULL)
 	{
-		prim = pio->FormatRead(filename);
+		PrimitiveIO *pio = GetFromExtension(extension);
+		if (pio!=NULL)
+		{
+			prim = pio->FormatRead(filename);
+		}
+		delete pio;
+
+		// it doesn't matter if the cache can't be written, 
+		// the directory could be read only
+		if (prim!=NULL && mesh) MeshCache::Write(filename,prim);
 	}
-	delete pio;
 	
 	if (prim==NULL) return NULL;
 	if (!cache) return prim;
@@ -72,6 +86,7 @@ bool PrimitiveIO::Write(const std::string &filename, const Primitive *ob, unsign
 PrimitiveIO *PrimitiveIO::GetFromExtension(const string &extension)
 {
 	if (extension=="obj") return new OBJPrimitiveIO;
+	else if (extension=="ply") return new PLYPrimitiveIO;
 	else if (extension=="png") return new PixelPrimitiveIO;
 	return NULL;
 }
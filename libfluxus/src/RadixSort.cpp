@@ -0,0 +1,197 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <string.h>
+#include <algorithm>
+#include "RadixSort.h"
+#include "JobPool.h"
+
+using namespace Fluxus;
+
+// 11 bits per pass, so three passes cover 32 bit keys
+static const unsigned int RADIX_BITS=11;
+static const unsigned int RADIX_SIZE=1<<RADIX_BITS;
+static const unsigned int RADIX_MASK=RADIX_SIZE-1;
+
+// flips the bits of a float so the keys sort correctly as 
+// unsigned ints, negative numbers need all their bits flipping
+static inline unsigned int FloatToKey(float f)
+{
+	unsigned int u;
+	memcpy(&u,&f,sizeof(u));
+	return (u&0x80000000)?~u:(u|0x80000000);
+}
+
+// one thread's slice of a pass, it counts the digits in its 
+// slice, then copies them out once it's been given the offsets
+struct RadixJob
+{
+	unsigned int Shift;
+	unsigned int Start,End;
+	unsigned int *SrcKeys,*SrcIndices;
+	unsigned int *DstKeys,*DstIndices;
+	unsigned int Count[RADIX_SIZE];
+	bool Scatter;
+};
+
+static void *RadixThread(void *data)
+{
+	RadixJob *job=(RadixJob*)data;
+	if (!job->Scatter)
+	{
+		memset(job->Count,0,sizeof(job->Count));
+		for (unsigned int n=job->Start; n<job->End; n++)
+		{
+			job->Count[(job->SrcKeys[n]>>job->Shift)&RADIX_MASK]++;
+		}
+	}
+	else
+	{
+		for (unsigned int n=job->Start; n<job->End; n++)
+		{
+			unsigned int d=(job->SrcKeys[n]>>job->Shift)&RADIX_MASK;
+			unsigned int dst=job->Count[d]++;
+			job->DstKeys[dst]=job->SrcKeys[n];
+			job->DstIndices[dst]=job->SrcIndices[n];
+		}
+	}
+	return NULL;
+}
+
+RadixSort::RadixSort()
+{
+}
+
+RadixSort::~RadixSort()
+{
+}
+
+const vector<unsigned int> &RadixSort::Sort(const vector<float> &keys)
+{
+	unsigned int count=keys.size();
+	m_Keys.resize(count);
+	for (unsigned int n=0; n<count; n++)
+	{
+		m_Keys[n]=FloatToKey(keys[n]);
+	}
+
+	// if last frame's order is still right, keep it
+	if (m_Indices.size()==count)
+	{
+		bool sorted=true;
+		for (unsigned int n=1; n<count && sorted; n++)
+		{
+			sorted=m_Keys[m_Indices[n-1]]<=m_Keys[m_Indices[n]];
+		}
+		if (sorted) return m_Indices;
+	}
+
+	m_Indices.resize(count);
+	m_TempIndices.resize(count);
+	m_TempKeys.resize(count);
+	for (unsigned int n=0; n<count; n++)
+	{
+		m_Indices[n]=n;
+	}
+	if (count<2) return m_Indices;
+
+	// ping pong between the arrays, the keys get sorted 
+	// along with the indices
+	unsigned int *srckeys=&m_Keys[0], *srcindices=&m_Indices[0];
+	unsigned int *dstkeys=&m_TempKeys[0], *dstindices=&m_TempIndices[0];
+	for (unsigned int shift=0; shift<32; shift+=RADIX_BITS)
+	{
+		if (count>THREADED_SIZE) ThreadedPass(shift,srckeys,srcindices,dstkeys,dstindices,count);
+		else Pass(shift,srckeys,srcindices,dstkeys,dstindices,count);
+		swap(srckeys,dstkeys);
+		swap(srcindices,dstindices);
+	}
+
+	// three passes, so the result has ended up in the temp arrays
+	m_Indices.swap(m_TempIndices);
+	return m_Indices;
+}
+
+void RadixSort::Pass(unsigned int shift, unsigned int *srckeys, unsigned int *srcindices,
+                     unsigned int *dstkeys, unsigned int *dstindices, unsigned int count)
+{
+	unsigned int offsets[RADIX_SIZE];
+	memset(offsets,0,sizeof(offsets));
+	for (unsigned int n=0; n<count; n++)
+	{
+		offsets[(srckeys[n]>>shift)&RADIX_MASK]++;
+	}
+
+	unsigned int total=0;
+	for (unsigned int d=0; d<RADIX_SIZE; d++)
+	{
+		unsigned int c=offsets[d];
+		offsets[d]=total;
+		total+=c;
+	}
+
+	for (unsigned int n=0; n<count; n++)
+	{
+		unsigned int dst=offsets[(srckeys[n]>>shift)&RADIX_MASK]++;
+		dstkeys[dst]=srckeys[n];
+		dstindices[dst]=srcindices[n];
+	}
+}
+
+void RadixSort::ThreadedPass(unsigned int shift, unsigned int *srckeys, unsigned int *srcindices,
+                             unsigned int *dstkeys, unsigned int *dstindices, unsigned int count)
+{
+	JobPool *pool=JobPool::Get();
+	unsigned int numthreads=pool->GetNumThreads();
+	if (numthreads==1)
+	{
+		Pass(shift,srckeys,srcindices,dstkeys,dstindices,count);
+		return;
+	}
+
+	RadixJob jobs[JobPool::MAX_THREADS];
+	unsigned int slice=count/numthreads;
+	for (unsigned int t=0; t<numthreads; t++)
+	{
+		jobs[t].Shift=shift;
+		jobs[t].Start=t*slice;
+		jobs[t].End=(t==numthreads-1)?count:(t+1)*slice;
+		jobs[t].SrcKeys=srckeys;
+		jobs[t].SrcIndices=srcindices;
+		jobs[t].DstKeys=dstkeys;
+		jobs[t].DstIndices=dstindices;
+		jobs[t].Scatter=false;
+	}
+
+	pool->RunEach(RadixThread,jobs,numthreads);
+
+	// turn the counts into where each thread writes each digit,
+	// in slice order so the sort stays stable
+	unsigned int total=0;
+	for (unsigned int d=0; d<RADIX_SIZE; d++)
+	{
+		for (unsigned int t=0; t<numthreads; t++)
+		{
+			unsigned int c=jobs[t].Count[d];
+			jobs[t].Count[d]=total;
+			total+=c;
+		}
+	}
+
+	for (unsigned int t=0; t<numthreads; t++) jobs[t].Scatter=true;
+	pool->RunEach(RadixThread,jobs,numthreads);
+}
@@ -0,0 +1,66 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_RADIXSORT
+#define N_RADIXSORT
+
+#include <vector>
+
+using namespace std;
+
+namespace Fluxus
+{
+
+//////////////////////////////////////////////////////
+/// Sorts float keys with a radix sort, giving back the
+/// order as a list of indices into the keys. All the 
+/// working arrays are kept between sorts, so sorting 
+/// every frame doesn't allocate. If the keys come in 
+/// the same order as last time, and the last order is 
+/// still correct (the camera and objects barely moved) 
+/// it's reused without sorting at all. Big sorts are 
+/// split over threads.
+class RadixSort
+{
+public:
+	RadixSort();
+	~RadixSort();
+
+	/// Returns the indices of the keys in ascending order
+	const vector<unsigned int> &Sort(const vector<float> &keys);
+
+	/// Forget the last order
+	void Reset() { m_Indices.clear(); }
+
+	/// Sorts bigger than this are done with threads
+	static const unsigned int THREADED_SIZE=100000;
+
+private:
+	void Pass(unsigned int shift, unsigned int *srckeys, unsigned int *srcindices,
+	          unsigned int *dstkeys, unsigned int *dstindices, unsigned int count);
+	void ThreadedPass(unsigned int shift, unsigned int *srckeys, unsigned int *srcindices,
+	                  unsigned int *dstkeys, unsigned int *dstindices, unsigned int count);
+
+	vector<unsigned int> m_Indices;
+	vector<unsigned int> m_Keys;
+	vector<unsigned int> m_TempIndices;
+	vector<unsigned int> m_TempKeys;
+};
+
+}
+
+#endif
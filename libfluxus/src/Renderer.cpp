@@ -23,6 +23,7 @@
 #include "PrimitiveIO.h"
 #include "ShaderCache.h"
 #include "GLSLShader.h"
+#include "VertexBuffer.h"
 #include "Trace.h"
 #include "FFGLManager.h"
 #include <sys/time.h>
@@ -135,6 +136,9 @@ void Renderer::Render()
 		glClear(GL_ACCUM_BUFFER_BIT);
 	}
 
+	// only moves the parts of the scene which have changed
+	m_World.UpdateTransforms();
+
 	for (unsigned int cam=0; cam<m_CameraVec.size(); cam++)
 	{
 		// need to clear this even if we aren't using shadows
@@ -252,6 +256,7 @@ void Renderer::PreRender(unsigned int CamIndex, bool PickMode)
     if (!m_Initialised || PickMode || Cam.NeedsInit())
     {
 		GLSLShader::Init();
+		VertexBuffer::Init();
 
 		glViewport((int)(Cam.GetViewportX()*(float)m_Width),(int)(Cam.GetViewportY()*(float)m_Height),
 			(int)(Cam.GetViewportWidth()*(float)m_Width),(int)(Cam.GetViewportHeight()*(float)m_Height));
@@ -448,98 +453,112 @@ void Renderer::ClearLights()
 	AddLight(light);
 }
 
-int Renderer::Select(unsigned int CamIndex, int x, int y, int size)
+// general 4x4 inverse by gauss-jordan elimination, dMatrix::inverse() 
+// assumes an affine matrix, which the projection isn't
+static bool InvertMatrix(const dMatrix &src, dMatrix &dst)
 {
-	static const int SELECT_SIZE=512;
-	unsigned int IDs[SELECT_SIZE];
-	memset(IDs,0,SELECT_SIZE);
-	GLuint ID=0;
-	glSelectBuffer(SELECT_SIZE,(GLuint*)IDs);
-	glRenderMode(GL_SELECT);
-	glInitNames();
-	
-	m_SelectInfo.x=x;
-	m_SelectInfo.y=y;
-	m_SelectInfo.size=size;
-	
-	// the problem here is that select is called mid-scene, so we have to set up for 
-	// picking mode here...
-	PreRender(CamIndex,true);
-	
-	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
-	
-	int hits=glRenderMode(GL_RENDER);
-	unsigned int *ptr=IDs, numnames;
-	float minz,maxz,closest=1000000;
+	float a[4][8];
+	for (int r=0; r<4; r++)
+	{
+		for (int c=0; c<4; c++)
+		{
+			a[r][c]=src.m[r][c];
+			a[r][c+4]=(r==c)?1:0;
+		}
+	}
 
-	// process the hit records
-	for (int n=0; n<hits; n++)
+	for (int c=0; c<4; c++)
 	{
-		numnames=*ptr;
-		ptr++;
-		minz = (float) *ptr++/0x7fffffff;
-		maxz = (float) *ptr++/0x7fffffff;
-				
-		// find the closest one
-		if (closest>minz) 
+		// partial pivoting
+		int pivot=c;
+		for (int r=c+1; r<4; r++)
+		{
+			if (fabs(a[r][c])>fabs(a[pivot][c])) pivot=r;
+		}
+		if (a[pivot][c]==0) return false;
+		if (pivot!=c)
 		{
-			closest=minz;
-			ID=*ptr;
+			for (int k=0; k<8; k++) swap(a[c][k],a[pivot][k]);
+		}
+
+		float d=1/a[c][c];
+		for (int k=0; k<8; k++) a[c][k]*=d;
+
+		for (int r=0; r<4; r++)
+		{
+			if (r!=c && a[r][c]!=0)
+			{
+				float f=a[r][c];
+				for (int k=0; k<8; k++) a[r][k]-=f*a[c][k];
+			}
 		}
-		for (unsigned int i=0; i<numnames; i++) *ptr++;
 	}
-	
-	// ... and reset the scene back here so we can carry on afterwards as if nothing
-	// has happened...
-	m_Initialised=false;
-	PreRender(CamIndex);
-	
-	return ID;
+
+	for (int r=0; r<4; r++)
+	{
+		for (int c=0; c<4; c++)
+		{
+			dst.m[r][c]=a[r][c+4];
+		}
+	}
+	return true;
 }
 
-int Renderer::SelectAll(unsigned int CamIndex, int x, int y, int size, unsigned int **rIDs)
+bool Renderer::GetPickLine(unsigned int CamIndex, int x, int y, dVector &start, dVector &end)
 {
-	static const int SELECT_SIZE=512;
-	unsigned int IDs[SELECT_SIZE];
-	static unsigned int OutputIDs[SELECT_SIZE];
+	if (CamIndex>=m_CameraVec.size()) return false;
 
-	memset(IDs,0,SELECT_SIZE);
-	GLuint ID=0;
-	glSelectBuffer(SELECT_SIZE,(GLuint*)IDs);
-	glRenderMode(GL_SELECT);
-	glInitNames();
+	dMatrix viewproj,inv;
+	if (!m_World.GetViewProjection(CamIndex,viewproj)) return false;
+	if (!InvertMatrix(viewproj,inv)) return false;
 
-	m_SelectInfo.x=x;
-	m_SelectInfo.y=y;
-	m_SelectInfo.size=size;
+	// convert the window position into normalised device coordinates
+	Camera &Cam = m_CameraVec[CamIndex];
+	float vx=Cam.GetViewportX()*(float)m_Width;
+	float vy=Cam.GetViewportY()*(float)m_Height;
+	float vw=Cam.GetViewportWidth()*(float)m_Width;
+	float vh=Cam.GetViewportHeight()*(float)m_Height;
+	if (vw<=0 || vh<=0) return false;
 
-	// the problem here is that select is called mid-scene, so we have to set up for 
-	// picking mode here...
-	PreRender(CamIndex,true);
+	float nx=((x-vx)/vw)*2-1;
+	float ny=(((m_Height-y)-vy)/vh)*2-1;
 
-	// render the scene for picking
-	m_World.Render(&m_ShadowVolumeGen,SceneGraph::SELECT);
+	// the line runs from the near to the far clip plane
+	start=inv.transform_persp(dVector(nx,ny,-1));
+	end=inv.transform_persp(dVector(nx,ny,1));
+	return true;
+}
 
-	int hits=glRenderMode(GL_RENDER);
-	unsigned int *ptr=IDs, numnames;
-	float minz,maxz,closest=1000000;
+int Renderer::Select(unsigned int CamIndex, int x, int y, int size)
+{
+	// picking is done on the cpu against the scene's bounding volumes 
+	// and triangles, which saves rendering the scene again mid-frame
+	dVector start,end;
+	if (!GetPickLine(CamIndex,x,y,start,end)) return 0;
+	
+	vector<int> IDs;
+	m_World.LineQuery(start,end,1<<CamIndex,false,IDs);
+	if (IDs.empty()) return 0;
+	return IDs[0];
+}
 
-	// process the hit records
-	for (int n=0; n<hits; n++)
-	{
-		numnames=*ptr;
-		ptr+=3;
-		OutputIDs[n] = *ptr; // save ID
-		for (unsigned int i=0; i<numnames; i++) *ptr++;
-	}
+int Renderer::SelectAll(unsigned int CamIndex, int x, int y, int size, unsigned int **rIDs)
+{
+	static const int SELECT_SIZE=512;
+	static unsigned int OutputIDs[SELECT_SIZE];
+	*rIDs = OutputIDs;
 
-	// ... and reset the scene back here so we can carry on afterwards as if nothing
-	// has happened...
-	m_Initialised=false;
-	PreRender(CamIndex);
+	dVector start,end;
+	if (!GetPickLine(CamIndex,x,y,start,end)) return 0;
 
-	*rIDs = OutputIDs;
+	vector<int> IDs;
+	m_World.LineQuery(start,end,1<<CamIndex,true,IDs);
+	
+	int hits=0;
+	for (vector<int>::iterator i=IDs.begin(); i!=IDs.end() && hits<SELECT_SIZE; ++i)
+	{
+		OutputIDs[hits++]=*i;
+	}
 	return hits;
 }
 
@@ -581,6 +600,12 @@ void Renderer::RenderPrimitive(Primitive *Prim, bool del /* = false */)
 	m_ImmediateMode.Add(Prim, GetState(), del);
 }
 
+void Renderer::RenderInstances(Primitive *Prim, const vector<dMatrix> &transforms,
+                               const vector<dColour> &colours)
+{
+	m_ImmediateMode.AddInstances(Prim, GetState(), transforms, colours);
+}
+
 dMatrix Renderer::GetGlobalTransform(int ID)
 {
 	dMatrix mat;
@@ -742,4 +767,5 @@ void Renderer::PrintInfo()
 	m_World.Dump();	
 	Trace::Stream<<"NumRendered:"<<m_World.GetNumRendered()<<endl;
 	Trace::Stream<<"HighWater:"<<m_World.GetHighWater()<<endl;
+	Trace::Stream<<"TrianglesSaved:"<<m_World.GetTrianglesSaved()<<endl;
 }
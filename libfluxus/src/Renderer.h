@@ -95,6 +95,10 @@ public:
 	/// Immediate mode (don't delete prim till after Render() - when it
 	/// will actually be rendered
 	void         RenderPrimitive(Primitive *Prim, bool del = false);
+	/// Immediate mode, draws the primitive once per transform in 
+	/// one batch, colours are optional (one per transform)
+	void         RenderInstances(Primitive *Prim, const vector<dMatrix> &transforms,
+	                             const vector<dColour> &colours);
 	/// Get primitive ID from screen space
 	int          Select(unsigned int CamIndex, int x, int y, int size);
 	/// Get all primitive IDs from screen space
@@ -164,6 +168,9 @@ public:
 
 private:
 	void PreRender(unsigned int CamIndex, bool PickMode=false);
+	/// Finds the line through the scene under a screen position, 
+	/// returns false if the camera hasn't been rendered yet
+	bool GetPickLine(unsigned int CamIndex, int x, int y, dVector &start, dVector &end);
 	void PostRender();
 	void RenderLights(bool camera);
 	void RenderStencilShadows(unsigned int CamIndex);
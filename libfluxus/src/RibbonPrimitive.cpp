@@ -205,19 +205,11 @@ dBoundingBox RibbonPrimitive::GetBoundingBox(const dMatrix &space)
 
 void RibbonPrimitive::ApplyTransform(bool ScaleRotOnly)
 {
-	if (!ScaleRotOnly)
+	if (!m_VertData->empty())
 	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
-		{
-			*i=GetState()->Transform.transform(*i);
-		}
-	}
-	else
-	{
-		for (vector<dVector,FLX_ALLOC(dVector) >::iterator i=m_VertData->begin(); i!=m_VertData->end(); ++i)
-		{
-			*i=GetState()->Transform.transform_no_trans(*i);
-		}
+		dVector *data=&(*m_VertData)[0];
+		if (!ScaleRotOnly) GetState()->Transform.transform(data,data,m_VertData->size());
+		else GetState()->Transform.transform_no_trans(data,data,m_VertData->size());
 	}
 	
 	GetState()->Transform.init();
@@ -14,15 +14,30 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <string.h>
+#include <float.h>
+#include <list>
 #include "SceneGraph.h"
 #include "PolyPrimitive.h"
 #include "PixelPrimitive.h"
+#include "Geometry.h"
 
 using namespace Fluxus;
 
+static bool SameMatrix(const dMatrix &a, const dMatrix &b)
+{
+	return memcmp(a.arr(),b.arr(),sizeof(float)*16)==0;
+}
+
 SceneGraph::SceneGraph() :
+m_UpdateOrderDirty(false),
+m_BVHDirty(true),
+m_VisibleStamp(0),
+m_FrustumQueried(false),
 m_NumRendered(0),
-m_HighWater(0)
+m_HighWater(0),
+m_ViewportHeight(0),
+m_TrianglesSaved(0)
 {
 	// need to reset to having a root node present
 	Clear();
@@ -41,10 +56,25 @@ void SceneGraph::Render(ShadowVolumeGen *shadowgen, unsigned int camera, Mode re
 	glGetFloatv(GL_PROJECTION_MATRIX,total.arr());
 	total=total*m_TopTransform;
 	GetFrustumPlanes(m_FrustumPlanes, total, false);
+
+	// for turning bounding boxes into sizes on screen
+	glGetFloatv(GL_PROJECTION_MATRIX,m_Projection.arr());
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT,viewport);
+	m_ViewportHeight=viewport[3];
+
+	if (camera>=m_ViewProjections.size()) m_ViewProjections.resize(camera+1);
+	m_ViewProjections[camera]=total;
+
+	// the frustum test is done for all nodes at once, the 
+	// first time it's needed
+	m_VisibleStamp++;
+	m_FrustumQueried=false;
 	
 	unsigned int cameracode = 1<<camera;
 
 	m_NumRendered=0;
+	m_TrianglesSaved=0;
 
 	// render all the children of the root
 	for (vector<Node*>::iterator i=m_Root->Children.begin(); i!=m_Root->Children.end(); ++i)
@@ -93,6 +123,8 @@ void SceneGraph::RenderWalk(SceneNode *node,  int depth, unsigned int cameracode
 
 	if (!(node->Prim->GetState()->Hints & HINT_FRUSTUM_CULL) || FrustumClip(node))
 	{
+		SetScreenSize(node);
+		
 		if (node->Prim->GetState()->Hints & HINT_DEPTH_SORT)
 		{
 			// render it later, and after depth sorting
@@ -174,15 +206,45 @@ void SceneGraph::GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise)
 
 bool SceneGraph::FrustumClip(SceneNode *node)
 {
-	// do the frustum clip
-  	for (int n=0; n<6; n++)
-	{	
-		if (!Intersect(m_FrustumPlanes[n], node, 0))
+	if (!m_FrustumQueried)
+	{
+		// find everything in the frustum in one go, whole 
+		// regions of the scene get thrown away at once
+		UpdateBVH();
+		vector<int> visible;
+		m_BVH.FrustumQuery(m_FrustumPlanes,6,visible);
+		for (vector<int>::iterator i=visible.begin(); i!=visible.end(); ++i)
 		{
-			return false;
+			m_VisibleStamps[*i]=m_VisibleStamp;
 		}
+		m_FrustumQueried=true;
 	}
-	return true;
+
+	return m_VisibleStamps[node->ID]==m_VisibleStamp;
+}
+
+void SceneGraph::SetScreenSize(SceneNode *node)
+{
+	// the height on screen of the sphere around the bounding 
+	// box, in pixels - good enough for picking detail levels
+	dBoundingBox box=m_GlobalAABBs[node->ID];
+	if (box.empty()) return;
+	
+	float radius=(box.max-box.min).mag()*0.5f;
+	dVector centre=m_TopTransform.transform((box.min+box.max)*0.5f);
+	float scale=m_Projection.m[1][1]*m_ViewportHeight;
+	float pixels=radius*scale;
+	
+	if (m_Projection.m[3][3]==0) // perspective
+	{
+		float distance=-centre.z;
+		// full detail if the camera is inside it
+		if (distance<=radius) pixels=FLT_MAX;
+		else pixels/=distance;
+	}
+
+	node->Prim->SetScreenSize(pixels);
+	m_TrianglesSaved+=node->Prim->GetTrianglesSaved();
 }
 
 void SceneGraph::CohenSutherland(const dVector &p, char &cs)
@@ -216,11 +278,20 @@ void SceneGraph::Detach(SceneNode *node)
 		node->Parent->RemoveChild(node->ID);
 		m_Root->Children.push_back(node);
 		node->Parent=m_Root;
+
+		m_Parents[node->ID]=m_Root->ID;
+		m_Flags[node->ID]|=NODE_DIRTY;
+		m_UpdateOrderDirty=true;
 	}
 }
 
 dMatrix SceneGraph::GetGlobalTransform(const SceneNode *node) const
 {
+	if (IsTransformCached(node))
+	{
+		return m_GlobalTransforms[node->ID];
+	}
+
 	dMatrix Mat,Ret;
 
 	list<const SceneNode*> Path;
@@ -301,28 +372,319 @@ void SceneGraph::GetConnections(const Node *node, vector<pair<const SceneNode*,c
 void SceneGraph::Clear()
 {
 	Tree::Clear();
+	m_Parents.clear();
+	m_LocalTransforms.clear();
+	m_GlobalTransforms.clear();
+	m_LocalAABBs.clear();
+	m_GlobalAABBs.clear();
+	m_Hints.clear();
+	m_Flags.clear();
+	m_UpdateOrder.clear();
+	m_UpdateOrderDirty=false;
+	m_VisibleStamps.clear();
+	m_BVH.Clear();
+	m_BVHDirty=true;
+
 	SceneNode *root = new SceneNode(NULL);
 	AddNode(0,root);
 }
-	
+
+int SceneGraph::AddNode(int ParentID, Node *node)
+{
+	int ID=Tree::AddNode(ParentID,node);
+	if (ID==0) return 0;
+
+	ResizeNodeData(ID+1);
+	m_Parents[ID]=node->Parent?node->Parent->ID:0;
+	m_Flags[ID]=NODE_DIRTY;
+	// new nodes are always leaves, so the order is still fine
+	m_UpdateOrder.push_back(ID);
+	m_BVHDirty=true;
+	return ID;
+}
+
+void SceneGraph::RemoveNode(Node *node)
+{
+	// removed nodes are skipped by the update until the order is rebuilt
+	Tree::RemoveNode(node);
+	m_UpdateOrderDirty=true;
+	m_BVHDirty=true;
+}
+
+void SceneGraph::ReparentNode(int NodeID, int NewParentID)
+{
+	Tree::ReparentNode(NodeID,NewParentID);
+	Node *node=FindNode(NodeID);
+	if (node!=NULL && node->Parent!=NULL)
+	{
+		m_Parents[NodeID]=node->Parent->ID;
+		m_Flags[NodeID]|=NODE_DIRTY;
+		m_UpdateOrderDirty=true;
+	}
+}
+
+void SceneGraph::ResizeNodeData(unsigned int size)
+{
+	if (m_Parents.size()>=size) return;
+	m_Parents.resize(size,0);
+	m_LocalTransforms.resize(size);
+	m_GlobalTransforms.resize(size);
+	m_LocalAABBs.resize(size);
+	m_GlobalAABBs.resize(size);
+	m_Hints.resize(size,0);
+	m_Flags.resize(size,0);
+	m_VisibleStamps.resize(size,0);
+}
+
+void SceneGraph::BuildUpdateOrder()
+{
+	m_UpdateOrder.clear();
+	m_UpdateOrderDirty=false;
+	if (m_Root==NULL) return;
+
+	// depth first, so parents come before their children
+	vector<Node*> stack;
+	stack.push_back(m_Root);
+	while (!stack.empty())
+	{
+		Node *node=stack.back();
+		stack.pop_back();
+		m_UpdateOrder.push_back(node->ID);
+		for (vector<Node*>::iterator i=node->Children.begin(); i!=node->Children.end(); ++i)
+		{
+			stack.push_back(*i);
+		}
+	}
+}
+
+void SceneGraph::UpdateTransforms()
+{
+	if (m_UpdateOrderDirty) BuildUpdateOrder();
+
+	for (vector<int>::iterator i=m_UpdateOrder.begin(); i!=m_UpdateOrder.end(); ++i)
+	{
+		int ID=*i;
+		const SceneNode *node=static_cast<const SceneNode*>(m_NodeVec[ID]);
+		if (node==NULL) continue; // removed
+
+		// the root has no primitive, and stays at the origin
+		if (node->Prim==NULL)
+		{
+			m_Flags[ID]=0;
+			continue;
+		}
+
+		const State *state=node->Prim->GetState();
+		int parent=m_Parents[ID];
+		bool lazy=state->Hints & HINT_LAZY_PARENT;
+
+		if (!(m_Flags[ID]&(NODE_DIRTY|NODE_MOVED)) &&
+			(lazy || !(m_Flags[parent]&NODE_CHANGED)) &&
+			state->Hints==m_Hints[ID] &&
+			SameMatrix(state->Transform,m_LocalTransforms[ID]))
+		{
+			// nothing to do for this node
+			m_Flags[ID]=0;
+			continue;
+		}
+
+		m_LocalTransforms[ID]=state->Transform;
+		m_Hints[ID]=state->Hints;
+
+		// lazy parent transforms are treated as world space
+		dMatrix global;
+		if (lazy || m_NodeVec[parent]==m_Root) global=m_LocalTransforms[ID];
+		else global=m_GlobalTransforms[parent]*m_LocalTransforms[ID];
+
+		// only flag the children if we have actually moved
+		if (SameMatrix(global,m_GlobalTransforms[ID]))
+		{
+			m_Flags[ID]=(m_Flags[ID]&NODE_MOVED)?NODE_CHANGED:0;
+		}
+		else
+		{
+			m_GlobalTransforms[ID]=global;
+			m_GlobalAABBs[ID]=TransformAABB(m_LocalAABBs[ID],global);
+			m_Flags[ID]=NODE_CHANGED;
+			if (!m_BVHDirty) m_BVH.Refit(ID,m_GlobalAABBs[ID]);
+		}
+	}
+
+	UpdateBVH();
+}
+
+void SceneGraph::UpdateBVH()
+{
+	if (!m_BVHDirty && !m_BVH.NeedsRebuild()) return;
+
+	vector<int> items;
+	items.reserve(m_NodeVec.size());
+	for (unsigned int ID=0; ID<m_NodeVec.size(); ID++)
+	{
+		if (m_NodeVec[ID]!=NULL && m_NodeVec[ID]!=m_Root) items.push_back(ID);
+	}
+
+	m_BVH.Build(items,m_GlobalAABBs);
+	m_BVHDirty=false;
+}
+
+bool SceneGraph::IsTransformCached(const SceneNode *node) const
+{
+	// check nothing has changed on the path up to the root
+	const SceneNode *current=node;
+	while (current!=NULL && current->Prim!=NULL)
+	{
+		int ID=current->ID;
+		const State *state=current->Prim->GetState();
+		if ((m_Flags[ID]&(NODE_DIRTY|NODE_MOVED)) ||
+			state->Hints!=m_Hints[ID] ||
+			!SameMatrix(state->Transform,m_LocalTransforms[ID]))
+		{
+			return false;
+		}
+
+		if (state->Hints & HINT_LAZY_PARENT) return true;
+		current=static_cast<const SceneNode*>(current->Parent);
+	}
+	return true;
+}
+
+dBoundingBox SceneGraph::TransformAABB(dBoundingBox box, const dMatrix &mat)
+{
+	if (box.empty()) return box;
+
+	dVector points[8];
+	box.getvertices(points);
+	dBoundingBox ret;
+	for (int i=0; i<8; i++)
+	{
+		ret.expand(mat.transform(points[i]));
+	}
+	return ret;
+}
+
 void SceneGraph::RecalcAABB(SceneNode *node)
 {
-	node->m_GlobalAABB=node->Prim->GetBoundingBox(GetGlobalTransform(node));
+	int ID=node->ID;
+	if (!IsTransformCached(node))
+	{
+		// bring this node's cache up to date, so the next update 
+		// doesn't replace the exact box with the transformed local 
+		// one - but remember it's moved so the children still get 
+		// updated
+		m_GlobalTransforms[ID]=GetGlobalTransform(node);
+		m_LocalTransforms[ID]=node->Prim->GetState()->Transform;
+		m_Hints[ID]=node->Prim->GetState()->Hints;
+		m_Flags[ID]|=NODE_MOVED;
+	}
+
+	m_LocalAABBs[ID]=node->Prim->GetBoundingBox(dMatrix());
+	m_GlobalAABBs[ID]=node->Prim->GetBoundingBox(m_GlobalTransforms[ID]);
+	if (!m_BVHDirty) m_BVH.Refit(ID,m_GlobalAABBs[ID]);
+}
+
+void SceneGraph::BoxQuery(const dBoundingBox &box, vector<int> &result)
+{
+	UpdateBVH();
+	m_BVH.BoxQuery(box,result);
+}
+
+void SceneGraph::SphereQuery(const dVector &centre, float radius, vector<int> &result)
+{
+	UpdateBVH();
+	m_BVH.SphereQuery(centre,radius,result);
+}
+
+bool SceneGraph::IsPickable(const SceneNode *node, unsigned int cameracode) const
+{
+	if (!node->Prim->IsSelectable()) return false;
+
+	// hidden parents hide their children
+	const SceneNode *current=node;
+	while (current!=NULL && current->Prim!=NULL)
+	{
+		if ((current->Prim->GetVisibility()&cameracode)==0) return false;
+		current=static_cast<const SceneNode*>(current->Parent);
+	}
+	return true;
+}
+
+void SceneGraph::LineQuery(const dVector &start, const dVector &end, unsigned int cameracode, 
+                           bool all, vector<int> &result)
+{
+	UpdateBVH();
+
+	// candidates from the bounding boxes, nearest first
+	vector<pair<float,int> > candidates;
+	m_BVH.LineQuery(start,end,candidates);
+
+	vector<pair<float,int> > hits;
+	float nearest=2;
+	vector<unsigned int> triangles;
+	for (vector<pair<float,int> >::iterator i=candidates.begin(); i!=candidates.end(); ++i)
+	{
+		// no box further on can contain anything closer
+		if (!all && i->first>nearest) break;
+
+		const SceneNode *node=static_cast<const SceneNode*>(FindNode(i->second));
+		if (node==NULL || !IsPickable(node,cameracode)) continue;
+
+		float t=i->first;
+		const PolyPrimitive *poly=dynamic_cast<const PolyPrimitive*>(node->Prim);
+		if (poly)
+		{
+			// test the triangles in the primitive's own space
+			dMatrix inv=GetGlobalTransform(node).inverse();
+			dVector lstart=inv.transform(start);
+			dVector lend=inv.transform(end);
+			const TypedPData<dVector> *points=dynamic_cast<const TypedPData<dVector>*>(poly->GetDataRawConst("p"));
+			if (points==NULL) continue;
+
+			triangles.clear();
+			poly->GetTriangles(triangles);
+			t=-1;
+			dVector bary;
+			for (unsigned int n=0; n+2<triangles.size(); n+=3)
+			{
+				float d=IntersectLineTriangle(lstart,lend,points->m_Data[triangles[n]],
+					points->m_Data[triangles[n+1]],points->m_Data[triangles[n+2]],bary);
+				if (d>=0 && (t<0 || d<t)) t=d;
+			}
+			if (t<0) continue;
+		}
+
+		hits.push_back(pair<float,int>(t,i->second));
+		if (t<nearest) nearest=t;
+	}
+
+	sort(hits.begin(),hits.end());
+	if (!all && hits.size()>1) hits.resize(1);
+	for (vector<pair<float,int> >::iterator i=hits.begin(); i!=hits.end(); ++i)
+	{
+		result.push_back(i->second);
+	}
+}
+
+bool SceneGraph::GetViewProjection(unsigned int camera, dMatrix &m) const
+{
+	if (camera>=m_ViewProjections.size()) return false;
+	m=m_ViewProjections[camera];
+	return true;
 }
 
 bool SceneGraph::Intersect(const SceneNode *a, const SceneNode *b, float threshold)
 {
-	return b->m_GlobalAABB.inside(a->m_GlobalAABB, threshold);
+	return m_GlobalAABBs[b->ID].inside(m_GlobalAABBs[a->ID], threshold);
 }
 
 bool SceneGraph::Intersect(const dVector &point, const SceneNode *node, float threshold)
 {
-	return node->m_GlobalAABB.inside(point,threshold);
+	return m_GlobalAABBs[node->ID].inside(point,threshold);
 }
 
 bool SceneGraph::Intersect(const dPlane &plane, const SceneNode *node, float threshold)
 {
-	return node->m_GlobalAABB.inside(plane,threshold);
+	return m_GlobalAABBs[node->ID].inside(plane,threshold);
 }
 
 void SceneGraph::RenderAxes()
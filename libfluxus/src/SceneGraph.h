@@ -23,6 +23,7 @@
 #include "State.h"
 #include "ShadowVolumeGen.h"
 #include "DepthSorter.h"
+#include "BVH.h"
 
 using namespace std;
 
@@ -39,7 +40,6 @@ public:
 	SceneNode(Primitive *p) : Prim(p) {}
 	virtual ~SceneNode() { if (Prim) delete Prim; }
 	Primitive *Prim;
-	dBoundingBox m_GlobalAABB;
 };
 
 istream &operator>>(istream &s, SceneNode &o);
@@ -62,15 +62,35 @@ public:
 	/// Clears the graph of all primitives
 	virtual void Clear();
 
+	///////////////////////////////////////////
+	///@name Tree interface
+	/// Overridden to keep the flat node data in step
+	///@{
+	virtual int AddNode(int ParentID, Node *node);
+	virtual void RemoveNode(Node *node);
+	virtual void ReparentNode(int NodeID, int NewParentID);
+	///@}
+
+	/// Brings the cached world transforms and bounding boxes
+	/// up to date, only recalculating the subtrees where a 
+	/// local transform has changed. The renderer calls this 
+	/// once a frame.
+	void UpdateTransforms();
+
 	/// Parents the node to the root, and sets its
 	/// transform to keep it physically in the same
 	/// place in the world.
 	///\todo make the maintain transform optional
 	void Detach(SceneNode *node);
 
-	/// Gets the world space transfrom of the node
+	/// Gets the world space transfrom of the node, this is 
+	/// cached unless the node or one of its parents has moved
+	/// since the last UpdateTransforms()
 	dMatrix GetGlobalTransform(const SceneNode *node) const;
 
+	/// The world space bounding box, as of the last update
+	const dBoundingBox &GetGlobalAABB(const SceneNode *node) const { return m_GlobalAABBs[node->ID]; }
+
 	/// Gets the bounding box of the node, and all
 	/// its children too
 	void GetBoundingBox(SceneNode *node, dBoundingBox &result);
@@ -82,8 +102,30 @@ public:
 	void GetConnections(const Node *node,
 		vector<pair<const SceneNode*,const SceneNode*> > &connections) const;
 
+	/// Recalculates the bounding box from the primitive's 
+	/// geometry, after this it follows the node around as 
+	/// it's transformed, but doesn't see changes to the shape
 	void RecalcAABB(SceneNode *node);
 
+	///////////////////////////////////////////
+	///@name Spatial queries
+	/// These use a bounding volume hierarchy over the node 
+	/// bounding boxes, so only look at nodes nearby
+	///@{
+	/// All the nodes with bounding boxes overlapping the box or sphere
+	void BoxQuery(const dBoundingBox &box, vector<int> &result);
+	void SphereQuery(const dVector &centre, float radius, vector<int> &result);
+	/// Nodes hit by the line, nearest first. Polygon primitives are 
+	/// tested against their triangles, others just their bounding box.
+	/// Nodes that are hidden from the camera, or not selectable, are 
+	/// skipped. If all is false it stops at the first hit.
+	void LineQuery(const dVector &start, const dVector &end, unsigned int cameracode, 
+	               bool all, vector<int> &result);
+	///@}
+
+	/// The view projection matrix the camera was last rendered with
+	bool GetViewProjection(unsigned int camera, dMatrix &m) const;
+
 	///Bounding box intersections, for higher accuracy, see the evaluators
 	///\todo fix const correctness from here...
 	bool Intersect(const SceneNode *a, const SceneNode *b, float threshold);
@@ -93,6 +135,8 @@ public:
 	/// Some statistics
 	unsigned int GetNumRendered() { return m_NumRendered; }
 	unsigned int GetHighWater() { return m_HighWater; }
+	/// Triangles not drawn in the last frame thanks to level of detail
+	unsigned int GetTrianglesSaved() { return m_TrianglesSaved; }
 
 	/// Render origin
 	static void RenderAxes();
@@ -101,8 +145,48 @@ private:
 	void RenderWalk(SceneNode *node, int depth, unsigned int cameracode, ShadowVolumeGen *shadowgen, Mode rendermode);
 	void GetBoundingBox(SceneNode *node, dMatrix mat, dBoundingBox &result);
 	bool FrustumClip(SceneNode *node);
+	void SetScreenSize(SceneNode *node);
 	void CohenSutherland(const dVector &p, char &cs);
 	void GetFrustumPlanes(dPlane *planes, dMatrix m, bool normalise);
+	bool IsTransformCached(const SceneNode *node) const;
+	bool IsPickable(const SceneNode *node, unsigned int cameracode) const;
+	void UpdateBVH();
+	void BuildUpdateOrder();
+	void ResizeNodeData(unsigned int size);
+	static dBoundingBox TransformAABB(dBoundingBox box, const dMatrix &mat);
+
+	/// Dirty nodes need their world transform recalculating, 
+	/// changed nodes have moved in this update, and moved
+	/// nodes have moved since the last one
+	enum NodeFlags{NODE_DIRTY=0x01, NODE_CHANGED=0x02, NODE_MOVED=0x04};
+
+	/// Per node data stored in flat arrays indexed by node
+	/// ID, so the transform update is a walk along contiguous
+	/// memory rather than chasing pointers around the tree
+	///@{
+	vector<int> m_Parents;
+	vector<dMatrix> m_LocalTransforms;
+	vector<dMatrix> m_GlobalTransforms;
+	vector<dBoundingBox> m_LocalAABBs;
+	vector<dBoundingBox> m_GlobalAABBs;
+	vector<int> m_Hints;
+	vector<unsigned char> m_Flags;
+	///@}
+
+	/// Node IDs ordered with parents before their children
+	vector<int> m_UpdateOrder;
+	bool m_UpdateOrderDirty;
+
+	/// Over the global bounding boxes, rebuilt when nodes are 
+	/// added or removed and refitted when they move
+	BVH m_BVH;
+	bool m_BVHDirty;
+	/// Frame stamp per node, set if it passed the frustum test
+	vector<unsigned int> m_VisibleStamps;
+	unsigned int m_VisibleStamp;
+	bool m_FrustumQueried;
+	/// Indexed by camera
+	vector<dMatrix> m_ViewProjections;
 
 	DepthSorter m_DepthSorter;
 	dMatrix m_TopTransform;
@@ -110,6 +194,10 @@ private:
 
 	unsigned int m_NumRendered;
 	unsigned int m_HighWater;
+	
+	dMatrix m_Projection;
+	float m_ViewportHeight;
+	unsigned int m_TrianglesSaved;
 };
 
 }
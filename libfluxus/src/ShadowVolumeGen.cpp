@@ -14,12 +14,37 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <string.h>
 #include <algorithm>
 #include "ShadowVolumeGen.h"
+#include "JobPool.h"
 
 using namespace Fluxus;
 
+// casters not seen for this many clears are forgotten
+static const unsigned int CASTER_LIFETIME=64;
+
+struct ExtrudeJob
+{
+	const ShadowVolumeGen *Gen;
+	const void *Caster;
+	unsigned int Start,End;
+	vector<dVector> *Volume;
+};
+
+static bool SameMatrix(const dMatrix &a, const dMatrix &b)
+{
+	return memcmp(a.arr(),b.arr(),sizeof(float)*16)==0;
+}
+
+static bool SameVector(const dVector &a, const dVector &b)
+{
+	return a.x==b.x && a.y==b.y && a.z==b.z;
+}
+
 ShadowVolumeGen::ShadowVolumeGen() :
+m_VolumeDirty(false),
+m_Clears(0),
 m_ShadowVolume(PolyPrimitive::QUADS),
 m_LightPosition(5,5,0),
 m_Length(10),
@@ -50,149 +75,240 @@ void ShadowVolumeGen::Generate(Primitive *prim)
 
 void ShadowVolumeGen::Clear()
 { 
-	m_ShadowVolume.Clear();
-	
+	m_Volume.clear();
+	m_VolumeDirty=true;
+	m_Clears++;
+
+	// forget about primitives which have stopped casting, 
+	// or been destroyed
+	if (m_Clears%CASTER_LIFETIME==0)
+	{
+		for (map<const Primitive*,Caster>::iterator i=m_Casters.begin(); i!=m_Casters.end();)
+		{
+			if (m_Clears-i->second.Clears>CASTER_LIFETIME) m_Casters.erase(i++);
+			else ++i;
+		}
+	}
 }
 
 PolyPrimitive *ShadowVolumeGen::GetVolume() 
 { 
+	if (m_VolumeDirty)
+	{
+		// copy the volume over in one go
+		m_ShadowVolume.Resize(m_Volume.size());
+		if (!m_Volume.empty())
+		{
+			vector<dVector,FLX_ALLOC(dVector) > *points=m_ShadowVolume.GetDataVec<dVector>("p");
+			std::copy(m_Volume.begin(),m_Volume.end(),points->begin());
+		}
+		m_ShadowVolume.SetDataDirty("p");
+		m_VolumeDirty=false;
+	}
 	return &m_ShadowVolume; 
 }
 
 void ShadowVolumeGen::PolyGen(PolyPrimitive *src)
 {	
 	TypedPData<dVector> *points = dynamic_cast<TypedPData<dVector>* >(src->GetDataRaw("p"));
-	
-	///\todo using geometric normals, as we need them to be non smoothed
-	/// to tell the difference between faces, but this doesn't update with
-	/// n (from things like skinning and user deformation). recalc-normals
-	/// is ok though as it regenerates them... not sure what the answer is.
-	const vector<dVector> &normals = src->GetGeometricNormals();
-	const vector<vector<int> > &connected=src->GetConnectedVerts();
-	
-	dMatrix &transform = src->GetState()->Transform;
+	if (points==NULL) return;
 	
 	int stride=0;
 	if (src->GetType()==PolyPrimitive::TRISTRIP) stride=2;
 	if (src->GetType()==PolyPrimitive::QUADS) stride=4;
 	if (src->GetType()==PolyPrimitive::TRILIST) stride=3;
-	if (stride>0)
+	if (stride==0) return;
+
+	Caster &caster=m_Casters[src];
+	caster.Clears=m_Clears;
+
+	// the adjacency only changes with the topology
+	bool rebuild=caster.Topology!=src->GetTopologyVersion() ||
+		caster.Verts!=points->Size() || caster.Indices!=src->GetIndexConst().size() ||
+		caster.Indexed!=src->IsIndexed() || caster.Stride!=stride;
+	if (rebuild) 
 	{
-		SharedEdgeContainer edges = src->GetUniqueEdges();
-		vector<pair<dVector,dVector> > silhouette;
-			
-		if (src->IsIndexed())
-		{
-			vector<unsigned int> index = src->GetIndex();
-			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
-			{
-				EdgeContainer sharededges = *i;
-
-				dVector lightdir = transform.transform(points->m_Data[index[sharededges.begin()->first]])-m_LightPosition;
-				lightdir.normalise();
-
-				if (sharededges.size()==2)
-				{
-					bool backface=false;
-					bool frontface=false;
-
-					EdgeContainer::iterator frontedge;
-
-					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
-					{			
-						// only check the first vert, as they should have 
-						// the same geometric normal if the poly is planar..
-						if (lightdir.dot(transform.transform_no_trans(normals[edge->first]))>0) 
-						{
-							frontedge=edge;
-							frontface=true;
-						}
-						else backface=true;
-					}
-
-					// if we contain both front and back facing normals (from the light's pov) 
-					if (backface && frontface) 
-					{			
-						silhouette.push_back(pair<dVector,dVector>(transform.transform(points->m_Data[index[frontedge->first]]),
-					                                    		   transform.transform(points->m_Data[index[frontedge->second]])));
-					}
-				}
-			}
-		}
-		else
+		BuildAdjacency(src,stride,caster);
+	}
+
+	// the world space points and normals only change if it moves or deforms
+	const dMatrix &transform=src->GetState()->Transform;
+	bool moved=rebuild || caster.Points!=points->GetVersion() || !SameMatrix(caster.Transform,transform);
+	if (moved)
+	{
+		UpdateWorld(points->m_Data,transform,caster);
+		caster.Points=points->GetVersion();
+	}
+
+	// and the volume only if the light has moved too
+	if (moved || !SameVector(caster.Light,m_LightPosition) || caster.Length!=m_Length)
+	{
+		BuildVolume(caster);
+	}
+
+	m_Volume.insert(m_Volume.end(),caster.Volume.begin(),caster.Volume.end());
+	m_VolumeDirty=true;
+
+	if (m_Debug) DrawEdges(caster.Volume);
+}
+
+void ShadowVolumeGen::BuildAdjacency(PolyPrimitive *src, int stride, Caster &caster)
+{
+	const vector<vector<pair<int,int> > > &edges=src->GetUniqueEdges();
+	const vector<unsigned int> &index=src->GetIndexConst();
+	bool indexed=src->IsIndexed();
+	unsigned int numpoints=src->GetDataRaw("p")->Size();
+	unsigned int count=indexed?index.size():numpoints;
+
+	// a face for every stride verts, using the same verts
+	// as the geometric normals to find the normal
+	caster.Faces.clear();
+	for (unsigned int i=0; i+2<count; i+=stride)
+	{
+		for (unsigned int n=0; n<3; n++)
 		{
-			// loop over all the edges
-			for (SharedEdgeContainer::iterator i=edges.begin(); i!=edges.end(); ++i)
-			{
-				EdgeContainer sharededges = *i;
-
-				dVector lightdir = transform.transform(points->m_Data[sharededges.begin()->first])-m_LightPosition;
-				lightdir.normalise();
-
-
-				if (sharededges.size()==2)
-				{
-					bool backface=false;
-					bool frontface=false;
-
-					EdgeContainer::iterator frontedge;
-
-					// loop over the edges shared by this one
-					for (EdgeContainer::iterator edge=sharededges.begin(); edge!=sharededges.end(); ++edge)
-					{			
-						// only check the first vert, as they should have 
-						// the same geometric normal if the poly is planar..
-						if (lightdir.dot(transform.transform_no_trans(normals[edge->first]))>0) 
-						{
-							frontedge=edge;
-							frontface=true;
-						}
-						else backface=true;
-					}
-
-					// if we contain both front and back facing normals (from the light's pov) 
-					if (backface && frontface) 
-					{			
-						silhouette.push_back(pair<dVector,dVector>(transform.transform(points->m_Data[frontedge->first]),
-					                                    		   transform.transform(points->m_Data[frontedge->second])));
-					}
-				}
-			}
+			unsigned int v=indexed?index[i+n]:i+n;
+			caster.Faces.push_back(v<numpoints?v:0);
 		}
-		
-		for (vector<pair<dVector,dVector> >::iterator i=silhouette.begin();
-		     i!=silhouette.end(); i++)
+	}
+	unsigned int numfaces=caster.Faces.size()/3;
+
+	// we only need the edges between two faces
+	caster.Edges.clear();
+	for (vector<vector<pair<int,int> > >::const_iterator i=edges.begin(); i!=edges.end(); ++i)
+	{
+		if (i->size()!=2) continue;
+		int edge[6];
+		bool valid=true;
+		for (unsigned int side=0; side<2; side++)
 		{
-			AddEdge(i->first,i->second);
+			const pair<int,int> &e=(*i)[side];
+			unsigned int start=indexed?index[e.first]:e.first;
+			unsigned int end=indexed?index[e.second]:e.second;
+			unsigned int face=e.first/stride;
+			if (start>=numpoints || end>=numpoints || face>=numfaces) valid=false;
+			edge[side*3]=start;
+			edge[side*3+1]=end;
+			edge[side*3+2]=face;
 		}
+		if (valid) caster.Edges.insert(caster.Edges.end(),edge,edge+6);
 	}
+
+	// this may have changed when the edges were generated
+	caster.Topology=src->GetTopologyVersion();
+	caster.Verts=numpoints;
+	caster.Indices=index.size();
+	caster.Indexed=indexed;
+	caster.Stride=stride;
 }
 
-void ShadowVolumeGen::AddEdge(dVector start, dVector end)
+void ShadowVolumeGen::UpdateWorld(const vector<dVector,FLX_ALLOC(dVector) > &points, 
+                                  const dMatrix &transform, Caster &caster)
 {
-	if (m_Debug)
+	caster.WorldPoints.resize(points.size());
+	if (!points.empty()) transform.transform(&points[0],&caster.WorldPoints[0],points.size());
+
+	// face normals in world space, these don't need 
+	// normalising as only the sign is used
+	unsigned int numfaces=caster.Faces.size()/3;
+	caster.FaceNormals.resize(numfaces);
+	for (unsigned int f=0; f<numfaces; f++)
 	{
-		glDisable(GL_LIGHTING);
-		glLineWidth(3);
-		glBegin(GL_LINES);					
-			glColor3f(1,0,0);
-			glVertex3fv(start.arr());
-			glColor3f(0,0,1);
-			glVertex3fv(end.arr());
-		glEnd();
-		glEnable(GL_LIGHTING);
+		const dVector &p0=caster.WorldPoints[caster.Faces[f*3]];
+		const dVector &p1=caster.WorldPoints[caster.Faces[f*3+1]];
+		const dVector &p2=caster.WorldPoints[caster.Faces[f*3+2]];
+		caster.FaceNormals[f]=(p0-p1).cross(p1-p2);
 	}
 
-	m_ShadowVolume.AddVertex(dVertex(start,dVector(0,0,0),0,0));
-	m_ShadowVolume.AddVertex(dVertex(end,dVector(0,0,0),0,0));
+	caster.Transform=transform;
+}
+
+void ShadowVolumeGen::BuildVolume(Caster &caster)
+{
+	caster.Light=m_LightPosition;
+	caster.Length=m_Length;
+	caster.Volume.clear();
 
-	dVector proj = end-m_LightPosition;
-	m_ShadowVolume.AddVertex(dVertex(end+proj*m_Length,dVector(0,0,0),0,0));
+	unsigned int numedges=caster.Edges.size()/6;
+	unsigned int numthreads=JobPool::Get()->GetNumThreads();
+	if (numedges<THREADED_SIZE) numthreads=1;
 
-	proj = start-m_LightPosition;
-	m_ShadowVolume.AddVertex(dVertex(start+proj*m_Length,dVector(0,0,0),0,0));
+	if (numthreads==1)
+	{
+		Extrude(caster,0,numedges,caster.Volume);
+		return;
+	}
+
+	// each thread extrudes into its own buffer, then they're joined
+	if (m_ThreadVolumes.size()<numthreads) m_ThreadVolumes.resize(numthreads);
+	ExtrudeJob jobs[JobPool::MAX_THREADS];
+	unsigned int slice=numedges/numthreads;
+	for (unsigned int t=0; t<numthreads; t++)
+	{
+		jobs[t].Gen=this;
+		jobs[t].Caster=&caster;
+		jobs[t].Start=t*slice;
+		jobs[t].End=t==numthreads-1?numedges:(t+1)*slice;
+		jobs[t].Volume=&m_ThreadVolumes[t];
+		m_ThreadVolumes[t].clear();
+	}
+
+	JobPool::Get()->RunEach(ExtrudeThread,jobs,numthreads);
+
+	for (unsigned int t=0; t<numthreads; t++)
+	{
+		caster.Volume.insert(caster.Volume.end(),m_ThreadVolumes[t].begin(),m_ThreadVolumes[t].end());
+	}
+}
+
+void *ShadowVolumeGen::ExtrudeThread(void *data)
+{
+	ExtrudeJob *job=(ExtrudeJob*)data;
+	job->Gen->Extrude(*(const Caster*)job->Caster,job->Start,job->End,*job->Volume);
+	return NULL;
+}
+
+void ShadowVolumeGen::Extrude(const Caster &caster, unsigned int start, unsigned int end, vector<dVector> &volume) const
+{
+	for (unsigned int e=start; e<end; e++)
+	{
+		const int *edge=&caster.Edges[e*6];
+		dVector lightdir=caster.WorldPoints[edge[0]]-m_LightPosition;
+		
+		// if one face is facing the light and the other isn't 
+		// (from the light's pov) this is on the silhouette
+		bool front=lightdir.dot(caster.FaceNormals[edge[2]])>0;
+		bool otherfront=lightdir.dot(caster.FaceNormals[edge[5]])>0;
+		if (front!=otherfront)
+		{
+			const int *frontedge=front?edge:edge+3;
+			AddEdge(caster.WorldPoints[frontedge[0]],caster.WorldPoints[frontedge[1]],volume);
+		}
+	}
+}
+
+void ShadowVolumeGen::AddEdge(const dVector &start, const dVector &end, vector<dVector> &volume) const
+{
+	volume.push_back(start);
+	volume.push_back(end);
+	volume.push_back(end+(end-m_LightPosition)*m_Length);
+	volume.push_back(start+(start-m_LightPosition)*m_Length);
+}
+
+void ShadowVolumeGen::DrawEdges(const vector<dVector> &volume) const
+{
+	glDisable(GL_LIGHTING);
+	glLineWidth(3);
+	glBegin(GL_LINES);					
+	for (unsigned int i=0; i+1<volume.size(); i+=4)
+	{
+		glColor3f(1,0,0);
+		glVertex3fv(volume[i].arr());
+		glColor3f(0,0,1);
+		glVertex3fv(volume[i+1].arr());
+	}
+	glEnd();
+	glEnable(GL_LIGHTING);
 }
 
 ///\todo shadow volumes for nurbs
@@ -254,17 +370,16 @@ void ShadowVolumeGen::NURBSGen(NURBSPrimitive *src)
 				glEnable(GL_LIGHTING);
 				glPopMatrix();
 
-				m_ShadowVolume.AddVertex(dVertex(worldpoint1,dVector(0,0,0),0,0));
-				m_ShadowVolume.AddVertex(dVertex(worldpoint2,dVector(0,0,0),0,0));
+				m_Volume.push_back(worldpoint1);
+				m_Volume.push_back(worldpoint2);
 
 				dVector proj = worldpoint2-m_LightPosition;
-				m_ShadowVolume.AddVertex(dVertex(worldpoint1+proj*100,dVector(0,0,0),0,0));
+				m_Volume.push_back(worldpoint1+proj*100);
 
 				proj = worldpoint1-m_LightPosition;
-				m_ShadowVolume.AddVertex(dVertex(worldpoint2+proj*100,dVector(0,0,0),0,0));
+				m_Volume.push_back(worldpoint2+proj*100);
+				m_VolumeDirty=true;
 			}
 		}
 	}
 }
-
-
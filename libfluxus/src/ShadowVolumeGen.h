@@ -18,12 +18,10 @@
 // Generates a shadow volume poly primitive for the supplied 
 // primitives and light position
 
-// Can we accelerate the process by caching as much as possible, and 
-// changing only when light positions/primitive transforms/deform?
-
 #ifndef N_SHADOWGEN
 #define N_SHADOWGEN
 
+#include <map>
 #include "Primitive.h"
 #include "PolyPrimitive.h"
 #include "NURBSPrimitive.h"
@@ -37,7 +35,12 @@ namespace Fluxus
 /// volumes are then concatenated into a 
 /// single polygon primitive for rendering 
 /// into a stencil buffer for shadow 
-/// rendering.
+/// rendering. The edge and face adjacency 
+/// of each caster is worked out once, and 
+/// its world space points and face normals 
+/// are only recalculated when it moves or 
+/// deforms. If the light hasn't moved 
+/// either, last frame's volume is reused.
 class ShadowVolumeGen
 {
 public:
@@ -73,18 +76,66 @@ public:
 	void SetDebug(bool s) { m_Debug=s; }
 	bool GetDebug() { return m_Debug; }
 	///@}
+
+	/// Casters with fewer edges than this aren't threaded
+	static const unsigned int THREADED_SIZE=8192;
 	
 private:
 
-	typedef pair<int,int> EdgeType;
-	typedef vector<EdgeType> EdgeContainer;
-	typedef vector<EdgeContainer> SharedEdgeContainer;
+	/// What we keep for each primitive casting shadows
+	struct Caster
+	{
+		Caster() : Topology(0), Verts(0), Indices(0), Indexed(false), Stride(0), 
+			Points(0), Length(0), Clears(0) {}
+
+		/// What the adjacency was built from
+		unsigned int Topology;
+		unsigned int Verts;
+		unsigned int Indices;
+		bool Indexed;
+		int Stride;
+		/// For each edge shared by two faces, the verts and 
+		/// face for each side: start, end, face, start, end, face
+		vector<int> Edges;
+		/// The verts used to find the normal of each face
+		vector<int> Faces;
+
+		/// What the world space data was made from
+		unsigned int Points;
+		dMatrix Transform;
+		vector<dVector> WorldPoints;
+		vector<dVector> FaceNormals;
+
+		/// What the volume was made from
+		dVector Light;
+		float Length;
+		/// The extruded quads
+		vector<dVector> Volume;
+
+		/// When this caster was last used
+		unsigned int Clears;
+	};
 
 	void PolyGen(PolyPrimitive *src);
 	void NURBSGen(NURBSPrimitive *src);
 	
-	void AddEdge(dVector start, dVector end);
-	int FindNextEdge(unsigned int index, vector<pair<dVector,dVector> > &silhouette, bool &flip);
+	void BuildAdjacency(PolyPrimitive *src, int stride, Caster &caster);
+	void UpdateWorld(const vector<dVector,FLX_ALLOC(dVector) > &points, const dMatrix &transform, Caster &caster);
+	void BuildVolume(Caster &caster);
+	/// Finds the silhouette edges in a range of the caster's 
+	/// edges, adding quads for them to the volume
+	void Extrude(const Caster &caster, unsigned int start, unsigned int end, vector<dVector> &volume) const;
+	static void *ExtrudeThread(void *data);
+	void AddEdge(const dVector &start, const dVector &end, vector<dVector> &volume) const;
+	void DrawEdges(const vector<dVector> &volume) const;
+
+	map<const Primitive*,Caster> m_Casters;
+	/// Buffers for the threads to extrude into, kept between frames
+	vector<vector<dVector> > m_ThreadVolumes;
+	/// The volume of all the casters since the last Clear()
+	vector<dVector> m_Volume;
+	bool m_VolumeDirty;
+	unsigned int m_Clears;
 
 	PolyPrimitive m_ShadowVolume;
 	dVector m_LightPosition;
@@ -92,7 +143,6 @@ private:
 	float m_Expand;
 	bool m_Debug;
 };
-
 };
 
 #endif
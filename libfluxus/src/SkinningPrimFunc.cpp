@@ -15,13 +15,43 @@
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 #include "SkinningPrimFunc.h"
 #include "Primitive.h"
 #include "SceneGraph.h"
+#include "State.h"
+#include "JobPool.h"
 
 using namespace Fluxus;
 
-SkinningPrimFunc::SkinningPrimFunc()
+struct SkinJob
+{
+	SkinningPrimFunc *Func;
+	unsigned int Start,End;
+};
+
+static inline float QuatDot(const float *a, const float *b)
+{
+	return a[0]*b[0]+a[1]*b[1]+a[2]*b[2]+a[3]*b[3];
+}
+
+// rotates v by the unit quaternion q
+static inline dVector QuatRotate(const float *q, const dVector &v)
+{
+	dVector axis(q[0],q[1],q[2]);
+	dVector t=axis.cross(v)*2;
+	return v+t*q[3]+axis.cross(t);
+}
+
+SkinningPrimFunc::SkinningPrimFunc() :
+m_DualQuaternion(false),
+m_P(NULL),
+m_PRef(NULL),
+m_N(NULL),
+m_NRef(NULL),
+m_Bones(NULL),
+m_Weights(NULL)
 {
 }
 
@@ -34,12 +64,13 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 	int rootid = GetArg<int>("skeleton-root",0);
 	int bindposerootid = GetArg<int>("bindpose-root",0);
 	bool skinnormals = GetArg<int>("skin-normals",0);
-	vector<dVector, FLX_ALLOC(dVector) > *p = prim.GetDataVec<dVector>("p");
-	vector<dVector, FLX_ALLOC(dVector) > *pref = prim.GetDataVec<dVector>("pref");
-	vector<dVector, FLX_ALLOC(dVector) > *n = NULL;
-	vector<dVector, FLX_ALLOC(dVector) > *nref = NULL;
+	m_DualQuaternion = GetArg<int>("dual-quaternion",0);
+	m_P = prim.GetDataVec<dVector>("p");
+	m_PRef = prim.GetDataVec<dVector>("pref");
+	m_N = NULL;
+	m_NRef = NULL;
 
-	if (!pref)
+	if (!m_PRef)
 	{
 		///\todo sort out a proper error messaging thing
 		Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs a pref (copy of p)"<<endl;
@@ -48,9 +79,9 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 
 	if (skinnormals)
 	{
-		n = prim.GetDataVec<dVector>("n");
-		nref = prim.GetDataVec<dVector>("nref");
-		if (!nref)
+		m_N = prim.GetDataVec<dVector>("n");
+		m_NRef = prim.GetDataVec<dVector>("nref");
+		if (!m_NRef)
 		{
 			Trace::Stream<<"SkinningPrimFunc::Run: aborting: primitive needs an nref (copy of n)"<<endl;
 			return;
@@ -65,36 +96,284 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 	}
 
 	const SceneNode *bindposeroot = static_cast<const SceneNode *>(world.FindNode(bindposerootid));
-	if (!root)
+	if (!bindposeroot)
 	{
 		Trace::Stream<<"GenSkinWeightsPrimFunc::Run: couldn't find bindopose skeleton root node "<<bindposerootid<<endl;
 		return;
 	}
 
-	// get the nodes as flat lists
-	vector<const SceneNode*> skeleton;
-	world.GetNodes(root, skeleton);
-	vector<const SceneNode*> bindposeskeleton;
-	world.GetNodes(bindposeroot, bindposeskeleton);
+	UpdatePalette(world,root,bindposeroot);
 
-	if (skeleton.size()!=bindposeskeleton.size())
+	if (m_Skeleton.size()!=m_BindPose.size())
 	{
 		Trace::Stream<<"SkinningPrimFunc::Run: aborting: skeleton sizes do not match! "<<
-			skeleton.size()<<" vs "<<bindposeskeleton.size()<<endl;
+			m_Skeleton.size()<<" vs "<<m_BindPose.size()<<endl;
+		return;
+	}
+
+	// use the strongest bones for each vertex if we have them
+	char type;
+	unsigned int size;
+	if (prim.GetDataInfo("skinbones",type,size) && type=='c' &&
+		prim.GetDataInfo("skinweights",type,size) && type=='c')
+	{
+		m_Bones = prim.GetDataVec<dColour>("skinbones");
+		m_Weights = prim.GetDataVec<dColour>("skinweights");
+	}
+	else
+	{
+		SkinAll(prim,skinnormals);
 		return;
 	}
 
-	// make a vector of all the transforms
-	vector<dMatrix> transforms;
-	for (unsigned int i=0; i<skeleton.size(); i++)
+	unsigned int count=prim.Size();
+	unsigned int numthreads=JobPool::Get()->GetNumThreads();
+	if (count<THREADED_SIZE) numthreads=1;
+
+	SkinJob jobs[JobPool::MAX_THREADS];
+	unsigned int slice=count/numthreads;
+	for (unsigned int t=0; t<numthreads; t++)
+	{
+		jobs[t].Func=this;
+		jobs[t].Start=t*slice;
+		jobs[t].End=t==numthreads-1?count:(t+1)*slice;
+	}
+
+	JobPool::Get()->RunEach(SkinThread,jobs,numthreads);
+}
+
+void SkinningPrimFunc::GetTransforms(const SceneGraph &world, const SceneNode *node, 
+                                     const dMatrix &global, vector<dMatrix> &transforms)
+{
+	transforms.push_back(global);
+
+	for (vector<Node*>::const_iterator i=node->Children.begin();
+			i!=node->Children.end(); i++)
+	{
+		const SceneNode *child=static_cast<const SceneNode*>(*i);
+		// lazy parented nodes are in world space
+		if (child->Prim->GetState()->Hints & HINT_LAZY_PARENT)
+		{
+			GetTransforms(world,child,child->Prim->GetState()->Transform,transforms);
+		}
+		else
+		{
+			GetTransforms(world,child,global*child->Prim->GetState()->Transform,transforms);
+		}
+	}
+}
+
+void SkinningPrimFunc::UpdatePalette(const SceneGraph &world, const SceneNode *root, const SceneNode *bindposeroot)
+{
+	m_Skeleton.clear();
+	GetTransforms(world,root,world.GetGlobalTransform(root),m_Skeleton);
+
+	// the bind pose doesn't usually move, so keep its inverse
+	vector<dMatrix> bindpose;
+	GetTransforms(world,bindposeroot,world.GetGlobalTransform(bindposeroot),bindpose);
+	if (bindpose.size()!=m_BindPose.size())
+	{
+		m_BindPose.clear();
+		m_InverseBindPose.clear();
+		m_BindPose.resize(bindpose.size());
+		m_InverseBindPose.resize(bindpose.size());
+		// make sure they all get calculated
+		for (unsigned int i=0; i<bindpose.size(); i++) m_BindPose[i].zero();
+	}
+
+	for (unsigned int i=0; i<bindpose.size(); i++)
+	{
+		if (memcmp(bindpose[i].arr(),m_BindPose[i].arr(),sizeof(float)*16)!=0)
+		{
+			m_BindPose[i]=bindpose[i];
+			m_InverseBindPose[i]=bindpose[i].inverse();
+		}
+	}
+
+	if (m_Skeleton.size()!=m_BindPose.size()) return;
+
+	m_Palette.resize(m_Skeleton.size());
+	for (unsigned int i=0; i<m_Skeleton.size(); i++)
+	{
+		m_Palette[i]=m_Skeleton[i]*m_InverseBindPose[i];
+	}
+
+	if (m_DualQuaternion)
+	{
+		m_DualPalette.resize(m_Palette.size());
+		for (unsigned int i=0; i<m_Palette.size(); i++)
+		{
+			m_DualPalette[i]=MakeDualQuat(m_Palette[i]);
+		}
+	}
+}
+
+SkinningPrimFunc::DualQuat SkinningPrimFunc::MakeDualQuat(const dMatrix &m)
+{
+	DualQuat ret;
+	float *q=ret.Real;
+
+	// the rotation, m[column][row]
+	float trace=m.m[0][0]+m.m[1][1]+m.m[2][2];
+	if (trace>0)
+	{
+		float s=0.5f/sqrtf(trace+1);
+		q[3]=0.25f/s;
+		q[0]=(m.m[1][2]-m.m[2][1])*s;
+		q[1]=(m.m[2][0]-m.m[0][2])*s;
+		q[2]=(m.m[0][1]-m.m[1][0])*s;
+	}
+	else if (m.m[0][0]>m.m[1][1] && m.m[0][0]>m.m[2][2])
+	{
+		float s=2*sqrtf(1+m.m[0][0]-m.m[1][1]-m.m[2][2]);
+		q[3]=(m.m[1][2]-m.m[2][1])/s;
+		q[0]=0.25f*s;
+		q[1]=(m.m[1][0]+m.m[0][1])/s;
+		q[2]=(m.m[2][0]+m.m[0][2])/s;
+	}
+	else if (m.m[1][1]>m.m[2][2])
+	{
+		float s=2*sqrtf(1+m.m[1][1]-m.m[0][0]-m.m[2][2]);
+		q[3]=(m.m[2][0]-m.m[0][2])/s;
+		q[0]=(m.m[1][0]+m.m[0][1])/s;
+		q[1]=0.25f*s;
+		q[2]=(m.m[2][1]+m.m[1][2])/s;
+	}
+	else
 	{
-		transforms.push_back(world.GetGlobalTransform(skeleton[i])*
-							 world.GetGlobalTransform(bindposeskeleton[i]).inverse());
+		float s=2*sqrtf(1+m.m[2][2]-m.m[0][0]-m.m[1][1]);
+		q[3]=(m.m[0][1]-m.m[1][0])/s;
+		q[0]=(m.m[2][0]+m.m[0][2])/s;
+		q[1]=(m.m[2][1]+m.m[1][2])/s;
+		q[2]=0.25f*s;
 	}
+	float len=sqrtf(QuatDot(q,q));
+	for (unsigned int i=0; i<4; i++) q[i]/=len;
 
+	// dual = 0.5 * translation * real
+	dVector t(m.m[3][0],m.m[3][1],m.m[3][2]);
+	dVector axis(q[0],q[1],q[2]);
+	dVector d=(t*q[3]+t.cross(axis))*0.5f;
+	ret.Dual[0]=d.x;
+	ret.Dual[1]=d.y;
+	ret.Dual[2]=d.z;
+	ret.Dual[3]=-0.5f*t.dot(axis);
+	return ret;
+}
+
+void *SkinningPrimFunc::SkinThread(void *data)
+{
+	SkinJob *job=(SkinJob*)data;
+	job->Func->SkinRange(job->Start,job->End);
+	return NULL;
+}
+
+void SkinningPrimFunc::SkinRange(unsigned int start, unsigned int end)
+{
+	unsigned int numbones=m_Palette.size();
+	for (unsigned int i=start; i<end; i++)
+	{
+		const float *bones=(*m_Bones)[i].arr();
+		const float *weights=(*m_Weights)[i].arr();
+		const dVector &pref=(*m_PRef)[i];
+
+		if (m_DualQuaternion)
+		{
+			float real[4]={0,0,0,0};
+			float dual[4]={0,0,0,0};
+			const float *first=NULL;
+			for (unsigned int k=0; k<4; k++)
+			{
+				float w=weights[k];
+				unsigned int bone=(unsigned int)bones[k];
+				if (w==0 || bone>=numbones) continue;
+				const DualQuat &dq=m_DualPalette[bone];
+				// blend the shortest way round from the first bone
+				if (first==NULL) first=dq.Real;
+				else if (QuatDot(first,dq.Real)<0) w=-w;
+				for (unsigned int j=0; j<4; j++)
+				{
+					real[j]+=dq.Real[j]*w;
+					dual[j]+=dq.Dual[j]*w;
+				}
+			}
+
+			float len=sqrtf(QuatDot(real,real));
+			if (len==0) continue;
+			for (unsigned int j=0; j<4; j++)
+			{
+				real[j]/=len;
+				dual[j]/=len;
+			}
+
+			// translation = 2 * dual * conjugate(real)
+			dVector axis(real[0],real[1],real[2]);
+			dVector d(dual[0],dual[1],dual[2]);
+			dVector t=(d*real[3]-axis*dual[3]+axis.cross(d))*2;
+			dVector p=QuatRotate(real,pref)+t;
+			p.w=pref.w;
+			(*m_P)[i]=p;
+			if (m_N!=NULL) 
+			{
+				dVector n=QuatRotate(real,(*m_NRef)[i]);
+				n.w=(*m_NRef)[i].w;
+				(*m_N)[i]=n;
+			}
+		}
+		else
+		{
+#ifdef __SSE__
+			// blend the columns of the bone matrices
+			__m128 c0=_mm_setzero_ps();
+			__m128 c1=_mm_setzero_ps();
+			__m128 c2=_mm_setzero_ps();
+			__m128 c3=_mm_setzero_ps();
+			for (unsigned int k=0; k<4; k++)
+			{
+				unsigned int bone=(unsigned int)bones[k];
+				if (weights[k]==0 || bone>=numbones) continue;
+				const dMatrix &m=m_Palette[bone];
+				__m128 w=_mm_set1_ps(weights[k]);
+				c0=_mm_add_ps(c0,_mm_mul_ps(w,_mm_loadu_ps(m.m[0])));
+				c1=_mm_add_ps(c1,_mm_mul_ps(w,_mm_loadu_ps(m.m[1])));
+				c2=_mm_add_ps(c2,_mm_mul_ps(w,_mm_loadu_ps(m.m[2])));
+				c3=_mm_add_ps(c3,_mm_mul_ps(w,_mm_loadu_ps(m.m[3])));
+			}
+			__m128 r=_mm_mul_ps(c0,_mm_set1_ps(pref.x));
+			r=_mm_add_ps(r,_mm_mul_ps(c1,_mm_set1_ps(pref.y)));
+			r=_mm_add_ps(r,_mm_mul_ps(c2,_mm_set1_ps(pref.z)));
+			r=_mm_add_ps(r,_mm_mul_ps(c3,_mm_set1_ps(pref.w)));
+			_mm_storeu_ps((*m_P)[i].arr(),r);
+			if (m_N!=NULL)
+			{
+				const dVector &nref=(*m_NRef)[i];
+				r=_mm_mul_ps(c0,_mm_set1_ps(nref.x));
+				r=_mm_add_ps(r,_mm_mul_ps(c1,_mm_set1_ps(nref.y)));
+				r=_mm_add_ps(r,_mm_mul_ps(c2,_mm_set1_ps(nref.z)));
+				_mm_storeu_ps((*m_N)[i].arr(),r);
+				(*m_N)[i].w=nref.w;
+			}
+#else
+			dMatrix mat;
+			mat.zero();
+			for (unsigned int k=0; k<4; k++)
+			{
+				unsigned int bone=(unsigned int)bones[k];
+				if (weights[k]==0 || bone>=numbones) continue;
+				mat+=m_Palette[bone]*weights[k];
+			}
+			(*m_P)[i]=mat.transform(pref);
+			if (m_N!=NULL) (*m_N)[i]=mat.transform_no_trans((*m_NRef)[i]);
+#endif
+		}
+	}
+}
+
+void SkinningPrimFunc::SkinAll(Primitive &prim, bool skinnormals)
+{
 	// get pointers to all the weights
 	vector<vector<float, FLX_ALLOC(float) >*> weights;
-	for (unsigned int bone=0; bone<skeleton.size(); bone++)
+	for (unsigned int bone=0; bone<m_Palette.size(); bone++)
 	{
 		char wname[256];
 		snprintf(wname,256,"w%d",bone);
@@ -111,17 +390,17 @@ void SkinningPrimFunc::Run(Primitive &prim, const SceneGraph &world)
 	{
 		dMatrix mat;
 		mat.zero();
-		for	(unsigned int bone=0; bone<skeleton.size(); bone++)
+		for	(unsigned int bone=0; bone<m_Palette.size(); bone++)
 		{
-			mat+=(transforms[bone]*(*weights[bone])[i]);
+			float w=(*weights[bone])[i];
+			if (w!=0) mat+=m_Palette[bone]*w;
 		}
 
-		(*p)[i]=mat.transform((*pref)[i]);
+		(*m_P)[i]=mat.transform((*m_PRef)[i]);
 
 		if (skinnormals)
 		{
-			(*n)[i]=mat.transform_no_trans((*nref)[i]);
+			(*m_N)[i]=mat.transform_no_trans((*m_NRef)[i]);
 		}
 	}
 }
-
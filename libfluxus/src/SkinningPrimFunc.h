@@ -28,6 +28,12 @@ namespace Fluxus
 
 //////////////////////////////////////////////////
 /// A primitive function for debugging skin weights
+/// Deforms a primitive to follow a skeleton. If the primitive has 
+/// "skinbones" and "skinweights" pdata (from genskinweights) only 
+/// those four bones are blended for each vertex, otherwise every 
+/// "w<n>" weight array is. The bones can be blended as matrices, or
+/// as dual quaternions which keep the volume around twisting joints
+/// but ignore any scaling in the skeleton.
 class SkinningPrimFunc : public PrimitiveFunction
 {
 public:
@@ -36,8 +42,44 @@ public:
 
 	virtual void Run(Primitive &prim, const SceneGraph &world);
 
+	/// Primitives with fewer vertices than this aren't threaded
+	static const unsigned int THREADED_SIZE=8192;
+
 private:
+	/// A rotation and translation, as a real and dual quaternion
+	struct DualQuat
+	{
+		float Real[4];
+		float Dual[4];
+	};
+
+	/// Fills in the world transforms of the skeleton, in the 
+	/// same order as SceneGraph::GetNodes, in a single walk
+	void GetTransforms(const SceneGraph &world, const SceneNode *node,
+	                   const dMatrix &global, vector<dMatrix> &transforms);
+	/// Updates the bone matrices (and dual quaternions) from the skeletons.
+	/// The inverse bind pose is only recalculated if the bind pose moves.
+	void UpdatePalette(const SceneGraph &world, const SceneNode *root, const SceneNode *bindposeroot);
+	static DualQuat MakeDualQuat(const dMatrix &m);
 	
+	void SkinAll(Primitive &prim, bool skinnormals);
+	void SkinRange(unsigned int start, unsigned int end);
+	static void *SkinThread(void *data);
+
+	vector<dMatrix> m_Skeleton;
+	vector<dMatrix> m_BindPose;
+	vector<dMatrix> m_InverseBindPose;
+	vector<dMatrix> m_Palette;
+	vector<DualQuat> m_DualPalette;
+
+	// the arrays being skinned
+	bool m_DualQuaternion;
+	vector<dVector,FLX_ALLOC(dVector) > *m_P;
+	vector<dVector,FLX_ALLOC(dVector) > *m_PRef;
+	vector<dVector,FLX_ALLOC(dVector) > *m_N;
+	vector<dVector,FLX_ALLOC(dVector) > *m_NRef;
+	vector<dColour,FLX_ALLOC(dColour) > *m_Bones;
+	vector<dColour,FLX_ALLOC(dColour) > *m_Weights;
 };
 
 
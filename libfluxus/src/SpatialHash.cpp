@@ -0,0 +1,102 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <math.h>
+#include "SpatialHash.h"
+
+using namespace Fluxus;
+
+SpatialHash::SpatialHash(float tolerance) :
+m_Tolerance(tolerance),
+m_Points(NULL),
+m_Mask(0)
+{
+}
+
+SpatialHash::Cell SpatialHash::GetCell(const dVector &point) const
+{
+	Cell c;
+	c.x=(long long)floor(point.x/m_Tolerance);
+	c.y=(long long)floor(point.y/m_Tolerance);
+	c.z=(long long)floor(point.z/m_Tolerance);
+	return c;
+}
+
+unsigned int SpatialHash::Bucket(const Cell &cell) const
+{
+	unsigned long long h=((unsigned long long)cell.x*73856093ULL)^
+	                     ((unsigned long long)cell.y*19349663ULL)^
+	                     ((unsigned long long)cell.z*83492791ULL);
+	return (unsigned int)(h^(h>>32))&m_Mask;
+}
+
+void SpatialHash::Build(const dVector *points, unsigned int count)
+{
+	m_Points=points;
+	
+	// keep the buckets at least twice the number of points
+	unsigned int size=16;
+	while (size<count*2) size<<=1;
+	m_Mask=size-1;
+	
+	m_Buckets.assign(size,-1);
+	m_Next.resize(count);
+	m_Cells.resize(count);
+	
+	for (unsigned int i=0; i<count; i++)
+	{
+		m_Cells[i]=GetCell(points[i]);
+		unsigned int b=Bucket(m_Cells[i]);
+		m_Next[i]=m_Buckets[b];
+		m_Buckets[b]=i;
+	}
+}
+
+void SpatialHash::Find(const dVector &point, vector<int> &found) const
+{
+	if (m_Points==NULL) return;
+	
+	Cell centre=GetCell(point);
+	for (int z=-1; z<=1; z++)
+	{
+		for (int y=-1; y<=1; y++)
+		{
+			for (int x=-1; x<=1; x++)
+			{
+				Cell c;
+				c.x=centre.x+x;
+				c.y=centre.y+y;
+				c.z=centre.z+z;
+				
+				for (int i=m_Buckets[Bucket(c)]; i!=-1; i=m_Next[i])
+				{
+					// other cells can share the bucket
+					if (m_Cells[i]==c)
+					{
+						const dVector &p=m_Points[i];
+						if (fabs(p.x-point.x)<m_Tolerance && 
+						    fabs(p.y-point.y)<m_Tolerance && 
+						    fabs(p.z-point.z)<m_Tolerance)
+						{
+							found.push_back(i);
+						}
+					}
+				}
+			}
+		}
+	}
+}
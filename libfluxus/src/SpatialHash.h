@@ -0,0 +1,71 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_SPATIAL_HASH
+#define N_SPATIAL_HASH
+
+#include <vector>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// Finds coincident points quickly, by quantising them into 
+/// cells the size of the tolerance and hashing the cells. Two
+/// points within the tolerance can only be in the same or
+/// neighbouring cells, so each search only has to look at 27 
+/// cells rather than every point.
+class SpatialHash
+{
+public:
+	/// The tolerance is per axis, as with dVector::feq
+	SpatialHash(float tolerance=0.001);
+	~SpatialHash() {}
+
+	/// Hashes the points, which need to be kept 
+	/// around while the hash is used
+	void Build(const dVector *points, unsigned int count);
+
+	/// Appends the numbers of all the hashed points within 
+	/// the tolerance of the point, in no particular order
+	void Find(const dVector &point, vector<int> &found) const;
+
+private:
+	struct Cell
+	{
+		bool operator==(const Cell &other) const 
+		{ return x==other.x && y==other.y && z==other.z; }
+		long long x,y,z;
+	};
+
+	Cell GetCell(const dVector &point) const;
+	unsigned int Bucket(const Cell &cell) const;
+
+	float m_Tolerance;
+	const dVector *m_Points;
+	vector<Cell> m_Cells;
+	vector<int> m_Buckets; ///< first point in each bucket
+	vector<int> m_Next;    ///< next point in the same bucket
+	unsigned int m_Mask;
+};
+
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include "TexturePainter.h"
 #include "State.h"
 #include "PixelPrimitive.h"
+#include <string.h>
 
 using namespace Fluxus;
 
@@ -149,6 +150,50 @@ void State::Unapply()
 	}
 }
 
+static bool SameColour(const dColour &a, const dColour &b)
+{
+	return a.r==b.r && a.g==b.g && a.b==b.b && a.a==b.a;
+}
+
+bool State::CanInstance(const State &other) const
+{
+	if (Hints!=other.Hints ||
+		Shader!=other.Shader ||
+		Opacity!=other.Opacity ||
+		Shinyness!=other.Shinyness ||
+		ColourMode!=other.ColourMode ||
+		Cull!=other.Cull ||
+		Parent!=other.Parent ||
+		LineWidth!=other.LineWidth ||
+		PointWidth!=other.PointWidth ||
+		StippledLines!=other.StippledLines ||
+		StippleFactor!=other.StippleFactor ||
+		StipplePattern!=other.StipplePattern ||
+		SourceBlend!=other.SourceBlend ||
+		DestinationBlend!=other.DestinationBlend ||
+		WireOpacity!=other.WireOpacity ||
+		!SameColour(Specular,other.Specular) ||
+		!SameColour(Emissive,other.Emissive) ||
+		!SameColour(Ambient,other.Ambient) ||
+		!SameColour(WireColour,other.WireColour) ||
+		!SameColour(NormalColour,other.NormalColour))
+	{
+		return false;
+	}
+
+	for (int n=0; n<MAX_TEXTURES; n++)
+	{
+		if (Textures[n]!=other.Textures[n]) return false;
+		// texture states only matter if there is a texture
+		if (Textures[n]!=0 && memcmp(&TextureStates[n],&other.TextureStates[n],sizeof(TextureState))!=0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 void State::Spew()
 {
 	Trace::Stream<<"Colour: "<<Colour<<endl
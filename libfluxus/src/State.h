@@ -70,6 +70,11 @@ public:
 	void Unapply();
 	void Spew();
 
+	/// Returns true if the other state only differs from
+	/// this one by transform and colour, so primitives
+	/// drawn with both can be instanced together
+	bool CanInstance(const State &other) const;
+
 	dColour Colour;
 	dColour Specular;
 	dColour Emissive;
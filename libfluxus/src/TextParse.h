@@ -0,0 +1,166 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_TEXT_PARSE
+#define N_TEXT_PARSE
+
+#include <cstdlib>
+#include <cmath>
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// Helpers for scanning numbers and words out of text files 
+/// in place, they all take a position which is moved forward 
+/// past what was read, and the end of the data - the text 
+/// doesn't need to be null terminated, so it can be read 
+/// straight out of a MappedFile
+
+/// Skips spaces and tabs, but not newlines
+inline void SkipSpace(const char *&pos, const char *end)
+{
+	while (pos<end && (*pos==' ' || *pos=='\t' || *pos=='\r')) pos++;
+}
+
+/// Moves to the start of the next line
+inline void SkipLine(const char *&pos, const char *end)
+{
+	while (pos<end && *pos!='\n') pos++;
+	if (pos<end) pos++;
+}
+
+inline bool IsEndOfLine(const char *pos, const char *end)
+{
+	return pos>=end || *pos=='\n' || *pos=='\r';
+}
+
+/// Moves past the next word, returning its start and length
+inline unsigned int ReadWord(const char *&pos, const char *end, const char *&word)
+{
+	SkipSpace(pos,end);
+	word=pos;
+	while (pos<end && *pos!=' ' && *pos!='\t' && *pos!='\r' && *pos!='\n') pos++;
+	return pos-word;
+}
+
+/// Compares a word returned from ReadWord with a string
+inline bool WordIs(const char *word, unsigned int len, const char *str)
+{
+	unsigned int i=0;
+	for (; i<len; i++)
+	{
+		if (str[i]!=word[i]) return false;
+	}
+	return str[i]=='\0';
+}
+
+/// Reads a decimal integer, returns false if there isn't one
+inline bool ParseInt(const char *&pos, const char *end, int &out)
+{
+	const char *p=pos;
+	bool neg=false;
+	if (p<end && (*p=='-' || *p=='+')) neg=*p++=='-';
+	if (p>=end || *p<'0' || *p>'9') return false;
+	int value=0;
+	while (p<end && *p>='0' && *p<='9') value=value*10+(*p++-'0');
+	out=neg?-value:value;
+	pos=p;
+	return true;
+}
+
+/// Reads a floating point number, returns false if there isn't one
+inline bool ParseFloat(const char *&pos, const char *end, float &out)
+{
+	static const double powers[] = { 1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,
+		1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22 };
+
+	const char *p=pos;
+	bool neg=false;
+	if (p<end && (*p=='-' || *p=='+')) neg=*p++=='-';
+
+	// collect up to 18 significant digits into an integer, 
+	// which is plenty for floats, and count the exponent
+	unsigned long long mantissa=0;
+	int digits=0;
+	int exponent=0;
+	bool found=false;
+	while (p<end && *p>='0' && *p<='9')
+	{
+		if (digits<18) { mantissa=mantissa*10+(*p-'0'); if (mantissa) digits++; }
+		else exponent++;
+		p++;
+		found=true;
+	}
+	if (p<end && *p=='.')
+	{
+		p++;
+		while (p<end && *p>='0' && *p<='9')
+		{
+			if (digits<18) { mantissa=mantissa*10+(*p-'0'); if (mantissa) digits++; exponent--; }
+			p++;
+			found=true;
+		}
+	}
+
+	if (!found)
+	{
+		// not a plain number, could be nan or inf, so 
+		// leave it to the c library on a terminated copy
+		char buf[64];
+		unsigned int len=0;
+		const char *s=pos;
+		while (s<end && len<63 && *s!=' ' && *s!='\t' && *s!='\r' && *s!='\n') buf[len++]=*s++;
+		buf[len]='\0';
+		char *stop=buf;
+		out=strtod(buf,&stop);
+		if (stop==buf) return false;
+		pos+=stop-buf;
+		return true;
+	}
+
+	if (p<end && (*p=='e' || *p=='E'))
+	{
+		const char *e=p+1;
+		int exp=0;
+		if (ParseInt(e,end,exp))
+		{
+			exponent+=exp;
+			p=e;
+		}
+	}
+
+	double value=(double)mantissa;
+	if (exponent<0)
+	{
+		if (exponent>=-22) value/=powers[-exponent];
+		else value*=pow(10.0,exponent);
+	}
+	else if (exponent>0)
+	{
+		if (exponent<=22) value*=powers[exponent];
+		else value*=pow(10.0,exponent);
+	}
+
+	out=neg?-value:value;
+	pos=p;
+	return true;
+}
+
+}
+
+#endif
@@ -67,33 +67,25 @@ int Tree::AddNode(int ParentID, Node *node)
 	    m_Root=node;
 	}
 	
-	// store in the node map for quick searching...
-	m_NodeMap[node->ID]=node;
+	// store in the node vector for quick searching...
+	if (m_NodeVec.size()<=(unsigned int)node->ID) m_NodeVec.resize(node->ID+1,NULL);
+	m_NodeVec[node->ID]=node;
 	
 	return node->ID;
 }
 
 Node *Tree::FindNode(int ID) const
 {
-	map<int,Node*>::const_iterator i=m_NodeMap.find(ID);
-	if (i!=m_NodeMap.end())
-	{
-		return i->second;
-	}
-	
-	return NULL;
+	if (ID<0 || ID>=(int)m_NodeVec.size()) return NULL;
+	return m_NodeVec[ID];
 }
 
 void Tree::RemoveNode(Node *node)
 {
 	if (node==NULL) return;
 	
-	// remove from node map
-	map<int,Node*>::iterator i=m_NodeMap.find(node->ID);
-	if (i!=m_NodeMap.end())
-	{
-		m_NodeMap.erase(i);
-	}
+	// remove from node vector
+	if (node->ID<(int)m_NodeVec.size()) m_NodeVec[node->ID]=NULL;
 	
 	// if not root, remove ourself from our parent's child vector
 	if (node->Parent)
@@ -112,12 +104,8 @@ void Tree::RemoveNodeWalk(Node *node)
 		RemoveNodeWalk(*i);
 	}
 	
-	// remove from node map
-	map<int,Node*>::iterator i=m_NodeMap.find(node->ID);
-	if (i!=m_NodeMap.end())
-	{
-		m_NodeMap.erase(i);
-	}
+	// remove from node vector
+	if (node->ID<(int)m_NodeVec.size()) m_NodeVec[node->ID]=NULL;
 	
 	delete node;
 }
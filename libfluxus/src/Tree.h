@@ -64,7 +64,7 @@ public:
     virtual void ReparentNode(int NodeID, int NewParentID);
 	
 	/// Clear the tree
-    virtual void Clear() { if (m_Root) RemoveNode(m_Root); m_Root=NULL; m_CurrentID=1; }
+    virtual void Clear() { if (m_Root) RemoveNode(m_Root); m_Root=NULL; m_CurrentID=1; m_NodeVec.clear(); }
 	
 	/// Print out the tree for debugging
     virtual void Dump(int Depth=0,Node *node=NULL) const;
@@ -78,7 +78,10 @@ public:
 protected:
 	void RemoveNodeWalk(Node *node);
 	
-	map<int,Node*> m_NodeMap;
+	/// Indexed by ID for quick searching, IDs are never 
+	/// reused (until the tree is cleared) so removed nodes
+	/// just leave a NULL behind
+	vector<Node*> m_NodeVec;
 	Node *m_Root;
     int m_CurrentID;
 };
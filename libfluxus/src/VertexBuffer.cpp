@@ -0,0 +1,113 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include "VertexBuffer.h"
+
+using namespace Fluxus;
+
+bool VertexBuffer::m_Enabled = false;
+bool VertexBuffer::m_InstancingEnabled = false;
+
+VertexBuffer::VertexBuffer(GLenum target, GLenum usage) :
+m_Target(target),
+m_Buffer(0),
+m_Size(0),
+m_Usage(usage)
+{
+}
+
+VertexBuffer::VertexBuffer(const VertexBuffer &other) :
+m_Target(other.m_Target),
+m_Buffer(0),
+m_Size(0),
+m_Usage(other.m_Usage)
+{
+}
+
+VertexBuffer::~VertexBuffer()
+{
+	if (m_Buffer!=0)
+	{
+		glDeleteBuffers(1,&m_Buffer);
+	}
+}
+
+void VertexBuffer::Init()
+{
+	m_Enabled = glewIsSupported("GL_VERSION_1_5");
+	m_InstancingEnabled = glewIsSupported("GL_VERSION_2_0 GL_ARB_draw_instanced GL_ARB_instanced_arrays");
+}
+
+void VertexBuffer::Update(PData *pd)
+{
+	if (pd==NULL) return;
+	unsigned int start,end;
+	pd->GetDirtyRange(start,end);
+	unsigned int elementsize=pd->ElementSize();
+	Update(pd->GetRawData(),pd->Size()*elementsize,start*elementsize,end*elementsize);
+	if (m_Enabled) pd->ClearDirty();
+}
+
+void VertexBuffer::Update(const void *data, unsigned int size, unsigned int start, unsigned int end)
+{
+	if (!m_Enabled || data==NULL) return;
+
+	if (m_Buffer==0)
+	{
+		glGenBuffers(1,&m_Buffer);
+	}
+
+	glBindBuffer(m_Target,m_Buffer);
+
+	if (size!=m_Size || m_Usage==GL_STREAM_DRAW)
+	{
+		// the array has changed size, so we need to reallocate,
+		// if this isn't the first upload then it's likely to be 
+		// changing a lot. stream buffers are always replaced 
+		// whole, so the driver doesn't have to wait for the 
+		// last frame to finish with them
+		if (m_Size!=0 && m_Usage==GL_STATIC_DRAW) m_Usage=GL_DYNAMIC_DRAW;
+		glBufferData(m_Target,size,data,m_Usage);
+		m_Size=size;
+	}
+	else if (start<end)
+	{
+		m_Usage=GL_DYNAMIC_DRAW;
+		glBufferSubData(m_Target,start,end-start,(const char*)data+start);
+	}
+}
+
+const void *VertexBuffer::Bind(const void *client)
+{
+	if (!m_Enabled) return client;
+
+	if (m_Buffer!=0)
+	{
+		glBindBuffer(m_Target,m_Buffer);
+		return NULL;
+	}
+	
+	glBindBuffer(m_Target,0);
+	return client;
+}
+
+void VertexBuffer::Unbind()
+{
+	if (!m_Enabled) return;
+	glBindBuffer(GL_ARRAY_BUFFER,0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+}
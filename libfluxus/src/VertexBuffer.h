@@ -0,0 +1,83 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_VERTEX_BUFFER
+#define N_VERTEX_BUFFER
+
+#include "OpenGL.h"
+#include "PData.h"
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////
+/// A gl buffer object which keeps a copy of a pdata
+/// array (or an index list) on the graphics card. 
+/// Data is only uploaded when it has been written to, 
+/// and then only the range which was changed. If
+/// buffer objects are not supported it falls back to
+/// client side arrays.
+class VertexBuffer
+{
+public:
+	/// Usage is a hint for the driver, GL_STREAM_DRAW
+	/// for data which is replaced every frame
+	VertexBuffer(GLenum target=GL_ARRAY_BUFFER, GLenum usage=GL_STATIC_DRAW);
+	/// Copies don't share the gl buffer, they 
+	/// upload their own when first updated
+	VertexBuffer(const VertexBuffer &other);
+	~VertexBuffer();
+
+	/// Uploads the dirty range of the pdata array, and
+	/// clears its dirty flag
+	void Update(PData *pd);
+	
+	/// Uploads raw data, start and end are in bytes and give
+	/// the range which has changed
+	void Update(const void *data, unsigned int size, unsigned int start, unsigned int end);
+
+	/// Binds the buffer and returns the address to give the 
+	/// gl pointer functions - an offset into the buffer, or 
+	/// the client side address if we aren't using buffers
+	const void *Bind(const void *client);
+
+	/// Returns to using client side arrays, call this 
+	/// when finished drawing
+	static void Unbind();
+
+	/// Checks for driver support, needs a gl context
+	static void Init();
+	static bool IsEnabled() { return m_Enabled; }
+	/// Whether we can use per-instance buffers for 
+	/// hardware instanced drawing
+	static bool IsInstancingEnabled() { return m_InstancingEnabled; }
+	
+private:
+	const VertexBuffer &operator=(const VertexBuffer &other);
+
+	GLenum m_Target;
+	GLuint m_Buffer;
+	unsigned int m_Size;
+	GLenum m_Usage;
+	
+	static bool m_Enabled;
+	static bool m_InstancingEnabled;
+};
+
+}
+
+#endif
@@ -0,0 +1,128 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+#include "VoxelBricks.h"
+
+using namespace Fluxus;
+
+VoxelBricks::VoxelBricks() :
+m_BricksX(0),
+m_BricksY(0),
+m_BricksZ(0),
+m_NumAllocated(0)
+{
+}
+
+VoxelBricks::VoxelBricks(const VoxelBricks &other) :
+m_BricksX(0),
+m_BricksY(0),
+m_BricksZ(0),
+m_NumAllocated(0)
+{
+	*this=other;
+}
+
+VoxelBricks::~VoxelBricks()
+{
+	Clear();
+}
+
+const VoxelBricks &VoxelBricks::operator=(const VoxelBricks &other)
+{
+	if (&other==this) return *this;
+	
+	Clear();
+	m_BricksX=other.m_BricksX;
+	m_BricksY=other.m_BricksY;
+	m_BricksZ=other.m_BricksZ;
+	m_Bricks.assign(other.m_Bricks.size(),(dColour*)NULL);
+	for (unsigned int i=0; i<m_Bricks.size(); i++)
+	{
+		if (other.m_Bricks[i]!=NULL)
+		{
+			m_Bricks[i]=Allocate();
+			std::copy(other.m_Bricks[i],other.m_Bricks[i]+VOXELS,m_Bricks[i]);
+			m_NumAllocated++;
+		}
+	}
+	return *this;
+}
+
+void VoxelBricks::Init(unsigned int w, unsigned int h, unsigned int d)
+{
+	Clear();
+	m_BricksX=(w+MASK)>>SHIFT;
+	m_BricksY=(h+MASK)>>SHIFT;
+	m_BricksZ=(d+MASK)>>SHIFT;
+	m_Bricks.assign(m_BricksX*m_BricksY*m_BricksZ,(dColour*)NULL);
+}
+
+void VoxelBricks::Clear()
+{
+	for (vector<dColour*>::iterator i=m_Bricks.begin(); i!=m_Bricks.end(); ++i)
+	{
+		if (*i!=NULL)
+		{
+			Release(*i);
+			*i=NULL;
+		}
+	}
+	m_NumAllocated=0;
+}
+
+dColour *VoxelBricks::MakeBrick(unsigned int bx, unsigned int by, unsigned int bz)
+{
+	dColour *&brick=m_Bricks[BrickIndex(bx,by,bz)];
+	if (brick==NULL)
+	{
+		brick=Allocate();
+		m_NumAllocated++;
+	}
+	return brick;
+}
+
+void VoxelBricks::FreeBrick(unsigned int bx, unsigned int by, unsigned int bz)
+{
+	dColour *&brick=m_Bricks[BrickIndex(bx,by,bz)];
+	if (brick!=NULL)
+	{
+		Release(brick);
+		brick=NULL;
+		m_NumAllocated--;
+	}
+}
+
+dColour *VoxelBricks::Allocate()
+{
+	// aligned so the voxels can be worked on with sse
+	void *mem=NULL;
+	if (posix_memalign(&mem,16,VOXELS*sizeof(dColour))!=0) throw std::bad_alloc();
+	dColour *brick=(dColour*)mem;
+	for (unsigned int i=0; i<VOXELS; i++) 
+	{
+		new (&brick[i]) dColour(0,0,0,0);
+	}
+	return brick;
+}
+
+void VoxelBricks::Release(dColour *brick)
+{
+	free(brick);
+}
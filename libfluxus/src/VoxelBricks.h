@@ -0,0 +1,98 @@
+// Copyright (C) 2011 Dave Griffiths
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+
+#ifndef N_VOXEL_BRICKS
+#define N_VOXEL_BRICKS
+
+#include <vector>
+#include "dada.h"
+
+using namespace std;
+
+namespace Fluxus
+{
+
+///////////////////////////////////////////////////////////////
+/// Sparse storage for a volume of colours, split into bricks
+/// of 8x8x8 voxels which are only allocated when something is
+/// written to them. The empty bricks are all transparent black,
+/// so big volumes only cost memory where there is something in
+/// them, and operations can skip the empty space.
+class VoxelBricks
+{
+public:
+	VoxelBricks();
+	VoxelBricks(const VoxelBricks &other);
+	~VoxelBricks();
+	const VoxelBricks &operator=(const VoxelBricks &other);
+
+	/// Voxels along each side of a brick
+	static const unsigned int SIZE=8;
+	static const unsigned int SHIFT=3;
+	static const unsigned int MASK=7;
+	/// Voxels in a brick
+	static const unsigned int VOXELS=SIZE*SIZE*SIZE;
+
+	/// Sets the size in voxels, and empties it
+	void Init(unsigned int w, unsigned int h, unsigned int d);
+	/// Frees all the bricks
+	void Clear();
+
+	unsigned int GetBricksX() const { return m_BricksX; }
+	unsigned int GetBricksY() const { return m_BricksY; }
+	unsigned int GetBricksZ() const { return m_BricksZ; }
+	/// The number of bricks allocated
+	unsigned int GetNumAllocated() const { return m_NumAllocated; }
+
+	/// Returns the brick's voxels, x changing fastest, 
+	/// or NULL if it's empty
+	dColour *GetBrick(unsigned int bx, unsigned int by, unsigned int bz) const
+		{ return m_Bricks[BrickIndex(bx,by,bz)]; }
+	/// Returns the brick's voxels, allocating it if needed
+	dColour *MakeBrick(unsigned int bx, unsigned int by, unsigned int bz);
+	/// Empties the brick, freeing its voxels
+	void FreeBrick(unsigned int bx, unsigned int by, unsigned int bz);
+	
+	/// The position of a voxel inside its brick
+	static unsigned int VoxelIndex(unsigned int x, unsigned int y, unsigned int z)
+		{ return (x&MASK)|((y&MASK)<<SHIFT)|((z&MASK)<<(SHIFT*2)); }
+
+	/// Reads a voxel, no bounds checking
+	dColour Get(unsigned int x, unsigned int y, unsigned int z) const
+	{
+		const dColour *brick=GetBrick(x>>SHIFT,y>>SHIFT,z>>SHIFT);
+		if (brick==NULL) return dColour(0,0,0,0);
+		return brick[VoxelIndex(x,y,z)];
+	}
+
+private:
+	unsigned int BrickIndex(unsigned int bx, unsigned int by, unsigned int bz) const
+		{ return bx+by*m_BricksX+bz*m_BricksX*m_BricksY; }
+	static dColour *Allocate();
+	static void Release(dColour *brick);
+
+	unsigned int m_BricksX;
+	unsigned int m_BricksY;
+	unsigned int m_BricksZ;
+	unsigned int m_NumAllocated;
+	/// The occupancy map, NULL for empty bricks
+	vector<dColour*> m_Bricks;
+};
+
+}
+
+#endif
@@ -14,26 +14,63 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
+#include <math.h>
+#include <float.h>
 #include "Renderer.h"
 #include "VoxelPrimitive.h"
 #include "BlobbyPrimitive.h"
 #include "State.h"
+#include "JobPool.h"
 
 using namespace Fluxus;
 
-VoxelPrimitive::VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d)
+// influences are only applied where they would 
+// add more than this to any of the channels
+static const float INFLUENCE_CUTOFF=0.001;
+
+struct VoxelJob
+{
+	VoxelPrimitive *Prim;
+	const vector<unsigned int> *Bricks;
+	unsigned int Start,End;
+};
+
+VoxelPrimitive::VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d, bool sparse) :
+m_ColData(NULL),
+m_GradData(NULL),
+m_Width(w),
+m_Height(h),
+m_Depth(d),
+m_Sparse(sparse),
+m_Op(OP_INFLUENCE),
+m_OpValue(0)
 {
-	AddData("c",new TypedPData<dColour>(w*h*d));
-	AddData("g",new TypedPData<dColour>(w*h*d));
-	m_Width=w;
-	m_Height=h;
-	m_Depth=d;
+	if (m_Sparse)
+	{
+		m_Bricks.Init(w,h,d);
+		m_GradBricks.Init(w,h,d);
+	}
+	else
+	{
+		AddData("c",new TypedPData<dColour>(w*h*d));
+		AddData("g",new TypedPData<dColour>(w*h*d));
+	}
 	// direct access for speed
 	PDataDirty();
 }
 
 VoxelPrimitive::VoxelPrimitive(const VoxelPrimitive &other) :
-Primitive(other)
+Primitive(other),
+m_ColData(NULL),
+m_GradData(NULL),
+m_Width(other.m_Width),
+m_Height(other.m_Height),
+m_Depth(other.m_Depth),
+m_Sparse(other.m_Sparse),
+m_Bricks(other.m_Bricks),
+m_GradBricks(other.m_GradBricks),
+m_Op(OP_INFLUENCE),
+m_OpValue(0)
 {
 	PDataDirty();
 }
@@ -49,6 +86,7 @@ VoxelPrimitive* VoxelPrimitive::Clone() const
 
 void VoxelPrimitive::PDataDirty()
 {
+	if (m_Sparse) return;
 	m_ColData=GetDataVec<dColour>("c");
 	m_GradData=GetDataVec<dColour>("g");
 }
@@ -69,76 +107,330 @@ dColour VoxelPrimitive::SafeRef(unsigned int x, unsigned int y, unsigned int z)
 {
 	if (x>0 && x<m_Width && y>0 && y<m_Height && z>0 && z<m_Depth)
 	{
+		if (m_Sparse) return m_Bricks.Get(x,y,z);
 		return (*m_ColData)[Index(x,y,z)];
 	}
 	return dColour(0,0,0);
 }
 
-void VoxelPrimitive::CalcGradient()
+dColour *VoxelPrimitive::Voxel(vector<dColour,FLX_ALLOC(dColour) > *data, dColour *brick,
+                               unsigned int x, unsigned int y, unsigned int z)
+{
+	if (m_Sparse)
+	{
+		if (brick==NULL) return NULL;
+		return brick+VoxelBricks::VoxelIndex(x,y,z);
+	}
+	return &(*data)[Index(x,y,z)];
+}
+
+void VoxelPrimitive::RunBricks(const dVector &min, const dVector &max, bool allocate)
 {
-	for (unsigned int x=0; x<m_Width; x++)
+	// convert the bounds to the range of voxels they contain
+	unsigned int size[3]={m_Width,m_Height,m_Depth};
+	for (unsigned int a=0; a<3; a++)
+	{
+		if (size[a]==0) return;
+		float lo=min.arr()[a]*m_Width;
+		float hi=max.arr()[a]*m_Width;
+		if (lo<0) lo=0;
+		if (hi>size[a]-1) hi=size[a]-1;
+		if (!(lo<=hi)) return;
+		m_OpMin[a]=(unsigned int)ceilf(lo);
+		m_OpMax[a]=(unsigned int)floorf(hi);
+		if (m_OpMin[a]>m_OpMax[a]) return;
+	}
+
+	vector<unsigned int> bricks;
+	for (unsigned int bz=m_OpMin[2]>>VoxelBricks::SHIFT; bz<=m_OpMax[2]>>VoxelBricks::SHIFT; bz++)
 	{
-		for (unsigned int y=0; y<m_Height; y++)
+		for (unsigned int by=m_OpMin[1]>>VoxelBricks::SHIFT; by<=m_OpMax[1]>>VoxelBricks::SHIFT; by++)
 		{
-			for (unsigned int z=0; z<m_Depth; z++)
+			for (unsigned int bx=m_OpMin[0]>>VoxelBricks::SHIFT; bx<=m_OpMax[0]>>VoxelBricks::SHIFT; bx++)
 			{
-				(*m_GradData)[Index(x,y,z)]=dColour(SafeRef(x-1,y,z).r-SafeRef(x+1,y,z).r,
-					SafeRef(x,y-1,z).g-SafeRef(x,y+1,z).g,
-					SafeRef(x,y,z-1).b-SafeRef(x,y,z+1).b);
-			}	
+				if (m_Sparse)
+				{
+					// the gradient bricks are set up before the operation, 
+					// lighting needs a brick anywhere there is a gradient
+					bool used;
+					if (m_Op==OP_GRADIENT) used=m_GradBricks.GetBrick(bx,by,bz)!=NULL;
+					else used=allocate || m_Bricks.GetBrick(bx,by,bz)!=NULL ||
+						(m_Op==OP_LIGHT && m_GradBricks.GetBrick(bx,by,bz)!=NULL);
+					if (!used) continue;
+					// allocate here rather than in the threads
+					if (m_Op!=OP_GRADIENT) m_Bricks.MakeBrick(bx,by,bz);
+				}
+				bricks.push_back(bx);
+				bricks.push_back(by);
+				bricks.push_back(bz);
+			}
 		}
 	}
+
+	unsigned int numbricks=bricks.size()/3;
+	unsigned int numthreads=JobPool::Get()->GetNumThreads();
+	if (numbricks*VoxelBricks::VOXELS<THREADED_SIZE) numthreads=1;
+	if (numthreads>numbricks) numthreads=numbricks;
+	if (numthreads<1) return;
+
+	VoxelJob jobs[JobPool::MAX_THREADS];
+	unsigned int slice=numbricks/numthreads;
+	for (unsigned int t=0; t<numthreads; t++)
+	{
+		jobs[t].Prim=this;
+		jobs[t].Bricks=&bricks;
+		jobs[t].Start=t*slice;
+		jobs[t].End=t==numthreads-1?numbricks:(t+1)*slice;
+	}
+
+	JobPool::Get()->RunEach(BrickThread,jobs,numthreads);
 }
 
-void VoxelPrimitive::SphereInfluence(const dVector &pos, const dColour &col, float pow)
+void *VoxelPrimitive::BrickThread(void *data)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	VoxelJob *job=(VoxelJob*)data;
+	const vector<unsigned int> &bricks=*job->Bricks;
+	for (unsigned int i=job->Start; i<job->End; i++)
 	{
-		(*m_ColData)[i]+=col*powf(1/Position(i).dist(pos),pow);
+		job->Prim->ProcessBrick(bricks[i*3],bricks[i*3+1],bricks[i*3+2]);
 	}
+	return NULL;
 }
 
-void VoxelPrimitive::SphereSolid(const dVector &pos, const dColour &col, float radius)
+void VoxelPrimitive::ProcessBrick(unsigned int bx, unsigned int by, unsigned int bz)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	// the part of the brick inside the operation's range
+	unsigned int min[3]={bx<<VoxelBricks::SHIFT,by<<VoxelBricks::SHIFT,bz<<VoxelBricks::SHIFT};
+	unsigned int max[3];
+	for (unsigned int a=0; a<3; a++)
+	{
+		max[a]=min[a]+VoxelBricks::MASK;
+		if (min[a]<m_OpMin[a]) min[a]=m_OpMin[a];
+		if (max[a]>m_OpMax[a]) max[a]=m_OpMax[a];
+	}
+
+	dColour *colbrick=NULL;
+	dColour *gradbrick=NULL;
+	if (m_Sparse)
 	{
-		if (Position(i).dist(pos)<radius) (*m_ColData)[i]=col;
+		colbrick=m_Bricks.GetBrick(bx,by,bz);
+		gradbrick=m_GradBricks.GetBrick(bx,by,bz);
+	}
+
+	for (unsigned int z=min[2]; z<=max[2]; z++)
+	{
+		for (unsigned int y=min[1]; y<=max[1]; y++)
+		{
+			ProcessRow(Voxel(m_ColData,colbrick,min[0],y,z),
+			           Voxel(m_GradData,gradbrick,min[0],y,z),
+			           min[0],max[0]+1,y,z);
+		}
 	}
 }
 
-void VoxelPrimitive::BoxSolid(const dVector &topleft, const dVector &botright, const dColour &col)
+void VoxelPrimitive::ProcessRow(dColour *col, dColour *grad,
+                                unsigned int x0, unsigned int x1, unsigned int y, unsigned int z)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	// positions are the voxel coordinates over the width
+	float scale=1/(float)m_Width;
+	dVector p(0,y*scale,z*scale);
+	unsigned int count=x1-x0;
+
+	switch (m_Op)
 	{
-		dVector pos=Position(i);
-		if (pos>topleft && pos<botright) (*m_ColData)[i]=col;
+		case OP_INFLUENCE:
+		{
+			bool squared=m_OpValue==2;
+			float halfpow=-0.5f*m_OpValue;
+#ifdef __SSE__
+			__m128 colour=_mm_loadu_ps(m_OpColour.arr());
+#endif
+			for (unsigned int i=0; i<count; i++)
+			{
+				p.x=(x0+i)*scale;
+				float distsq=p.distsq(m_OpPos);
+				// (1/dist)^pow without the square root
+				float weight=squared?1/distsq:powf(distsq,halfpow);
+#ifdef __SSE__
+				float *c=col[i].arr();
+				_mm_storeu_ps(c,_mm_add_ps(_mm_loadu_ps(c),_mm_mul_ps(colour,_mm_set1_ps(weight))));
+#else
+				col[i]+=m_OpColour*weight;
+#endif
+			}
+		}
+		break;
+		case OP_SPHERE:
+		{
+			float radiussq=m_OpValue*m_OpValue;
+			for (unsigned int i=0; i<count; i++)
+			{
+				p.x=(x0+i)*scale;
+				if (p.distsq(m_OpPos)<radiussq) col[i]=m_OpColour;
+			}
+		}
+		break;
+		case OP_BOX:
+		{
+			for (unsigned int i=0; i<count; i++)
+			{
+				p.x=(x0+i)*scale;
+				if (p>m_OpPos && p<m_OpPos2) col[i]=m_OpColour;
+			}
+		}
+		break;
+		case OP_THRESHOLD:
+		{
+			float valuesq=m_OpValue*m_OpValue;
+			for (unsigned int i=0; i<count; i++)
+			{
+				if (m_OpValue>0 && col[i].magsq()<valuesq) col[i]=dColour(0,0,0,0);
+				else col[i]=dColour(1,1,1,1);
+			}
+		}
+		break;
+		case OP_GRADIENT:
+		{
+			for (unsigned int i=0; i<count; i++)
+			{
+				unsigned int x=x0+i;
+				grad[i]=dColour(SafeRef(x-1,y,z).r-SafeRef(x+1,y,z).r,
+					SafeRef(x,y-1,z).g-SafeRef(x,y+1,z).g,
+					SafeRef(x,y,z-1).b-SafeRef(x,y,z+1).b);
+			}
+		}
+		break;
+		case OP_LIGHT:
+		{
+#ifdef __SSE__
+			__m128 colour=_mm_loadu_ps(m_OpColour.arr());
+#endif
+			for (unsigned int i=0; i<count; i++)
+			{
+				p.x=(x0+i)*scale;
+				// empty sparse bricks have no gradient
+				float lambert=0;
+				if (grad!=NULL)	lambert=dVector(grad[i].r,grad[i].g,grad[i].b).dot(m_OpPos-p);
+				if (lambert>0) 
+				{
+#ifdef __SSE__
+					float *c=col[i].arr();
+					_mm_storeu_ps(c,_mm_add_ps(_mm_loadu_ps(c),_mm_mul_ps(colour,_mm_set1_ps(lambert))));
+#else
+					col[i]+=m_OpColour*lambert;
+#endif
+				}
+				else col[i]*=0.1; // ambient...
+			}
+		}
+		break;
 	}
 }
 
-void VoxelPrimitive::Threshold(float value)
+void VoxelPrimitive::CalcGradient()
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	if (m_Sparse)
 	{
-		if ((*m_ColData)[i].mag()<value)
+		// the gradient is only non zero in and next to the
+		// voxels that are in use, so keep bricks for those
+		int bw=m_Bricks.GetBricksX();
+		int bh=m_Bricks.GetBricksY();
+		int bd=m_Bricks.GetBricksZ();
+		vector<bool> needed(bw*bh*bd,false);
+		for (int bz=0; bz<bd; bz++)
 		{
-			(*m_ColData)[i]=dColour(0,0,0,0);
+			for (int by=0; by<bh; by++)
+			{
+				for (int bx=0; bx<bw; bx++)
+				{
+					if (m_Bricks.GetBrick(bx,by,bz)==NULL) continue;
+					for (int z=max(bz-1,0); z<=min(bz+1,bd-1); z++)
+					{
+						for (int y=max(by-1,0); y<=min(by+1,bh-1); y++)
+						{
+							for (int x=max(bx-1,0); x<=min(bx+1,bw-1); x++)
+							{
+								needed[x+y*bw+z*bw*bh]=true;
+							}
+						}
+					}
+				}
+			}
 		}
-		else
+		
+		for (int bz=0; bz<bd; bz++)
 		{
-			(*m_ColData)[i]=dColour(1,1,1,1);
+			for (int by=0; by<bh; by++)
+			{
+				for (int bx=0; bx<bw; bx++)
+				{
+					if (needed[bx+by*bw+bz*bw*bh]) m_GradBricks.MakeBrick(bx,by,bz);
+					else m_GradBricks.FreeBrick(bx,by,bz);
+				}
+			}
 		}
 	}
+
+	m_Op=OP_GRADIENT;
+	RunBricks(dVector(0,0,0),dVector(m_Width,m_Height,m_Depth)/m_Width,false);
 }
 
-void VoxelPrimitive::PointLight(dVector lightpos, dColour col)
+void VoxelPrimitive::SphereInfluence(const dVector &pos, const dColour &col, float pow)
 {
-	for (unsigned int i=0; i<m_Width*m_Height*m_Depth; i++)
+	m_Op=OP_INFLUENCE;
+	m_OpPos=pos;
+	m_OpColour=col;
+	m_OpValue=pow;
+
+	float strength=0;
+	for (unsigned int i=0; i<4; i++) strength=max(strength,fabsf(col.arr()[i]));
+	if (strength==0) return;
+
+	// only visit the voxels within the distance 
+	// where the influence becomes negligible
+	float radius=pow>0?powf(strength/INFLUENCE_CUTOFF,1/pow):FLT_MAX;
+	if (radius<FLT_MAX)
+	{
+		RunBricks(pos-dVector(radius,radius,radius),pos+dVector(radius,radius,radius),true);
+	}
+	else
 	{
-		dVector *n=reinterpret_cast<dVector*>(&(*m_GradData)[i]);
-		float lambert = n->dot(lightpos-Position(i));
-		if (lambert>0) (*m_ColData)[i]+=col*lambert;
-		else (*m_ColData)[i]*=0.1; // ambient...
-	}	
+		RunBricks(dVector(0,0,0),dVector(m_Width,m_Height,m_Depth)/m_Width,true);
+	}
+}
+
+void VoxelPrimitive::SphereSolid(const dVector &pos, const dColour &col, float radius)
+{
+	m_Op=OP_SPHERE;
+	m_OpPos=pos;
+	m_OpColour=col;
+	m_OpValue=radius;
+	RunBricks(pos-dVector(radius,radius,radius),pos+dVector(radius,radius,radius),true);
+}
+
+void VoxelPrimitive::BoxSolid(const dVector &topleft, const dVector &botright, const dColour &col)
+{
+	m_Op=OP_BOX;
+	m_OpPos=topleft;
+	m_OpPos2=botright;
+	m_OpColour=col;
+	RunBricks(topleft,botright,true);
+}
+
+void VoxelPrimitive::Threshold(float value)
+{
+	m_Op=OP_THRESHOLD;
+	m_OpValue=value;
+	// empty voxels only change if everything passes
+	RunBricks(dVector(0,0,0),dVector(m_Width,m_Height,m_Depth)/m_Width,value<=0);
+}
+
+void VoxelPrimitive::PointLight(dVector lightpos, dColour col)
+{
+	m_Op=OP_LIGHT;
+	m_OpPos=lightpos;
+	m_OpColour=col;
+	RunBricks(dVector(0,0,0),dVector(m_Width,m_Height,m_Depth)/m_Width,false);
 }
 	
 void VoxelPrimitive::Render()
@@ -154,23 +446,56 @@ void VoxelPrimitive::Render()
 		down.normalise();
 		across/=m_Width;
 		down/=m_Width;
+		float scale=1/(float)m_Width;
+		
+		// go brick by brick, so empty sparse bricks are skipped
+		unsigned int bw=(m_Width+VoxelBricks::MASK)>>VoxelBricks::SHIFT;
+		unsigned int bh=(m_Height+VoxelBricks::MASK)>>VoxelBricks::SHIFT;
+		unsigned int bd=(m_Depth+VoxelBricks::MASK)>>VoxelBricks::SHIFT;
 		
 		glBegin(GL_QUADS);
-		for (unsigned int n=0; n<m_ColData->size(); n++)
+		for (unsigned int bz=0; bz<bd; bz++)
 		{
-			if ((*m_ColData)[n].a>0.001)
-			{		
-				dVector p(n%m_Width,n/m_Width%m_Height,n/(m_Width*m_Height));
-				p/=m_Width;
-				glColor4fv((*m_ColData)[n].arr());
-				glTexCoord2f(0,0);
-				glVertex3fv((p-across-down).arr());
-				glTexCoord2f(0,1);
-				glVertex3fv((p-across+down).arr());
-				glTexCoord2f(1,1);
-				glVertex3fv((p+across+down).arr());
-				glTexCoord2f(1,0);
-				glVertex3fv((p+across-down).arr());
+			for (unsigned int by=0; by<bh; by++)
+			{
+				for (unsigned int bx=0; bx<bw; bx++)
+				{
+					dColour *brick=NULL;
+					if (m_Sparse)
+					{
+						brick=m_Bricks.GetBrick(bx,by,bz);
+						if (brick==NULL) continue;
+					}
+					
+					unsigned int x0=bx<<VoxelBricks::SHIFT;
+					unsigned int x1=min(x0+VoxelBricks::SIZE,m_Width);
+					unsigned int y1=min((by+1)<<VoxelBricks::SHIFT,m_Height);
+					unsigned int z1=min((bz+1)<<VoxelBricks::SHIFT,m_Depth);
+					for (unsigned int z=bz<<VoxelBricks::SHIFT; z<z1; z++)
+					{
+						for (unsigned int y=by<<VoxelBricks::SHIFT; y<y1; y++)
+						{
+							dColour *row=Voxel(m_ColData,brick,x0,y,z);
+							for (unsigned int x=x0; x<x1; x++)
+							{
+								const dColour &c=row[x-x0];
+								if (c.a>0.001)
+								{		
+									dVector p(x*scale,y*scale,z*scale);
+									glColor4fv(c.arr());
+									glTexCoord2f(0,0);
+									glVertex3fv((p-across-down).arr());
+									glTexCoord2f(0,1);
+									glVertex3fv((p-across+down).arr());
+									glTexCoord2f(1,1);
+									glVertex3fv((p+across+down).arr());
+									glTexCoord2f(1,0);
+									glVertex3fv((p+across-down).arr());
+								}
+							}
+						}
+					}
+				}
 			}
 		}
 		glEnd();
@@ -182,47 +507,18 @@ BlobbyPrimitive *VoxelPrimitive::ConvertToBlobby()
 {
 	BlobbyPrimitive *blob = new BlobbyPrimitive(m_Width, m_Height, m_Depth, dVector(1,1,1));
 
-    // cell corners
-    // 0 = 0 1 0
-    // 1 = 0 1 1
-    // 2 = 0 0 1
-    // 3 = 0 0 0
-
-    // 4 = 1 1 0
-    // 5 = 1 1 1
-    // 6 = 1 0 1
-    // 7 = 1 0 0
-
-    unsigned int pos=0;
-    for (unsigned int x=0; x<m_Width; x++)
+    // the grid points of the field line up with the voxels
+    IsoSurface &field = blob->GetField();
+    for (unsigned int x=0; x<=m_Width; x++)
     {
-        for (unsigned int y=0; y<m_Height; y++)
+        for (unsigned int y=0; y<=m_Height; y++)
         {
-            for (unsigned int z=0; z<m_Depth; z++)
+            for (unsigned int z=0; z<=m_Depth; z++)
             {
-                BlobbyPrimitive::Cell &cell = blob->GetVoxels()[pos];
-
-                cell.val[0]=SafeRef(x,y+1,z).mag();
-                cell.val[1]=SafeRef(x,y+1,z+1).mag();
-                cell.val[2]=SafeRef(x,y,z+1).mag();
-                cell.val[3]=SafeRef(x,y,z).mag();
-
-                cell.val[4]=SafeRef(x+1,y+1,z).mag();
-                cell.val[5]=SafeRef(x+1,y+1,z+1).mag();
-                cell.val[6]=SafeRef(x+1,y,z+1).mag();
-                cell.val[7]=SafeRef(x+1,y,z).mag();
-
-                cell.col[0]=SafeRef(x,y+1,z);
-                cell.col[1]=SafeRef(x,y+1,z+1);
-                cell.col[2]=SafeRef(x,y,z+1);
-                cell.col[3]=SafeRef(x,y,z);
-
-                cell.col[4]=SafeRef(x+1,y+1,z);
-                cell.col[5]=SafeRef(x+1,y+1,z+1);
-                cell.col[6]=SafeRef(x+1,y,z+1);
-                cell.col[7]=SafeRef(x+1,y,z);
-
-                pos++;
+                dColour c=SafeRef(x,y,z);
+                unsigned int i=field.Index(x,y,z);
+                field.GetValues()[i]=c.mag();
+                field.GetColours()[i]=c;
             }
         }
     }
@@ -18,6 +18,7 @@
 #define N_VOXELPRIM
 
 #include "Primitive.h"
+#include "VoxelBricks.h"
 
 namespace Fluxus
 {
@@ -25,10 +26,15 @@ namespace Fluxus
 class BlobbyPrimitive;
 
 //////////////////////////////////////////////////////
+/// A volume of coloured voxels. By default the voxels are
+/// kept in the "c" pdata with the gradients in "g", sparse 
+/// voxels are kept in bricks which are only allocated where
+/// something has been drawn, so they have no pdata. Either 
+/// way the operations only visit the bricks they can change.
 class VoxelPrimitive : public Primitive
 {
 public:
-	VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d);
+	VoxelPrimitive(unsigned int w, unsigned int h, unsigned int d, bool sparse=false);
 	VoxelPrimitive(const VoxelPrimitive &other);
 	virtual ~VoxelPrimitive();
 	
@@ -49,6 +55,7 @@ public:
 	unsigned int GetWidth() { return m_Width; }
 	unsigned int GetHeight() { return m_Height; }
 	unsigned int GetDepth() { return m_Depth; }
+	bool IsSparse() { return m_Sparse; }
 	void SphereInfluence(const dVector &pos, const dColour &col, float pow);
 	void SphereSolid(const dVector &pos, const dColour &col, float radius);
 	void BoxSolid(const dVector &topleft, const dVector &botright, const dColour &col);
@@ -58,6 +65,9 @@ public:
 	BlobbyPrimitive *ConvertToBlobby();
 	///@}
 	
+	/// Operations covering fewer voxels than this aren't threaded
+	static const unsigned int THREADED_SIZE=32768;
+
 protected:
 
 	virtual void PDataDirty();
@@ -67,11 +77,40 @@ protected:
 
 private:
 
+	enum OpType {OP_INFLUENCE,OP_SPHERE,OP_BOX,OP_THRESHOLD,OP_GRADIENT,OP_LIGHT};
+
+	/// Runs the current operation over the bricks overlapping 
+	/// the bounds in world space, split over threads. Empty sparse 
+	/// bricks are skipped, unless allocate is set
+	void RunBricks(const dVector &min, const dVector &max, bool allocate);
+	void ProcessBrick(unsigned int bx, unsigned int by, unsigned int bz);
+	/// Processes a run of voxels in x, which are next to 
+	/// each other in memory in both the pdata and the bricks
+	void ProcessRow(dColour *col, dColour *grad, 
+	                unsigned int x0, unsigned int x1, unsigned int y, unsigned int z);
+	static void *BrickThread(void *data);
+	/// Returns the voxel from the brick, or from the pdata if not sparse
+	dColour *Voxel(vector<dColour,FLX_ALLOC(dColour) > *data, dColour *brick,
+	               unsigned int x, unsigned int y, unsigned int z);
+
 	vector<dColour,FLX_ALLOC(dColour) > *m_ColData;
 	vector<dColour,FLX_ALLOC(dColour) > *m_GradData;
 	unsigned int m_Width;
 	unsigned int m_Height;
 	unsigned int m_Depth;
+	bool m_Sparse;
+	VoxelBricks m_Bricks;
+	VoxelBricks m_GradBricks;
+	
+	// the current operation
+	OpType m_Op;
+	dVector m_OpPos;
+	dVector m_OpPos2;
+	dColour m_OpColour;
+	float m_OpValue;
+	// the voxels it covers
+	unsigned int m_OpMin[3];
+	unsigned int m_OpMax[3];
 };
 
 }
@@ -244,6 +244,75 @@ void dMatrix::RigidBlend(const dMatrix& other, float amount)
     *this = mat;
 }
 
+void dMatrix::transform(const dVector *src, dVector *dst, unsigned int count) const
+{
+	// no sse here, the compiler does as well with the plain loop
+	for (unsigned int i=0; i<count; i++)
+	{
+		dst[i]=transform(src[i]);
+	}
+}
+
+void dMatrix::transform_no_trans(const dVector *src, dVector *dst, unsigned int count) const
+{
+#ifdef __SSE__
+	// clear w in the rows, and use it to carry the source w through
+	__m128 r0=_mm_setr_ps(m[0][0],m[0][1],m[0][2],0);
+	__m128 r1=_mm_setr_ps(m[1][0],m[1][1],m[1][2],0);
+	__m128 r2=_mm_setr_ps(m[2][0],m[2][1],m[2][2],0);
+	__m128 r3=_mm_setr_ps(0,0,0,1);
+	for (unsigned int i=0; i<count; i++)
+	{
+		__m128 p=_mm_loadu_ps(src[i].arr());
+		__m128 r=_mm_mul_ps(_mm_shuffle_ps(p,p,_MM_SHUFFLE(0,0,0,0)),r0);
+		r=_mm_add_ps(r,_mm_mul_ps(_mm_shuffle_ps(p,p,_MM_SHUFFLE(1,1,1,1)),r1));
+		r=_mm_add_ps(r,_mm_mul_ps(_mm_shuffle_ps(p,p,_MM_SHUFFLE(2,2,2,2)),r2));
+		r=_mm_add_ps(r,_mm_mul_ps(p,r3));
+		_mm_storeu_ps(dst[i].arr(),r);
+	}
+#else
+	for (unsigned int i=0; i<count; i++)
+	{
+		dst[i]=transform_no_trans(src[i]);
+	}
+#endif
+}
+
+void dMatrix::transform_normals(const dVector *src, dVector *dst, unsigned int count) const
+{
+	transform_no_trans(src,dst,count);
+	for (unsigned int i=0; i<count; i++)
+	{
+		float mag=dst[i].mag();
+		if (mag>0) dst[i]/=mag;
+	}
+}
+
+dMatrix dMatrix::inverse_affine() const
+{
+	// the inverse of the rotation/scale part is the transposed 
+	// cross products of its rows over the determinant
+	dVector r0(m[0][0],m[0][1],m[0][2]);
+	dVector r1(m[1][0],m[1][1],m[1][2]);
+	dVector r2(m[2][0],m[2][1],m[2][2]);
+	dVector c0=r1.cross(r2);
+	dVector c1=r2.cross(r0);
+	dVector c2=r0.cross(r1);
+	float det=r0.dot(c0);
+	if (det==0) return dMatrix();
+	float s=1/det;
+
+	dMatrix t;
+	t.m[0][0]=c0.x*s; t.m[0][1]=c1.x*s; t.m[0][2]=c2.x*s;
+	t.m[1][0]=c0.y*s; t.m[1][1]=c1.y*s; t.m[1][2]=c2.y*s;
+	t.m[2][0]=c0.z*s; t.m[2][1]=c1.z*s; t.m[2][2]=c2.z*s;
+	
+	// then the translation is undone in the new space
+	dVector tr=t.transform_no_trans(dVector(m[3][0],m[3][1],m[3][2]));
+	t.m[3][0]=-tr.x; t.m[3][1]=-tr.y; t.m[3][2]=-tr.z;
+	return t;
+}
+
 ostream &Fluxus::operator<<(ostream &os, dMatrix const &om)
 {
     for (int j=0; j<4; j++)
@@ -24,6 +24,9 @@
 #include <cstring>
 #include <math.h>
 #include <iostream>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 #include "Trace.h"
 
 using namespace std;
@@ -56,6 +59,7 @@ public:
 		dVector(dVector const &c) { *this=c; }
 		
 		float *arr() { return &x; }
+		const float *arr() const { return &x; }
 		int operator==(dVector const &rhs) { return (x==rhs.x&&y==rhs.y&&z==rhs.z); }
 		
 		inline dVector &operator=(dVector const &rhs)
@@ -249,6 +253,7 @@ public:
 		dColour(dColour const &c) {*this=c;}
 
 		float *arr() { return &r; }
+		const float *arr() const { return &r; }
 
 		inline dColour &operator=(dColour const &rhs)
 		{
@@ -408,6 +413,7 @@ public:
 	}
 	
     inline float *arr() { return &m[0][0]; }
+    inline const float *arr() const { return &m[0][0]; }
 
 	inline void init()
 	{
@@ -480,6 +486,21 @@ public:
     	//                  m[i][3]*rhs.m[3][j];
 
     	dMatrix t;
+#ifdef __SSE__
+		// each row of the result is the row of rhs transformed by this
+		__m128 r0=_mm_loadu_ps(m[0]);
+		__m128 r1=_mm_loadu_ps(m[1]);
+		__m128 r2=_mm_loadu_ps(m[2]);
+		__m128 r3=_mm_loadu_ps(m[3]);
+		for (int i=0; i<4; i++)
+		{
+			__m128 r=_mm_mul_ps(_mm_set1_ps(rhs.m[i][0]),r0);
+			r=_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(rhs.m[i][1]),r1));
+			r=_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(rhs.m[i][2]),r2));
+			r=_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(rhs.m[i][3]),r3));
+			_mm_storeu_ps(t.m[i],r);
+		}
+#else
     	/*for (int i=0; i<4; i++)
         	for (int j=0; j<4; j++)
     	t.m[i][j]=m[0][j]*rhs.m[i][0]+m[1][j]*rhs.m[i][1]+m[2][j]*rhs.m[i][2]+m[3][j]*rhs.m[i][3];
@@ -505,6 +526,7 @@ public:
     	t.m[3][2]=m[0][2]*rhs.m[3][0]+m[1][2]*rhs.m[3][1]+m[2][2]*rhs.m[3][2]+m[3][2]*rhs.m[3][3];
     	t.m[3][3]=m[0][3]*rhs.m[3][0]+m[1][3]*rhs.m[3][1]+m[2][3]*rhs.m[3][2]+m[3][3]*rhs.m[3][3];
 
+#endif
     	return t;
 	}
 
@@ -811,6 +833,17 @@ public:
     	return t;
 	}
 
+	///@name Array transforms
+	/// These work on whole arrays of vectors at a time, and are
+	/// much quicker than calling the single versions in a loop.
+	/// The source and destination can be the same array.
+	///@{
+	void transform(const dVector *src, dVector *dst, unsigned int count) const;
+	void transform_no_trans(const dVector *src, dVector *dst, unsigned int count) const;
+	/// As transform_no_trans, but normalises the results
+	void transform_normals(const dVector *src, dVector *dst, unsigned int count) const;
+	///@}
+
 	/*void load_glmatrix(float glm[16])
 	{
 		glm[0]= m[0][0]; glm[1]= m[1][0]; glm[2]= m[2][0]; glm[3]= m[3][0];
@@ -877,6 +910,10 @@ public:
 	   return temp;
 	}
 
+	/// A quicker inverse, only for matrices made from 
+	/// rotations, scales and translations
+	dMatrix inverse_affine() const;
+
 	inline float determinant()  const
 	{
 	   return 
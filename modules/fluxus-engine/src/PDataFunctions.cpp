@@ -20,6 +20,10 @@
 #include "PDataFunctions.h"
 #include "Renderer.h"
 #include "FluxusEngine.h"
+#include "PDataExpression.h"
+#include "PolyPrimitive.h"
+#include "PixelPrimitive.h"
+#include "NoiseField.h"
 
 using namespace PDataFunctions;
 using namespace SchemeHelper;
@@ -111,10 +115,11 @@ using namespace Fluxus;
 // EndSectionDoc 
 
 // StartFunctionDoc-en
-// pdata-ref type-string index-number
+// pdata-ref type-string/handle index-number
 // Returns: value-vector/colour/matrix/number
 // Description:
-// Returns the corresponding pdata element.
+// Returns the corresponding pdata element. The pdata can be named with a string, or a
+// handle from pdata-handle.
 // Example:
 // (pdata-ref "p" 1)
 // EndFunctionDoc
@@ -145,33 +150,33 @@ Scheme_Object *pdata_ref(int argc, Scheme_Object **argv)
 	MZ_GC_VAR_IN_REG(0, argv);
 	MZ_GC_VAR_IN_REG(1, ret);
 	MZ_GC_REG();	
-	ArgCheck("pdata-ref", "si", argc, argv);		
+	ArgCheck("pdata-ref", "ni", argc, argv);		
 	
 	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();    
 	if (Grabbed) 
 	{
-		string name=StringFromScheme(argv[0]);
+		unsigned int handle=PDataHandleFromScheme(argv[0]);
 		unsigned int index=IntFromScheme(argv[1]);
 		unsigned int size=0;
 		char type;
 		
-		if (Grabbed->GetDataInfo(name,type,size))
+		if (Grabbed->GetDataInfo(handle,type,size))
 		{
 			if (type=='f')	
 			{
-				ret=scheme_make_double(Grabbed->GetData<float>(name,index%size)); 
+				ret=scheme_make_double(Grabbed->GetData<float>(handle,index%size)); 
 			}
 			else if (type=='v')	
 			{
-				ret=FloatsToScheme(Grabbed->GetData<dVector>(name,index%size).arr(),3); 
+				ret=FloatsToScheme(Grabbed->GetData<dVector>(handle,index%size).arr(),3); 
 			}
 			else if (type=='c')	
 			{
-				ret=FloatsToScheme(Grabbed->GetData<dColour>(name,index%size).arr(),4); 
+				ret=FloatsToScheme(Grabbed->GetData<dColour>(handle,index%size).arr(),4); 
 			}
 			else if (type=='m')	
 			{
-				ret=FloatsToScheme(Grabbed->GetData<dMatrix>(name,index%size).arr(),16); 
+				ret=FloatsToScheme(Grabbed->GetData<dMatrix>(handle,index%size).arr(),16); 
 			}
 			else
 			{
@@ -201,10 +206,11 @@ Scheme_Object *pdata_ref(int argc, Scheme_Object **argv)
 }
 
 // StartFunctionDoc-en
-// pdata-set! type-string index-number value-vector/colour/matrix/number
+// pdata-set! type-string/handle index-number value-vector/colour/matrix/number
 // Returns: void
 // Description:
-// Writes to the corresponding pdata element.
+// Writes to the corresponding pdata element. The pdata can be named with a string, or a
+// handle from pdata-handle.
 // Example:
 // (pdata-set! "p" 1 (vector 0 100 0))
 // EndFunctionDoc
@@ -229,24 +235,25 @@ Scheme_Object *pdata_ref(int argc, Scheme_Object **argv)
 
 Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
 {
+	static const unsigned int SizeHandle=PDataContainer::GetHandle("s");
+
 	MZ_GC_DECL_REG(1);
 	MZ_GC_VAR_IN_REG(0, argv);
 	MZ_GC_REG();
-	ArgCheck("pdata-set!", "si?", argc, argv);
+	ArgCheck("pdata-set!", "ni?", argc, argv);
     Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
 	if (Grabbed)
 	{
-		size_t ssize=0;
-		string name=StringFromScheme(argv[0]);
+		unsigned int handle=PDataHandleFromScheme(argv[0]);
 		unsigned int index=IntFromScheme(argv[1]);
 		unsigned int size;
 		char type;
 
-		if (Grabbed->GetDataInfo(name,type,size))
+		if (Grabbed->GetDataInfo(handle,type,size))
 		{
 			if (type=='f')
 			{
-				if (SCHEME_NUMBERP(argv[2])) Grabbed->SetData<float>(name,index%size,FloatFromScheme(argv[2]));
+				if (SCHEME_NUMBERP(argv[2])) Grabbed->SetData<float>(handle,index%size,FloatFromScheme(argv[2]));
 				else Trace::Stream<<"expected number value in pdata-set"<<endl;
 			}
 			else if (type=='v')
@@ -255,15 +262,15 @@ Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
 				{
 					dVector v;
 					FloatsFromScheme(argv[2],v.arr(),3);
-					Grabbed->SetData<dVector>(name,index%size,v);
+					Grabbed->SetData<dVector>(handle,index%size,v);
 				}
-				else if (name.compare("s")==0) // one value scale
+				else if (handle==SizeHandle) // one value scale
 				{
 					if (SCHEME_NUMBERP(argv[2]))
 					{
 						float t=FloatFromScheme(argv[2]);
 						dVector v(t,t,t);
-						Grabbed->SetData<dVector>(name,index%size,v);
+						Grabbed->SetData<dVector>(handle,index%size,v);
 					}
 					else Trace::Stream<<"expected number or vector (size 3) value in pdata-set"<<endl;
 				}
@@ -273,7 +280,7 @@ Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
 			{
 				ArgCheck("pdata-set!", "c", 1, &argv[2]);
 				dColour c=ColourFromScheme(argv[2],Grabbed->GetState()->ColourMode);
-				Grabbed->SetData<dColour>(name,index%size,c);
+				Grabbed->SetData<dColour>(handle,index%size,c);
 				/*
 				if (SCHEME_VECTORP(argv[2]) && SCHEME_VEC_SIZE(argv[2])>=3 && SCHEME_VEC_SIZE(argv[2])<=4)
 				{
@@ -285,7 +292,7 @@ Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
 						c = c.HSVtoRGB();
 					}
 
-					Grabbed->SetData<dColour>(name,index%size,c);
+					Grabbed->SetData<dColour>(handle,index%size,c);
 				}
 				else Trace::Stream<<"expected colour vector (size 3 or 4) value in pdata-set"<<endl;
 				*/
@@ -296,7 +303,7 @@ Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
 				{
 					dMatrix m;
 					FloatsFromScheme(argv[2],m.arr(),16);
-					Grabbed->SetData<dMatrix>(name,index%size,m);
+					Grabbed->SetData<dMatrix>(handle,index%size,m);
 				}
 				else Trace::Stream<<"expected matrix vector (size 16) value in pdata-set"<<endl;
 			}
@@ -306,6 +313,65 @@ Scheme_Object *pdata_set(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// pdata-handle type-string
+// Returns: handle
+// Description:
+// Returns a handle for a pdata name, which can be used in place of the name string
+// in pdata-ref and pdata-set!. Handles are the same for every primitive, and save 
+// looking the name up each time, so they speed up loops over lots of pdata. 
+// pdata-map!, pdata-index-map! and pdata-fold use them automatically.
+// Example:
+// (define p (pdata-handle "p"))
+// (with-primitive (build-sphere 10 10)
+//     (for ((i (in-range 0 (pdata-size))))
+//         (pdata-set! p i (vmul (pdata-ref p i) 2))))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// pdata-handle string-tipo
+// Retorna: handle
+// Descrição:
+// Retorna um handle para um nome de pdata, que pode ser usado no lugar da string
+// do nome em pdata-ref e pdata-set!. Os handles são os mesmos para todas as
+// primitivas e evitam procurar o nome a cada vez, então aceleram laços sobre
+// muitos pdata. pdata-map!, pdata-index-map! e pdata-fold usam eles automaticamente.
+// Exemplo:
+// (define p (pdata-handle "p"))
+// (with-primitive (build-sphere 10 10)
+//     (for ((i (in-range 0 (pdata-size))))
+//         (pdata-set! p i (vmul (pdata-ref p i) 2))))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// pdata-handle type-chaîne-de-caractères
+// Retour: handle
+// Description:
+// Retourne un handle pour un nom de pdata, qui peut être utilisé à la place du nom
+// dans pdata-ref et pdata-set!. Les handles sont les mêmes pour toutes les primitives,
+// et évitent de chercher le nom à chaque fois, ce qui accélère les boucles sur beaucoup
+// de pdata. pdata-map!, pdata-index-map! et pdata-fold les utilisent automatiquement.
+// Exemple:
+// (define p (pdata-handle "p"))
+// (with-primitive (build-sphere 10 10)
+//     (for ((i (in-range 0 (pdata-size))))
+//         (pdata-set! p i (vmul (pdata-ref p i) 2))))
+// EndFunctionDoc
+
+Scheme_Object *pdata_handle(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("pdata-handle", "n", argc, argv);
+	if (IsPDataHandle(argv[0]))
+	{
+		MZ_GC_UNREG();
+		return argv[0];
+	}
+	unsigned int handle=PDataContainer::GetHandle(StringFromScheme(argv[0]));
+	MZ_GC_UNREG();
+	return PDataHandleToScheme(handle);
+}
+
 // StartFunctionDoc-en
 // pdata-add name-string type-string
 // Returns: void
@@ -883,26 +949,735 @@ Scheme_Object *pdata_size(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// the number of floats each element has in an flvector, 
+// vectors lose their w component to match pdata-ref
+static unsigned int FlvectorComponents(char type)
+{
+	switch (type)
+	{
+		case 'f': return 1;
+		case 'v': return 3;
+		case 'c': return 4;
+		case 'm': return 16;
+	}
+	return 0;
+}
+
 // StartFunctionDoc-en
-// recalc-normals smoothornot-number
+// pdata->flvector type-string/handle
+// Returns: flvector
+// Description:
+// Copies a whole pdata array into a new flvector in one go, which is much faster than
+// reading it an element at a time with pdata-ref. The elements are stored one after the
+// other, 1 number for floats, 3 for vectors, 4 for colours and 16 for matrices.
+// Example:
+// (define shape (build-sphere 10 10))
+// (with-primitive shape
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 0 (flvector-length p))))
+//             (flvector-set! p i (* (flvector-ref p i) 2)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// pdata->flvector string-tipo/handle
+// Retorna: flvector
+// Descrição:
+// Copia um array pdata inteiro para um novo flvector de uma vez, o que é muito mais
+// rápido que ler um elemento por vez com pdata-ref. Os elementos são guardados um
+// depois do outro, 1 número para floats, 3 para vetores, 4 para cores e 16 para matrizes.
+// Exemplo:
+// (define shape (build-sphere 10 10))
+// (with-primitive shape
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 0 (flvector-length p))))
+//             (flvector-set! p i (* (flvector-ref p i) 2)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// pdata->flvector type-chaîne-de-caractères/handle
+// Retour: flvector
+// Description:
+// Copie un tableau pdata entier dans un nouveau flvector en une fois, ce qui est beaucoup
+// plus rapide que de le lire élément par élément avec pdata-ref. Les éléments sont rangés
+// les uns après les autres, 1 nombre pour les flottants, 3 pour les vecteurs, 4 pour les
+// couleurs et 16 pour les matrices.
+// Exemple:
+// (define shape (build-sphere 10 10))
+// (with-primitive shape
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 0 (flvector-length p))))
+//             (flvector-set! p i (* (flvector-ref p i) 2)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+Scheme_Object *pdata_to_flvector(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *ret=NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, ret);
+	MZ_GC_REG();
+	ArgCheck("pdata->flvector", "n", argc, argv);
+
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		PData *pd=Grabbed->GetDataRaw(PDataHandleFromScheme(argv[0]));
+		if (pd!=NULL)
+		{
+			unsigned int components=FlvectorComponents(pd->GetType());
+			unsigned int stride=pd->ElementSize()/sizeof(float);
+			unsigned int size=pd->Size();
+			ret=scheme_alloc_flvector(size*components);
+			const float *src=(const float*)pd->GetRawData();
+			double *dst=SCHEME_FLVEC_ELS(ret);
+			for (unsigned int n=0; n<size; n++)
+			{
+				for (unsigned int c=0; c<components; c++)
+				{
+					*dst++=src[c];
+				}
+				src+=stride;
+			}
+			MZ_GC_UNREG();
+			return ret;
+		}
+		Trace::Stream<<"pdata->flvector: can't find pdata"<<endl;
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// flvector->pdata! type-string/handle flvector
+// Returns: void
+// Description:
+// Copies an flvector into a whole pdata array in one go, laid out as pdata->flvector
+// makes them. If the flvector is too short, only the elements it covers are written.
+// Example:
+// (define shape (build-sphere 10 10))
+// (with-primitive shape
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 0 (flvector-length p))))
+//             (flvector-set! p i (* (flvector-ref p i) 2)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// flvector->pdata! string-tipo/handle flvector
+// Retorna: void
+// Descrição:
+// Copia um flvector para um array pdata inteiro de uma vez, organizado como o
+// pdata->flvector faz. Se o flvector for curto demais, só os elementos que ele
+// cobre são escritos.
+// Exemplo:
+// (define shape (build-sphere 10 10))
+// (with-primitive shape
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 0 (flvector-length p))))
+//             (flvector-set! p i (* (flvector-ref p i) 2)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// flvector->pdata! type-chaîne-de-caractères/handle flvector
+// Retour: vide
+// Description:
+// Copie un flvector dans un tableau pdata entier en une fois, rangé comme le fait
+// pdata->flvector. Si le flvector est trop court, seuls les éléments qu'il couvre
+// sont écrits.
+// Exemple:
+// (define shape (build-sphere 10 10))
+// (with-primitive shape
+//     (let ((p (pdata->flvector "p")))
+//         (for ((i (in-range 0 (flvector-length p))))
+//             (flvector-set! p i (* (flvector-ref p i) 2)))
+//         (flvector->pdata! "p" p)))
+// EndFunctionDoc
+
+Scheme_Object *flvector_to_pdata(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("flvector->pdata!", "n?", argc, argv);
+	if (!SCHEME_FLVECTORP(argv[1]))
+	{
+		MZ_GC_UNREG();
+		scheme_wrong_type("flvector->pdata!", "flvector", 1, argc, argv);
+	}
+
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		PData *pd=Grabbed->GetDataRaw(PDataHandleFromScheme(argv[0]));
+		if (pd!=NULL)
+		{
+			unsigned int components=FlvectorComponents(pd->GetType());
+			unsigned int stride=pd->ElementSize()/sizeof(float);
+			unsigned int size=min(pd->Size(),(unsigned int)SCHEME_FLVEC_SIZE(argv[1])/components);
+			float *dst=(float*)pd->GetRawData();
+			const double *src=SCHEME_FLVEC_ELS(argv[1]);
+			for (unsigned int n=0; n<size; n++)
+			{
+				for (unsigned int c=0; c<components; c++)
+				{
+					dst[c]=*src++;
+				}
+				dst+=stride;
+			}
+			pd->SetDirty();
+		}
+		else Trace::Stream<<"flvector->pdata!: can't find pdata"<<endl;
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// pdata-pointer type-string/handle
+// Returns: cpointer
+// Description:
+// Returns a pointer to the pdata array's memory, for use with the ffi (pdata-view wraps 
+// this up as a cvector). Unlike pdata->flvector this doesn't copy anything. The array 
+// holds single precision floats, 1 per element for floats, 4 for vectors (x y z w), 4 
+// for colours and 16 for matrices. The pointer is only valid until the pdata is resized 
+// or removed, so get a new one each frame. Getting the pointer marks the whole array as 
+// changed, as it's assumed you are going to write to it.
+// Example:
+// (require ffi/unsafe)
+// (with-primitive (build-sphere 10 10)
+//     (let ((p (make-cvector* (pdata-pointer "p") _float (* 4 (pdata-size)))))
+//         (cvector-set! p 0 (* 2 (cvector-ref p 0)))))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// pdata-pointer string-tipo/handle
+// Retorna: cpointer
+// Descrição:
+// Retorna um ponteiro para a memória do array pdata, para usar com a ffi (pdata-view
+// embrulha isso como um cvector). Ao contrário de pdata->flvector nada é copiado. O
+// array guarda floats de precisão simples, 1 por elemento para floats, 4 para vetores
+// (x y z w), 4 para cores e 16 para matrizes. O ponteiro só é válido até o pdata ser
+// redimensionado ou removido, então pegue um novo a cada quadro. Pegar o ponteiro marca
+// o array inteiro como modificado, pois presume-se que você vai escrever nele.
+// Exemplo:
+// (require ffi/unsafe)
+// (with-primitive (build-sphere 10 10)
+//     (let ((p (make-cvector* (pdata-pointer "p") _float (* 4 (pdata-size)))))
+//         (cvector-set! p 0 (* 2 (cvector-ref p 0)))))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// pdata-pointer type-chaîne-de-caractères/handle
+// Retour: cpointer
+// Description:
+// Retourne un pointeur sur la mémoire du tableau pdata, pour l'utiliser avec la ffi
+// (pdata-view l'enveloppe dans un cvector). Contrairement à pdata->flvector rien n'est
+// copié. Le tableau contient des flottants simple précision, 1 par élément pour les
+// flottants, 4 pour les vecteurs (x y z w), 4 pour les couleurs et 16 pour les matrices.
+// Le pointeur n'est valide que jusqu'à ce que le pdata soit redimensionné ou supprimé,
+// donc il faut en prendre un nouveau à chaque image. Prendre le pointeur marque tout le
+// tableau comme modifié, car on suppose que vous allez écrire dedans.
+// Exemple:
+// (require ffi/unsafe)
+// (with-primitive (build-sphere 10 10)
+//     (let ((p (make-cvector* (pdata-pointer "p") _float (* 4 (pdata-size)))))
+//         (cvector-set! p 0 (* 2 (cvector-ref p 0)))))
+// EndFunctionDoc
+
+Scheme_Object *pdata_pointer(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("pdata-pointer", "n", argc, argv);
+
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		PData *pd=Grabbed->GetDataRaw(PDataHandleFromScheme(argv[0]));
+		if (pd!=NULL)
+		{
+			pd->SetDirty();
+			MZ_GC_UNREG();
+			return scheme_make_cptr(pd->GetRawData(),NULL);
+		}
+		Trace::Stream<<"pdata-pointer: can't find pdata"<<endl;
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// turns a quoted expression into values in the expression, 
+// returns the value number or NO_VALUE if it's not understood
+static unsigned int BuildExpression(Primitive *prim, PDataExpression &exp, Scheme_Object *src)
+{
+	// the names and the recursion can allocate, so src 
+	// and i need to be kept track of across them
+	Scheme_Object *i=NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, src);
+	MZ_GC_VAR_IN_REG(1, i);
+	MZ_GC_REG();
+
+	unsigned int result=PDataExpression::NO_VALUE;
+
+	if (SCHEME_CHAR_STRINGP(src) || IsPDataHandle(src))
+	{
+		PData *pd=prim->GetDataRaw(PDataHandleFromScheme(src));
+		if (pd!=NULL) result=exp.AddInput(pd);
+		else Trace::Stream<<"pdata-eval!: can't find pdata"<<endl;
+	}
+	else if (SCHEME_NUMBERP(src))
+	{
+		float v=FloatFromScheme(src);
+		result=exp.AddConstant(dColour(v,v,v,v));
+	}
+	else if (SCHEME_VECTORP(src))
+	{
+		switch (SCHEME_VEC_SIZE(src))
+		{
+			case 3: 
+			{
+				dVector v=VectorFromScheme(src);
+				result=exp.AddConstant(dColour(v.x,v.y,v.z,1));
+			}
+			break;
+			case 4: 
+			{
+				dColour c;
+				FloatsFromScheme(src,c.arr(),4);
+				result=exp.AddConstant(c);
+			}
+			break;
+			case 16: result=exp.AddMatrix(MatrixFromScheme(src)); break;
+			default: Trace::Stream<<"pdata-eval!: vectors need 3, 4 or 16 elements"<<endl; break;
+		}
+	}
+	else if (SCHEME_PAIRP(src) && SCHEME_SYMBOLP(SCHEME_CAR(src)))
+	{
+		PDataExpression::Op op;
+		string name=SymbolName(SCHEME_CAR(src));
+		if (PDataExpression::FindOp(name,op))
+		{
+			vector<unsigned int> args;
+			bool ok=true;
+			for (i=SCHEME_CDR(src); ok && SCHEME_PAIRP(i); i=SCHEME_CDR(i))
+			{
+				unsigned int arg=BuildExpression(prim,exp,SCHEME_CAR(i));
+				if (arg==PDataExpression::NO_VALUE) ok=false;
+				else args.push_back(arg);
+			}
+			if (ok) result=exp.AddOp(op,args);
+		}
+		else Trace::Stream<<"pdata-eval!: unknown operator "<<name<<endl;
+	}
+	else Trace::Stream<<"pdata-eval!: can't understand expression"<<endl;
+
+	MZ_GC_UNREG();
+	return result;
+}
+
+// StartFunctionDoc-en
+// pdata-eval! type-string/handle expression
+// Returns: void
+// Description:
+// Works out an expression over whole pdata arrays and writes the result into the pdata
+// array given. This is much faster than chaining pdata-op calls or using pdata-map!, 
+// as the expression is worked out for a block of elements at a time, with no temporary
+// arrays, and big arrays are split over the processors. The expression is a quoted list
+// where strings (or pdata handles) are pdata arrays, numbers and vectors are constants 
+// and lists are operators. The operators are + - * / min max, (madd a b c) for a*b+c, 
+// (lerp a b t), (clamp a lo hi), dot cross mag normalise noise sin cos, and 
+// (transform matrix v) where the matrix is a pdata array of matrices or a 16 element 
+// vector. Scalars are applied to all components. Writing to a vector array leaves the 
+// w component alone, writing to a float array uses the first component. The arrays used 
+// all have to be the same size, and the result can be one of the inputs.
+// Example:
+// (define particles (build-particles 1000))
+// (with-primitive particles
+//     (pdata-add "vel" "v")
+//     (pdata-map! (lambda (v) (srndvec)) "vel"))
+// (every-frame
+//     (with-primitive particles
+//         (pdata-eval! "p" '(madd "vel" 0.01 "p"))
+//         (pdata-eval! "c" '(clamp (* (noise "p") #(1 0.5 0.2 1)) 0 1))))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// pdata-eval! string-tipo/handle expressão
+// Retorna: void
+// Descrição:
+// Calcula uma expressão sobre arrays pdata inteiros e escreve o resultado no array
+// pdata dado. É muito mais rápido que encadear chamadas de pdata-op ou usar pdata-map!,
+// pois a expressão é calculada para um bloco de elementos de cada vez, sem arrays
+// temporários, e arrays grandes são divididos entre os processadores. A expressão é uma
+// lista com quote onde strings (ou handles de pdata) são arrays pdata, números e vetores
+// são constantes e listas são operadores. Os operadores são + - * / min max, (madd a b c)
+// para a*b+c, (lerp a b t), (clamp a lo hi), dot cross mag normalise noise sin cos, e
+// (transform matriz v) onde a matriz é um array pdata de matrizes ou um vetor de 16
+// elementos. Escalares são aplicados a todos os componentes. Escrever num array de vetores
+// não altera o componente w, escrever num array de floats usa o primeiro componente. Os
+// arrays usados têm que ter o mesmo tamanho, e o resultado pode ser uma das entradas.
+// Exemplo:
+// (define particles (build-particles 1000))
+// (with-primitive particles
+//     (pdata-add "vel" "v")
+//     (pdata-map! (lambda (v) (srndvec)) "vel"))
+// (every-frame
+//     (with-primitive particles
+//         (pdata-eval! "p" '(madd "vel" 0.01 "p"))
+//         (pdata-eval! "c" '(clamp (* (noise "p") #(1 0.5 0.2 1)) 0 1))))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// pdata-eval! type-chaîne-de-caractères/handle expression
+// Retour: vide
+// Description:
+// Calcule une expression sur des tableaux pdata entiers et écrit le résultat dans le
+// tableau pdata donné. C'est beaucoup plus rapide qu'enchaîner des appels à pdata-op ou
+// qu'utiliser pdata-map!, car l'expression est calculée sur un bloc d'éléments à la fois,
+// sans tableaux temporaires, et les grands tableaux sont répartis sur les processeurs.
+// L'expression est une liste quotée où les chaînes (ou les handles de pdata) sont des
+// tableaux pdata, les nombres et vecteurs sont des constantes et les listes des opérateurs.
+// Les opérateurs sont + - * / min max, (madd a b c) pour a*b+c, (lerp a b t), (clamp a lo hi),
+// dot cross mag normalise noise sin cos, et (transform matrice v) où la matrice est un
+// tableau pdata de matrices ou un vecteur de 16 éléments. Les scalaires s'appliquent à
+// toutes les composantes. Écrire dans un tableau de vecteurs laisse la composante w
+// intacte, écrire dans un tableau de flottants utilise la première composante. Les
+// tableaux utilisés doivent avoir la même taille, et le résultat peut être une des entrées.
+// Exemple:
+// (define particles (build-particles 1000))
+// (with-primitive particles
+//     (pdata-add "vel" "v")
+//     (pdata-map! (lambda (v) (srndvec)) "vel"))
+// (every-frame
+//     (with-primitive particles
+//         (pdata-eval! "p" '(madd "vel" 0.01 "p"))
+//         (pdata-eval! "c" '(clamp (* (noise "p") #(1 0.5 0.2 1)) 0 1))))
+// EndFunctionDoc
+
+Scheme_Object *pdata_eval(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("pdata-eval!", "n?", argc, argv);
+
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed)
+	{
+		PData *dst=Grabbed->GetDataRaw(PDataHandleFromScheme(argv[0]));
+		if (dst!=NULL)
+		{
+			// keep the memory between calls
+			static PDataExpression exp;
+			exp.Clear();
+			unsigned int result=BuildExpression(Grabbed,exp,argv[1]);
+			if (result!=PDataExpression::NO_VALUE) exp.Run(dst,result);
+		}
+		else Trace::Stream<<"pdata-eval!: can't find pdata"<<endl;
+	}
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// reads the pfunc-set! style settings list for pdata-noise!
+static void NoiseSettingsFromScheme(Scheme_Object *settings, NoiseField &field, bool &curl)
+{
+	Scheme_Object *paramvec=NULL;
+	// IsSymbol interns, so value has to be kept track of too
+	Scheme_Object *value=NULL;
+	MZ_GC_DECL_REG(3);
+	MZ_GC_VAR_IN_REG(0, settings);
+	MZ_GC_VAR_IN_REG(1, paramvec);
+	MZ_GC_VAR_IN_REG(2, value);
+	MZ_GC_REG();
+
+	paramvec=scheme_list_to_vector(settings);
+	for (int n=0; n<SCHEME_VEC_SIZE(paramvec)-1; n+=2)
+	{
+		if (!SCHEME_SYMBOLP(SCHEME_VEC_ELS(paramvec)[n]))
+		{
+			Trace::Stream<<"pdata-noise!: expected a symbol in the settings"<<endl;
+			continue;
+		}
+
+		string param=SymbolName(SCHEME_VEC_ELS(paramvec)[n]);
+		value=SCHEME_VEC_ELS(paramvec)[n+1];
+		if (param=="type" && SCHEME_SYMBOLP(value))
+		{
+			if (IsSymbol(value,"perlin")) field.SetBasis(NoiseField::PERLIN);
+			else if (IsSymbol(value,"simplex")) field.SetBasis(NoiseField::SIMPLEX);
+			else Trace::Stream<<"pdata-noise!: unknown type "<<SymbolName(value)<<endl;
+		}
+		else if (param=="fractal" && SCHEME_SYMBOLP(value))
+		{
+			if (IsSymbol(value,"fbm")) field.SetFractal(NoiseField::FBM);
+			else if (IsSymbol(value,"ridged")) field.SetFractal(NoiseField::RIDGED);
+			else Trace::Stream<<"pdata-noise!: unknown fractal "<<SymbolName(value)<<endl;
+		}
+		else if (param=="frequency" || param=="offset")
+		{
+			dVector v;
+			if (SCHEME_NUMBERP(value))
+			{
+				float f=FloatFromScheme(value);
+				v=dVector(f,f,f,f);
+			}
+			else if (SCHEME_VECTORP(value)) v=VectorFromScheme(value);
+			else Trace::Stream<<"pdata-noise!: wrong type for "<<param<<endl;
+			if (param=="frequency") field.SetFrequency(v);
+			else field.SetOffset(v);
+		}
+		else if (param=="curl") curl=SCHEME_TRUEP(value);
+		else if (SCHEME_NUMBERP(value))
+		{
+			if (param=="dims") field.SetDimensions(IntFromScheme(value));
+			else if (param=="octaves") field.SetOctaves(IntFromScheme(value));
+			else if (param=="lacunarity") field.SetLacunarity(FloatFromScheme(value));
+			else if (param=="gain") field.SetGain(FloatFromScheme(value));
+			else if (param=="seed") field.SetSeed(IntFromScheme(value));
+			else Trace::Stream<<"pdata-noise!: unknown setting "<<param<<endl;
+		}
+		else Trace::Stream<<"pdata-noise!: wrong type for "<<param<<endl;
+	}
+	MZ_GC_UNREG();
+}
+
+// StartFunctionDoc-en
+// pdata-noise! type-string/handle [source-type-string/handle] [settings-list]
+// Returns: void
+// Description:
+// Fills a whole pdata array with fractal noise in one go, sampled at the positions in the
+// source array ("p" by default). On pixel primitives with no source given, the noise is 
+// sampled over the image instead, with x and y going from 0 to 1 across it. Float arrays 
+// get the noise value, vector arrays get it in x y and z, and colour arrays in red green 
+// and blue, keeping the alpha. The settings are a list of symbols and values: 'type is 
+// 'simplex (the default, -1 to 1) or 'perlin (0 to 1, like the noise function), 'dims is 
+// how many components of the source are used (2 to 4, perlin only goes up to 3), 'fractal 
+// is 'fbm or 'ridged, then 'octaves 'lacunarity 'gain 'frequency 'offset and 'seed. The 
+// frequency and offset can be numbers or vectors. Setting 'curl to #t writes the curl of 
+// the noise instead, a swirling 3D flow that's good for moving particles about. Big 
+// arrays are split over the processors.
+// Example:
+// (define particles (build-particles 10000))
+// (with-primitive particles
+//     (pdata-map! (lambda (p) (vmul (crndvec) 10)) "p")
+//     (pdata-add "vel" "v"))
+// (every-frame
+//     (with-primitive particles
+//         (pdata-noise! "vel" "p" (list 'curl #t 'frequency 0.1 'offset (* 0.1 (time))))
+//         (pdata-eval! "p" '(madd "vel" 0.02 "p"))))
+//
+// (with-primitive (build-pixels 256 256)
+//     (pdata-noise! "c" '(type perlin fractal ridged octaves 6 frequency 8))
+//     (pixels-upload))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// pdata-noise! string-tipo/handle [string-tipo-fonte/handle] [lista-configurações]
+// Retorna: void
+// Descrição:
+// Preenche um array pdata inteiro com ruído fractal de uma vez, amostrado nas posições
+// do array fonte ("p" por padrão). Em primitivas de pixels sem fonte, o ruído é amostrado
+// sobre a imagem, com x e y indo de 0 a 1. Arrays de floats recebem o valor do ruído,
+// arrays de vetores recebem ele em x y e z, e arrays de cores em vermelho verde e azul,
+// mantendo o alfa. As configurações são uma lista de símbolos e valores: 'type é 'simplex
+// (o padrão, -1 a 1) ou 'perlin (0 a 1, como a função noise), 'dims é quantos componentes
+// da fonte são usados (2 a 4, perlin vai só até 3), 'fractal é 'fbm ou 'ridged, e então
+// 'octaves 'lacunarity 'gain 'frequency 'offset e 'seed. A frequência e o offset podem ser
+// números ou vetores. Com 'curl #t é escrito o rotacional do ruído, um fluxo 3D que gira
+// e é bom para mover partículas. Arrays grandes são divididos entre os processadores.
+// Exemplo:
+// (define particles (build-particles 10000))
+// (with-primitive particles
+//     (pdata-map! (lambda (p) (vmul (crndvec) 10)) "p")
+//     (pdata-add "vel" "v"))
+// (every-frame
+//     (with-primitive particles
+//         (pdata-noise! "vel" "p" (list 'curl #t 'frequency 0.1 'offset (* 0.1 (time))))
+//         (pdata-eval! "p" '(madd "vel" 0.02 "p"))))
+//
+// (with-primitive (build-pixels 256 256)
+//     (pdata-noise! "c" '(type perlin fractal ridged octaves 6 frequency 8))
+//     (pixels-upload))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// pdata-noise! type-chaîne-de-caractères/handle [source-chaîne-de-caractères/handle] [paramètres-liste]
+// Retour: vide
+// Description:
+// Remplit un tableau pdata entier avec du bruit fractal en une fois, échantillonné aux
+// positions du tableau source ("p" par défaut). Sur les primitives pixels sans source, le
+// bruit est échantillonné sur l'image, avec x et y allant de 0 à 1. Les tableaux de
+// flottants reçoivent la valeur du bruit, les tableaux de vecteurs en x y et z, et les
+// tableaux de couleurs en rouge vert et bleu, en gardant l'alpha. Les paramètres sont une
+// liste de symboles et de valeurs : 'type est 'simplex (par défaut, -1 à 1) ou 'perlin
+// (0 à 1, comme la fonction noise), 'dims est le nombre de composantes de la source
+// utilisées (2 à 4, perlin va seulement jusqu'à 3), 'fractal est 'fbm ou 'ridged, puis
+// 'octaves 'lacunarity 'gain 'frequency 'offset et 'seed. La fréquence et le décalage
+// peuvent être des nombres ou des vecteurs. Avec 'curl à #t c'est le rotationnel du bruit
+// qui est écrit, un flux 3D tourbillonnant pratique pour déplacer des particules. Les
+// grands tableaux sont répartis sur les processeurs.
+// Exemple:
+// (define particles (build-particles 10000))
+// (with-primitive particles
+//     (pdata-map! (lambda (p) (vmul (crndvec) 10)) "p")
+//     (pdata-add "vel" "v"))
+// (every-frame
+//     (with-primitive particles
+//         (pdata-noise! "vel" "p" (list 'curl #t 'frequency 0.1 'offset (* 0.1 (time))))
+//         (pdata-eval! "p" '(madd "vel" 0.02 "p"))))
+//
+// (with-primitive (build-pixels 256 256)
+//     (pdata-noise! "c" '(type perlin fractal ridged octaves 6 frequency 8))
+//     (pixels-upload))
+// EndFunctionDoc
+
+Scheme_Object *pdata_noise(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	if (argc==1) ArgCheck("pdata-noise!", "n", argc, argv);
+	else if (argc==3) ArgCheck("pdata-noise!", "nnl", argc, argv);
+	else if (SCHEME_LISTP(argv[1])) ArgCheck("pdata-noise!", "nl", argc, argv);
+	else ArgCheck("pdata-noise!", "nn", argc, argv);
+
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (!Grabbed)
+	{
+		Trace::Stream<<"pdata-noise! called without a primitive being grabbed"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+
+	NoiseField field;
+	bool curl=false;
+	if (SCHEME_LISTP(argv[argc-1]) && argc>1) NoiseSettingsFromScheme(argv[argc-1],field,curl);
+
+	unsigned int handle=PDataHandleFromScheme(argv[0]);
+	PData *dst=Grabbed->GetDataRaw(handle);
+	char type;
+	unsigned int size=0;
+	if (dst==NULL || !Grabbed->GetDataInfo(handle,type,size) || (type!='f' && type!='v' && type!='c'))
+	{
+		Trace::Stream<<"pdata-noise!: can't find a float, vector or colour pdata to write to"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+
+	// the points to sample at, or the pixel grid
+	const dVector *points=NULL;
+	PixelPrimitive *pixels=dynamic_cast<PixelPrimitive*>(Grabbed);
+	bool grid=argc==1 || (argc==2 && SCHEME_LISTP(argv[1]));
+	if (!grid || !pixels)
+	{
+		PData *src=grid?Grabbed->GetDataRaw("p"):Grabbed->GetDataRaw(PDataHandleFromScheme(argv[1]));
+		TypedPData<dVector> *vsrc=dynamic_cast<TypedPData<dVector>*>(src);
+		if (vsrc==NULL || vsrc->Size()!=size)
+		{
+			Trace::Stream<<"pdata-noise!: source needs to be a vector pdata the same size"<<endl;
+			MZ_GC_UNREG();
+			return scheme_void;
+		}
+		points=&vsrc->m_Data[0];
+	}
+	else if (pixels->GetWidth()*pixels->GetHeight()!=size)
+	{
+		Trace::Stream<<"pdata-noise!: pdata isn't the size of the pixels"<<endl;
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+
+	if (size==0)
+	{
+		MZ_GC_UNREG();
+		return scheme_void;
+	}
+
+	// keep the memory between calls
+	static vector<float> values;
+	static vector<dVector> vectors;
+	if (curl)
+	{
+		vectors.resize(size);
+		if (points==NULL)
+		{
+			// curl needs points, so make them from the grid
+			for (unsigned int i=0; i<size; i++)
+			{
+				vectors[i]=dVector((i%pixels->GetWidth())/(float)pixels->GetWidth(),
+				                   (i/pixels->GetWidth())/(float)pixels->GetHeight(),0);
+			}
+			points=&vectors[0];
+		}
+		// the points are read a block at a time before it's written, so this can be in place
+		field.FillCurl(points,&vectors[0],size);
+	}
+	else if (type=='f')
+	{
+		float *out=&static_cast<TypedPData<float>*>(dst)->m_Data[0];
+		if (points) field.Fill(points,out,size);
+		else field.FillGrid(pixels->GetWidth(),pixels->GetHeight(),out);
+	}
+	else
+	{
+		values.resize(size);
+		if (points) field.Fill(points,&values[0],size);
+		else field.FillGrid(pixels->GetWidth(),pixels->GetHeight(),&values[0]);
+	}
+
+	if (type=='v')
+	{
+		dVector *out=&static_cast<TypedPData<dVector>*>(dst)->m_Data[0];
+		for (unsigned int i=0; i<size; i++)
+		{
+			if (curl) out[i]=dVector(vectors[i].x,vectors[i].y,vectors[i].z,out[i].w);
+			else out[i]=dVector(values[i],values[i],values[i],out[i].w);
+		}
+	}
+	else if (type=='c')
+	{
+		dColour *out=&static_cast<TypedPData<dColour>*>(dst)->m_Data[0];
+		for (unsigned int i=0; i<size; i++)
+		{
+			if (curl) out[i]=dColour(vectors[i].x,vectors[i].y,vectors[i].z,out[i].a);
+			else out[i]=dColour(values[i],values[i],values[i],out[i].a);
+		}
+	}
+	else if (curl)
+	{
+		float *out=&static_cast<TypedPData<float>*>(dst)->m_Data[0];
+		for (unsigned int i=0; i<size; i++) out[i]=vectors[i].x;
+	}
+
+	dst->SetDirty();
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// recalc-normals smoothornot-number [weighting-symbol]
 // Returns: void
 // Description:
 // For polygon primitives only. Looks at the vertex positions and calculates the lighting normals for you 
-// automatically. Call with "1" for smooth normals, "0" for faceted normals.
+// automatically. Call with "1" for smooth normals, "0" for faceted normals. Smooth normals are averaged 
+// from the faces around each vertex, the optional weighting can be 'equal (the default), 'area to weight 
+// bigger faces more, or 'angle to use the angle of the face at the vertex. This is fast enough to call 
+// every frame after deforming a primitive.
 // Example:
 // (define shape (build-sphere 10 10)) ; build a sphere (which is smooth by default)
 // (grab shape)
 // (recalc-normals 0) ; make the sphere faceted
+// (recalc-normals 1 'angle) ; and smooth again
 // (ungrab)
 // EndFunctionDoc
 
 // StartFunctionDoc-pt
-// recalc-normals número-macio-ou-não
+// recalc-normals número-macio-ou-não [símbolo-ponderação]
 // Retorna: void
 // Descrição:
 // Para primitivas poligonais apenas. Olha a posição dos vértices e
 // cálcula as normais da luz pra você automaticamente. Chame com "1"
-// para normais macias, "0" para normais facetadas.
+// para normais macias, "0" para normais facetadas. A ponderação
+// opcional pode ser 'equal (padrão), 'area ou 'angle.
 // Exemplo:
 // (define shape (build-sphere 10 10)) ; build a sphere (which is smooth by default)
 // (grab shape)
@@ -911,11 +1686,12 @@ Scheme_Object *pdata_size(int argc, Scheme_Object **argv)
 // EndFunctionDoc
 
 // StartFunctionDoc-fr
-// recalc-normals lissageounon-nombre
+// recalc-normals lissageounon-nombre [ponderation-symbole]
 // Retour: vide
 // Description:
 // Pour les primitives polygones uniquement. Etudie la position des vertex et calcule les normales d'éclairage
 // automatiquement. Appellé avec "1" pour les normales lissées, "0" pour des normales en facettes.
+// La pondération optionnelle peut être 'equal (par défaut), 'area ou 'angle.
 // Exemple:
 // (define shape (build-sphere 10 10)) ; construit une sphère (lissée par défaut)
 // (grab shape)
@@ -926,9 +1702,22 @@ Scheme_Object *pdata_size(int argc, Scheme_Object **argv)
 Scheme_Object *recalc_normals(int argc, Scheme_Object **argv)
 {
  	DECL_ARGV();
-	ArgCheck("recalc-normals", "i", argc, argv);			
+	if (argc==1) ArgCheck("recalc-normals", "i", argc, argv);
+	else ArgCheck("recalc-normals", "iS", argc, argv);
 	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();    
-	if (Grabbed) Grabbed->RecalculateNormals(IntFromScheme(argv[0]));
+	PolyPrimitive *poly=dynamic_cast<PolyPrimitive*>(Grabbed);
+	if (poly && argc>1)
+	{
+		PolyPrimitive::NormalWeighting weighting=PolyPrimitive::WEIGHT_EQUAL;
+		if (IsSymbol(argv[1],"area")) weighting=PolyPrimitive::WEIGHT_AREA;
+		else if (IsSymbol(argv[1],"angle")) weighting=PolyPrimitive::WEIGHT_ANGLE;
+		else if (!IsSymbol(argv[1],"equal")) 
+		{
+			Trace::Stream<<"recalc-normals: unknown weighting "<<SymbolName(argv[1])<<endl;
+		}
+		poly->RecalculateNormals(IntFromScheme(argv[0]),weighting);
+	}
+	else if (Grabbed) Grabbed->RecalculateNormals(IntFromScheme(argv[0]));
 	MZ_GC_UNREG(); 
 	return scheme_void;
 }
@@ -940,12 +1729,18 @@ void PDataFunctions::AddGlobals(Scheme_Env *env)
 	MZ_GC_REG();
 	scheme_add_global("pdata-ref", scheme_make_prim_w_arity(pdata_ref, "pdata-ref", 2, 2), env);
 	scheme_add_global("pdata-set!", scheme_make_prim_w_arity(pdata_set, "pdata-set!", 3, 3), env);
+	scheme_add_global("pdata-handle", scheme_make_prim_w_arity(pdata_handle, "pdata-handle", 1, 1), env);
 	scheme_add_global("pdata-add", scheme_make_prim_w_arity(pdata_add, "pdata-add", 2, 2), env);
 	scheme_add_global("pdata-exists?", scheme_make_prim_w_arity(pdata_exists, "pdata-exists?", 1, 1), env);
 	scheme_add_global("pdata-names", scheme_make_prim_w_arity(pdata_names, "pdata-names", 0, 0), env);
 	scheme_add_global("pdata-op", scheme_make_prim_w_arity(pdata_op, "pdata-op", 3, 3), env);
 	scheme_add_global("pdata-copy", scheme_make_prim_w_arity(pdata_copy, "pdata-copy", 2, 2), env);
 	scheme_add_global("pdata-size", scheme_make_prim_w_arity(pdata_size, "pdata-size", 0, 0), env);
-	scheme_add_global("recalc-normals", scheme_make_prim_w_arity(recalc_normals, "recalc-normals", 1, 1), env);
+	scheme_add_global("pdata->flvector", scheme_make_prim_w_arity(pdata_to_flvector, "pdata->flvector", 1, 1), env);
+	scheme_add_global("flvector->pdata!", scheme_make_prim_w_arity(flvector_to_pdata, "flvector->pdata!", 2, 2), env);
+	scheme_add_global("pdata-pointer", scheme_make_prim_w_arity(pdata_pointer, "pdata-pointer", 1, 1), env);
+	scheme_add_global("pdata-eval!", scheme_make_prim_w_arity(pdata_eval, "pdata-eval!", 2, 2), env);
+	scheme_add_global("pdata-noise!", scheme_make_prim_w_arity(pdata_noise, "pdata-noise!", 1, 3), env);
+	scheme_add_global("recalc-normals", scheme_make_prim_w_arity(recalc_normals, "recalc-normals", 1, 2), env);
  	MZ_GC_UNREG(); 
 }
@@ -60,6 +60,8 @@ void PFuncContainer::Run(unsigned int id, Primitive *p, const SceneGraph *sg)
 	if (id<m_PFuncVec.size())
 	{
 		m_PFuncVec[id]->Run(*p,*sg);
+		// we don't know what the function changed
+		p->SetAllDataDirty();
 	}	
 }
 
@@ -982,7 +982,8 @@ Scheme_Object *build_nurbs_plane(int argc, Scheme_Object **argv)
 // flavors, camera facing sprites, which are the default, can be textured and individually
 // scaled; and points (when hint-points is set), which cannot be textured but are much faster
 // to render, as they are hardware supported gl points. By default these point particles are
-// square, turn on hint-anti-alias to make them circular.
+// square, turn on hint-anti-alias to make them circular. The "r" pdata spins the sprites 
+// around the view direction, in degrees.
 // Example:
 // (define mynewshape (build-particles 100))
 // EndFunctionDoc
@@ -1092,32 +1093,49 @@ Scheme_Object *build_image(int argc, Scheme_Object **argv)
 }
 
 // StartFunctionDoc-en
-// build-voxels width-number height-number depth-number 
+// build-voxels width-number height-number depth-number [sparse-boolean]
 // Returns: primitiveid-number
 // Description:
 // Builds voxels primitive, similar to pixel primitives, except include a 3rd dimension.
+// Sparse voxels only use memory where something has been drawn into them, so they
+// can be much bigger, but they don't have any pdata, and empty voxels are transparent.
 // Example:
 // (define vox (build-voxels 10 10 10))
+// (define big (build-voxels 512 512 512 #t))
 // EndFunctionDoc
 
 // StartFunctionDoc-fr
-// build-voxels largeur-nombre hauteur-nombre profondeur-nombre 
+// build-voxels largeur-nombre hauteur-nombre profondeur-nombre [sparse-booléen]
 // Retour: primitiveid-nombre
 // Description:
 // Construit une primitive voxel, simiaire aux primitives pixel,
 // excepté qu'elles incluent une troisiême diemension.
+// Les voxels clairsemés n'utilisent de la mémoire que là où quelque chose
+// a été dessiné, ils peuvent donc être bien plus grands, mais ils n'ont pas
+// de pdata, et les voxels vides sont transparents.
 // Exemple:
 // (define vox (build-voxels 10 10 10))
+// (define big (build-voxels 512 512 512 #t))
 // EndFunctionDoc
 
 Scheme_Object *build_voxels(int argc, Scheme_Object **argv)
 {
 	DECL_ARGV();
-	ArgCheck("build-voxels", "iii", argc, argv);
+	bool sparse = false;
+	if (argc == 3)
+	{
+		ArgCheck("build-voxels", "iii", argc, argv);
+	}
+	else
+	{
+		ArgCheck("build-voxels", "iiib", argc, argv);
+		sparse = BoolFromScheme(argv[3]);
+	}
 
 	VoxelPrimitive *VoxPrim = new VoxelPrimitive(IntFromScheme(argv[0]),
 												IntFromScheme(argv[1]),
-												IntFromScheme(argv[2]));
+												IntFromScheme(argv[2]),
+												sparse);
 	MZ_GC_UNREG();
 
 	return scheme_make_integer_value(Engine::Get()->Renderer()->AddPrimitive(VoxPrim));
@@ -1901,7 +1919,12 @@ Scheme_Object *locator_bounding_radius(int argc, Scheme_Object **argv)
 // load-primitive
 // Returns: primitiveid-number
 // Description:
-// Loads a primitive from disk
+// Loads a primitive from disk. Meshes can be .obj or .ply files
+// (ascii or binary), and the first time one is loaded a binary copy
+// is saved next to it with .fluxmesh added to the name, so later loads
+// are much quicker. The copy is ignored if the original file changes.
+// A mesh made only of quads loads as quads, any other faces are split
+// into triangles.
 // Example:
 // (define mynewshape (load-primitive "octopus.obj"))
 // EndFunctionDoc
@@ -1918,7 +1941,12 @@ Scheme_Object *locator_bounding_radius(int argc, Scheme_Object **argv)
 // load-primitive
 // Retour: primitiveid-nombre
 // Description:
-// Charge une primitive à partir du disque.
+// Charge une primitive à partir du disque. Les maillages peuvent être
+// des fichiers .obj ou .ply (ascii ou binaire), et au premier chargement
+// une copie binaire est enregistrée à côté avec .fluxmesh ajouté au nom,
+// pour que les chargements suivants soient plus rapides. Un maillage
+// composé uniquement de quads est chargé en quads, les autres faces
+// sont découpées en triangles.
 // Exemple:
 // (define mynewshape (load-primitive "octopus.obj"))
 // EndFunctionDoc
@@ -3018,6 +3046,161 @@ Scheme_Object *draw_instance(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// draw-instances primitiveid-number transforms [colours]
+// Returns: void
+// Description:
+// Draws a retained mode primitive once for each of a list of transforms, in one go. This
+// is much faster than calling draw-instance lots of times, as the state is only set up 
+// once, and if the current shader has a mat4 attribute called InstanceTransform (and 
+// optionally a vec4 called InstanceColour) the hardware will draw all of them with 
+// one call. The transforms are relative to the current state, and can be a list of 
+// matrices, or the name of a pdata array on the currently grabbed primitive - matrix 
+// arrays are used as transforms, and vector arrays as positions. Colours are optional, 
+// and can be a list of colours or the name of a colour pdata array.
+// Example:
+// (define mynewshape (build-cube))
+// (with-primitive mynewshape (hide 1))
+// (define p (build-particles 1000))
+// (with-primitive p
+//     (hide 1)
+//     (pdata-map! (lambda (p) (vmul (crndvec) 20)) "p")
+//     (pdata-map! (lambda (c) (rndvec)) "c"))
+// (every-frame 
+//     (with-primitive p
+//         (draw-instances mynewshape "p" "c")))
+// EndFunctionDoc
+
+// fills a vector from a pdata array on the grabbed primitive, 
+// or a list/vector of scheme values
+static bool InstanceTransformsFromScheme(Scheme_Object *src, vector<dMatrix> &transforms)
+{
+	if (SCHEME_CHAR_STRINGP(src))
+	{
+		Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+		if (Grabbed==NULL) return false;
+
+		PData *pd=Grabbed->GetDataRaw(StringFromScheme(src));
+		TypedPData<dMatrix> *matrices=dynamic_cast<TypedPData<dMatrix>*>(pd);
+		if (matrices)
+		{
+			transforms.assign(matrices->m_Data.begin(),matrices->m_Data.end());
+			return true;
+		}
+
+		TypedPData<dVector> *positions=dynamic_cast<TypedPData<dVector>*>(pd);
+		if (positions)
+		{
+			transforms.resize(positions->m_Data.size());
+			for (unsigned int i=0; i<positions->m_Data.size(); i++)
+			{
+				transforms[i].translate(positions->m_Data[i].x,positions->m_Data[i].y,positions->m_Data[i].z);
+			}
+			return true;
+		}
+		return false;
+	}
+
+	Scheme_Object *vec=src;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, src);
+	MZ_GC_VAR_IN_REG(1, vec);
+	MZ_GC_REG();
+
+	if (SCHEME_LISTP(src)) vec=scheme_list_to_vector(src);
+	if (!SCHEME_VECTORP(vec))
+	{
+		MZ_GC_UNREG();
+		return false;
+	}
+
+	transforms.resize(SCHEME_VEC_SIZE(vec));
+	for (unsigned int i=0; i<transforms.size(); i++)
+	{
+		if (!SCHEME_VECTORP(SCHEME_VEC_ELS(vec)[i]) || SCHEME_VEC_SIZE(SCHEME_VEC_ELS(vec)[i])!=16)
+		{
+			MZ_GC_UNREG();
+			return false;
+		}
+		transforms[i]=MatrixFromScheme(SCHEME_VEC_ELS(vec)[i]);
+	}
+
+	MZ_GC_UNREG();
+	return true;
+}
+
+static bool InstanceColoursFromScheme(Scheme_Object *src, vector<dColour> &colours)
+{
+	if (SCHEME_CHAR_STRINGP(src))
+	{
+		Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+		if (Grabbed==NULL) return false;
+
+		TypedPData<dColour> *pd=dynamic_cast<TypedPData<dColour>*>(Grabbed->GetDataRaw(StringFromScheme(src)));
+		if (pd==NULL) return false;
+		colours.assign(pd->m_Data.begin(),pd->m_Data.end());
+		return true;
+	}
+
+	Scheme_Object *vec=src;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, src);
+	MZ_GC_VAR_IN_REG(1, vec);
+	MZ_GC_REG();
+
+	if (SCHEME_LISTP(src)) vec=scheme_list_to_vector(src);
+	if (!SCHEME_VECTORP(vec))
+	{
+		MZ_GC_UNREG();
+		return false;
+	}
+
+	COLOUR_MODE mode=Engine::Get()->State()->ColourMode;
+	colours.resize(SCHEME_VEC_SIZE(vec));
+	for (unsigned int i=0; i<colours.size(); i++)
+	{
+		colours[i]=ColourFromScheme(SCHEME_VEC_ELS(vec)[i],mode);
+	}
+
+	MZ_GC_UNREG();
+	return true;
+}
+
+Scheme_Object *draw_instances(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("draw-instances", "i??", argc, argv);
+	Primitive *p = Engine::Get()->Renderer()->GetPrimitive(IntFromScheme(argv[0]));
+	if (p)
+	{
+		vector<dMatrix> transforms;
+		vector<dColour> colours;
+		if (!InstanceTransformsFromScheme(argv[1],transforms))
+		{
+			Trace::Stream<<"draw-instances: transforms should be a list of matrices or the name of a matrix or vector pdata array"<<endl;
+		}
+		else if (argc>2 && !InstanceColoursFromScheme(argv[2],colours))
+		{
+			Trace::Stream<<"draw-instances: colours should be a list of colours or the name of a colour pdata array"<<endl;
+		}
+		else if (!colours.empty() && colours.size()!=transforms.size())
+		{
+			Trace::Stream<<"draw-instances: need the same number of colours as transforms"<<endl;
+		}
+		else
+		{
+			Engine::Get()->Renderer()->RenderInstances(p,transforms,colours);
+		}
+	}
+	else
+	{
+		Trace::Stream<<"draw-instances can only be called with an existing object id"<<endl;
+	}
+
+	MZ_GC_UNREG(); 
+    return scheme_void;
+}
+
 // StartFunctionDoc-en
 // draw-cube
 // Returns: void
@@ -3418,9 +3601,9 @@ Scheme_Object *poly_indices(int argc, Scheme_Object **argv)
 		{
 			l = scheme_null;
 
-			for (int n=(int)pp->GetIndex().size()-1; n>=0; n--)
+			for (int n=(int)pp->GetIndexConst().size()-1; n>=0; n--)
 			{
-				l=scheme_make_pair(scheme_make_integer(pp->GetIndex()[n]),l);
+				l=scheme_make_pair(scheme_make_integer(pp->GetIndexConst()[n]),l);
 			}
 			MZ_GC_UNREG();
 		    return l;
@@ -3764,6 +3947,165 @@ Scheme_Object *poly_convert_to_indexed(int argc, Scheme_Object **argv)
     return scheme_void;
 }
 
+// StartFunctionDoc-en
+// lod-build levels-number ratio-number
+// Returns: void
+// Description:
+// Builds simplified copies of the currently grabbed polygon 
+// primitive, which are drawn in its place when it's small on 
+// the screen. Each level has ratio times the triangles of the 
+// one before. The copies are made when you call this, so call 
+// it again if you change the shape, or with 0 levels to remove 
+// them.
+// Example:
+// (define mynewshape (build-sphere 100 100))
+// (with-primitive mynewshape
+//     (lod-build 4 0.5))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// lod-build número-níveis número-razão
+// Retorna: void
+// Descrição:
+// Constrói cópias simplificadas da primitiva poligonal atualmente
+// "grabbed", que são desenhadas no seu lugar quando ela está
+// pequena na tela. Cada nível tem razão vezes os triângulos do
+// anterior. As cópias são feitas quando você chama isto, então
+// chame de novo se mudar a forma, ou com 0 níveis para removê-las.
+// Exemplo:
+// (define mynewshape (build-sphere 100 100))
+// (with-primitive mynewshape
+//     (lod-build 4 0.5))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// lod-build nombre-niveaux nombre-ratio
+// Retour: vide
+// Description:
+// Construit des copies simplifiées de la primitive polygone en
+// cours, dessinées à sa place lorsqu'elle est petite à l'écran.
+// Chaque niveau a ratio fois les triangles du précédent. Les
+// copies sont faites à l'appel, appelez à nouveau si la forme
+// change, ou avec 0 niveaux pour les supprimer.
+// Exemple:
+// (define mynewshape (build-sphere 100 100))
+// (with-primitive mynewshape
+//     (lod-build 4 0.5))
+// EndFunctionDoc
+
+Scheme_Object *lod_build(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("lod-build", "if", argc, argv);
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed) 
+	{
+		PolyPrimitive *pp = dynamic_cast<PolyPrimitive *>(Grabbed);
+		if (pp)
+		{
+			int levels=IntFromScheme(argv[0]);
+			pp->BuildLOD(levels>0?levels:0,FloatFromScheme(argv[1]));
+			MZ_GC_UNREG();
+			return scheme_void;
+		}
+	}
+	
+	Trace::Stream<<"lod-build can only be called while a polyprimitive is grabbed"<<endl;
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// lod-detail pixels-number
+// Returns: void
+// Description:
+// Sets how many pixels each triangle of the currently grabbed 
+// primitive should cover on screen, higher numbers draw fewer 
+// triangles. Polygon primitives pick from the levels made by 
+// lod-build, nurbs primitives are tessellated to suit, 0 turns
+// this off for them. The default is 16 for polygons and off for 
+// nurbs.
+// Example:
+// (with-primitive (build-nurbs-sphere 10 10)
+//     (lod-detail 50))
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// lod-detail número-pixels
+// Retorna: void
+// Descrição:
+// Ajusta quantos pixels cada triângulo da primitiva atualmente
+// "grabbed" deve cobrir na tela, números maiores desenham menos
+// triângulos. Primitivas poligonais escolhem entre os níveis
+// feitos por lod-build, primitivas nurbs são tesseladas de acordo,
+// 0 desliga isso para elas. O padrão é 16 para polígonos e
+// desligado para nurbs.
+// Exemplo:
+// (with-primitive (build-nurbs-sphere 10 10)
+//     (lod-detail 50))
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// lod-detail nombre-pixels
+// Retour: vide
+// Description:
+// Règle combien de pixels chaque triangle de la primitive en
+// cours doit couvrir à l'écran, des nombres plus grands dessinent
+// moins de triangles. Les primitives polygones choisissent parmi
+// les niveaux de lod-build, les primitives nurbs sont tessellées
+// en conséquence, 0 le désactive pour elles. Par défaut 16 pour
+// les polygones et désactivé pour les nurbs.
+// Exemple:
+// (with-primitive (build-nurbs-sphere 10 10)
+//     (lod-detail 50))
+// EndFunctionDoc
+
+Scheme_Object *lod_detail(int argc, Scheme_Object **argv)
+{
+	DECL_ARGV();
+	ArgCheck("lod-detail", "f", argc, argv);
+	Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+	if (Grabbed) Grabbed->SetLODDetail(FloatFromScheme(argv[0]));
+	MZ_GC_UNREG();
+	return scheme_void;
+}
+
+// StartFunctionDoc-en
+// lod-triangles-saved
+// Returns: number
+// Description:
+// Returns the number of triangles that weren't drawn in the 
+// last frame thanks to the level of detail settings.
+// Example:
+// (display (lod-triangles-saved))(newline)
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// lod-triangles-saved
+// Retorna: número
+// Descrição:
+// Retorna o número de triângulos que não foram desenhados no
+// último quadro graças aos ajustes de nível de detalhe.
+// Exemplo:
+// (display (lod-triangles-saved))(newline)
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// lod-triangles-saved
+// Retour: nombre
+// Description:
+// Retourne le nombre de triangles qui n'ont pas été dessinés
+// lors de la dernière image grâce aux réglages de niveau de
+// détail.
+// Exemple:
+// (display (lod-triangles-saved))(newline)
+// EndFunctionDoc
+
+Scheme_Object *lod_triangles_saved(int argc, Scheme_Object **argv)
+{
+	return scheme_make_integer_value(Engine::Get()->Renderer()->GetSceneGraph().GetTrianglesSaved());
+}
+
 // StartFunctionDoc-en
 // build-copy src-primitive-number
 // Returns: primitiveid-number
@@ -3832,6 +4174,9 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //     skeleton-root primid-number : the root of the bindpose skeleton for skinning
 //     sharpness float : a control of how sharp the creasing will be when skinned 
 //
+//     Also adds colour pdata called "skinbones" and "skinweights", holding the four 
+//     strongest bones for each vertex and their weights, which skinning uses if present.
+//
 // skinweights->vertcols
 //     A utility for visualising skinweights for debugging. 
 //     no arguments
@@ -3844,6 +4189,12 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //     skeleton-root primid-number : the root primitive of the animating skeleton
 //     bindpose-root primid-number : the root primitive of the bindpose skeleton
 //     skin-normals number : whether to skin the normals as well as the positions
+//     dual-quaternion number : whether to blend the bones as dual quaternions, which 
+//         stops joints collapsing when they twist, but ignores scaling in the skeleton.
+//         Only used with "skinbones" and "skinweights" pdata
+//
+//     If the primitive has the "skinbones" and "skinweights" pdata from genskinweights 
+//     only those four bones are blended for each vertex, otherwise all the "w<n>" weights are.
 //     
 // Example:
 // (define mypfunc (make-pfunc 'arithmetic))
@@ -3876,6 +4227,10 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //     sharpness float : um controle de quão afiado o vinco vai ser
 //     quando "skineado". 
 //
+//     Também adiciona pdata de cor chamadas "skinbones" e "skinweights",
+//     com os quatro ossos mais fortes de cada vértice e seus pesos, que
+//     skinning usa se existirem.
+//
 // skinweights->vertcols
 //     Uma utilidade para visualizar pesos de skin para debugar. 
 //     sem argumentos.
@@ -3890,6 +4245,9 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //     skeleton-root primid-number : a primitiva raiz do esqueleto animado
 //     bindpose-root primid-number : a raiz primitiva da pose bind do esqueleto
 //     skin-normals number : se devemos usar skin nas normais como nas posições
+//     dual-quaternion number : se devemos misturar os ossos como quatérnios
+//         duplos, o que evita que as juntas colapsem quando torcem, mas ignora
+//         a escala do esqueleto. Só usado com pdata "skinbones" e "skinweights"
 // 
 // Exemplo:
 // (define mypfunc (make-pfunc 'arithmetic))
@@ -3921,6 +4279,9 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //     skeleton-root primid-number : la racine de la pose du squelette pour le skinning
 //     sharpness float : control la netteté des angles dans les plis lors du skinning
 //
+//     Ajoute aussi les pdatas couleur "skinbones" et "skinweights", contenant les quatre
+//     os les plus forts de chaque sommet et leurs poids, utilisés par skinning s'ils existent.
+//
 // skinweights->vertcols
 //     Un outil pour visualiser les poids de skinning pour débuggage.
 //     Aucun arguments
@@ -3933,6 +4294,9 @@ Scheme_Object *build_copy(int argc, Scheme_Object **argv)
 //     skeleton-root primid-number : le primitive racine pour animer le suelette
 //     bindpose-root primid-number : la primitive racine pour les poses du squelette
 //     skin-normals number : selon si les normals sont aussi à "skinner"
+//     dual-quaternion number : mélange les os en quaternions duaux, ce qui évite que les
+//         articulations s'effondrent en torsion, mais ignore l'échelle du squelette.
+//         Seulement avec les pdatas "skinbones" et "skinweights"
 //
 // Exemple:
 // (define mypfunc (make-pfunc 'arithmetic))
@@ -4127,7 +4491,7 @@ Scheme_Object *pfunc_run(int argc, Scheme_Object **argv)
 // Returns: void
 // Description:
 // Returns a list of pdata values at each intersection point of 
-// the specified line. The line is in primitive local space, to 
+// the specified line, nearest the start first. The line is in primitive local space, to 
 // check with a point in global space, you need to transform the 
 // point with the inverse of the primitive transform.
 // Example:
@@ -4199,7 +4563,7 @@ Scheme_Object *pfunc_run(int argc, Scheme_Object **argv)
 // Retour: vide
 // Description:
 // Retourne une liste de valeur pdata à chaque point d'intersection
-// de la ligne spécifiée. La ligne est en espace local, pour vérifier
+// de la ligne spécifiée, le plus proche du début en premier. La ligne est en espace local, pour vérifier
 // en espace global, vous devez transformer le point avec l'inverse
 // de la transformation de la primitive.
 // Exemple:
@@ -4259,7 +4623,8 @@ Scheme_Object *geo_line_intersect(int argc, Scheme_Object **argv)
 			vector<Evaluator::Point> points;
 			eval->IntersectLine(VectorFromScheme(argv[0]), VectorFromScheme(argv[1]), points);
 
-			for (vector<Evaluator::Point>::iterator i=points.begin(); i!=points.end(); ++i)
+			// built backwards, so the list comes out nearest first
+			for (vector<Evaluator::Point>::reverse_iterator i=points.rbegin(); i!=points.rend(); ++i)
 			{
 				pl = scheme_null;
                 // jam the parametric position on the ray to the end of the list
@@ -4291,6 +4656,245 @@ Scheme_Object *geo_line_intersect(int argc, Scheme_Object **argv)
     return l;
 }
 
+// reads the lines for geo/rays-intersect
+static bool RayPointsFromScheme(Scheme_Object *src, vector<dVector> &points)
+{
+	if (SCHEME_CHAR_STRINGP(src))
+	{
+		Primitive *Grabbed=Engine::Get()->Renderer()->Grabbed();
+		if (Grabbed==NULL) return false;
+
+		TypedPData<dVector> *pd=dynamic_cast<TypedPData<dVector>*>(Grabbed->GetDataRaw(StringFromScheme(src)));
+		if (pd==NULL) return false;
+		points.assign(pd->m_Data.begin(),pd->m_Data.end());
+		return true;
+	}
+
+	Scheme_Object *vec=src;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, src);
+	MZ_GC_VAR_IN_REG(1, vec);
+	MZ_GC_REG();
+
+	if (SCHEME_LISTP(src)) vec=scheme_list_to_vector(src);
+	if (!SCHEME_VECTORP(vec))
+	{
+		MZ_GC_UNREG();
+		return false;
+	}
+
+	points.resize(SCHEME_VEC_SIZE(vec));
+	for (unsigned int i=0; i<points.size(); i++)
+	{
+		if (!SCHEME_VECTORP(SCHEME_VEC_ELS(vec)[i]) || SCHEME_VEC_SIZE(SCHEME_VEC_ELS(vec)[i])!=3)
+		{
+			MZ_GC_UNREG();
+			return false;
+		}
+		points[i]=VectorFromScheme(SCHEME_VEC_ELS(vec)[i]);
+	}
+	MZ_GC_UNREG();
+	return true;
+}
+
+// StartFunctionDoc-en
+// geo/rays-intersect primitiveid-number starts ends [pdata-name]
+// Returns: list
+// Description:
+// Finds where lots of lines hit a polygon primitive in one go, which 
+// is much quicker than calling geo/line-intersect for each of them. 
+// The starts and ends are lists of vectors, or the names of vector 
+// pdata arrays in the currently grabbed primitive. Returns a list with 
+// an entry for each line, #f if it missed, otherwise a pair of the 
+// distance along the line (0 to 1) and the value of the pdata array 
+// given (defaults to "p") where it first hit. The lines are in the 
+// local space of the primitive being hit.
+// Example:
+// (clear)
+// (define s (build-sphere 50 50))
+// (define rays (build-particles 1000))
+// 
+// (define hits
+//     (with-primitive rays
+//         (hide 1)
+//         (pdata-map! (lambda (p) (vmul (srndvec) 3)) "p")
+//         (pdata-add "end" "v")
+//         (geo/rays-intersect s "p" "end")))
+// 
+// (for-each
+//     (lambda (hit)
+//         (when hit
+//             (with-state
+//                 (translate (cdr hit))
+//                 (scale 0.05)
+//                 (build-cube))))
+//     hits)
+// EndFunctionDoc
+
+// StartFunctionDoc-pt
+// geo/rays-intersect número-id-primitiva inícios fins [nome-pdata]
+// Retorna: lista
+// Descrição:
+// Encontra onde muitas linhas atingem uma primitiva poligonal de uma
+// vez, o que é bem mais rápido que chamar geo/line-intersect para cada
+// uma delas. Os inícios e fins são listas de vetores, ou nomes de
+// arrays pdata de vetores na primitiva atualmente pega. Retorna uma
+// lista com um item para cada linha, #f se errou, ou um par com a
+// distância ao longo da linha (0 a 1) e o valor da pdata dada
+// (padrão "p") onde atingiu primeiro. As linhas estão no espaço local
+// da primitiva atingida.
+// Exemplo:
+// (clear)
+// (define s (build-sphere 50 50))
+// (define rays (build-particles 1000))
+// 
+// (define hits
+//     (with-primitive rays
+//         (hide 1)
+//         (pdata-map! (lambda (p) (vmul (srndvec) 3)) "p")
+//         (pdata-add "end" "v")
+//         (geo/rays-intersect s "p" "end")))
+// 
+// (for-each
+//     (lambda (hit)
+//         (when hit
+//             (with-state
+//                 (translate (cdr hit))
+//                 (scale 0.05)
+//                 (build-cube))))
+//     hits)
+// EndFunctionDoc
+
+// StartFunctionDoc-fr
+// geo/rays-intersect nombre-id-primitive débuts fins [nom-pdata]
+// Retour: liste
+// Description:
+// Trouve où de nombreuses lignes touchent une primitive polygone en
+// une fois, bien plus rapide que d'appeler geo/line-intersect pour
+// chacune. Les débuts et fins sont des listes de vecteurs, ou les
+// noms de tableaux pdata de vecteurs de la primitive en cours.
+// Retourne une liste avec un élément par ligne, #f si elle n'a rien
+// touché, sinon une paire de la distance le long de la ligne (0 à 1)
+// et de la valeur du pdata donné (par défaut "p") au premier point
+// touché. Les lignes sont en espace local de la primitive touchée.
+// Exemple:
+// (clear)
+// (define s (build-sphere 50 50))
+// (define rays (build-particles 1000))
+// 
+// (define hits
+//     (with-primitive rays
+//         (hide 1)
+//         (pdata-map! (lambda (p) (vmul (srndvec) 3)) "p")
+//         (pdata-add "end" "v")
+//         (geo/rays-intersect s "p" "end")))
+// 
+// (for-each
+//     (lambda (hit)
+//         (when hit
+//             (with-state
+//                 (translate (cdr hit))
+//                 (scale 0.05)
+//                 (build-cube))))
+//     hits)
+// EndFunctionDoc
+
+Scheme_Object *geo_rays_intersect(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *value = NULL;
+	Scheme_Object *l = NULL;
+
+	MZ_GC_DECL_REG(3);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, value);
+	MZ_GC_VAR_IN_REG(2, l);
+	MZ_GC_REG();
+	if (argc==3) ArgCheck("geo/rays-intersect", "i??", argc, argv);
+	else ArgCheck("geo/rays-intersect", "i??s", argc, argv);
+
+	l = scheme_null;
+	
+	PolyPrimitive *prim = dynamic_cast<PolyPrimitive*>(Engine::Get()->Renderer()->GetPrimitive(IntFromScheme(argv[0])));
+	string name="p";
+	if (argc>3) name=StringFromScheme(argv[3]);
+	char type=0;
+	unsigned int size=0;
+	vector<dVector> starts,ends;
+	
+	if (prim==NULL)
+	{
+		Trace::Stream<<"geo/rays-intersect can only be called with a polyprimitive id"<<endl;
+	}
+	else if (!RayPointsFromScheme(argv[1],starts) || !RayPointsFromScheme(argv[2],ends))
+	{
+		Trace::Stream<<"geo/rays-intersect: starts and ends should be lists of vectors or the names of vector pdata arrays"<<endl;
+	}
+	else if (starts.size()!=ends.size())
+	{
+		Trace::Stream<<"geo/rays-intersect: need the same number of starts and ends"<<endl;
+	}
+	else if (!prim->GetDataInfo(name,type,size))
+	{
+		Trace::Stream<<"geo/rays-intersect: can't find pdata "<<name<<endl;
+	}
+	else if (!starts.empty())
+	{
+		vector<PolyEvaluator::RayHit> hits(starts.size());
+		PolyEvaluator eval(prim);
+		eval.IntersectLines(&starts[0],&ends[0],starts.size(),&hits[0]);
+		
+		PData *pd=prim->GetDataRaw(name);
+		
+		// built backwards, so the list comes out in the same order as the lines
+		for (int i=hits.size()-1; i>=0; i--)
+		{
+			const PolyEvaluator::RayHit &hit=hits[i];
+			if (hit.m_T<0)
+			{
+				l = scheme_make_pair(scheme_false,l);
+				continue;
+			}
+			
+			const unsigned int *v=hit.m_Verts;
+			const dVector &b=hit.m_Bary;
+			switch (type)
+			{
+				case 'f': 
+				{
+					const vector<float,FLX_ALLOC(float) > &d=static_cast<TypedPData<float>*>(pd)->m_Data;
+					value = scheme_make_double(d[v[0]]*b.x+d[v[1]]*b.y+d[v[2]]*b.z); 
+				}
+				break;
+				case 'v': 
+				{
+					const vector<dVector,FLX_ALLOC(dVector) > &d=static_cast<TypedPData<dVector>*>(pd)->m_Data;
+					value = FloatsToScheme((d[v[0]]*b.x+d[v[1]]*b.y+d[v[2]]*b.z).arr(),3); 
+				}
+				break;
+				case 'c': 
+				{
+					const vector<dColour,FLX_ALLOC(dColour) > &d=static_cast<TypedPData<dColour>*>(pd)->m_Data;
+					value = FloatsToScheme((d[v[0]]*b.x+d[v[1]]*b.y+d[v[2]]*b.z).arr(),4); 
+				}
+				break;
+				case 'm': 
+				{
+					const vector<dMatrix,FLX_ALLOC(dMatrix) > &d=static_cast<TypedPData<dMatrix>*>(pd)->m_Data;
+					value = FloatsToScheme((d[v[0]]*b.x+d[v[1]]*b.y+d[v[2]]*b.z).arr(),16); 
+				}
+				break;
+				default: value = scheme_false; break;
+			}
+			
+			value = scheme_make_pair(scheme_make_double(hit.m_T),value);
+			l = scheme_make_pair(value,l);
+		}
+	}
+	
+	MZ_GC_UNREG(); 
+	return l;
+}
+
 // StartFunctionDoc-en
 // recalc-bb
 // Returns: void
@@ -4492,6 +5096,94 @@ Scheme_Object *bb_point_intersect(int argc, Scheme_Object **argv)
 	return scheme_false;
 }
 
+// StartFunctionDoc-en
+// bb/box-query min max
+// Returns: list-of-primitive-ids
+// Description:
+// Returns a list of all the primitives with bounding boxes overlapping the 
+// world space box given by its min and max corners. This uses the scene's 
+// bounding volume hierarchy, so it's much faster than testing every 
+// primitive in turn with bb/bb-intersect?.
+// Example:
+// (clear)
+// (for ((i (in-range 0 100)))
+//     (with-state
+//         (translate (vmul (crndvec) 10))
+//         (build-cube)))
+//
+// (for-each
+//     (lambda (p)
+//         (with-primitive p (colour (vector 1 0 0))))
+//     (bb/box-query (vector -2 -2 -2) (vector 2 2 2)))
+// EndFunctionDoc
+
+Scheme_Object *bb_box_query(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *l = NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, l);
+	MZ_GC_REG();
+	ArgCheck("bb/box-query", "vv", argc, argv);
+	l = scheme_null;
+
+	dBoundingBox box;
+	box.expand(VectorFromScheme(argv[0]));
+	box.expand(VectorFromScheme(argv[1]));
+
+	vector<int> IDs;
+	Engine::Get()->Renderer()->GetSceneGraph().BoxQuery(box,IDs);
+	for (vector<int>::reverse_iterator i=IDs.rbegin(); i!=IDs.rend(); ++i)
+	{
+		l=scheme_make_pair(scheme_make_integer(*i),l);
+	}
+
+	MZ_GC_UNREG();
+	return l;
+}
+
+// StartFunctionDoc-en
+// bb/sphere-query centre radius
+// Returns: list-of-primitive-ids
+// Description:
+// Returns a list of all the primitives with bounding boxes overlapping the
+// world space sphere given.
+// Example:
+// (clear)
+// (for ((i (in-range 0 100)))
+//     (with-state
+//         (translate (vmul (crndvec) 10))
+//         (build-cube)))
+//
+// (every-frame
+//     (for-each
+//         (lambda (p)
+//             (with-primitive p (colour (rndvec))))
+//         (bb/sphere-query (vmul (vector (sin (time)) (cos (time)) 0) 5) 2)))
+// EndFunctionDoc
+
+Scheme_Object *bb_sphere_query(int argc, Scheme_Object **argv)
+{
+	Scheme_Object *l = NULL;
+	MZ_GC_DECL_REG(2);
+	MZ_GC_VAR_IN_REG(0, argv);
+	MZ_GC_VAR_IN_REG(1, l);
+	MZ_GC_REG();
+	ArgCheck("bb/sphere-query", "vf", argc, argv);
+	l = scheme_null;
+
+	vector<int> IDs;
+	Engine::Get()->Renderer()->GetSceneGraph().SphereQuery(VectorFromScheme(argv[0]),
+		FloatFromScheme(argv[1]),IDs);
+	for (vector<int>::reverse_iterator i=IDs.rbegin(); i!=IDs.rend(); ++i)
+	{
+		l=scheme_make_pair(scheme_make_integer(*i),l);
+	}
+
+	MZ_GC_UNREG();
+	return l;
+}
+
 // StartFunctionDoc-en
 // get-children 
 // Returns: list-numbers
@@ -4752,7 +5444,7 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("build-particles", scheme_make_prim_w_arity(build_particles, "build-particles", 1, 1), env);
 	scheme_add_global("build-image", scheme_make_prim_w_arity(build_image, "build-image", 3, 3), env);
 	scheme_add_global("build-locator", scheme_make_prim_w_arity(build_locator, "build-locator", 0, 0), env);
-	scheme_add_global("build-voxels", scheme_make_prim_w_arity(build_voxels, "build-voxels", 3, 3), env);
+	scheme_add_global("build-voxels", scheme_make_prim_w_arity(build_voxels, "build-voxels", 3, 4), env);
 	scheme_add_global("locator-bounding-radius", scheme_make_prim_w_arity(locator_bounding_radius, "locator-bounding-radius", 1, 1), env);
 	scheme_add_global("build-pixels", scheme_make_prim_w_arity(build_pixels, "build-pixels", 2, 4), env);
 	scheme_add_global("build-type", scheme_make_prim_w_arity(build_type, "build-type", 2, 2), env);
@@ -4787,6 +5479,7 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("blobby->poly", scheme_make_prim_w_arity(blobby2poly, "blobby->poly", 1, 1), env);
 	scheme_add_global("type->poly", scheme_make_prim_w_arity(type2poly, "type->poly", 1, 1), env);
 	scheme_add_global("draw-instance", scheme_make_prim_w_arity(draw_instance, "draw-instance", 1, 1), env);
+	scheme_add_global("draw-instances", scheme_make_prim_w_arity(draw_instances, "draw-instances", 2, 3), env);
 	scheme_add_global("draw-cube", scheme_make_prim_w_arity(draw_cube, "draw-cube", 0, 0), env);
 	scheme_add_global("draw-plane", scheme_make_prim_w_arity(draw_plane, "draw-plane", 0, 0), env);
 	scheme_add_global("draw-sphere", scheme_make_prim_w_arity(draw_sphere, "draw-sphere", 0, 0), env);
@@ -4801,14 +5494,20 @@ void PrimitiveFunctions::AddGlobals(Scheme_Env *env)
 	scheme_add_global("poly-type-enum", scheme_make_prim_w_arity(poly_type_enum, "poly-type-enum", 0, 0), env);
 	scheme_add_global("poly-indexed?", scheme_make_prim_w_arity(poly_indexed, "poly-indexed?", 0, 0), env);
 	scheme_add_global("poly-convert-to-indexed", scheme_make_prim_w_arity(poly_convert_to_indexed, "poly-convert-to-indexed", 0, 0), env);
+	scheme_add_global("lod-build", scheme_make_prim_w_arity(lod_build, "lod-build", 2, 2), env);
+	scheme_add_global("lod-detail", scheme_make_prim_w_arity(lod_detail, "lod-detail", 1, 1), env);
+	scheme_add_global("lod-triangles-saved", scheme_make_prim_w_arity(lod_triangles_saved, "lod-triangles-saved", 0, 0), env);
 	scheme_add_global("build-copy", scheme_make_prim_w_arity(build_copy, "build-copy", 1, 1), env);
 	scheme_add_global("make-pfunc", scheme_make_prim_w_arity(make_pfunc, "make-pfunc", 1, 1), env);
 	scheme_add_global("pfunc-set!", scheme_make_prim_w_arity(pfunc_set, "pfunc-set!", 2, 2), env);
 	scheme_add_global("pfunc-run", scheme_make_prim_w_arity(pfunc_run, "pfunc-run", 1, 1), env);
 	scheme_add_global("geo/line-intersect", scheme_make_prim_w_arity(geo_line_intersect, "geo/line-intersect", 2, 2), env);
+	scheme_add_global("geo/rays-intersect", scheme_make_prim_w_arity(geo_rays_intersect, "geo/rays-intersect", 3, 4), env);
 	scheme_add_global("recalc-bb", scheme_make_prim_w_arity(recalc_bb, "recalc-bb", 0, 0), env);
 	scheme_add_global("bb/bb-intersect?", scheme_make_prim_w_arity(bb_bb_intersect, "bb/bb-intersect?", 2, 2), env);
 	scheme_add_global("bb/point-intersect?", scheme_make_prim_w_arity(bb_point_intersect, "bb/point-intersect?", 2, 2), env);
+	scheme_add_global("bb/box-query", scheme_make_prim_w_arity(bb_box_query, "bb/box-query", 2, 2), env);
+	scheme_add_global("bb/sphere-query", scheme_make_prim_w_arity(bb_sphere_query, "bb/sphere-query", 2, 2), env);
 	scheme_add_global("get-children", scheme_make_prim_w_arity(get_children, "get-children", 0, 0), env);
 	scheme_add_global("get-parent", scheme_make_prim_w_arity(get_parent, "get-parent", 0, 0), env);
 	scheme_add_global("get-bb", scheme_make_prim_w_arity(get_bb, "get-bb", 0, 0), env);
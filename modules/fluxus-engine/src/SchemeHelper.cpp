@@ -245,6 +245,23 @@ vector<float> SchemeHelper::FloatVectorFromScheme(Scheme_Object *src)
 	return ret;
 }
 
+Scheme_Object *SchemeHelper::PDataHandleToScheme(unsigned int handle)
+{
+	// the handle number is stored as the pointer
+	return scheme_make_cptr((void*)(size_t)handle,scheme_intern_symbol("pdata-handle"));
+}
+
+bool SchemeHelper::IsPDataHandle(Scheme_Object *src)
+{
+	return SCHEME_CPTRP(src) && SAME_OBJ(SCHEME_CPTR_TYPE(src),scheme_intern_symbol("pdata-handle"));
+}
+
+unsigned int SchemeHelper::PDataHandleFromScheme(Scheme_Object *src)
+{
+	if (SCHEME_CPTRP(src)) return (unsigned int)(size_t)SCHEME_CPTR_VAL(src);
+	return PDataContainer::FindHandle(StringFromScheme(src));
+}
+
 void SchemeHelper::ArgCheck(const string &funcname, const string &format, int argc, Scheme_Object **argv)
 {
 	MZ_GC_DECL_REG(1);
@@ -366,6 +383,14 @@ void SchemeHelper::ArgCheck(const string &funcname, const string &format, int ar
 					}
 				break;
 
+				case 'n': // pdata name string or handle
+					if (!SCHEME_CHAR_STRINGP(argv[n]) && !IsPDataHandle(argv[n]))
+					{
+						MZ_GC_UNREG();
+						scheme_wrong_type(funcname.c_str(), "pdata name string or handle", n, argc, argv);
+					}
+				break;
+
 				case 'p': // path or string
 					if (!SCHEME_CHAR_STRINGP(argv[n]) && !SCHEME_PATHP(argv[n]))
 					{
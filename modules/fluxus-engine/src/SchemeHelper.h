@@ -45,6 +45,11 @@ namespace SchemeHelper
 	Fluxus::dMatrix MatrixFromScheme(Scheme_Object *src);
 	vector<int> IntVectorFromScheme(Scheme_Object *src);
 	vector<float> FloatVectorFromScheme(Scheme_Object *src);
+	
+	// pdata names can be given as strings or handles made by pdata-handle
+	Scheme_Object *PDataHandleToScheme(unsigned int handle);
+	bool IsPDataHandle(Scheme_Object *src);
+	unsigned int PDataHandleFromScheme(Scheme_Object *src);
 
 	void ArgCheck(const std::string &funcname, const std::string &format, int argc, Scheme_Object **argv);
 